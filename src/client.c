@@ -63,6 +63,8 @@
 #include <named/server.h>
 #include <named/update.h>
 
+#include "ospresp.h"
+
 /***
  *** Client
  ***/
@@ -548,6 +550,9 @@ exit_check(ns_client_t *client) {
 		INSIST(!ISC_QLINK_LINKED(client, ilink));
 
 		ns_query_free(client);
+		if (client->sdbmemo != NULL)
+			client->sdbmemofree(client);
+		isc_mem_put(client->mctx, client->respkeybuf, OSPRESP_KEY_SIZE);
 		isc_mem_put(client->mctx, client->uribuf, URI_BUFFER_SIZE);
 		isc_mem_put(client->mctx, client->recvbuf, RECV_BUFFER_SIZE);
 		isc_event_free((isc_event_t **)&client->sendevent);
@@ -961,6 +966,47 @@ ns_client_sendraw(ns_client_t *client, dns_message_t *message) {
 	ns_client_next(client, result);
 }
 
+/*
+ * Send the cached response of a query, see ospresp.c.  Returns ISC_FALSE
+ * when the query has to take the full way.
+ */
+static isc_boolean_t
+client_sendcached(ns_client_t *client) {
+	isc_result_t result;
+	unsigned char *data;
+	isc_buffer_t buffer;
+	unsigned char sendbuf[SEND_BUFFER_SIZE];
+	size_t length;
+
+	CTRACE("sendcached");
+
+	result = ospresp_get(client, sendbuf, sizeof(sendbuf), &length);
+	if (result != ISC_R_SUCCESS)
+		return (ISC_FALSE);
+
+	/*
+	 * The response is already in sendbuf, only check that it fits
+	 * the client's UDP buffer.
+	 */
+	result = client_allocsendbuf(client, &buffer, NULL, length,
+				     sendbuf, &data);
+	if (result != ISC_R_SUCCESS)
+		return (ISC_FALSE);
+	isc_buffer_add(&buffer, length);
+
+	result = client_sendpkg(client, &buffer);
+	if (result == ISC_R_SUCCESS) {
+		isc_stats_increment(ns_g_server->nsstats,
+				    dns_nsstatscounter_response);
+		if ((client->attributes & NS_CLIENTATTR_WANTOPT) != 0)
+			isc_stats_increment(ns_g_server->nsstats,
+					    dns_nsstatscounter_edns0out);
+	} else
+		ns_client_next(client, result);
+
+	return (ISC_TRUE);
+}
+
 static void
 client_send(ns_client_t *client) {
 	isc_result_t result;
@@ -1110,6 +1156,11 @@ client_send(ns_client_t *client) {
 		cleanup_cctx = ISC_FALSE;
 	}
 
+	if (client->resphold != 0) {
+		isc_buffer_usedregion(&buffer, &r);
+		ospresp_put(client, r.base, r.length);
+	}
+
 	if (TCP_CLIENT(client)) {
 		isc_buffer_usedregion(&buffer, &r);
 		isc_buffer_putuint16(&tcpbuffer, (isc_uint16_t) r.length);
@@ -1257,6 +1308,13 @@ ns_client_error(ns_client_t *client, isc_result_t result) {
 	message = client->message;
 	rcode = dns_result_torcode(result);
 
+	/*
+	 * query_find() answers SERVFAIL for database results it does not
+	 * know.  A database that refused the query wants REFUSED.
+	 */
+	if (rcode == dns_rcode_servfail && client->sdbrefused)
+		rcode = dns_rcode_refused;
+
 #if NS_CLIENT_DROPPORT
 	/*
 	 * Don't send FORMERR to ports on the drop port list.
@@ -2035,6 +2093,11 @@ client_request(isc_task_t *task, isc_event_t *event) {
 	/*
 	 * Deal with EDNS.
 	 */
+	client->urilen = 0;
+	client->respkeylen = 0;
+	client->resphold = 0;
+	client->sdbmemovalid = ISC_FALSE;
+	client->sdbrefused = ISC_FALSE;
 	if (ns_g_noedns)
 		opt = NULL;
 	else
@@ -2320,6 +2383,8 @@ client_request(isc_task_t *task, isc_event_t *event) {
 	switch (client->message->opcode) {
 	case dns_opcode_query:
 		CTRACE("query");
+		if (client_sendcached(client))
+			break;
 		ns_query_start(client);
 		break;
 	case dns_opcode_update:
@@ -2537,6 +2602,19 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
 		goto cleanup_recvevent;
 	}
 
+	client->respkeylen = 0;
+	client->resphold = 0;
+	client->respgen = 0;
+	client->sdbmemo = NULL;
+	client->sdbmemofree = NULL;
+	client->sdbmemovalid = ISC_FALSE;
+	client->sdbrefused = ISC_FALSE;
+	client->respkeybuf = isc_mem_get(client->mctx, OSPRESP_KEY_SIZE);
+	if  (client->respkeybuf == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_uribuf;
+	}
+
 	ISC_EVENT_INIT(&client->ctlevent, sizeof(client->ctlevent), 0, NULL,
 		       NS_EVENT_CLIENTCONTROL, client_start, client, client,
 		       NULL, NULL);
@@ -2558,7 +2636,7 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
 	 */
 	result = ns_query_init(client);
 	if (result != ISC_R_SUCCESS)
-		goto cleanup_uribuf;
+		goto cleanup_respkeybuf;
 
 	result = isc_task_onshutdown(client->task, client_shutdown, client);
 	if (result != ISC_R_SUCCESS)
@@ -2573,6 +2651,9 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
  cleanup_query:
 	ns_query_free(client);
 
+ cleanup_respkeybuf:
+	isc_mem_put(client->mctx, client->respkeybuf, OSPRESP_KEY_SIZE);
+
  cleanup_uribuf:
 	isc_mem_put(client->mctx, client->uribuf, URI_BUFFER_SIZE);
 
@@ -165,6 +165,14 @@ struct ns_client {
 	isc_uint32_t		expire;
 	isc_uint16_t		urilen;
 	unsigned char *		uribuf;
+	unsigned char *		respkeybuf;	/* Response cache key */
+	unsigned int		respkeylen;	/* 0 not cacheable */
+	isc_uint32_t		resphold;	/* Seconds the response may be reused, set by the database, 0 for never */
+	isc_uint32_t		respgen;	/* Response cache generation at lookup */
+	void *			sdbmemo;	/* Lookup result kept by the database for repeat lookups */
+	void			(*sdbmemofree)(ns_client_t *client);	/* Frees sdbmemo, set by the database */
+	isc_boolean_t		sdbmemovalid;	/* sdbmemo is from the current request */
+	isc_boolean_t		sdbrefused;	/* The database refused the query, set by the database */
 };
 
 typedef ISC_QUEUE(ns_client_t) client_queue_t;
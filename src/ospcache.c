@@ -0,0 +1,1349 @@
+/*
+ * ospcache.c
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <isc/crc64.h>
+#include <isc/list.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/rwlock.h>
+#include <isc/util.h>
+
+#include "ospcache.h"
+#include "osptrie.h"
+
+/* Constant */
+#define OSPCACHE_SHARDS			16		/* Number of shards, power of 2 */
+#define OSPCACHE_ENTRY_GUESS	512		/* Expected average entry size used to size hash tables */
+#define OSPCACHE_MIN_BUCKETS	64		/* Min number of hash buckets per shard, power of 2 */
+#define OSPCACHE_SNAP_MAGIC		"OSPSNAP"	/* Snapshot file magic */
+#define OSPCACHE_SNAP_VERSION	1		/* Snapshot file format version */
+#define OSPCACHE_SNAP_MINSLOTS	16		/* Min number of snapshot index slots, power of 2 */
+#define OSPCACHE_PATH_SIZE		1024	/* File path length */
+
+typedef struct ospcache_entry ospcache_entry_t;
+
+/* Cache entry, destinations and key follow in the same allocation */
+struct ospcache_entry {
+	ospcache_entry_t *next;				/* Hash chain */
+	ISC_LINK(ospcache_entry_t) link;	/* LRU list, most recently used at head */
+	unsigned int hash;					/* Key hash */
+	size_t size;						/* Allocated size */
+	isc_stdtime_t expire;				/* Expire time */
+	isc_result_t status;				/* ISC_R_SUCCESS for route, others for negative result */
+	unsigned int hits;					/* Number of fresh hits */
+	isc_boolean_t prefetch;				/* Refresh ahead requested flag */
+	int count;							/* Number of destinations */
+	ospcache_dest_t *dest;				/* Destinations */
+	char *key;							/* Key */
+	unsigned char *wire;				/* Rendered rdata set, separate allocation, NULL for none */
+	size_t wirelen;						/* Rendered rdata set length */
+};
+
+/* Cache shard */
+typedef struct ospcache_shard {
+	isc_mutex_t lock;					/* Shard lock */
+	unsigned int nbuckets;				/* Number of hash buckets, power of 2 */
+	ospcache_entry_t **buckets;			/* Hash buckets */
+	ISC_LIST(ospcache_entry_t) lru;		/* LRU list */
+	size_t memory;						/* Memory used by entries */
+	ospcache_stats_t stats;				/* Statistics */
+} ospcache_shard_t;
+
+/* Prefix entry, a free slot has expire 0 */
+typedef struct ospcache_prefix {
+	char prefix[OSPCACHE_NUM_SIZE];		/* Number prefix */
+	isc_stdtime_t expire;				/* Expire time */
+	ospcache_route_t route;				/* Route */
+} ospcache_prefix_t;
+
+/*
+ * Snapshot file header. The file is the header, count fixed size records, then an open addressing index of nslots
+ * record numbers, 1 based, 0 for an empty slot. The checksum covers records and index.
+ */
+typedef struct ospcache_snaphdr {
+	char magic[8];				/* OSPCACHE_SNAP_MAGIC */
+	isc_uint32_t version;		/* OSPCACHE_SNAP_VERSION */
+	isc_uint32_t destsize;		/* Size of ospcache_dest_t */
+	isc_uint32_t recsize;		/* Size of ospcache_snaprec_t */
+	isc_uint32_t count;			/* Number of records */
+	isc_uint32_t nslots;		/* Number of index slots, power of 2 */
+	isc_uint32_t reserved;		/* Reserved, 0 */
+	isc_uint64_t recoffset;		/* Offset of records */
+	isc_uint64_t indexoffset;	/* Offset of index */
+	isc_uint64_t checksum;		/* CRC-64 of records and index */
+	isc_uint64_t created;		/* Creation time */
+} ospcache_snaphdr_t;
+
+/* Snapshot record */
+typedef struct ospcache_snaprec {
+	isc_uint32_t hash;				/* Key hash */
+	isc_uint32_t expire;			/* Expire time */
+	char key[OSPCACHE_KEY_SIZE];	/* Key */
+	ospcache_route_t route;			/* Route, unused destinations zeroed */
+} ospcache_snaprec_t;
+
+/* Cache */
+struct ospcache {
+	isc_mem_t *mctx;							/* Memory context */
+	size_t maxmemory;							/* Max memory per shard */
+	unsigned int stale;							/* Seconds entries are kept past expiry */
+	unsigned int prefetch;						/* Seconds before expiry hot entries are refreshed, 0 for never */
+	unsigned int prefetchhits;					/* Min number of hits for an entry to be hot */
+	isc_mutex_t prefixlock;						/* Prefix table lock */
+	osptrie_t *prefixtrie;						/* Prefix to slot index, NULL for prefix table disabled */
+	ospcache_prefix_t *prefixes;				/* Prefix slots */
+	unsigned int maxprefixes;					/* Number of prefix slots */
+	unsigned int nprefixes;						/* Number of prefix slots ever used */
+	isc_uint64_t prefixhits;					/* Number of lookups answered from prefix table */
+	isc_uint64_t prefixevictions;				/* Number of live prefixes dropped for space */
+	isc_uint64_t prefixpurges;					/* Number of prefixes dropped by purge */
+	isc_rwlock_t snaplock;						/* Snapshot lock, written only to drop the snapshot */
+	void *snapbase;								/* Mapped snapshot, read only, NULL for none */
+	size_t snapsize;							/* Mapped snapshot size */
+	ospcache_shard_t shards[OSPCACHE_SHARDS];	/* Shards */
+};
+
+/*
+ * Hash key, FNV-1a
+ * param key Key
+ * return Hash value
+ */
+unsigned int ospcache_hash(
+	const char *key)
+{
+	const unsigned char *p;
+	unsigned int hash = 2166136261U;
+
+	for (p = (const unsigned char *)key; *p != '\0'; p++) {
+		hash ^= *p;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/*
+ * Get shard of a hash value
+ * param cache Cache handle
+ * param hash Hash value
+ * return Shard
+ */
+static ospcache_shard_t *ospcache_get_shard(
+	ospcache_t *cache,
+	unsigned int hash)
+{
+	return &cache->shards[hash & (OSPCACHE_SHARDS - 1)];
+}
+
+/*
+ * Get bucket of a hash value
+ * param shard Shard
+ * param hash Hash value
+ * return Bucket
+ */
+static ospcache_entry_t **ospcache_get_bucket(
+	ospcache_shard_t *shard,
+	unsigned int hash)
+{
+	return &shard->buckets[(hash / OSPCACHE_SHARDS) & (shard->nbuckets - 1)];
+}
+
+/*
+ * Unlink and free entry, shard must be locked
+ * param cache Cache handle
+ * param shard Shard
+ * param entry Entry
+ */
+static void ospcache_free_entry(
+	ospcache_t *cache,
+	ospcache_shard_t *shard,
+	ospcache_entry_t *entry)
+{
+	ospcache_entry_t **prev;
+
+	for (prev = ospcache_get_bucket(shard, entry->hash); *prev != entry; prev = &(*prev)->next)
+		;
+	*prev = entry->next;
+
+	ISC_LIST_UNLINK(shard->lru, entry, link);
+	shard->memory -= entry->size + entry->wirelen;
+	shard->stats.entries--;
+
+	if (entry->wire != NULL) {
+		isc_mem_put(cache->mctx, entry->wire, entry->wirelen);
+	}
+	isc_mem_put(cache->mctx, entry, entry->size);
+}
+
+/*
+ * Find entry, shard must be locked
+ * param shard Shard
+ * param hash Key hash
+ * param key Key
+ * return Entry or NULL
+ */
+static ospcache_entry_t *ospcache_find_entry(
+	ospcache_shard_t *shard,
+	unsigned int hash,
+	const char *key)
+{
+	ospcache_entry_t *entry;
+
+	for (entry = *ospcache_get_bucket(shard, hash); entry != NULL; entry = entry->next) {
+		if ((entry->hash == hash) && (strcmp(entry->key, key) == 0)) {
+			break;
+		}
+	}
+
+	return entry;
+}
+
+/*
+ * Create cache
+ * param mctx Memory context
+ * param maxmemory Max memory used by entries in bytes
+ * param stale Seconds entries are kept past expiry for ospcache_getstale, 0 for none
+ * param cachep Cache handle
+ * return ISC_R_SUCCESS successful, ISC_R_NOMEMORY or other error failed
+ */
+isc_result_t ospcache_create(
+	isc_mem_t *mctx,
+	size_t maxmemory,
+	unsigned int stale,
+	ospcache_t **cachep)
+{
+	ospcache_t *cache;
+	ospcache_shard_t *shard;
+	unsigned int i, nbuckets;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	REQUIRE(cachep != NULL && *cachep == NULL);
+
+	cache = isc_mem_get(mctx, sizeof(*cache));
+	if (cache == NULL) {
+		return ISC_R_NOMEMORY;
+	}
+	cache->mctx = NULL;
+	isc_mem_attach(mctx, &cache->mctx);
+	cache->maxmemory = maxmemory / OSPCACHE_SHARDS;
+	cache->stale = stale;
+	cache->prefetch = 0;
+	cache->prefetchhits = 0;
+	cache->prefixtrie = NULL;
+	cache->prefixes = NULL;
+	cache->maxprefixes = 0;
+	cache->nprefixes = 0;
+	cache->prefixhits = 0;
+	cache->prefixevictions = 0;
+	cache->prefixpurges = 0;
+	cache->snapbase = NULL;
+	cache->snapsize = 0;
+	if ((result = isc_rwlock_init(&cache->snaplock, 0, 0)) != ISC_R_SUCCESS) {
+		isc_mem_putanddetach(&cache->mctx, cache, sizeof(*cache));
+		return result;
+	}
+
+	/* Size hash tables for the expected number of entries */
+	for (nbuckets = OSPCACHE_MIN_BUCKETS; nbuckets * OSPCACHE_ENTRY_GUESS < cache->maxmemory; nbuckets *= 2)
+		;
+
+	for (i = 0; i < OSPCACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+		memset(&shard->stats, 0, sizeof(shard->stats));
+		ISC_LIST_INIT(shard->lru);
+		shard->memory = 0;
+		shard->nbuckets = nbuckets;
+		shard->buckets = isc_mem_get(mctx, nbuckets * sizeof(ospcache_entry_t *));
+		if (shard->buckets == NULL) {
+			result = ISC_R_NOMEMORY;
+			break;
+		}
+		memset(shard->buckets, 0, nbuckets * sizeof(ospcache_entry_t *));
+		result = isc_mutex_init(&shard->lock);
+		if (result != ISC_R_SUCCESS) {
+			isc_mem_put(mctx, shard->buckets, nbuckets * sizeof(ospcache_entry_t *));
+			break;
+		}
+	}
+
+	if (result != ISC_R_SUCCESS) {
+		while (i-- > 0) {
+			shard = &cache->shards[i];
+			DESTROYLOCK(&shard->lock);
+			isc_mem_put(mctx, shard->buckets, shard->nbuckets * sizeof(ospcache_entry_t *));
+		}
+		isc_rwlock_destroy(&cache->snaplock);
+		isc_mem_putanddetach(&cache->mctx, cache, sizeof(*cache));
+		return result;
+	}
+
+	*cachep = cache;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Destroy cache
+ * param cachep Cache handle
+ */
+void ospcache_destroy(
+	ospcache_t **cachep)
+{
+	ospcache_t *cache;
+	ospcache_shard_t *shard;
+	unsigned int i;
+
+	REQUIRE(cachep != NULL && *cachep != NULL);
+
+	cache = *cachep;
+
+	for (i = 0; i < OSPCACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+		while (!ISC_LIST_EMPTY(shard->lru)) {
+			ospcache_free_entry(cache, shard, ISC_LIST_HEAD(shard->lru));
+		}
+		DESTROYLOCK(&shard->lock);
+		isc_mem_put(cache->mctx, shard->buckets, shard->nbuckets * sizeof(ospcache_entry_t *));
+	}
+
+	if (cache->snapbase != NULL) {
+		munmap(cache->snapbase, cache->snapsize);
+	}
+	isc_rwlock_destroy(&cache->snaplock);
+
+	if (cache->prefixtrie != NULL) {
+		osptrie_destroy(&cache->prefixtrie);
+		isc_mem_put(cache->mctx, cache->prefixes, cache->maxprefixes * sizeof(ospcache_prefix_t));
+		DESTROYLOCK(&cache->prefixlock);
+	}
+
+	isc_mem_putanddetach(&cache->mctx, cache, sizeof(*cache));
+
+	*cachep = NULL;
+}
+
+/*
+ * Set refresh ahead policy
+ * param cache Cache handle
+ * param prefetch Seconds before expiry hot entries are handed out for refresh, 0 for never
+ * param prefetchhits Min number of hits for an entry to be hot
+ */
+void ospcache_setprefetch(
+	ospcache_t *cache,
+	unsigned int prefetch,
+	unsigned int prefetchhits)
+{
+	cache->prefetch = prefetch;
+	cache->prefetchhits = prefetchhits;
+}
+
+/*
+ * Enable prefix table, routes stored against number prefixes and found by longest prefix match
+ * param cache Cache handle
+ * param maxprefixes Max number of prefixes
+ * return ISC_R_SUCCESS successful, ISC_R_NOMEMORY or other error failed
+ */
+isc_result_t ospcache_setprefix(
+	ospcache_t *cache,
+	unsigned int maxprefixes)
+{
+	isc_result_t result;
+
+	REQUIRE(cache->prefixtrie == NULL && maxprefixes > 0);
+
+	cache->prefixes = isc_mem_get(cache->mctx, maxprefixes * sizeof(ospcache_prefix_t));
+	if (cache->prefixes == NULL) {
+		return ISC_R_NOMEMORY;
+	}
+
+	if ((result = isc_mutex_init(&cache->prefixlock)) != ISC_R_SUCCESS) {
+		isc_mem_put(cache->mctx, cache->prefixes, maxprefixes * sizeof(ospcache_prefix_t));
+		cache->prefixes = NULL;
+		return result;
+	}
+
+	if ((result = osptrie_create(cache->mctx, &cache->prefixtrie)) != ISC_R_SUCCESS) {
+		DESTROYLOCK(&cache->prefixlock);
+		isc_mem_put(cache->mctx, cache->prefixes, maxprefixes * sizeof(ospcache_prefix_t));
+		cache->prefixes = NULL;
+		return result;
+	}
+
+	cache->maxprefixes = maxprefixes;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Rebuild prefix trie from live slots, prefix lock must be held
+ * param cache Cache handle
+ * param now Current time
+ */
+static void ospcache_rebuild_prefix(
+	ospcache_t *cache,
+	isc_stdtime_t now)
+{
+	ospcache_prefix_t *slot;
+	unsigned int i;
+
+	osptrie_clear(cache->prefixtrie);
+
+	for (i = 0; i < cache->nprefixes; i++) {
+		slot = &cache->prefixes[i];
+		if (slot->expire > now) {
+			if (osptrie_add(cache->prefixtrie, slot->prefix, (int)i) != ISC_R_SUCCESS) {
+				slot->expire = 0;
+			}
+		} else {
+			slot->expire = 0;
+		}
+	}
+}
+
+/*
+ * Get route by longest prefix match
+ * param cache Cache handle
+ * param number Number
+ * param now Current time
+ * param route Route buffer
+ * return ISC_R_SUCCESS found, ISC_R_NOTFOUND not found or expired
+ */
+isc_result_t ospcache_getprefix(
+	ospcache_t *cache,
+	const char *number,
+	isc_stdtime_t now,
+	ospcache_route_t *route)
+{
+	ospcache_prefix_t *slot;
+	int index;
+	isc_result_t result = ISC_R_NOTFOUND;
+
+	if (cache->prefixtrie == NULL) {
+		return ISC_R_NOTFOUND;
+	}
+
+	LOCK(&cache->prefixlock);
+
+	index = osptrie_match(cache->prefixtrie, number, NULL);
+	if (index != OSPTRIE_NONE) {
+		slot = &cache->prefixes[index];
+		if (slot->expire > now) {
+			route->count = slot->route.count;
+			memcpy(route->dest, slot->route.dest, slot->route.count * sizeof(ospcache_dest_t));
+			cache->prefixhits++;
+			result = ISC_R_SUCCESS;
+		}
+	}
+
+	UNLOCK(&cache->prefixlock);
+
+	return result;
+}
+
+/*
+ * Add or replace route for a prefix, the slot expiring soonest is reused when the table is full
+ * param cache Cache handle
+ * param prefix Number prefix
+ * param now Current time
+ * param expire Expire time
+ * param route Route
+ * return ISC_R_SUCCESS successful, ISC_R_NOSPACE prefix too long, ISC_R_RANGE not a digit string, ISC_R_NOMEMORY failed
+ */
+isc_result_t ospcache_putprefix(
+	ospcache_t *cache,
+	const char *prefix,
+	isc_stdtime_t now,
+	isc_stdtime_t expire,
+	const ospcache_route_t *route)
+{
+	ospcache_prefix_t *slot;
+	unsigned int i, victim;
+	int index, length;
+	isc_result_t result;
+
+	REQUIRE(route->count >= 0 && route->count <= OSPCACHE_MAX_DEST);
+
+	if (cache->prefixtrie == NULL) {
+		return ISC_R_NOTFOUND;
+	}
+
+	if (strlen(prefix) >= OSPCACHE_NUM_SIZE) {
+		return ISC_R_NOSPACE;
+	}
+
+	LOCK(&cache->prefixlock);
+
+	index = osptrie_match(cache->prefixtrie, prefix, &length);
+	if ((index != OSPTRIE_NONE) && (length == (int)strlen(prefix))) {
+		/* Replace route of the same prefix */
+		victim = (unsigned int)index;
+	} else if (cache->nprefixes < cache->maxprefixes) {
+		victim = cache->nprefixes++;
+	} else {
+		victim = 0;
+		for (i = 1; i < cache->maxprefixes; i++) {
+			if (cache->prefixes[i].expire < cache->prefixes[victim].expire) {
+				victim = i;
+			}
+		}
+		slot = &cache->prefixes[victim];
+		if (slot->expire > now) {
+			cache->prefixevictions++;
+		}
+		if (slot->expire != 0) {
+			osptrie_add(cache->prefixtrie, slot->prefix, OSPTRIE_NONE);
+		}
+	}
+
+	slot = &cache->prefixes[victim];
+	snprintf(slot->prefix, sizeof(slot->prefix), "%s", prefix);
+	slot->expire = expire;
+	slot->route.count = route->count;
+	memcpy(slot->route.dest, route->dest, route->count * sizeof(ospcache_dest_t));
+
+	if ((result = osptrie_add(cache->prefixtrie, prefix, (int)victim)) != ISC_R_SUCCESS) {
+		slot->expire = 0;
+	} else if (osptrie_nodes(cache->prefixtrie) > cache->maxprefixes * OSPCACHE_NUM_SIZE) {
+		/* Removed prefixes leave their nodes behind, start over from the live slots */
+		ospcache_rebuild_prefix(cache, now);
+	}
+
+	UNLOCK(&cache->prefixlock);
+
+	return result;
+}
+
+/*
+ * Lookup entry
+ * param cache Cache handle
+ * param key Key
+ * param now Current time
+ * param stale Accept expired entries still in the stale window
+ * param status Entry result buffer
+ * param route Route buffer, NULL for negative entries
+ * param wire Rendered rdata set buffer, route is not filled if the set is returned, NULL for route only
+ * param wiresize Rendered rdata set buffer size
+ * param wirelen Rendered rdata set length buffer, 0 if the entry has none
+ * param prefetch Refresh ahead flag buffer, NULL for not requesting refresh ahead
+ * return ISC_R_SUCCESS found, ISC_R_NOTFOUND not found or expired
+ */
+static isc_result_t ospcache_lookup(
+	ospcache_t *cache,
+	const char *key,
+	isc_stdtime_t now,
+	isc_boolean_t stale,
+	isc_result_t *status,
+	ospcache_route_t *route,
+	unsigned char *wire,
+	size_t wiresize,
+	size_t *wirelen,
+	isc_boolean_t *prefetch)
+{
+	unsigned int hash = ospcache_hash(key);
+	ospcache_shard_t *shard = ospcache_get_shard(cache, hash);
+	ospcache_entry_t *entry;
+	isc_result_t result = ISC_R_NOTFOUND;
+
+	LOCK(&shard->lock);
+
+	entry = ospcache_find_entry(shard, hash, key);
+	if ((entry != NULL) && (entry->expire + cache->stale <= now)) {
+		ospcache_free_entry(cache, shard, entry);
+		shard->stats.expirations++;
+		entry = NULL;
+	}
+
+	/* Expired entries only answer stale lookups */
+	if ((entry != NULL) && (entry->expire <= now) && (stale == ISC_FALSE)) {
+		entry = NULL;
+	}
+
+	if ((entry != NULL) && ((route != NULL) == (entry->status == ISC_R_SUCCESS))) {
+		*status = entry->status;
+		if ((wire != NULL) && (entry->wire != NULL) && (entry->wirelen <= wiresize)) {
+			memcpy(wire, entry->wire, entry->wirelen);
+			*wirelen = entry->wirelen;
+			shard->stats.wirehits++;
+		} else if (route != NULL) {
+			route->count = entry->count;
+			memcpy(route->dest, entry->dest, entry->count * sizeof(ospcache_dest_t));
+		}
+
+		/* Move to head of LRU list */
+		ISC_LIST_UNLINK(shard->lru, entry, link);
+		ISC_LIST_PREPEND(shard->lru, entry, link);
+
+		if (entry->expire <= now) {
+			shard->stats.stalehits++;
+		} else {
+			shard->stats.hits++;
+			entry->hits++;
+
+			/* Hot entries close to expiry are handed out once for refresh ahead */
+			if ((prefetch != NULL) &&
+				(cache->prefetch != 0) &&
+				(entry->prefetch == ISC_FALSE) &&
+				(entry->hits >= cache->prefetchhits) &&
+				(entry->expire - now <= cache->prefetch))
+			{
+				entry->prefetch = ISC_TRUE;
+				*prefetch = ISC_TRUE;
+				shard->stats.prefetches++;
+			}
+		}
+		result = ISC_R_SUCCESS;
+	} else if (stale == ISC_FALSE) {
+		shard->stats.misses++;
+	}
+
+	UNLOCK(&shard->lock);
+
+	return result;
+}
+
+/*
+ * Add or replace entry, least recently used entries are evicted to stay within the memory limit
+ * param cache Cache handle
+ * param key Key
+ * param expire Expire time
+ * param status Entry result
+ * param route Route, NULL for negative entries
+ * return ISC_R_SUCCESS successful, ISC_R_NOSPACE too large, ISC_R_NOMEMORY failed
+ */
+static isc_result_t ospcache_insert(
+	ospcache_t *cache,
+	const char *key,
+	isc_stdtime_t expire,
+	isc_result_t status,
+	const ospcache_route_t *route)
+{
+	unsigned int hash = ospcache_hash(key);
+	ospcache_shard_t *shard = ospcache_get_shard(cache, hash);
+	ospcache_entry_t *entry, *old, **bucket;
+	int count = (route != NULL) ? route->count : 0;
+	size_t keylen = strlen(key) + 1;
+	size_t size;
+
+	REQUIRE(count >= 0 && count <= OSPCACHE_MAX_DEST);
+
+	size = sizeof(*entry) + count * sizeof(ospcache_dest_t) + keylen;
+	if (size > cache->maxmemory) {
+		return ISC_R_NOSPACE;
+	}
+
+	entry = isc_mem_get(cache->mctx, size);
+	if (entry == NULL) {
+		return ISC_R_NOMEMORY;
+	}
+	entry->hash = hash;
+	entry->size = size;
+	entry->expire = expire;
+	entry->status = status;
+	entry->hits = 0;
+	entry->prefetch = ISC_FALSE;
+	entry->count = count;
+	entry->dest = (ospcache_dest_t *)(entry + 1);
+	if (count != 0) {
+		memcpy(entry->dest, route->dest, count * sizeof(ospcache_dest_t));
+	}
+	entry->key = (char *)(entry->dest + count);
+	memcpy(entry->key, key, keylen);
+	entry->wire = NULL;
+	entry->wirelen = 0;
+	ISC_LINK_INIT(entry, link);
+
+	LOCK(&shard->lock);
+
+	/* Replace old entry */
+	if ((old = ospcache_find_entry(shard, hash, key)) != NULL) {
+		ospcache_free_entry(cache, shard, old);
+	}
+
+	/* Evict least recently used entries */
+	while ((shard->memory + size > cache->maxmemory) && !ISC_LIST_EMPTY(shard->lru)) {
+		ospcache_free_entry(cache, shard, ISC_LIST_TAIL(shard->lru));
+		shard->stats.evictions++;
+	}
+
+	bucket = ospcache_get_bucket(shard, hash);
+	entry->next = *bucket;
+	*bucket = entry;
+	ISC_LIST_PREPEND(shard->lru, entry, link);
+	shard->memory += size;
+	shard->stats.entries++;
+	shard->stats.inserts++;
+
+	UNLOCK(&shard->lock);
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Get route from mapped snapshot, found routes are copied into the cache
+ * param cache Cache handle
+ * param key Key
+ * param now Current time
+ * param route Route buffer
+ * return ISC_R_SUCCESS found, ISC_R_NOTFOUND not found or expired
+ */
+static isc_result_t ospcache_snapget(
+	ospcache_t *cache,
+	const char *key,
+	isc_stdtime_t now,
+	ospcache_route_t *route)
+{
+	const ospcache_snaphdr_t *header;
+	const ospcache_snaprec_t *records, *record;
+	const isc_uint32_t *index;
+	unsigned int hash = ospcache_hash(key);
+	ospcache_shard_t *shard = ospcache_get_shard(cache, hash);
+	isc_uint32_t slot, probe;
+	isc_result_t result = ISC_R_NOTFOUND;
+
+	RWLOCK(&cache->snaplock, isc_rwlocktype_read);
+
+	if ((header = cache->snapbase) == NULL) {
+		RWUNLOCK(&cache->snaplock, isc_rwlocktype_read);
+		return ISC_R_NOTFOUND;
+	}
+
+	records = (const ospcache_snaprec_t *)((const char *)cache->snapbase + header->recoffset);
+	index = (const isc_uint32_t *)((const char *)cache->snapbase + header->indexoffset);
+
+	for (probe = 0, slot = hash & (header->nslots - 1); probe < header->nslots; probe++, slot = (slot + 1) & (header->nslots - 1)) {
+		if (index[slot] == 0) {
+			break;
+		}
+		record = &records[index[slot] - 1];
+		if ((record->hash == hash) && (strcmp(record->key, key) == 0)) {
+			if (record->expire <= now) {
+				break;
+			}
+			route->count = record->route.count;
+			memcpy(route->dest, record->route.dest, record->route.count * sizeof(ospcache_dest_t));
+
+			/* Later lookups are answered by the cache itself */
+			ospcache_insert(cache, key, record->expire, ISC_R_SUCCESS, route);
+
+			LOCK(&shard->lock);
+			shard->stats.snaphits++;
+			UNLOCK(&shard->lock);
+
+			result = ISC_R_SUCCESS;
+			break;
+		}
+	}
+
+	RWUNLOCK(&cache->snaplock, isc_rwlocktype_read);
+
+	return result;
+}
+
+/*
+ * Get route
+ * param cache Cache handle
+ * param key Key
+ * param now Current time
+ * param route Route buffer
+ * param prefetch Refresh ahead flag buffer, set to ISC_TRUE if the caller should refresh the route, may be NULL
+ * return ISC_R_SUCCESS found, ISC_R_NOTFOUND not found or expired
+ */
+isc_result_t ospcache_get(
+	ospcache_t *cache,
+	const char *key,
+	isc_stdtime_t now,
+	ospcache_route_t *route,
+	isc_boolean_t *prefetch)
+{
+	return ospcache_getwire(cache, key, now, route, NULL, 0, NULL, prefetch);
+}
+
+/*
+ * Get rendered rdata set, or the route if the entry has no rendered rdata set
+ * param cache Cache handle
+ * param key Key
+ * param now Current time
+ * param route Route buffer, not filled if the rendered rdata set is returned
+ * param wire Rendered rdata set buffer, NULL for route only
+ * param wiresize Rendered rdata set buffer size
+ * param wirelen Rendered rdata set length buffer, 0 if the route is returned
+ * param prefetch Refresh ahead flag buffer, set to ISC_TRUE if the caller should refresh the route, may be NULL
+ * return ISC_R_SUCCESS found, ISC_R_NOTFOUND not found or expired
+ */
+isc_result_t ospcache_getwire(
+	ospcache_t *cache,
+	const char *key,
+	isc_stdtime_t now,
+	ospcache_route_t *route,
+	unsigned char *wire,
+	size_t wiresize,
+	size_t *wirelen,
+	isc_boolean_t *prefetch)
+{
+	isc_result_t status;
+	isc_result_t result;
+
+	if (prefetch != NULL) {
+		*prefetch = ISC_FALSE;
+	}
+	if (wirelen != NULL) {
+		*wirelen = 0;
+	}
+
+	result = ospcache_lookup(cache, key, now, ISC_FALSE, &status, route, wire, wiresize, wirelen, prefetch);
+	if (result != ISC_R_SUCCESS) {
+		result = ospcache_snapget(cache, key, now, route);
+	}
+
+	return result;
+}
+
+/*
+ * Attach a rendered rdata set to a cached route. It is only attached if the entry still holds the same route, so a
+ * set rendered from a replaced route is never served. The set is dropped with the entry.
+ * param cache Cache handle
+ * param key Key
+ * param route Route the set was rendered from
+ * param wire Rendered rdata set
+ * param wirelen Rendered rdata set length
+ * return ISC_R_SUCCESS successful, ISC_R_NOTFOUND no such route, ISC_R_NOSPACE over the memory limit, ISC_R_NOMEMORY failed
+ */
+isc_result_t ospcache_putwire(
+	ospcache_t *cache,
+	const char *key,
+	const ospcache_route_t *route,
+	const unsigned char *wire,
+	size_t wirelen)
+{
+	unsigned int hash = ospcache_hash(key);
+	ospcache_shard_t *shard = ospcache_get_shard(cache, hash);
+	ospcache_entry_t *entry;
+	unsigned char *copy;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	REQUIRE(wirelen != 0);
+
+	if ((copy = isc_mem_get(cache->mctx, wirelen)) == NULL) {
+		return ISC_R_NOMEMORY;
+	}
+	memcpy(copy, wire, wirelen);
+
+	LOCK(&shard->lock);
+
+	entry = ospcache_find_entry(shard, hash, key);
+	if ((entry == NULL) ||
+		(entry->status != ISC_R_SUCCESS) ||
+		(entry->wire != NULL) ||
+		(entry->count != route->count) ||
+		(memcmp(entry->dest, route->dest, entry->count * sizeof(ospcache_dest_t)) != 0))
+	{
+		result = ISC_R_NOTFOUND;
+	} else if (shard->memory + wirelen > cache->maxmemory) {
+		result = ISC_R_NOSPACE;
+	} else {
+		entry->wire = copy;
+		entry->wirelen = wirelen;
+		shard->memory += wirelen;
+		copy = NULL;
+	}
+
+	UNLOCK(&shard->lock);
+
+	if (copy != NULL) {
+		isc_mem_put(cache->mctx, copy, wirelen);
+	}
+
+	return result;
+}
+
+/*
+ * Get route, expired routes are returned until the stale window passes
+ * param cache Cache handle
+ * param key Key
+ * param now Current time
+ * param route Route buffer
+ * return ISC_R_SUCCESS found, ISC_R_NOTFOUND not found or past the stale window
+ */
+isc_result_t ospcache_getstale(
+	ospcache_t *cache,
+	const char *key,
+	isc_stdtime_t now,
+	ospcache_route_t *route)
+{
+	isc_result_t status;
+
+	return ospcache_lookup(cache, key, now, ISC_TRUE, &status, route, NULL, 0, NULL, NULL);
+}
+
+/*
+ * Add or replace route
+ * param cache Cache handle
+ * param key Key
+ * param expire Expire time
+ * param route Route
+ * return ISC_R_SUCCESS successful, ISC_R_NOSPACE too large, ISC_R_NOMEMORY failed
+ */
+isc_result_t ospcache_put(
+	ospcache_t *cache,
+	const char *key,
+	isc_stdtime_t expire,
+	const ospcache_route_t *route)
+{
+	return ospcache_insert(cache, key, expire, ISC_R_SUCCESS, route);
+}
+
+/*
+ * Get negative result
+ * param cache Cache handle
+ * param key Key
+ * param now Current time
+ * param status Negative result buffer
+ * return ISC_R_SUCCESS found, ISC_R_NOTFOUND not found or expired
+ */
+isc_result_t ospcache_getnegative(
+	ospcache_t *cache,
+	const char *key,
+	isc_stdtime_t now,
+	isc_result_t *status)
+{
+	return ospcache_lookup(cache, key, now, ISC_FALSE, status, NULL, NULL, 0, NULL, NULL);
+}
+
+/*
+ * Add or replace negative result
+ * param cache Cache handle
+ * param key Key
+ * param expire Expire time
+ * param status Negative result, must not be ISC_R_SUCCESS
+ * return ISC_R_SUCCESS successful, ISC_R_NOSPACE too large, ISC_R_NOMEMORY failed
+ */
+isc_result_t ospcache_putnegative(
+	ospcache_t *cache,
+	const char *key,
+	isc_stdtime_t expire,
+	isc_result_t status)
+{
+	REQUIRE(status != ISC_R_SUCCESS);
+
+	return ospcache_insert(cache, key, expire, status, NULL);
+}
+
+/*
+ * Call a function for each fresh route, prefix routes included. The function runs with a cache lock held and must not
+ * block or call back into the cache.
+ * param cache Cache handle
+ * param now Current time
+ * param func Function
+ * param arg Function argument
+ * return Number of routes walked
+ */
+unsigned int ospcache_walk(
+	ospcache_t *cache,
+	isc_stdtime_t now,
+	ospcache_walkfunc_t func,
+	void *arg)
+{
+	ospcache_route_t route;
+	ospcache_shard_t *shard;
+	ospcache_entry_t *entry;
+	ospcache_prefix_t *slot;
+	unsigned int i, count = 0;
+
+	for (i = 0; i < OSPCACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+
+		LOCK(&shard->lock);
+
+		for (entry = ISC_LIST_HEAD(shard->lru); entry != NULL; entry = ISC_LIST_NEXT(entry, link)) {
+			if ((entry->status == ISC_R_SUCCESS) && (entry->expire > now)) {
+				route.count = entry->count;
+				memcpy(route.dest, entry->dest, entry->count * sizeof(ospcache_dest_t));
+				func(arg, ISC_FALSE, entry->key, entry->expire, &route);
+				count++;
+			}
+		}
+
+		UNLOCK(&shard->lock);
+	}
+
+	if (cache->prefixtrie != NULL) {
+		LOCK(&cache->prefixlock);
+
+		for (i = 0; i < cache->nprefixes; i++) {
+			slot = &cache->prefixes[i];
+			if (slot->expire > now) {
+				func(arg, ISC_TRUE, slot->prefix, slot->expire, &slot->route);
+				count++;
+			}
+		}
+
+		UNLOCK(&cache->prefixlock);
+	}
+
+	return count;
+}
+
+/*
+ * Drop all entries, prefix routes and negative results for which a function returns ISC_TRUE. The mapped snapshot is
+ * dropped as a whole if any of its routes matches. The function runs with a cache lock held and must not call back into
+ * the cache.
+ * param cache Cache handle
+ * param func Match function
+ * param arg Match function argument
+ * return Number of entries and prefixes dropped
+ */
+unsigned int ospcache_purge(
+	ospcache_t *cache,
+	ospcache_matchfunc_t func,
+	void *arg)
+{
+	const ospcache_snaphdr_t *header;
+	const ospcache_snaprec_t *records;
+	ospcache_shard_t *shard;
+	ospcache_entry_t *entry, *next;
+	ospcache_prefix_t *slot;
+	isc_boolean_t match = ISC_FALSE;
+	unsigned int i, count = 0;
+
+	for (i = 0; i < OSPCACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+
+		LOCK(&shard->lock);
+
+		for (entry = ISC_LIST_HEAD(shard->lru); entry != NULL; entry = next) {
+			next = ISC_LIST_NEXT(entry, link);
+			if (func(arg, ISC_FALSE, entry->key, entry->count, entry->dest) == ISC_TRUE) {
+				ospcache_free_entry(cache, shard, entry);
+				shard->stats.purges++;
+				count++;
+			}
+		}
+
+		UNLOCK(&shard->lock);
+	}
+
+	if (cache->prefixtrie != NULL) {
+		LOCK(&cache->prefixlock);
+
+		for (i = 0; i < cache->nprefixes; i++) {
+			slot = &cache->prefixes[i];
+			if ((slot->expire != 0) && (func(arg, ISC_TRUE, slot->prefix, slot->route.count, slot->route.dest) == ISC_TRUE)) {
+				osptrie_add(cache->prefixtrie, slot->prefix, OSPTRIE_NONE);
+				slot->expire = 0;
+				cache->prefixpurges++;
+				count++;
+			}
+		}
+
+		UNLOCK(&cache->prefixlock);
+	}
+
+	/* The snapshot is read only, a stale route in it would come back on the next miss */
+	RWLOCK(&cache->snaplock, isc_rwlocktype_write);
+
+	if ((header = cache->snapbase) != NULL) {
+		records = (const ospcache_snaprec_t *)((const char *)cache->snapbase + header->recoffset);
+		for (i = 0; (i < header->count) && (match == ISC_FALSE); i++) {
+			match = func(arg, ISC_FALSE, records[i].key, records[i].route.count, records[i].route.dest);
+		}
+		if (match == ISC_TRUE) {
+			munmap(cache->snapbase, cache->snapsize);
+			cache->snapbase = NULL;
+			cache->snapsize = 0;
+		}
+	}
+
+	RWUNLOCK(&cache->snaplock, isc_rwlocktype_write);
+
+	return count;
+}
+
+/*
+ * Write fresh routes to a snapshot file, the file is replaced atomically
+ * param cache Cache handle
+ * param path Snapshot file path
+ * param now Current time
+ * param count Number of routes written buffer, may be NULL
+ * return ISC_R_SUCCESS successful, other failed
+ */
+isc_result_t ospcache_save(
+	ospcache_t *cache,
+	const char *path,
+	isc_stdtime_t now,
+	unsigned int *count)
+{
+	char tmppath[OSPCACHE_PATH_SIZE];
+	FILE *fp;
+	ospcache_snaphdr_t header;
+	ospcache_snaprec_t record;
+	ospcache_shard_t *shard;
+	ospcache_entry_t *entry;
+	isc_uint32_t *hashes = NULL, *tmp, *index = NULL;
+	isc_uint32_t nhashes = 0, size = 0, nslots, slot, i;
+	isc_uint64_t crc;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	if (snprintf(tmppath, sizeof(tmppath), "%s.tmp", path) >= (int)sizeof(tmppath)) {
+		return ISC_R_NOSPACE;
+	}
+
+	if ((fp = fopen(tmppath, "wb")) == NULL) {
+		return ISC_R_FAILURE;
+	}
+
+	/* Header is rewritten once counts and checksum are known */
+	memset(&header, 0, sizeof(header));
+	if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+		result = ISC_R_FAILURE;
+	}
+
+	isc_crc64_init(&crc);
+
+	for (i = 0; (i < OSPCACHE_SHARDS) && (result == ISC_R_SUCCESS); i++) {
+		shard = &cache->shards[i];
+
+		LOCK(&shard->lock);
+
+		for (entry = ISC_LIST_HEAD(shard->lru); entry != NULL; entry = ISC_LIST_NEXT(entry, link)) {
+			if ((entry->status != ISC_R_SUCCESS) || (entry->expire <= now)) {
+				continue;
+			}
+
+			if (nhashes == size) {
+				size = (size == 0) ? 1024 : size * 2;
+				if ((tmp = isc_mem_get(cache->mctx, size * sizeof(isc_uint32_t))) == NULL) {
+					result = ISC_R_NOMEMORY;
+					break;
+				}
+				if (hashes != NULL) {
+					memcpy(tmp, hashes, nhashes * sizeof(isc_uint32_t));
+					isc_mem_put(cache->mctx, hashes, (size / 2) * sizeof(isc_uint32_t));
+				}
+				hashes = tmp;
+			}
+
+			memset(&record, 0, sizeof(record));
+			record.hash = entry->hash;
+			record.expire = entry->expire;
+			snprintf(record.key, sizeof(record.key), "%s", entry->key);
+			record.route.count = entry->count;
+			memcpy(record.route.dest, entry->dest, entry->count * sizeof(ospcache_dest_t));
+
+			if (fwrite(&record, sizeof(record), 1, fp) != 1) {
+				result = ISC_R_FAILURE;
+				break;
+			}
+			isc_crc64_update(&crc, &record, sizeof(record));
+			hashes[nhashes++] = entry->hash;
+		}
+
+		UNLOCK(&shard->lock);
+	}
+
+	if (result == ISC_R_SUCCESS) {
+		for (nslots = OSPCACHE_SNAP_MINSLOTS; nslots < nhashes * 2; nslots *= 2)
+			;
+		if ((index = isc_mem_get(cache->mctx, nslots * sizeof(isc_uint32_t))) == NULL) {
+			result = ISC_R_NOMEMORY;
+		} else {
+			memset(index, 0, nslots * sizeof(isc_uint32_t));
+			for (i = 0; i < nhashes; i++) {
+				for (slot = hashes[i] & (nslots - 1); index[slot] != 0; slot = (slot + 1) & (nslots - 1))
+					;
+				index[slot] = i + 1;
+			}
+			if (fwrite(index, sizeof(isc_uint32_t), nslots, fp) != nslots) {
+				result = ISC_R_FAILURE;
+			}
+			isc_crc64_update(&crc, index, nslots * sizeof(isc_uint32_t));
+			isc_mem_put(cache->mctx, index, nslots * sizeof(isc_uint32_t));
+		}
+	}
+
+	if (result == ISC_R_SUCCESS) {
+		isc_crc64_final(&crc);
+
+		memcpy(header.magic, OSPCACHE_SNAP_MAGIC, sizeof(OSPCACHE_SNAP_MAGIC));
+		header.version = OSPCACHE_SNAP_VERSION;
+		header.destsize = sizeof(ospcache_dest_t);
+		header.recsize = sizeof(ospcache_snaprec_t);
+		header.count = nhashes;
+		header.nslots = nslots;
+		header.recoffset = sizeof(header);
+		header.indexoffset = sizeof(header) + (isc_uint64_t)nhashes * sizeof(ospcache_snaprec_t);
+		header.checksum = crc;
+		header.created = now;
+
+		if ((fseek(fp, 0, SEEK_SET) != 0) ||
+			(fwrite(&header, sizeof(header), 1, fp) != 1) ||
+			(fflush(fp) != 0) ||
+			(fsync(fileno(fp)) != 0))
+		{
+			result = ISC_R_FAILURE;
+		}
+	}
+
+	if (hashes != NULL) {
+		isc_mem_put(cache->mctx, hashes, size * sizeof(isc_uint32_t));
+	}
+
+	if ((fclose(fp) != 0) && (result == ISC_R_SUCCESS)) {
+		result = ISC_R_FAILURE;
+	}
+
+	if ((result == ISC_R_SUCCESS) && (rename(tmppath, path) != 0)) {
+		result = ISC_R_FAILURE;
+	}
+
+	if (result != ISC_R_SUCCESS) {
+		unlink(tmppath);
+	} else if (count != NULL) {
+		*count = nhashes;
+	}
+
+	return result;
+}
+
+/*
+ * Map a snapshot file read only, its routes answer cache misses until they expire
+ * param cache Cache handle
+ * param path Snapshot file path
+ * param count Number of routes in snapshot buffer, may be NULL
+ * return ISC_R_SUCCESS successful, ISC_R_FILENOTFOUND no snapshot, ISC_R_INVALIDFILE wrong version, size or checksum, other failed
+ */
+isc_result_t ospcache_load(
+	ospcache_t *cache,
+	const char *path,
+	unsigned int *count)
+{
+	int fd;
+	struct stat st;
+	void *base;
+	const ospcache_snaphdr_t *header;
+	isc_uint64_t crc;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	REQUIRE(cache->snapbase == NULL);
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return ISC_R_FILENOTFOUND;
+	}
+
+	if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(ospcache_snaphdr_t))) {
+		close(fd);
+		return ISC_R_INVALIDFILE;
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return ISC_R_FAILURE;
+	}
+
+	header = base;
+	if ((memcmp(header->magic, OSPCACHE_SNAP_MAGIC, sizeof(OSPCACHE_SNAP_MAGIC)) != 0) ||
+		(header->version != OSPCACHE_SNAP_VERSION) ||
+		(header->destsize != sizeof(ospcache_dest_t)) ||
+		(header->recsize != sizeof(ospcache_snaprec_t)) ||
+		(header->nslots < OSPCACHE_SNAP_MINSLOTS) ||
+		((header->nslots & (header->nslots - 1)) != 0) ||
+		(header->count >= header->nslots) ||
+		(header->recoffset != sizeof(ospcache_snaphdr_t)) ||
+		(header->indexoffset != header->recoffset + (isc_uint64_t)header->count * sizeof(ospcache_snaprec_t)) ||
+		(header->indexoffset + (isc_uint64_t)header->nslots * sizeof(isc_uint32_t) != (isc_uint64_t)st.st_size))
+	{
+		result = ISC_R_INVALIDFILE;
+	} else {
+		isc_crc64_init(&crc);
+		isc_crc64_update(&crc, (const char *)base + header->recoffset, st.st_size - header->recoffset);
+		isc_crc64_final(&crc);
+		if (crc != header->checksum) {
+			result = ISC_R_INVALIDFILE;
+		}
+	}
+
+	if (result != ISC_R_SUCCESS) {
+		munmap(base, st.st_size);
+		return result;
+	}
+
+	RWLOCK(&cache->snaplock, isc_rwlocktype_write);
+	cache->snapbase = base;
+	cache->snapsize = st.st_size;
+	RWUNLOCK(&cache->snaplock, isc_rwlocktype_write);
+	if (count != NULL) {
+		*count = header->count;
+	}
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Get statistics
+ * param cache Cache handle
+ * param stats Statistics buffer
+ */
+void ospcache_getstats(
+	ospcache_t *cache,
+	ospcache_stats_t *stats)
+{
+	ospcache_shard_t *shard;
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < OSPCACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+		LOCK(&shard->lock);
+		stats->hits += shard->stats.hits;
+		stats->misses += shard->stats.misses;
+		stats->stalehits += shard->stats.stalehits;
+		stats->prefetches += shard->stats.prefetches;
+		stats->snaphits += shard->stats.snaphits;
+		stats->wirehits += shard->stats.wirehits;
+		stats->inserts += shard->stats.inserts;
+		stats->evictions += shard->stats.evictions;
+		stats->expirations += shard->stats.expirations;
+		stats->purges += shard->stats.purges;
+		stats->entries += shard->stats.entries;
+		stats->memory += shard->memory;
+		UNLOCK(&shard->lock);
+	}
+
+	if (cache->prefixtrie != NULL) {
+		LOCK(&cache->prefixlock);
+		stats->prefixhits = cache->prefixhits;
+		stats->prefixevictions = cache->prefixevictions;
+		stats->purges += cache->prefixpurges;
+		for (i = 0; i < cache->nprefixes; i++) {
+			if (cache->prefixes[i].expire != 0) {
+				stats->prefixes++;
+			}
+		}
+		UNLOCK(&cache->prefixlock);
+	}
+}
+
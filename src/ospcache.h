@@ -0,0 +1,102 @@
+/*
+ * ospcache.h
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OSPCACHE_H
+#define OSPCACHE_H	1
+
+#include <isc/types.h>
+#include <isc/stdtime.h>
+
+/* Buffer size */
+#define OSPCACHE_KEY_SIZE	256		/* Cache key length */
+#define OSPCACHE_NUM_SIZE	64		/* Number length */
+#define OSPCACHE_HOST_SIZE	264		/* Destination address length, "[host]:port" */
+#define OSPCACHE_CIC_SIZE	16		/* Carrier Identification Code length */
+#define OSPCACHE_WIRE_SIZE	8192	/* Rendered rdata set length */
+
+/* Constant */
+#define OSPCACHE_MAX_DEST	12		/* Max number of destinations per route */
+
+/* Destination info */
+typedef struct ospcache_dest {
+	int protocol;					/* Destination signaling protocol */
+	int npdi;						/* Number Portability Dip */
+	char called[OSPCACHE_NUM_SIZE];	/* Called number */
+	char dest[OSPCACHE_HOST_SIZE];	/* Destination address */
+	char dnid[OSPCACHE_NUM_SIZE];	/* Destination network ID */
+	char nprn[OSPCACHE_NUM_SIZE];	/* Routing number */
+	char npcic[OSPCACHE_CIC_SIZE];	/* Carrier Identification Code */
+} ospcache_dest_t;
+
+/* Route info */
+typedef struct ospcache_route {
+	int count;									/* Number of destinations */
+	ospcache_dest_t dest[OSPCACHE_MAX_DEST];	/* Destinations */
+} ospcache_route_t;
+
+/* Cache statistics */
+typedef struct ospcache_stats {
+	isc_uint64_t hits;			/* Number of lookups answered from cache */
+	isc_uint64_t misses;		/* Number of lookups not answered from cache */
+	isc_uint64_t stalehits;		/* Number of lookups answered with expired entries */
+	isc_uint64_t prefetches;	/* Number of hot entries handed out for refresh ahead */
+	isc_uint64_t inserts;		/* Number of entries added or replaced */
+	isc_uint64_t evictions;		/* Number of entries dropped for memory */
+	isc_uint64_t expirations;	/* Number of entries dropped for age */
+	isc_uint64_t prefixhits;		/* Number of lookups answered from prefix table */
+	isc_uint64_t prefixevictions;	/* Number of live prefixes dropped for space */
+	isc_uint64_t snaphits;		/* Number of lookups answered from snapshot */
+	isc_uint64_t purges;		/* Number of entries and prefixes dropped by purge */
+	isc_uint64_t wirehits;		/* Number of lookups answered with rendered rdata */
+	unsigned int entries;		/* Current number of entries */
+	unsigned int prefixes;		/* Current number of prefixes, expired ones not yet reused included */
+	size_t memory;				/* Current memory used by entries */
+} ospcache_stats_t;
+
+/* Cache handle */
+typedef struct ospcache ospcache_t;
+
+/* Route walk function, called with prefix flag, key or prefix, expire time and route */
+typedef void (*ospcache_walkfunc_t)(void *arg, isc_boolean_t prefix, const char *key, isc_stdtime_t expire, const ospcache_route_t *route);
+
+/* Purge match function, called with prefix flag, key or prefix and destinations, no destinations for negative results */
+typedef isc_boolean_t (*ospcache_matchfunc_t)(void *arg, isc_boolean_t prefix, const char *key, int count, const ospcache_dest_t *dest);
+
+unsigned int ospcache_hash(const char *key);
+isc_result_t ospcache_create(isc_mem_t *mctx, size_t maxmemory, unsigned int stale, ospcache_t **cachep);
+void ospcache_destroy(ospcache_t **cachep);
+void ospcache_setprefetch(ospcache_t *cache, unsigned int prefetch, unsigned int prefetchhits);
+isc_result_t ospcache_setprefix(ospcache_t *cache, unsigned int maxprefixes);
+isc_result_t ospcache_getprefix(ospcache_t *cache, const char *number, isc_stdtime_t now, ospcache_route_t *route);
+isc_result_t ospcache_putprefix(ospcache_t *cache, const char *prefix, isc_stdtime_t now, isc_stdtime_t expire, const ospcache_route_t *route);
+isc_result_t ospcache_get(ospcache_t *cache, const char *key, isc_stdtime_t now, ospcache_route_t *route, isc_boolean_t *prefetch);
+isc_result_t ospcache_getwire(ospcache_t *cache, const char *key, isc_stdtime_t now, ospcache_route_t *route, unsigned char *wire, size_t wiresize, size_t *wirelen, isc_boolean_t *prefetch);
+isc_result_t ospcache_putwire(ospcache_t *cache, const char *key, const ospcache_route_t *route, const unsigned char *wire, size_t wirelen);
+isc_result_t ospcache_put(ospcache_t *cache, const char *key, isc_stdtime_t expire, const ospcache_route_t *route);
+isc_result_t ospcache_getstale(ospcache_t *cache, const char *key, isc_stdtime_t now, ospcache_route_t *route);
+isc_result_t ospcache_getnegative(ospcache_t *cache, const char *key, isc_stdtime_t now, isc_result_t *status);
+isc_result_t ospcache_putnegative(ospcache_t *cache, const char *key, isc_stdtime_t expire, isc_result_t status);
+unsigned int ospcache_purge(ospcache_t *cache, ospcache_matchfunc_t func, void *arg);
+unsigned int ospcache_walk(ospcache_t *cache, isc_stdtime_t now, ospcache_walkfunc_t func, void *arg);
+isc_result_t ospcache_save(ospcache_t *cache, const char *path, isc_stdtime_t now, unsigned int *count);
+isc_result_t ospcache_load(ospcache_t *cache, const char *path, unsigned int *count);
+void ospcache_getstats(ospcache_t *cache, ospcache_stats_t *stats);
+
+#endif /* OSPCACHE_H */
+
@@ -17,12 +17,23 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <ctype.h>
 #include <regex.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
+#include <isc/condition.h>
+#include <isc/list.h>
 #include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/quota.h>
+#include <isc/thread.h>
+#include <isc/time.h>
+#include <isc/util.h>
 
 #include <dns/log.h>
+#include <dns/name.h>
+#include <dns/result.h>
 #include <dns/sdb.h>
 
 #include <named/globals.h>
@@ -34,14 +45,24 @@
 #include <osp/osptrans.h>
 
 #include "ospdb.h"
+#include "ospcache.h"
+#include "ospshm.h"
+#include "osppeer.h"
+#include "osppurge.h"
+#include "ospreplica.h"
+#include "osplnp.h"
+#include "osprules.h"
+#include "ospresp.h"
 
 /* Buffer size */
 #define OSPDB_STR_SIZE	512		/* Normal string length */
 #define OSPDB_KEY_SIZE	1024	/* Key string length */
+#define OSPDB_TS_SIZE	32		/* Timestamp string length */
 
 /* Constant */
 #define OSPDB_MAX_SPNUM	8		/* Max number of service point URLs */
 #define OSPDB_MAX_CANUM	4		/* Max number of cacert file */
+#define OSPDB_MAX_PREFIXNUM	32	/* Max number of prefix scope rules */
 
 /* Configuration parameter name */
 #define OSPDB_NAME_SPURL		"spurl_"				/* Service point URL parameter name */
@@ -64,10 +85,47 @@
 #define OSPDB_NAME_NIDLOCATION	"networkidlocation"		/* Destination network ID location parameter name */
 #define OSPDB_NAME_NIDNAME		"networkidname"			/* Destination network ID name parameter name */
 #define OSPDB_NAME_USERPHONE	"userphone"				/* Append user=phone parameter name */
+#define OSPDB_NAME_MAXINFLIGHT	"maxinflight"			/* Max number of in-flight AuthReqs parameter name */
+#define OSPDB_NAME_CACHESIZE	"cachesize"				/* Route cache size parameter name */
+#define OSPDB_NAME_CACHEMINTTL	"cacheminttl"			/* Route cache min TTL parameter name */
+#define OSPDB_NAME_CACHEMAXTTL	"cachemaxttl"			/* Route cache max TTL parameter name */
+#define OSPDB_NAME_CACHEKEY		"cachekey"				/* Route cache key parameter name */
+#define OSPDB_NAME_NEGCACHESIZE	"negcachesize"			/* Negative cache size parameter name */
+#define OSPDB_NAME_NEGCACHETTL	"negcachettl"			/* Negative cache TTL parameter name */
+#define OSPDB_NAME_SERVESTALE	"servestale"			/* Serve stale window parameter name */
+#define OSPDB_NAME_STALEDEADLINE	"staledeadline"		/* Serve stale AuthReq deadline parameter name */
+#define OSPDB_NAME_STALETTL		"stalettl"				/* Stale answer TTL parameter name */
+#define OSPDB_NAME_REFRESHTHREADS	"refreshthreads"	/* Number of background refresh threads parameter name */
+#define OSPDB_NAME_PREFETCH		"prefetch"				/* Refresh ahead window parameter name */
+#define OSPDB_NAME_PREFETCHHITS	"prefetchhits"			/* Refresh ahead min hits parameter name */
+#define OSPDB_NAME_PREFETCHRATE	"prefetchrate"			/* Refresh ahead max rate parameter name */
+#define OSPDB_NAME_PREFIXSCOPE	"prefixscope"			/* Prefix scope rules parameter name */
+#define OSPDB_NAME_PREFIXENTRIES	"prefixentries"		/* Max number of cached prefixes parameter name */
+#define OSPDB_NAME_SNAPSHOTFILE	"snapshotfile"			/* Route cache snapshot file parameter name */
+#define OSPDB_NAME_SNAPSHOTINTERVAL	"snapshotinterval"	/* Route cache snapshot interval parameter name */
+#define OSPDB_NAME_SHMNAME		"shmname"				/* Shared route table name parameter name */
+#define OSPDB_NAME_SHMSIZE		"shmsize"				/* Shared route table size parameter name */
+#define OSPDB_NAME_PEERLISTEN	"peerlisten"			/* Cache replication listen address parameter name */
+#define OSPDB_NAME_PEERS		"peers"					/* Cache replication peer addresses parameter name */
+#define OSPDB_NAME_PEERSECRET	"peersecret"			/* Cache replication message secret parameter name */
+#define OSPDB_NAME_PURGELISTEN	"purgelisten"			/* Invalidation listener address parameter name */
+#define OSPDB_NAME_PURGESECRET	"purgesecret"			/* Invalidation message secret parameter name */
+#define OSPDB_NAME_REPLICAFILE	"replicafile"			/* Route replica export file parameter name */
+#define OSPDB_NAME_REPLICADELTA	"replicadelta"			/* Route replica delta file parameter name */
+#define OSPDB_NAME_REPLICAINTERVAL	"replicainterval"	/* Route replica delta check interval parameter name */
+#define OSPDB_NAME_LNPFILE		"lnpfile"				/* Number portability dataset parameter name */
+#define OSPDB_NAME_LNPINTERVAL	"lnpinterval"			/* Number portability dataset reload check interval parameter name */
+#define OSPDB_NAME_RULESFILE	"rulesfile"				/* Local rules file parameter name */
+#define OSPDB_NAME_RULESINTERVAL	"rulesinterval"		/* Local rules file reload check interval parameter name */
+#define OSPDB_NAME_RESPCACHESIZE	"respcachesize"		/* Response cache size parameter name */
+#define OSPDB_NAME_RESPCACHETTL	"respcachettl"			/* Response cache hold time parameter name */
 
 /* Configuration parameter value */
 #define OSPDB_VALUE_NO			"no"						/* Boolean flase */
 #define OSPDB_VALUE_YES			"yes"						/* Boolean true */
+#define OSPDB_VALUE_CALLED		"called"					/* Cache key called number */
+#define OSPDB_VALUE_CALLING		"calling"					/* Cache key calling number */
+#define OSPDB_VALUE_SOURCE		"source"					/* Cache key source device */
 #define OSPDB_DEF_SPURL			"http:/*127.0.0.1:5045/osp"	/* Default service point RUL */
 #define OSPDB_DEF_SPWEIGHT		1000						/* Default service point weight */
 #define OSPDB_MIN_SPWEIGHT		1							/* Min service point weight */
@@ -106,6 +164,70 @@
 #define OSPDB_DEF_NIDNAME		"networkid"					/* Default destination network ID name */
 #define OSPDB_DEF_USERPHONE		ISC_FALSE					/* Default user=phone flag */
 #define OSPDB_DEF_PROTOCOL		OSPC_PROTNAME_SIP			/* Default signaling protocol */
+#define OSPDB_DEF_MAXINFLIGHT	0							/* Default max number of in-flight AuthReqs, unlimited */
+#define OSPDB_MIN_MAXINFLIGHT	0							/* Min max number of in-flight AuthReqs */
+#define OSPDB_MAX_MAXINFLIGHT	10000						/* Max max number of in-flight AuthReqs */
+#define OSPDB_DEF_CACHESIZE		0							/* Default route cache size, disabled */
+#define OSPDB_MIN_CACHESIZE		0							/* Min route cache size in KB */
+#define OSPDB_MAX_CACHESIZE		1048576						/* Max route cache size in KB */
+#define OSPDB_DEF_CACHEMINTTL	0							/* Default route cache min TTL */
+#define OSPDB_MIN_CACHEMINTTL	0							/* Min route cache min TTL in seconds */
+#define OSPDB_MAX_CACHEMINTTL	3600						/* Max route cache min TTL in seconds */
+#define OSPDB_DEF_CACHEMAXTTL	60							/* Default route cache max TTL */
+#define OSPDB_MIN_CACHEMAXTTL	1							/* Min route cache max TTL in seconds */
+#define OSPDB_MAX_CACHEMAXTTL	86400						/* Max route cache max TTL in seconds */
+#define OSPDB_DEF_CACHEKEY		OSPDB_CACHEKEY_CALLED		/* Default route cache key, called number only */
+#define OSPDB_DEF_NEGCACHESIZE	0							/* Default negative cache size, disabled */
+#define OSPDB_MIN_NEGCACHESIZE	0							/* Min negative cache size in KB */
+#define OSPDB_MAX_NEGCACHESIZE	1048576						/* Max negative cache size in KB */
+#define OSPDB_DEF_NEGCACHETTL	10							/* Default negative cache TTL */
+#define OSPDB_MIN_NEGCACHETTL	1							/* Min negative cache TTL in seconds */
+#define OSPDB_MAX_NEGCACHETTL	3600						/* Max negative cache TTL in seconds */
+#define OSPDB_DEF_SERVESTALE	0							/* Default serve stale window, disabled */
+#define OSPDB_MIN_SERVESTALE	0							/* Min serve stale window in seconds */
+#define OSPDB_MAX_SERVESTALE	86400						/* Max serve stale window in seconds */
+#define OSPDB_DEF_STALEDEADLINE	0							/* Default serve stale AuthReq deadline, wait for AuthReq */
+#define OSPDB_MIN_STALEDEADLINE	0							/* Min serve stale AuthReq deadline in ms */
+#define OSPDB_MAX_STALEDEADLINE	60000						/* Max serve stale AuthReq deadline in ms */
+#define OSPDB_DEF_STALETTL		0							/* Default stale answer TTL */
+#define OSPDB_MIN_STALETTL		0							/* Min stale answer TTL in seconds */
+#define OSPDB_MAX_STALETTL		300							/* Max stale answer TTL in seconds */
+#define OSPDB_DEF_REFRESHTHREADS	2						/* Default number of background refresh threads */
+#define OSPDB_MIN_REFRESHTHREADS	1						/* Min number of background refresh threads */
+#define OSPDB_MAX_REFRESHTHREADS	32						/* Max number of background refresh threads */
+#define OSPDB_DEF_PREFETCH		0							/* Default refresh ahead window, disabled */
+#define OSPDB_MIN_PREFETCH		0							/* Min refresh ahead window in seconds */
+#define OSPDB_MAX_PREFETCH		3600						/* Max refresh ahead window in seconds */
+#define OSPDB_DEF_PREFETCHHITS	3							/* Default refresh ahead min hits */
+#define OSPDB_MIN_PREFETCHHITS	1							/* Min refresh ahead min hits */
+#define OSPDB_MAX_PREFETCHHITS	1000000						/* Max refresh ahead min hits */
+#define OSPDB_DEF_PREFETCHRATE	10							/* Default refresh ahead max rate */
+#define OSPDB_MIN_PREFETCHRATE	1							/* Min refresh ahead max rate in AuthReqs per second */
+#define OSPDB_MAX_PREFETCHRATE	10000						/* Max refresh ahead max rate in AuthReqs per second */
+#define OSPDB_DEF_PREFIXENTRIES	1000						/* Default max number of cached prefixes */
+#define OSPDB_MIN_PREFIXENTRIES	1							/* Min max number of cached prefixes */
+#define OSPDB_MAX_PREFIXENTRIES	100000						/* Max max number of cached prefixes */
+#define OSPDB_DEF_SNAPSHOTINTERVAL	300						/* Default route cache snapshot interval */
+#define OSPDB_MIN_SNAPSHOTINTERVAL	10						/* Min route cache snapshot interval in seconds */
+#define OSPDB_MAX_SNAPSHOTINTERVAL	86400					/* Max route cache snapshot interval in seconds */
+#define OSPDB_DEF_SHMSIZE		65536					/* Default shared route table size */
+#define OSPDB_MIN_SHMSIZE		1024					/* Min shared route table size in KB */
+#define OSPDB_MAX_SHMSIZE		4194304					/* Max shared route table size in KB */
+#define OSPDB_DEF_REPLICAINTERVAL	60						/* Default route replica delta check interval */
+#define OSPDB_MIN_REPLICAINTERVAL	1						/* Min route replica delta check interval in seconds */
+#define OSPDB_MAX_REPLICAINTERVAL	86400					/* Max route replica delta check interval in seconds */
+#define OSPDB_DEF_LNPINTERVAL	60							/* Default number portability dataset reload check interval */
+#define OSPDB_MIN_LNPINTERVAL	1							/* Min number portability dataset reload check interval in seconds */
+#define OSPDB_MAX_LNPINTERVAL	86400						/* Max number portability dataset reload check interval in seconds */
+#define OSPDB_DEF_RULESINTERVAL	10							/* Default local rules file reload check interval */
+#define OSPDB_MIN_RULESINTERVAL	1							/* Min local rules file reload check interval in seconds */
+#define OSPDB_MAX_RULESINTERVAL	86400						/* Max local rules file reload check interval in seconds */
+#define OSPDB_DEF_RESPCACHESIZE	0							/* Default response cache size, disabled */
+#define OSPDB_MIN_RESPCACHESIZE	0							/* Min response cache size in KB */
+#define OSPDB_MAX_RESPCACHESIZE	1048576						/* Max response cache size in KB */
+#define OSPDB_DEF_RESPCACHETTL	5							/* Default response cache hold time */
+#define OSPDB_MIN_RESPCACHETTL	1							/* Min response cache hold time in seconds */
+#define OSPDB_MAX_RESPCACHETTL	60							/* Max response cache hold time in seconds */
 
 /* Protocol */
 #define OSPDB_PROTOCOL_SIP		"sip"	/* SIP */
@@ -116,6 +238,11 @@
 #define OSPDB_URIHEADER_SIPS	"sips:"	/* SIPS URI scheme header */
 #define OSPDB_URIHEADER_TEL		"tel:"	/* Telephone URI scheme header */
 
+/* Route cache key components */
+#define OSPDB_CACHEKEY_CALLED	0x01	/* Called number */
+#define OSPDB_CACHEKEY_CALLING	0x02	/* Calling number, source URI user */
+#define OSPDB_CACHEKEY_SOURCE	0x04	/* Source device, source URI host or DNS client address */
+
 /* URI scheme header length */
 #define OSPDB_URIHLEN_SIP		4		/* SIP URI scheme header */
 #define OSPDB_URIHLEN_SIPS		5		/* SIPS URI scheme header */
@@ -141,6 +268,80 @@ typedef struct ospdb_config {
 	int timeout;									/* HTTP timeout */
 } ospdb_config_t;
 
+/* Prefix scope rule, routes of numbers starting with prefix are cached for their first length digits */
+typedef struct ospdb_prefixrule {
+	char prefix[OSPCACHE_NUM_SIZE];	/* Number prefix the rule applies to */
+	int length;						/* Scope length */
+} ospdb_prefixrule_t;
+
+/* Purge match info */
+typedef struct ospdb_purgematch {
+	int type;				/* Purge type */
+	const char *value;		/* Called number, number prefix or destination */
+} ospdb_purgematch_t;
+
+/* Shared object kind */
+#define OSPDB_SHARED_PROVIDER	0	/* OSP provider with its HTTP connections */
+#define OSPDB_SHARED_CACHE		1	/* Route and negative caches */
+
+/* Route cache configuration, parameters that shape the cached entries */
+typedef struct ospdb_cachecfg {
+	int cachesize;										/* Route cache size in KB */
+	int servestale;										/* Serve stale window */
+	int prefetch;										/* Refresh ahead window */
+	int prefetchhits;									/* Refresh ahead min hits */
+	unsigned int cachekey;								/* Route cache key components */
+	int prefixnum;										/* Number of prefix scope rules */
+	int prefixentries;									/* Max number of cached prefixes */
+	ospdb_prefixrule_t prefixrule[OSPDB_MAX_PREFIXNUM];	/* Prefix scope rules */
+	int negcachesize;									/* Negative cache size in KB */
+	int maxdest;										/* Max number of destinations */
+	int nidlocation;									/* Destination network ID location */
+	char nidname[OSPDB_STR_SIZE];						/* Destination network ID name */
+	isc_boolean_t userphone;							/* Append user=phone flag */
+} ospdb_cachecfg_t;
+
+/* Object kept across zone reloads, a new instance of a zone with the same configuration adopts it */
+typedef struct ospdb_shared ospdb_shared_t;
+struct ospdb_shared {
+	ISC_LINK(ospdb_shared_t) link;		/* Shared object list */
+	int kind;							/* Object kind */
+	char zone[OSPDB_STR_SIZE];			/* Zone name */
+	unsigned int hash;					/* Configuration hash */
+	union {
+		ospdb_config_t provider;		/* Provider configuration */
+		ospdb_cachecfg_t cache;			/* Cache configuration */
+	} cfg;								/* Configuration, zeroed beyond the kind's */
+	unsigned int refs;					/* Number of instances using the object */
+	OSPTPROVHANDLE provider;			/* OSP provider handle */
+	ospcache_t *cache;					/* Route cache */
+	ospcache_t *negcache;				/* Negative cache */
+};
+
+/* In-flight AuthReq shared by concurrent lookups for the same key */
+typedef struct ospdb_flight ospdb_flight_t;
+struct ospdb_flight {
+	ISC_LINK(ospdb_flight_t) link;	/* Flight list */
+	char key[OSPCACHE_KEY_SIZE];	/* Cache key */
+	unsigned int refs;				/* Number of lookups attached, leader included */
+	isc_boolean_t done;				/* Result available flag */
+	isc_result_t result;			/* AuthReq result */
+	ospcache_route_t route;			/* Route */
+};
+
+/* Background AuthReq */
+typedef struct ospdb_task ospdb_task_t;
+struct ospdb_task {
+	ISC_LINK(ospdb_task_t) link;		/* Task queue */
+	ospdb_flight_t *flight;				/* Flight to land, attached, NULL for refresh ahead */
+	char key[OSPCACHE_KEY_SIZE];		/* Cache key */
+	char called[OSPDB_STR_SIZE];		/* Called number */
+	char srcdev[OSPDB_STR_SIZE];		/* Source device */
+	char srcuriuser[OSPDB_STR_SIZE];	/* Source URI user */
+	char nprn[OSPLNP_NUM_SIZE];			/* Routing number from the number portability dataset */
+	char npcic[OSPLNP_CIC_SIZE];		/* Carrier Identification Code from the number portability dataset */
+};
+
 /* Running data */
 typedef struct ospdb_data {
 	isc_boolean_t usesrcuri;		/* Support EDNS0 source URI flag */
@@ -149,16 +350,89 @@ typedef struct ospdb_data {
 	int nidlocation;				/* Destination network ID location */
 	char nidname[OSPDB_STR_SIZE];	/* Destination network ID name */
 	isc_boolean_t userphone;		/* Append user=phone flag */
+	int maxinflight;				/* Max number of in-flight AuthReqs */
+	isc_quota_t inflight;			/* In-flight AuthReq quota */
+	int cachesize;					/* Route cache size in KB */
+	int cacheminttl;				/* Route cache min TTL */
+	int cachemaxttl;				/* Route cache max TTL */
+	unsigned int cachekey;			/* Route cache key components */
+	ospcache_t *cache;				/* Route cache */
+	int negcachesize;				/* Negative cache size in KB */
+	int negcachettl;				/* Negative cache TTL */
+	ospcache_t *negcache;			/* Negative cache */
+	isc_mutex_t flightlock;			/* Flight list lock */
+	isc_condition_t flightcond;		/* Signaled when a flight lands */
+	ISC_LIST(ospdb_flight_t) flights;	/* In-flight AuthReqs */
+	isc_uint64_t coalesced;			/* Number of lookups answered by another lookup's AuthReq */
+	int servestale;					/* Serve stale window */
+	int staledeadline;				/* Serve stale AuthReq deadline in ms */
+	int stalettl;					/* Stale answer TTL */
+	int refreshthreads;				/* Number of background refresh threads */
+	isc_mutex_t tasklock;			/* Task queue lock */
+	isc_condition_t taskcond;		/* Signaled when a task is queued or on shutdown */
+	ISC_LIST(ospdb_task_t) tasks;	/* Task queue */
+	isc_boolean_t shutdown;			/* Stop background threads flag */
+	int nthreads;					/* Number of running background threads */
+	isc_thread_t threads[OSPDB_MAX_REFRESHTHREADS];	/* Background threads */
+	int prefetch;					/* Refresh ahead window */
+	int prefetchhits;				/* Refresh ahead min hits */
+	int prefetchrate;				/* Refresh ahead max AuthReqs per second */
+	isc_stdtime_t prefetchsecond;	/* Current refresh ahead rate window */
+	int prefetchcount;				/* Refresh ahead AuthReqs queued in current window */
+	isc_uint64_t prefetchdrops;		/* Number of refresh ahead AuthReqs dropped for rate */
+	int prefixnum;					/* Number of prefix scope rules */
+	ospdb_prefixrule_t prefixrule[OSPDB_MAX_PREFIXNUM];	/* Prefix scope rules */
+	int prefixentries;				/* Max number of cached prefixes */
+	char snapshotfile[OSPDB_STR_SIZE];	/* Route cache snapshot file, empty for none */
+	int snapshotinterval;			/* Route cache snapshot interval */
+	isc_stdtime_t snapshotnext;		/* Next route cache snapshot time */
+	isc_condition_t housecond;		/* Signaled on shutdown to wake the housekeeping thread */
+	isc_boolean_t househeld;		/* Housekeeping thread running flag */
+	isc_thread_t housekeeper;		/* Housekeeping thread */
+	char shmname[OSPDB_STR_SIZE];	/* Shared route table name, empty for none */
+	int shmsize;					/* Shared route table size */
+	ospshm_t *shm;					/* Shared route table */
+	isc_boolean_t peeron;			/* Cache replication configured flag */
+	isc_sockaddr_t peerlisten;		/* Cache replication listen address */
+	int peernum;					/* Number of replication peers */
+	isc_sockaddr_t peeraddr[OSPPEER_MAX_PEERS];	/* Replication peer addresses */
+	char peersecret[OSPDB_STR_SIZE];	/* Cache replication message secret */
+	osppeer_t *peer;				/* Cache replication */
+	isc_boolean_t purgeon;			/* Invalidation listener configured flag */
+	isc_sockaddr_t purgelisten;		/* Invalidation listener address */
+	char purgesecret[OSPDB_STR_SIZE];	/* Invalidation message secret */
+	osppurge_t *purge;				/* Invalidation listener */
+	char replicafile[OSPDB_STR_SIZE];	/* Route replica export file, empty for none */
+	char replicadelta[OSPDB_STR_SIZE];	/* Route replica delta file, empty for none */
+	int replicainterval;			/* Route replica delta check interval */
+	isc_stdtime_t replicanext;		/* Next route replica delta check time */
+	time_t replicamtime;			/* Modification time of the last applied delta */
+	ospreplica_t *replica;			/* Route replica */
+	char lnpfile[OSPDB_STR_SIZE];	/* Number portability dataset, empty for none */
+	int lnpinterval;				/* Number portability dataset reload check interval */
+	isc_stdtime_t lnpnext;			/* Next number portability dataset reload check time */
+	osplnp_t *lnp;					/* Number portability dataset */
+	char rulesfile[OSPDB_STR_SIZE];	/* Local rules file, empty for none */
+	int rulesinterval;				/* Local rules file reload check interval */
+	isc_stdtime_t rulesnext;		/* Next local rules file reload check time */
+	osprules_t *rules;				/* Local rule table */
+	int respcachesize;				/* Response cache size in KB */
+	int respcachettl;				/* Response cache hold time */
+	isc_boolean_t respcache;		/* Attached to the response cache flag */
 	OSPTPROVHANDLE provider;		/* OSP provider handle */
+	ospdb_shared_t *sharedprovider;	/* Shared OSP provider */
+	ospdb_shared_t *sharedcache;	/* Shared route and negative caches, NULL for private ones */
 } ospdb_data_t;
 
 /* Query info */
 typedef struct ospdb_query {
-	const char *name;		/* Domain name */
+	const char *called;		/* Called number */
 	const char *serverip;	/* DNS server address */
-	const char *clientip;	/* DNS client address */
+	const char *srcdev;		/* Source device, source URI host or DNS client address */
 	const char *srcuriuser;	/* Source URI user */
-	const char *srcurihost;	/* Source URI host */
+	const char *routing;	/* Number routes depend on, the LRN of a ported number, else the called number */
+	const char *nprn;		/* Routing number of a ported number, empty for not ported */
+	const char *npcic;		/* Carrier Identification Code of a ported number */
 } ospdb_query_t;
 
 /* Response info */
@@ -173,8 +447,23 @@ typedef struct ospdb_response {
 	char npcic[OSPDB_STR_SIZE];							/* Carrier Identification Code */
 	int npdi;											/* Number Portability Dip */
 	char opname[OSPC_OPNAME_NUMBER][OSPDB_STR_SIZE];	/* Operator names */
+	isc_stdtime_t validuntil;							/* Valid until time, 0 for unknown */
+	unsigned int timelimit;								/* Call duration limit, 0 for unlimited */
 } ospdb_response_t;
 
+/* Lookup answer kept on the DNS client, so a repeat lookup of the same request goes to no cache and no AuthReq */
+typedef struct ospdb_memo {
+	ospdb_data_t *data;							/* Zone the lookup was for */
+	char called[OSPDB_STR_SIZE];				/* Called number */
+	isc_result_t result;						/* Lookup result */
+	isc_boolean_t stale;						/* Route served stale */
+	size_t wirelen;								/* Rendered records length, 0 for route */
+	union {
+		ospcache_route_t route;					/* Route, ported number info applied */
+		unsigned char wire[OSPCACHE_WIRE_SIZE];	/* Rendered records */
+	} answer;									/* Answer of successful lookups */
+} ospdb_memo_t;
+
 #define OSPDB_LOG_START					isc_log_write(ns_g_lctx, DNS_LOGCATEGORY_GENERAL, DNS_LOGMODULE_SDB, ISC_LOG_DEBUG(3), "%s: Start", (const char *)__func__)
 #define OSPDB_LOG_END					isc_log_write(ns_g_lctx, DNS_LOGCATEGORY_GENERAL, DNS_LOGMODULE_SDB, ISC_LOG_DEBUG(3), "%s: End", (const char *)__func__)
 #define OSPDB_LOG(_level, _fmt, ...)	isc_log_write(ns_g_lctx, DNS_LOGCATEGORY_GENERAL, DNS_LOGMODULE_SDB, _level, "%s: "_fmt"", (const char *)__func__, __VA_ARGS__)
@@ -189,6 +478,11 @@ static dns_sdbimplementation_t *ospdb = NULL;
 /* OSP client init flag */
 static isc_boolean_t ospdb_init_flag = ISC_FALSE;
 
+/* Objects kept across zone reloads */
+static isc_boolean_t ospdb_shared_flag = ISC_FALSE;
+static isc_mutex_t ospdb_sharedlock;
+static ISC_LIST(ospdb_shared_t) ospdb_sharedlist;
+
 /*
  * Init configuration parameter structure
  * param cfg Configuration parameter structure
@@ -231,6 +525,61 @@ static void ospdb_init_config(
 	data->nidlocation = OSPDB_DEF_NIDLOCATION;
 	data->nidname[0] = '\0';
 	data->userphone = OSPDB_DEF_USERPHONE;
+	data->maxinflight = OSPDB_DEF_MAXINFLIGHT;
+	data->cachesize = OSPDB_DEF_CACHESIZE;
+	data->cacheminttl = OSPDB_DEF_CACHEMINTTL;
+	data->cachemaxttl = OSPDB_DEF_CACHEMAXTTL;
+	data->cachekey = OSPDB_DEF_CACHEKEY;
+	data->cache = NULL;
+	data->negcachesize = OSPDB_DEF_NEGCACHESIZE;
+	data->negcachettl = OSPDB_DEF_NEGCACHETTL;
+	data->negcache = NULL;
+	data->servestale = OSPDB_DEF_SERVESTALE;
+	data->staledeadline = OSPDB_DEF_STALEDEADLINE;
+	data->stalettl = OSPDB_DEF_STALETTL;
+	data->refreshthreads = OSPDB_DEF_REFRESHTHREADS;
+	data->nthreads = 0;
+	data->prefetch = OSPDB_DEF_PREFETCH;
+	data->prefetchhits = OSPDB_DEF_PREFETCHHITS;
+	data->prefetchrate = OSPDB_DEF_PREFETCHRATE;
+	data->prefetchsecond = 0;
+	data->prefetchcount = 0;
+	data->prefetchdrops = 0;
+	data->prefixnum = 0;
+	data->prefixentries = OSPDB_DEF_PREFIXENTRIES;
+	data->snapshotfile[0] = '\0';
+	data->snapshotinterval = OSPDB_DEF_SNAPSHOTINTERVAL;
+	data->snapshotnext = 0;
+	data->househeld = ISC_FALSE;
+	data->shmname[0] = '\0';
+	data->shmsize = OSPDB_DEF_SHMSIZE;
+	data->shm = NULL;
+	data->peeron = ISC_FALSE;
+	data->peernum = 0;
+	data->peersecret[0] = '\0';
+	data->peer = NULL;
+	data->purgeon = ISC_FALSE;
+	data->purgesecret[0] = '\0';
+	data->purge = NULL;
+	data->replicafile[0] = '\0';
+	data->replicadelta[0] = '\0';
+	data->replicainterval = OSPDB_DEF_REPLICAINTERVAL;
+	data->replicanext = 0;
+	data->replicamtime = 0;
+	data->replica = NULL;
+	data->lnpfile[0] = '\0';
+	data->lnpinterval = OSPDB_DEF_LNPINTERVAL;
+	data->lnpnext = 0;
+	data->lnp = NULL;
+	data->rulesfile[0] = '\0';
+	data->rulesinterval = OSPDB_DEF_RULESINTERVAL;
+	data->rulesnext = 0;
+	data->rules = NULL;
+	data->respcachesize = OSPDB_DEF_RESPCACHESIZE;
+	data->respcachettl = OSPDB_DEF_RESPCACHETTL;
+	data->respcache = ISC_FALSE;
+	data->sharedprovider = NULL;
+	data->sharedcache = NULL;
 
 	OSPDB_LOG_END;
 }
@@ -249,10 +598,11 @@ static void ospdb_get_config(
 	ospdb_data_t *data)
 {
 	int i, j, tmp;
+	unsigned int flags;
 	char buffer1[OSPDB_STR_SIZE];
 	char buffer2[OSPDB_STR_SIZE];
 	char *saveptr = NULL;
-	char *name, *value;
+	char *name, *value, *item, *colon;
 
 	OSPDB_LOG_START;
 
@@ -418,6 +768,281 @@ static void ospdb_get_config(
 				} else {
 					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
 				}
+			} else if (strcmp(name, OSPDB_NAME_MAXINFLIGHT) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_MAXINFLIGHT) && (tmp <= OSPDB_MAX_MAXINFLIGHT)) {
+					data->maxinflight = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->maxinflight);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_CACHESIZE) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_CACHESIZE) && (tmp <= OSPDB_MAX_CACHESIZE)) {
+					data->cachesize = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->cachesize);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_CACHEMINTTL) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_CACHEMINTTL) && (tmp <= OSPDB_MAX_CACHEMINTTL)) {
+					data->cacheminttl = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->cacheminttl);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_CACHEMAXTTL) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_CACHEMAXTTL) && (tmp <= OSPDB_MAX_CACHEMAXTTL)) {
+					data->cachemaxttl = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->cachemaxttl);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_CACHEKEY) == 0) {
+				flags = 0;
+				for (item = strtok_r(value, "+", &saveptr); item != NULL; item = strtok_r(NULL, "+", &saveptr)) {
+					if (strcmp(item, OSPDB_VALUE_CALLED) == 0) {
+						flags |= OSPDB_CACHEKEY_CALLED;
+					} else if (strcmp(item, OSPDB_VALUE_CALLING) == 0) {
+						flags |= OSPDB_CACHEKEY_CALLING;
+					} else if (strcmp(item, OSPDB_VALUE_SOURCE) == 0) {
+						flags |= OSPDB_CACHEKEY_SOURCE;
+					} else {
+						flags = 0;
+						break;
+					}
+				}
+				if ((flags & OSPDB_CACHEKEY_CALLED) != 0) {
+					data->cachekey = flags;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%u'", name, data->cachekey);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, argv[i] + strlen(name) + 1);
+				}
+			} else if (strcmp(name, OSPDB_NAME_NEGCACHESIZE) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_NEGCACHESIZE) && (tmp <= OSPDB_MAX_NEGCACHESIZE)) {
+					data->negcachesize = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->negcachesize);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_NEGCACHETTL) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_NEGCACHETTL) && (tmp <= OSPDB_MAX_NEGCACHETTL)) {
+					data->negcachettl = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->negcachettl);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_SERVESTALE) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_SERVESTALE) && (tmp <= OSPDB_MAX_SERVESTALE)) {
+					data->servestale = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->servestale);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_STALEDEADLINE) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_STALEDEADLINE) && (tmp <= OSPDB_MAX_STALEDEADLINE)) {
+					data->staledeadline = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->staledeadline);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_STALETTL) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_STALETTL) && (tmp <= OSPDB_MAX_STALETTL)) {
+					data->stalettl = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->stalettl);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_REFRESHTHREADS) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_REFRESHTHREADS) && (tmp <= OSPDB_MAX_REFRESHTHREADS)) {
+					data->refreshthreads = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->refreshthreads);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_PREFETCH) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_PREFETCH) && (tmp <= OSPDB_MAX_PREFETCH)) {
+					data->prefetch = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->prefetch);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_PREFETCHHITS) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_PREFETCHHITS) && (tmp <= OSPDB_MAX_PREFETCHHITS)) {
+					data->prefetchhits = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->prefetchhits);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_PREFETCHRATE) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_PREFETCHRATE) && (tmp <= OSPDB_MAX_PREFETCHRATE)) {
+					data->prefetchrate = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->prefetchrate);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_PREFIXSCOPE) == 0) {
+				/* prefix:length[,prefix:length...] */
+				data->prefixnum = 0;
+				for (item = strtok_r(value, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+					if (((colon = strchr(item, ':')) == NULL) ||
+						(data->prefixnum >= OSPDB_MAX_PREFIXNUM) ||
+						(colon - item >= OSPCACHE_NUM_SIZE) ||
+						(strspn(item, "0123456789") != (size_t)(colon - item)))
+					{
+						data->prefixnum = 0;
+						break;
+					}
+					tmp = atoi(colon + 1);
+					if ((tmp < colon - item) || (tmp <= 0) || (tmp >= OSPCACHE_NUM_SIZE)) {
+						data->prefixnum = 0;
+						break;
+					}
+					*colon = '\0';
+					snprintf(data->prefixrule[data->prefixnum].prefix, sizeof(data->prefixrule[data->prefixnum].prefix), "%s", item);
+					data->prefixrule[data->prefixnum].length = tmp;
+					data->prefixnum++;
+				}
+				if (data->prefixnum != 0) {
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d' rules", name, data->prefixnum);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, argv[i] + strlen(name) + 1);
+				}
+			} else if (strcmp(name, OSPDB_NAME_PREFIXENTRIES) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_PREFIXENTRIES) && (tmp <= OSPDB_MAX_PREFIXENTRIES)) {
+					data->prefixentries = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->prefixentries);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_SNAPSHOTFILE) == 0) {
+				snprintf(data->snapshotfile, sizeof(data->snapshotfile), "%s", value);
+				OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%s'", name, data->snapshotfile);
+			} else if (strcmp(name, OSPDB_NAME_SNAPSHOTINTERVAL) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_SNAPSHOTINTERVAL) && (tmp <= OSPDB_MAX_SNAPSHOTINTERVAL)) {
+					data->snapshotinterval = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->snapshotinterval);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_SHMNAME) == 0) {
+				/* POSIX shared memory object name, "/name" */
+				if ((value[0] == '/') && (value[1] != '\0') && (strchr(value + 1, '/') == NULL)) {
+					snprintf(data->shmname, sizeof(data->shmname), "%s", value);
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%s'", name, data->shmname);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_SHMSIZE) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_SHMSIZE) && (tmp <= OSPDB_MAX_SHMSIZE)) {
+					data->shmsize = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->shmsize);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_PEERLISTEN) == 0) {
+				if (osppeer_parseaddr(value, &data->peerlisten) == ISC_R_SUCCESS) {
+					data->peeron = ISC_TRUE;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%s'", name, value);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_PEERS) == 0) {
+				/* address:port[,address:port...] */
+				data->peernum = 0;
+				for (item = strtok_r(value, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+					if ((data->peernum >= OSPPEER_MAX_PEERS) ||
+						(osppeer_parseaddr(item, &data->peeraddr[data->peernum]) != ISC_R_SUCCESS))
+					{
+						data->peernum = 0;
+						break;
+					}
+					data->peernum++;
+				}
+				if (data->peernum != 0) {
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d' peers", name, data->peernum);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, argv[i] + strlen(name) + 1);
+				}
+			} else if (strcmp(name, OSPDB_NAME_PEERSECRET) == 0) {
+				snprintf(data->peersecret, sizeof(data->peersecret), "%s", value);
+				OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%s'", name, "set");
+			} else if (strcmp(name, OSPDB_NAME_PURGELISTEN) == 0) {
+				if (osppeer_parseaddr(value, &data->purgelisten) == ISC_R_SUCCESS) {
+					data->purgeon = ISC_TRUE;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%s'", name, value);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_PURGESECRET) == 0) {
+				snprintf(data->purgesecret, sizeof(data->purgesecret), "%s", value);
+				OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%s'", name, "set");
+			} else if (strcmp(name, OSPDB_NAME_REPLICAFILE) == 0) {
+				snprintf(data->replicafile, sizeof(data->replicafile), "%s", value);
+				OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%s'", name, data->replicafile);
+			} else if (strcmp(name, OSPDB_NAME_REPLICADELTA) == 0) {
+				snprintf(data->replicadelta, sizeof(data->replicadelta), "%s", value);
+				OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%s'", name, data->replicadelta);
+			} else if (strcmp(name, OSPDB_NAME_REPLICAINTERVAL) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_REPLICAINTERVAL) && (tmp <= OSPDB_MAX_REPLICAINTERVAL)) {
+					data->replicainterval = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->replicainterval);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_LNPFILE) == 0) {
+				snprintf(data->lnpfile, sizeof(data->lnpfile), "%s", value);
+				OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%s'", name, data->lnpfile);
+			} else if (strcmp(name, OSPDB_NAME_LNPINTERVAL) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_LNPINTERVAL) && (tmp <= OSPDB_MAX_LNPINTERVAL)) {
+					data->lnpinterval = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->lnpinterval);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_RULESFILE) == 0) {
+				snprintf(data->rulesfile, sizeof(data->rulesfile), "%s", value);
+				OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%s'", name, data->rulesfile);
+			} else if (strcmp(name, OSPDB_NAME_RULESINTERVAL) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_RULESINTERVAL) && (tmp <= OSPDB_MAX_RULESINTERVAL)) {
+					data->rulesinterval = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->rulesinterval);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_RESPCACHESIZE) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_RESPCACHESIZE) && (tmp <= OSPDB_MAX_RESPCACHESIZE)) {
+					data->respcachesize = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->respcachesize);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
+			} else if (strcmp(name, OSPDB_NAME_RESPCACHETTL) == 0) {
+				tmp = atoi(value);
+				if ((tmp >= OSPDB_MIN_RESPCACHETTL) && (tmp <= OSPDB_MAX_RESPCACHETTL)) {
+					data->respcachettl = tmp;
+					OSPDB_LOG(ISC_LOG_DEBUG(2), "%s = '%d'", name, data->respcachettl);
+				} else {
+					OSPDB_LOG(ISC_LOG_WARNING, "Wrong %s value '%s'", name, value);
+				}
 			} else {
 				OSPDB_LOG(ISC_LOG_WARNING, "Wrong parameter name '%s'", name);
 			}
@@ -494,6 +1119,37 @@ static isc_boolean_t ospdb_check_config(
 		snprintf(data->nidname, sizeof(data->nidname), "%s", OSPDB_DEF_NIDNAME);
 	}
 
+	if (data->cacheminttl > data->cachemaxttl) {
+		OSPDB_LOG(ISC_LOG_WARNING, "%s '%d' larger than %s '%d'", OSPDB_NAME_CACHEMINTTL, data->cacheminttl, OSPDB_NAME_CACHEMAXTTL, data->cachemaxttl);
+		data->cacheminttl = data->cachemaxttl;
+	}
+
+	if ((data->servestale != 0) && (data->cachesize == 0)) {
+		OSPDB_LOG(ISC_LOG_WARNING, "%s requires %s, disabled", OSPDB_NAME_SERVESTALE, OSPDB_NAME_CACHESIZE);
+		data->servestale = 0;
+	}
+
+	if ((data->prefetch != 0) && (data->cachesize == 0)) {
+		OSPDB_LOG(ISC_LOG_WARNING, "%s requires %s, disabled", OSPDB_NAME_PREFETCH, OSPDB_NAME_CACHESIZE);
+		data->prefetch = 0;
+	}
+
+	/* A prefix route is shared by every caller and source, so it needs a called number only cache key */
+	if ((data->prefixnum != 0) && ((data->cachesize == 0) || (data->cachekey != OSPDB_CACHEKEY_CALLED))) {
+		OSPDB_LOG(ISC_LOG_WARNING, "%s requires %s and %s '%s', disabled", OSPDB_NAME_PREFIXSCOPE, OSPDB_NAME_CACHESIZE, OSPDB_NAME_CACHEKEY, OSPDB_VALUE_CALLED);
+		data->prefixnum = 0;
+	}
+
+	if ((data->snapshotfile[0] != '\0') && (data->cachesize == 0)) {
+		OSPDB_LOG(ISC_LOG_WARNING, "%s requires %s, disabled", OSPDB_NAME_SNAPSHOTFILE, OSPDB_NAME_CACHESIZE);
+		data->snapshotfile[0] = '\0';
+	}
+
+	if ((data->replicadelta[0] != '\0') && (data->replicafile[0] == '\0')) {
+		OSPDB_LOG(ISC_LOG_WARNING, "%s requires %s, disabled", OSPDB_NAME_REPLICADELTA, OSPDB_NAME_REPLICAFILE);
+		data->replicadelta[0] = '\0';
+	}
+
 	OSPDB_LOG_END;
 
 	return result;
@@ -541,6 +1197,42 @@ static void ospdb_dump_config(
 	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_NIDLOCATION, data->nidlocation);
 	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%s'", OSPDB_NAME_NIDNAME, data->nidname);
 	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_USERPHONE, data->userphone);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_MAXINFLIGHT, data->maxinflight);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_CACHESIZE, data->cachesize);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_CACHEMINTTL, data->cacheminttl);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_CACHEMAXTTL, data->cachemaxttl);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%u'", OSPDB_NAME_CACHEKEY, data->cachekey);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_NEGCACHESIZE, data->negcachesize);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_NEGCACHETTL, data->negcachettl);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_SERVESTALE, data->servestale);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_STALEDEADLINE, data->staledeadline);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_STALETTL, data->stalettl);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_REFRESHTHREADS, data->refreshthreads);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_PREFETCH, data->prefetch);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_PREFETCHHITS, data->prefetchhits);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_PREFETCHRATE, data->prefetchrate);
+	for (i = 0; i < data->prefixnum; i++) {
+		OSPDB_LOG(ISC_LOG_DEBUG(1), "%s[%d] = '%s:%d'", OSPDB_NAME_PREFIXSCOPE, i, data->prefixrule[i].prefix, data->prefixrule[i].length);
+	}
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_PREFIXENTRIES, data->prefixentries);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%s'", OSPDB_NAME_SNAPSHOTFILE, data->snapshotfile);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_SNAPSHOTINTERVAL, data->snapshotinterval);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%s'", OSPDB_NAME_SHMNAME, data->shmname);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_SHMSIZE, data->shmsize);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%s'", OSPDB_NAME_PEERLISTEN, (data->peeron == ISC_TRUE) ? "on" : "off");
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d' peers", OSPDB_NAME_PEERS, data->peernum);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%s'", OSPDB_NAME_PEERSECRET, (data->peersecret[0] != '\0') ? "set" : "none");
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%s'", OSPDB_NAME_PURGELISTEN, (data->purgeon == ISC_TRUE) ? "on" : "off");
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%s'", OSPDB_NAME_PURGESECRET, (data->purgesecret[0] != '\0') ? "set" : "none");
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%s'", OSPDB_NAME_REPLICAFILE, data->replicafile);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%s'", OSPDB_NAME_REPLICADELTA, data->replicadelta);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_REPLICAINTERVAL, data->replicainterval);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%s'", OSPDB_NAME_LNPFILE, data->lnpfile);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_LNPINTERVAL, data->lnpinterval);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%s'", OSPDB_NAME_RULESFILE, data->rulesfile);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_RULESINTERVAL, data->rulesinterval);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_RESPCACHESIZE, data->respcachesize);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "%s = '%d'", OSPDB_NAME_RESPCACHETTL, data->respcachettl);
 
 	OSPDB_LOG_END;
 }
@@ -687,6 +1379,294 @@ static void ospdb_delete_provider(
 	OSPDB_LOG_END;
 }
 
+/*
+ * Hash configuration, FNV-1a
+ * param cfg Configuration
+ * param size Configuration size
+ * return Hash value
+ */
+static unsigned int ospdb_hash_config(
+	const void *cfg,
+	size_t size)
+{
+	const unsigned char *byte = cfg;
+	unsigned int hash = 2166136261U;
+
+	while (size-- > 0) {
+		hash ^= *byte++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/*
+ * Find shared object, shared lock must be held
+ * param kind Object kind
+ * param zone Zone name
+ * param cfg Configuration
+ * param size Configuration size
+ * param hash Configuration hash
+ * return Shared object or NULL
+ */
+static ospdb_shared_t *ospdb_find_shared(
+	int kind,
+	const char *zone,
+	const void *cfg,
+	size_t size,
+	unsigned int hash)
+{
+	ospdb_shared_t *shared;
+
+	for (shared = ISC_LIST_HEAD(ospdb_sharedlist); shared != NULL; shared = ISC_LIST_NEXT(shared, link)) {
+		if ((shared->kind == kind) && (shared->hash == hash) && (strcmp(shared->zone, zone) == 0) && (memcmp(&shared->cfg, cfg, size) == 0)) {
+			break;
+		}
+	}
+
+	return shared;
+}
+
+/*
+ * Add shared object, shared lock must be held
+ * param kind Object kind
+ * param zone Zone name
+ * param cfg Configuration
+ * param size Configuration size
+ * param hash Configuration hash
+ * return Shared object with one reference or NULL
+ */
+static ospdb_shared_t *ospdb_add_shared(
+	int kind,
+	const char *zone,
+	const void *cfg,
+	size_t size,
+	unsigned int hash)
+{
+	ospdb_shared_t *shared;
+
+	if ((shared = isc_mem_get(ns_g_mctx, sizeof(*shared))) != NULL) {
+		memset(shared, 0, sizeof(*shared));
+		shared->kind = kind;
+		snprintf(shared->zone, sizeof(shared->zone), "%s", zone);
+		shared->hash = hash;
+		memcpy(&shared->cfg, cfg, size);
+		shared->refs = 1;
+		ISC_LINK_INIT(shared, link);
+		ISC_LIST_APPEND(ospdb_sharedlist, shared, link);
+	}
+
+	return shared;
+}
+
+/*
+ * Drop a reference to a shared object, the last one unlinks it
+ * param shared Shared object
+ * return ISC_TRUE last reference, caller frees the object, ISC_FALSE still in use
+ */
+static isc_boolean_t ospdb_release_shared(
+	ospdb_shared_t *shared)
+{
+	isc_boolean_t last = ISC_FALSE;
+
+	LOCK(&ospdb_sharedlock);
+	INSIST(shared->refs > 0);
+	if (--shared->refs == 0) {
+		ISC_LIST_UNLINK(ospdb_sharedlist, shared, link);
+		last = ISC_TRUE;
+	}
+	UNLOCK(&ospdb_sharedlock);
+
+	return last;
+}
+
+/*
+ * Attach OSP provider, the provider of a running instance of the zone with the same configuration is adopted with its
+ * HTTP connections
+ * param zone Zone name
+ * param cfg Configuration parameter structure, zeroed before it was filled
+ * param data Running data structure
+ * return ISC_R_SUCCESS successful, other failed
+ */
+static isc_result_t ospdb_attach_provider(
+	const char *zone,
+	ospdb_config_t *cfg,
+	ospdb_data_t *data)
+{
+	ospdb_shared_t *shared;
+	unsigned int hash;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	OSPDB_LOG_START;
+
+	hash = ospdb_hash_config(cfg, sizeof(*cfg));
+
+	/* Creating a provider is not fast, but zones are only created by loads and reloads */
+	LOCK(&ospdb_sharedlock);
+	if ((shared = ospdb_find_shared(OSPDB_SHARED_PROVIDER, zone, cfg, sizeof(*cfg), hash)) != NULL) {
+		shared->refs++;
+		OSPDB_LOG(ISC_LOG_INFO, "Adopted OSP provider of zone '%s'", zone);
+	} else if ((shared = ospdb_add_shared(OSPDB_SHARED_PROVIDER, zone, cfg, sizeof(*cfg), hash)) == NULL) {
+		OSPDB_LOG(ISC_LOG_ERROR, "%s", "Failed to get memory");
+		result = ISC_R_NOMEMORY;
+	} else if ((result = ospdb_create_provider(cfg, &shared->provider)) != ISC_R_SUCCESS) {
+		ISC_LIST_UNLINK(ospdb_sharedlist, shared, link);
+		isc_mem_put(ns_g_mctx, shared, sizeof(*shared));
+		shared = NULL;
+	}
+	if (shared != NULL) {
+		data->sharedprovider = shared;
+		data->provider = shared->provider;
+	}
+	UNLOCK(&ospdb_sharedlock);
+
+	OSPDB_LOG_END;
+
+	return result;
+}
+
+/*
+ * Detach OSP provider, the provider is deleted when no instance uses it
+ * param data Running data structure
+ */
+static void ospdb_detach_provider(
+	ospdb_data_t *data)
+{
+	ospdb_shared_t *shared = data->sharedprovider;
+
+	if (ospdb_release_shared(shared) == ISC_TRUE) {
+		ospdb_delete_provider(shared->provider);
+		isc_mem_put(ns_g_mctx, shared, sizeof(*shared));
+	} else {
+		OSPDB_LOG(ISC_LOG_INFO, "%s", "Keep OSP provider for the new instance of the zone");
+	}
+	data->sharedprovider = NULL;
+}
+
+/*
+ * Get route cache configuration
+ * param data Running data structure
+ * param cachecfg Cache configuration buffer
+ */
+static void ospdb_get_cachecfg(
+	ospdb_data_t *data,
+	ospdb_cachecfg_t *cachecfg)
+{
+	int i;
+
+	/* Zeroed so that configurations compare as bytes */
+	memset(cachecfg, 0, sizeof(*cachecfg));
+	cachecfg->cachesize = data->cachesize;
+	cachecfg->servestale = data->servestale;
+	cachecfg->prefetch = data->prefetch;
+	cachecfg->prefetchhits = data->prefetchhits;
+	cachecfg->cachekey = data->cachekey;
+	cachecfg->prefixnum = data->prefixnum;
+	cachecfg->prefixentries = data->prefixentries;
+	for (i = 0; i < data->prefixnum; i++) {
+		snprintf(cachecfg->prefixrule[i].prefix, sizeof(cachecfg->prefixrule[i].prefix), "%s", data->prefixrule[i].prefix);
+		cachecfg->prefixrule[i].length = data->prefixrule[i].length;
+	}
+	cachecfg->negcachesize = data->negcachesize;
+	/* Cached routes are cut to maxdest and kept with NAPTR records rendered from these */
+	cachecfg->maxdest = data->maxdest;
+	cachecfg->nidlocation = data->nidlocation;
+	snprintf(cachecfg->nidname, sizeof(cachecfg->nidname), "%s", data->nidname);
+	cachecfg->userphone = data->userphone;
+}
+
+/*
+ * Adopt the route and negative caches of a running instance of the zone with the same cache configuration
+ * param zone Zone name
+ * param data Running data structure
+ * return ISC_TRUE adopted, ISC_FALSE not found
+ */
+static isc_boolean_t ospdb_adopt_cache(
+	const char *zone,
+	ospdb_data_t *data)
+{
+	ospdb_cachecfg_t cachecfg;
+	ospdb_shared_t *shared;
+	unsigned int hash;
+
+	ospdb_get_cachecfg(data, &cachecfg);
+	hash = ospdb_hash_config(&cachecfg, sizeof(cachecfg));
+
+	LOCK(&ospdb_sharedlock);
+	if ((shared = ospdb_find_shared(OSPDB_SHARED_CACHE, zone, &cachecfg, sizeof(cachecfg), hash)) != NULL) {
+		shared->refs++;
+		data->sharedcache = shared;
+		data->cache = shared->cache;
+		data->negcache = shared->negcache;
+	}
+	UNLOCK(&ospdb_sharedlock);
+
+	return (shared != NULL) ? ISC_TRUE : ISC_FALSE;
+}
+
+/*
+ * Share new route and negative caches with later instances of the zone, they stay private if this fails
+ * param zone Zone name
+ * param data Running data structure
+ */
+static void ospdb_share_cache(
+	const char *zone,
+	ospdb_data_t *data)
+{
+	ospdb_cachecfg_t cachecfg;
+	ospdb_shared_t *shared;
+	unsigned int hash;
+
+	ospdb_get_cachecfg(data, &cachecfg);
+	hash = ospdb_hash_config(&cachecfg, sizeof(cachecfg));
+
+	LOCK(&ospdb_sharedlock);
+	if ((shared = ospdb_add_shared(OSPDB_SHARED_CACHE, zone, &cachecfg, sizeof(cachecfg), hash)) != NULL) {
+		shared->cache = data->cache;
+		shared->negcache = data->negcache;
+		data->sharedcache = shared;
+	}
+	UNLOCK(&ospdb_sharedlock);
+}
+
+/*
+ * Detach shared route and negative caches, the caches are left to the caller to free when no other instance uses them
+ * param data Running data structure
+ */
+static void ospdb_detach_cache(
+	ospdb_data_t *data)
+{
+	ospdb_shared_t *shared = data->sharedcache;
+
+	if (ospdb_release_shared(shared) == ISC_TRUE) {
+		isc_mem_put(ns_g_mctx, shared, sizeof(*shared));
+	} else {
+		OSPDB_LOG(ISC_LOG_INFO, "%s", "Keep caches for the new instance of the zone");
+		data->cache = NULL;
+		data->negcache = NULL;
+	}
+	data->sharedcache = NULL;
+}
+
+/*
+ * Check if no other instance uses the route cache
+ * param data Running data structure
+ * return ISC_TRUE only user, ISC_FALSE shared
+ */
+static isc_boolean_t ospdb_own_cache(
+	ospdb_data_t *data)
+{
+	isc_boolean_t own = ISC_TRUE;
+
+	if (data->sharedcache != NULL) {
+		LOCK(&ospdb_sharedlock);
+		own = (data->sharedcache->refs == 1) ? ISC_TRUE : ISC_FALSE;
+		UNLOCK(&ospdb_sharedlock);
+	}
+
+	return own;
+}
+
 /*
  * Parse SIP/SIPS URI
  * param secure SIP or SIPS
@@ -871,65 +1851,112 @@ static void ospdb_convert_toin(
 }
 
 /*
- * Check domain of ENUM query
- * param domain Domain name
- * return ISC_R_SUCCESS successful, ISC_R_FAILURE failed
+ * Check if a domain name is the name server name, one label "ns"
+ * param name Domain name relative to the zone
+ * return ISC_TRUE name server name, ISC_FALSE otherwise
  */
-static isc_result_t ospdb_check_domain(
-	const char *domain)
+static isc_boolean_t ospdb_is_nsname(
+	const dns_name_t *name)
 {
-	int i, size = strlen(domain);
-	isc_result_t result = ISC_R_SUCCESS;
+	isc_region_t region;
+	isc_boolean_t isns = ISC_FALSE;
+
+	dns_name_toregion((dns_name_t *)name, &region);
+
+	if ((dns_name_countlabels(name) == 1) &&
+		(region.length == 3) &&
+		(region.base[0] == 2) &&
+		(tolower(region.base[1]) == 'n') &&
+		(tolower(region.base[2]) == 's'))
+	{
+		isns = ISC_TRUE;
+	}
 
-	OSPDB_LOG_START;
+	return isns;
+}
 
-	for (i = 0; i < size; i++) {
-		if (i % 2) {
-			if (domain[i] != '.') {
-				result = ISC_R_FAILURE;
-			}
-		} else {
-			if ((domain[i] < '0') || (domain[i] > '9')) {
+/*
+ * Convert ENUM domain name to called number in one pass over its wire labels
+ * param name Domain name relative to the zone
+ * param buf Destination buffer
+ * param bufsize Size of buffer
+ * return ISC_R_SUCCESS successful, ISC_R_FAILURE not an ENUM name, ISC_R_NOSPACE number too long
+ */
+static isc_result_t ospdb_convert_name(
+	const dns_name_t *name,
+	char *buf,
+	int bufsize)
+{
+	isc_region_t region;
+	unsigned int labels = dns_name_countlabels(name);
+	unsigned int i;
+	unsigned char *label;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	OSPDB_LOG_START;
+
+	dns_name_toregion((dns_name_t *)name, &region);
+
+	/* The root label of an absolute name carries no digit */
+	if (dns_name_isabsolute(name)) {
+		labels--;
+	}
+
+	if (labels == 0) {
+		result = ISC_R_FAILURE;
+	} else if (labels >= (unsigned int)bufsize) {
+		result = ISC_R_NOSPACE;
+	} else {
+		/* Every label is one digit, so label i starts at byte 2 * i and holds digit labels - 1 - i */
+		for (i = 0; (i < labels) && (result == ISC_R_SUCCESS); i++) {
+			label = region.base + i * 2;
+			if ((label[0] != 1) || (label[1] < '0') || (label[1] > '9')) {
 				result = ISC_R_FAILURE;
+			} else {
+				buf[labels - 1 - i] = label[1];
 			}
 		}
 	}
 
+	if (result == ISC_R_SUCCESS) {
+		buf[labels] = '\0';
+		OSPDB_LOG(ISC_LOG_DEBUG(2), "Number = '%s'", buf);
+	} else {
+		*buf = '\0';
+	}
+
 	OSPDB_LOG_END;
 
 	return result;
 }
 
 /*
- * Convert ENUM domain name to called number
- * param domain ENUM domain
- * param buf Destination buffer
- * param bufsize Size of buffer
+ * Convert OSP timestamp to time
+ * param timestamp Timestamp string, "YYYY-MM-DDThh:mm:ssZ"
+ * return Seconds since the epoch, 0 for unknown
  */
-static void ospdb_convert_domain(
-	const char *domain,
-	char *buf,
-	int bufsize)
+static isc_stdtime_t ospdb_convert_timestamp(
+	const char *timestamp)
 {
-	char *h = buf;
-	const char *p = domain + strlen(domain) - 1;
-	int size = bufsize;
-
-	OSPDB_LOG_START;
-
-	while ((size > 1) && (p >= domain)) {
-		if (*p != '.') {
-			*h = *p;
-			h++;
-			size--;
+	int year, month, day, hour, minute, second;
+	int era, yoe, doy, doe;
+	long days;
+	isc_stdtime_t result = 0;
+
+	if (sscanf(timestamp, "%4d-%2d-%2dT%2d:%2d:%2d", &year, &month, &day, &hour, &minute, &second) == 6) {
+		/* Days since 1970-01-01 in the proleptic Gregorian calendar */
+		year -= (month <= 2) ? 1 : 0;
+		era = year / 400;
+		yoe = year - era * 400;
+		doy = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1;
+		doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+		days = (long)era * 146097 + doe - 719468;
+		if (days >= 0) {
+			result = (isc_stdtime_t)(days * 86400 + hour * 3600 + minute * 60 + second);
 		}
-		p--;
 	}
-	*h = '\0';
 
-	OSPDB_LOG(ISC_LOG_DEBUG(2), "Number = '%s'", buf);
-
-	OSPDB_LOG_END;
+	return result;
 }
 
 /*
@@ -945,8 +1972,6 @@ static isc_result_t ospdb_request_auth(
 	unsigned int *destnum)
 {
 	char source[OSPDB_STR_SIZE];
-	char srcdev[OSPDB_STR_SIZE];
-	char called[OSPDB_STR_SIZE];
 	struct timeval ts, te, td;
 	unsigned int logsize = 0;
 	int error = OSPC_ERR_NO_ERROR;
@@ -957,16 +1982,15 @@ static isc_result_t ospdb_request_auth(
 	/* Set service type */
 	OSPPTransactionSetServiceType(transaction, OSPC_SERVICE_VOICE);
 
-	ospdb_convert_toout(query->serverip, source, sizeof(source));
-	if (query->srcurihost[0] != '\0') {
-		ospdb_convert_toout(query->srcurihost, srcdev, sizeof(srcdev));
-	} else {
-		ospdb_convert_toout(query->clientip, srcdev, sizeof(srcdev));
+	/* The number has been dipped locally */
+	if (query->nprn[0] != '\0') {
+		OSPPTransactionSetNumberPortability(transaction, query->nprn, query->npcic, 1);
 	}
-	ospdb_convert_domain(query->name, called, sizeof(called));
+
+	ospdb_convert_toout(query->serverip, source, sizeof(source));
 
 	/* Log AuthReq info */
-	OSPDB_LOG(ISC_LOG_DEBUG(1), "AuthReq source '%s' srcdev '%s' called '%s' calling '%s' destnum '%d'", source, srcdev, called, query->srcuriuser, *destnum);
+	OSPDB_LOG(ISC_LOG_DEBUG(1), "AuthReq source '%s' srcdev '%s' called '%s' calling '%s' destnum '%d'", source, query->srcdev, query->called, query->srcuriuser, *destnum);
 
 	/* Get AuthReq start time */
 	gettimeofday(&ts, NULL);
@@ -975,10 +1999,10 @@ static isc_result_t ospdb_request_auth(
 	error = OSPPTransactionRequestAuthorisation(
 		transaction,		/* Transaction handle */
 		source,				/* BIND server address */
-		srcdev,				/* Source device or ENUM client address */
+		query->srcdev,		/* Source device or ENUM client address */
 		query->srcuriuser,	/* Calling number */
 		OSPC_NFORMAT_E164,	/* Calling number format */
-		called,				/* Called number */
+		query->called,		/* Called number */
 		OSPC_NFORMAT_E164,	/* Called number format */
 		NULL,				/* Username string, used if no number */
 		0,					/* Number of call IDs */
@@ -995,15 +2019,15 @@ static isc_result_t ospdb_request_auth(
 	timersub(&te, &ts, &td);
 
 	/* Log AuthReq cost info */
-	OSPDB_LOG(ISC_LOG_DEBUG(2), "AuthReq for %s cost = '%lu.%06lu'", called, td.tv_sec, td.tv_usec);
+	OSPDB_LOG(ISC_LOG_DEBUG(2), "AuthReq for %s cost = '%lu.%06lu'", query->called, td.tv_sec, td.tv_usec);
 
 	if (error == OSPC_ERR_NO_ERROR) {
-		if (destnum == 0) {
-			OSPDB_LOG(ISC_LOG_DEBUG(1), "Without any route for %s", called);
+		if (*destnum == 0) {
+			OSPDB_LOG(ISC_LOG_DEBUG(1), "Without any route for %s", query->called);
 			result = ISC_R_NOMORE;
 		}
 	} else {
-		OSPDB_LOG(ISC_LOG_DEBUG(1), "Unable to request auth for %s, error %d", called, error);
+		OSPDB_LOG(ISC_LOG_DEBUG(1), "Unable to request auth for %s, error %d", query->called, error);
 		switch (error) {
 		case OSPC_ERR_TRAN_UNAUTHORIZED:
 		case OSPC_ERR_TRAN_ROUTE_BLOCKED:
@@ -1139,7 +2163,8 @@ static isc_result_t ospdb_get_first(
 	ospdb_response_t *response)
 {
 	int error = OSPC_ERR_NO_ERROR;
-	unsigned int timelimit;
+	char validafter[OSPDB_TS_SIZE];
+	char validuntil[OSPDB_TS_SIZE];
 	unsigned int callidlen = 0;
 	char dest[OSPDB_STR_SIZE];
 	unsigned int tokenlen = 0;
@@ -1147,12 +2172,13 @@ static isc_result_t ospdb_get_first(
 
 	OSPDB_LOG_START;
 
+	validuntil[0] = '\0';
 	error = OSPPTransactionGetFirstDestination(
 		transaction,				/* Transaction handle */
-		0,							/* Size of timestamp buffer */
-		NULL,						/* Valid after timestamp buffer */
-		NULL,						/* Valid until timestamp buffer */
-		&timelimit,					/* Call duration limit */
+		sizeof(validuntil),			/* Size of timestamp buffer */
+		validafter,					/* Valid after timestamp buffer */
+		validuntil,					/* Valid until timestamp buffer */
+		&response->timelimit,		/* Call duration limit */
 		&callidlen,					/* Size of call ID buffer */
 		NULL,						/* Call ID buffer */
 		sizeof(response->called),	/* Size of called number buffer */
@@ -1167,6 +2193,7 @@ static isc_result_t ospdb_get_first(
 		NULL);						/* Token buffer */
 	if (error == OSPC_ERR_NO_ERROR) {
 		response->count = 1;
+		response->validuntil = ospdb_convert_timestamp(validuntil);
 		ospdb_convert_toin(dest, response->dest, sizeof(response->dest));
 		result = ospdb_check_route(transaction, response);
 	} else {
@@ -1191,7 +2218,8 @@ static isc_result_t ospdb_get_next(
 	ospdb_response_t *response)
 {
 	int error = OSPC_ERR_NO_ERROR;
-	unsigned int timelimit;
+	char validafter[OSPDB_TS_SIZE];
+	char validuntil[OSPDB_TS_SIZE];
 	unsigned int callidlen = 0;
 	char called[OSPDB_STR_SIZE];
 	char dest[OSPDB_STR_SIZE];
@@ -1200,26 +2228,28 @@ static isc_result_t ospdb_get_next(
 
 	OSPDB_LOG_START;
 
+	validuntil[0] = '\0';
 	error = OSPPTransactionGetNextDestination(
-		transaction,	/* Transaction handle */
-		0,				/* Reason */
-		0,				/* Size of timestamp buffer */
-		NULL,			/* Valid after timestamp buffer */
-		NULL,			/* Valid until timestamp buffer */
-		&timelimit,		/* Call duration limit */
-		&callidlen,		/* Size of call ID buffer */
-		NULL,			/* Call ID buffer */
-		sizeof(called),	/* Size of called number buffer */
-		called,			/* Called number buffer */
-		0,				/* Size of calling number buffer */
-		NULL,			/* Calling number buffer */
-		sizeof(dest),	/* Size of destination buffer */
-		dest,			/* Destination buffer */
-		0,				/* Size of destination device buffer */
-		NULL,			/* Destination device buffer */
-		&tokenlen,		/* Size of token buffer */
-		NULL);			/* Token buffer */
+		transaction,			/* Transaction handle */
+		0,						/* Reason */
+		sizeof(validuntil),		/* Size of timestamp buffer */
+		validafter,				/* Valid after timestamp buffer */
+		validuntil,				/* Valid until timestamp buffer */
+		&response->timelimit,	/* Call duration limit */
+		&callidlen,				/* Size of call ID buffer */
+		NULL,					/* Call ID buffer */
+		sizeof(called),			/* Size of called number buffer */
+		called,					/* Called number buffer */
+		0,						/* Size of calling number buffer */
+		NULL,					/* Calling number buffer */
+		sizeof(dest),			/* Size of destination buffer */
+		dest,					/* Destination buffer */
+		0,						/* Size of destination device buffer */
+		NULL,					/* Destination device buffer */
+		&tokenlen,				/* Size of token buffer */
+		NULL);					/* Token buffer */
 	if (error == OSPC_ERR_NO_ERROR) {
+		response->validuntil = ospdb_convert_timestamp(validuntil);
 		ospdb_convert_toin(dest, response->dest, sizeof(response->dest));
 		result = ospdb_check_route(transaction, response);
 	} else {
@@ -1233,17 +2263,189 @@ static isc_result_t ospdb_get_next(
 }
 
 /*
- * Build response record
+ * Copy destination into route
+ * param response Response info
+ * param dest Route destination buffer
+ * return ISC_R_SUCCESS successful, ISC_R_NOSPACE destination too long, left out of the route
+ */
+static isc_result_t ospdb_copy_dest(
+	ospdb_response_t *response,
+	ospcache_dest_t *dest)
+{
+	isc_result_t result = ISC_R_SUCCESS;
+
+	OSPDB_LOG_START;
+
+	if ((strlen(response->called) >= sizeof(dest->called)) ||
+		(strlen(response->dest) >= sizeof(dest->dest)) ||
+		(strlen(response->dnid) >= sizeof(dest->dnid)) ||
+		(strlen(response->nprn) >= sizeof(dest->nprn)) ||
+		(strlen(response->npcic) >= sizeof(dest->npcic)))
+	{
+		OSPDB_LOG(ISC_LOG_WARNING, "Destination %d too long, skipped", response->count);
+		result = ISC_R_NOSPACE;
+	} else {
+		dest->protocol = response->protocol;
+		dest->npdi = response->npdi;
+		snprintf(dest->called, sizeof(dest->called), "%s", response->called);
+		snprintf(dest->dest, sizeof(dest->dest), "%s", response->dest);
+		snprintf(dest->dnid, sizeof(dest->dnid), "%s", response->dnid);
+		snprintf(dest->nprn, sizeof(dest->nprn), "%s", response->nprn);
+		snprintf(dest->npcic, sizeof(dest->npcic), "%s", response->npcic);
+	}
+
+	OSPDB_LOG_END;
+
+	return result;
+}
+
+/*
+ * Get route TTL
  * param data Running data structure
- * param response Response data structure
- * param record Record buffer
- * param recsize Record buffer size
+ * param validuntil Valid until time, 0 for unknown
+ * param timelimit Call duration limit, 0 for unlimited
+ * param now Current time
+ * return TTL in seconds, 0 for not cacheable
  */
-static void ospdb_build_record(
+static unsigned int ospdb_get_ttl(
 	ospdb_data_t *data,
-	ospdb_response_t *response,
-	char *record,
-	int recsize)
+	isc_stdtime_t validuntil,
+	unsigned int timelimit,
+	isc_stdtime_t now)
+{
+	unsigned int ttl = data->cachemaxttl;
+
+	if (validuntil != 0) {
+		if (validuntil <= now) {
+			ttl = 0;
+		} else if (validuntil - now < ttl) {
+			ttl = validuntil - now;
+		}
+	}
+
+	if ((timelimit != 0) && (timelimit < ttl)) {
+		ttl = timelimit;
+	}
+
+	if (ttl < (unsigned int)data->cacheminttl) {
+		ttl = data->cacheminttl;
+	}
+
+	return ttl;
+}
+
+/*
+ * Query route from OSP server
+ * param data Running data structure
+ * param query Query info
+ * param route Route buffer
+ * param now Current time
+ * param ttl Route TTL buffer
+ * return ISC_R_SUCCESS successful, ISC_R_NOPERM unauth or blocked, ISC_R_NOTFOUND not found, ISC_R_FAILURE failed, ISC_R_NOMORE without route
+ */
+static isc_result_t ospdb_query_route(
+	ospdb_data_t *data,
+	ospdb_query_t *query,
+	ospcache_route_t *route,
+	isc_stdtime_t now,
+	unsigned int *ttl)
+{
+	int error = OSPC_ERR_NO_ERROR;
+	OSPTTRANHANDLE transaction;
+	ospdb_response_t response;
+	unsigned int destttl;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	OSPDB_LOG_START;
+
+	route->count = 0;
+	*ttl = data->cachemaxttl;
+
+	if ((error = OSPPTransactionNew(data->provider, &transaction)) == OSPC_ERR_NO_ERROR) {
+		response.total = data->maxdest;
+		if ((result = ospdb_request_auth(transaction, query, &response.total)) == ISC_R_SUCCESS) {
+			result = ospdb_get_first(transaction, &response);
+			while (result == ISC_R_SUCCESS) {
+				/* A destination that does not fit the route buffers is left out, the others are still answered */
+				if (ospdb_copy_dest(&response, &route->dest[route->count]) == ISC_R_SUCCESS) {
+					route->count++;
+
+					/* A route is only as fresh as its shortest lived destination */
+					destttl = ospdb_get_ttl(data, response.validuntil, response.timelimit, now);
+					if (destttl < *ttl) {
+						*ttl = destttl;
+					}
+				}
+
+				if (((unsigned int)response.count >= response.total) || (route->count >= OSPCACHE_MAX_DEST)) {
+					break;
+				}
+				response.count++;
+				result = ospdb_get_next(transaction, &response);
+			}
+
+			if ((result == ISC_R_SUCCESS) && (route->count == 0)) {
+				result = ISC_R_NOMORE;
+			}
+		}
+
+		if (transaction != OSPC_TRAN_HANDLE_INVALID) {
+			OSPPTransactionDelete(transaction);
+		}
+	} else {
+		OSPDB_LOG(ISC_LOG_ERROR, "Failed to create transaction, error %d", error);
+		result = ISC_R_FAILURE;
+	}
+
+	OSPDB_LOG_END;
+
+	return result;
+}
+
+/*
+ * Build cache key
+ * param data Running data structure
+ * param query Query info
+ * param key Key buffer
+ * param keysize Key buffer size
+ * return ISC_R_SUCCESS successful, ISC_R_NOSPACE key too long
+ */
+static isc_result_t ospdb_build_key(
+	ospdb_data_t *data,
+	ospdb_query_t *query,
+	char *key,
+	int keysize)
+{
+	int length;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	/* Ported numbers share routes by LRN, marked so that they never mix with routes of the LRN itself */
+	length = snprintf(key, keysize, "%s|%s|%s%s",
+		query->routing,
+		((data->cachekey & OSPDB_CACHEKEY_CALLING) != 0) ? query->srcuriuser : "",
+		((data->cachekey & OSPDB_CACHEKEY_SOURCE) != 0) ? query->srcdev : "",
+		(query->nprn[0] != '\0') ? "|rn" : "");
+	if ((length < 0) || (length >= keysize)) {
+		result = ISC_R_NOSPACE;
+	}
+
+	return result;
+}
+
+/*
+ * Build NAPTR service protocol and regular expression, shaped by network ID location and name and user=phone
+ * param data Running data structure
+ * param dest Destination info
+ * param protocolp Protocol name buffer
+ * param regexp Regular expression buffer
+ * param regsize Regular expression buffer size
+ */
+static void ospdb_build_regexp(
+	ospdb_data_t *data,
+	ospcache_dest_t *dest,
+	const char **protocolp,
+	char *regexp,
+	int regsize)
 {
 	const char *protocol;
 	char userinfo[OSPDB_STR_SIZE];
@@ -1253,7 +2455,7 @@ static void ospdb_build_record(
 
 	OSPDB_LOG_START;
 
-	switch (response->protocol) {
+	switch (dest->protocol) {
 	case OSPC_PROTNAME_Q931:
 		protocol = OSPDB_PROTOCOL_H323;
 		break;
@@ -1265,33 +2467,33 @@ static void ospdb_build_record(
 
 	head = userinfo;
 	size = sizeof(userinfo);
-	length = snprintf(head, size, "%s", response->called);
+	length = snprintf(head, size, "%s", dest->called);
 	head += length;
 	size -= length;
-	if (response->nprn[0] != '\0') {
-		length = snprintf(head, size, ";rn=%s", response->nprn);
+	if (dest->nprn[0] != '\0') {
+		length = snprintf(head, size, ";rn=%s", dest->nprn);
 		head += length;
 		size -= length;
 	}
-	if (response->npcic[0]) {
-		length = snprintf(head, size, ";cic=%s", response->npcic);
+	if (dest->npcic[0]) {
+		length = snprintf(head, size, ";cic=%s", dest->npcic);
 		head += length;
 		size -= length;
 	}
-	if (response->npdi) {
+	if (dest->npdi) {
 		length = snprintf(head, size, ";npdi");
 		head += length;
 		size -= length;
 	}
-	if ((data->nidlocation == 1) && (response->dnid[0] != '\0')) {
-		length = snprintf(head, size, ";%s=%s", data->nidname, response->dnid);
+	if ((data->nidlocation == 1) && (dest->dnid[0] != '\0')) {
+		length = snprintf(head, size, ";%s=%s", data->nidname, dest->dnid);
 	}
 
 	head = parameters;
 	size = sizeof(parameters);
 	head[0] = '\0';
-	if ((data->nidlocation == 2) && (response->dnid[0] != '\0')) {
-		length = snprintf(head, size, ";%s=%s", data->nidname, response->dnid);
+	if ((data->nidlocation == 2) && (dest->dnid[0] != '\0')) {
+		length = snprintf(head, size, ";%s=%s", data->nidname, dest->dnid);
 		head += length;
 		size -= length;
 	}
@@ -1299,224 +2501,1989 @@ static void ospdb_build_record(
 		snprintf(head, size, ";user=phone");
 	}
 
-	snprintf(record, recsize, "%d %d \"U\" \"E2U+%s\" \"!^.*$!%s:%s@%s%s!\" .", response->count * 10, 0, protocol, protocol, userinfo, response->dest, parameters);
-
-	OSPDB_LOG(ISC_LOG_DEBUG(2), "Record = '%s'", record);
+	snprintf(regexp, regsize, "!^.*$!%s:%s@%s%s!", protocol, userinfo, dest->dest, parameters);
+	*protocolp = protocol;
 
 	OSPDB_LOG_END;
 }
 
 /*
- * Lookup call back function
+ * Append a DNS character string
+ * param wire Buffer
+ * param size Buffer size
+ * param length Used length, updated
+ * param str String
+ * return ISC_R_SUCCESS successful, ISC_R_NOSPACE buffer too small or string longer than 255
  */
-#ifdef DNS_CLIENTINFO_VERSION
-static isc_result_t ospdb_lookup(
-	const char *zone,
-	const char *name,
-	void *dbdata,
-	dns_sdblookup_t *lookup,
-	dns_clientinfomethods_t *methods,
-	dns_clientinfo_t *clientinfo)
-#else
-static isc_result_t ospdb_lookup(
-	const char *zone,
-	const char *name,
-	void *dbdata,
-	dns_sdblookup_t *lookup)
-#endif /* DNS_CLIENTINFO_VERSION */
+static isc_result_t ospdb_put_charstr(
+	unsigned char *wire,
+	size_t size,
+	size_t *length,
+	const char *str)
 {
-#ifdef DNS_CLIENTINFO_VERSION
-	ns_client_t *client;
-	isc_sockaddr_t *address;
-	int length;
-	char srcuribuf[OSPDB_STR_SIZE];
-#endif /* DNS_CLIENTINFO_VERSION */
-	ospdb_data_t *data = dbdata;
-	int error = OSPC_ERR_NO_ERROR;
-	OSPTTRANHANDLE transaction;
-	ospdb_query_t query;
-	char clientip[OSPDB_STR_SIZE];
-	char srcuriuser[OSPDB_STR_SIZE];
-	char srcurihost[OSPDB_STR_SIZE];
-	unsigned int index;
-	ospdb_response_t response;
-	char record[OSPDB_STR_SIZE];
-	isc_result_t result = ISC_R_SUCCESS;
+	size_t strlength = strlen(str);
 
-	UNUSED(zone);
-	UNUSED(lookup);
+	if ((strlength > 255) || (*length + 1 + strlength > size)) {
+		return ISC_R_NOSPACE;
+	}
 
-	OSPDB_LOG_START;
+	wire[(*length)++] = (unsigned char)strlength;
+	memcpy(wire + *length, str, strlength);
+	*length += strlength;
 
-	if (strcmp(name, "@") == 0) {
-		/* If authority() is not defined, issue RR for SOA and for NS here. */
-		OSPDB_LOG(ISC_LOG_DEBUG(3), "%s", "lookup for '@'");
-	} else if (strcmp(name, "ns") == 0) {
-		/* For ns record */
-		OSPDB_LOG(ISC_LOG_DEBUG(3), "%s", "lookup for 'ns'");
-		result = dns_sdb_putrr(lookup, "A", 0, data->deviceip);
-	} else if (ospdb_check_domain(name) != ISC_R_SUCCESS) {
-		OSPDB_LOG(ISC_LOG_DEBUG(1), "Unsupported domain name '%s'", name);
-		result = ISC_R_NOTFOUND;
-	} else {
-		if ((error = OSPPTransactionNew(data->provider, &transaction)) == OSPC_ERR_NO_ERROR) {
-			/* Get domain name */
-			query.name = name;
+	return ISC_R_SUCCESS;
+}
 
-			/* Get DNS server address */
-			query.serverip = data->deviceip;
+/*
+ * Render a destination as NAPTR rdata in wire format preceded by its 2 byte length, appended to a buffer
+ * param data Running data structure
+ * param count Destination count, starting from 1
+ * param dest Destination info
+ * param wire Buffer
+ * param size Buffer size
+ * param length Used length, updated
+ * return ISC_R_SUCCESS successful, ISC_R_NOSPACE buffer too small or string longer than 255
+ */
+static isc_result_t ospdb_render_dest(
+	ospdb_data_t *data,
+	int count,
+	ospcache_dest_t *dest,
+	unsigned char *wire,
+	size_t size,
+	size_t *length)
+{
+	const char *protocol;
+	char services[OSPDB_STR_SIZE];
+	char regexp[OSPDB_STR_SIZE];
+	size_t used = *length, start;
+	unsigned int order = count * 10;
+	isc_result_t result;
 
-			/* Get DNS client address and source URI info */
-			clientip[0] = '\0';
-			srcuriuser[0] = '\0';
-			srcurihost[0] = '\0';
-#ifdef DNS_CLIENTINFO_VERSION
-			if ((methods != NULL) && ((methods->version - methods->age) >= DNS_CLIENTINFOMETHODS_VERSION)) {
-				methods->sourceip(clientinfo, &address);
-				if (getnameinfo(&address->type.sa, address->length, clientip, sizeof(clientip), NULL, 0, NI_NUMERICHOST) != 0) {
-					clientip[0] = '\0';
-				}
-			}
+	ospdb_build_regexp(data, dest, &protocol, regexp, sizeof(regexp));
+	snprintf(services, sizeof(services), "E2U+%s", protocol);
 
-			if ((data->usesrcuri == ISC_TRUE) && (clientinfo != NULL)) {
-				client = (ns_client_t *)clientinfo->data;
-				if ((client != NULL) && (client->urilen != 0)) {
-					length = client->urilen < sizeof(srcuribuf) ? client->urilen : sizeof(srcuribuf) - 1;
-					memmove(srcuribuf, client->uribuf, length);
-					srcuribuf[length] = '\0';
-					ospdb_parse_uri(srcuribuf, srcuriuser, sizeof(srcuriuser), srcurihost, sizeof(srcurihost));
-				}
-			}
-#endif /* DNS_CLIENTINFO_VERSION */
-			query.clientip = clientip;
-			query.srcuriuser = srcuriuser;
-			query.srcurihost = srcurihost;
-
-			response.total = data->maxdest;
-			if ((result = ospdb_request_auth(transaction, &query, &response.total)) == ISC_R_SUCCESS) {
-				if ((result = ospdb_get_first(transaction, &response)) == ISC_R_SUCCESS) {
-					ospdb_build_record(data, &response, record, sizeof(record));
-					dns_sdb_putrr(lookup, "NAPTR", 0, record);
-
-					for (index = 0; index < (response.total - 1); index++) {
-						response.count = index + 2;
-						if ((result = ospdb_get_next(transaction, &response)) == ISC_R_SUCCESS) {
-							ospdb_build_record(data, &response, record, sizeof(record));
-							dns_sdb_putrr(lookup, "NAPTR", 0, record);
-						} else {
-							break;
-						}
-					}
-				}
-			}
+	OSPDB_LOG(ISC_LOG_DEBUG(2), "Record = '%u 0 \"U\" \"%s\" \"%s\" .'", order, services, regexp);
 
-			if (transaction != OSPC_TRAN_HANDLE_INVALID) {
-				OSPPTransactionDelete(transaction);
-			}
+	/* Length, order and preference */
+	if (used + 6 > size) {
+		return ISC_R_NOSPACE;
+	}
+	start = used;
+	used += 2;
+	wire[used++] = (unsigned char)(order >> 8);
+	wire[used++] = (unsigned char)order;
+	wire[used++] = 0;
+	wire[used++] = 0;
+
+	/* Flags, services, regular expression and root replacement */
+	if (((result = ospdb_put_charstr(wire, size, &used, "U")) == ISC_R_SUCCESS) &&
+		((result = ospdb_put_charstr(wire, size, &used, services)) == ISC_R_SUCCESS) &&
+		((result = ospdb_put_charstr(wire, size, &used, regexp)) == ISC_R_SUCCESS))
+	{
+		if (used + 1 > size) {
+			result = ISC_R_NOSPACE;
 		} else {
-			OSPDB_LOG(ISC_LOG_ERROR, "Failed to create transaction, error %d", error);
-			result = ISC_R_FAILURE;
+			wire[used++] = 0;
+			wire[start] = (unsigned char)((used - start - 2) >> 8);
+			wire[start + 1] = (unsigned char)(used - start - 2);
+			*length = used;
 		}
 	}
 
-	OSPDB_LOG_END;
-
 	return result;
 }
 
 /*
- * Authority call back function
+ * Render route into an rdata set, each NAPTR rdata in wire format preceded by its 2 byte length
+ * param data Running data structure
+ * param route Route
+ * param wire Rdata set buffer
+ * param size Rdata set buffer size
+ * param wirelen Rdata set length buffer
+ * return ISC_R_SUCCESS successful, ISC_R_NOSPACE too large
  */
-static isc_result_t ospdb_authority(
-	const char *zone,
-	void *dbdata,
-	dns_sdblookup_t *lookup)
+static isc_result_t ospdb_render_route(
+	ospdb_data_t *data,
+	ospcache_route_t *route,
+	unsigned char *wire,
+	size_t size,
+	size_t *wirelen)
 {
-	isc_result_t result;
-
-	UNUSED(zone);
-	UNUSED(dbdata);
-
-	OSPDB_LOG_START;
-
-	/* SOA record */
-	result = dns_sdb_putsoa(lookup, "ns", "ospadmin", 0);
-	INSIST(result == ISC_R_SUCCESS);
+	size_t length = 0;
+	int i;
+	isc_result_t result = ISC_R_SUCCESS;
 
-	/* NS record */
-	result = dns_sdb_putrr(lookup, "NS", 86400, "ns");
-	INSIST(result == ISC_R_SUCCESS);
+	for (i = 0; (i < route->count) && (result == ISC_R_SUCCESS); i++) {
+		result = ospdb_render_dest(data, i + 1, &route->dest[i], wire, size, &length);
+	}
 
-	OSPDB_LOG_END;
+	*wirelen = length;
 
-	return (ISC_R_SUCCESS);
+	return result;
 }
 
 /*
- * Create call back function
+ * Put rendered rdata set
+ * param wire Rdata set
+ * param wirelen Rdata set length
+ * param ttl Record TTL
+ * param lookup SDB lookup handle
  */
-static isc_result_t ospdb_create(
-	const char *zone,
-	int argc,
-	char **argv,
-	void *driverdata,
-	void **dbdata)
+static void ospdb_put_wire(
+	const unsigned char *wire,
+	size_t wirelen,
+	unsigned int ttl,
+	dns_sdblookup_t *lookup)
 {
-	ospdb_config_t cfg;
-	ospdb_data_t *data;
-	isc_result_t result = ISC_R_SUCCESS;
+	size_t offset = 0;
+	unsigned int rdlen;
+
+	while (offset + 2 <= wirelen) {
+		rdlen = (wire[offset] << 8) | wire[offset + 1];
+		offset += 2;
+		dns_sdb_putrdata(lookup, dns_rdatatype_naptr, ttl, wire + offset, rdlen);
+		offset += rdlen;
+	}
+}
 
-	UNUSED(zone);
-	UNUSED(driverdata);
+/*
+ * Put route records. Records are rendered to wire format and put with dns_sdb_putrdata, without a text round trip.
+ * Routes cached under a key are rendered once, the rendered set is attached to the cache entry so that later hits
+ * skip rendering too.
+ * param data Running data structure
+ * param route Route
+ * param ttl Record TTL
+ * param key Cache key the route is cached under, NULL for none
+ * param lookup SDB lookup handle
+ */
+static void ospdb_put_route(
+	ospdb_data_t *data,
+	ospcache_route_t *route,
+	unsigned int ttl,
+	const char *key,
+	dns_sdblookup_t *lookup)
+{
+	int i;
+	unsigned char wire[OSPCACHE_WIRE_SIZE];
+	size_t wirelen;
 
 	OSPDB_LOG_START;
 
-	/* Get running data structure */
-	data = isc_mem_get(ns_g_mctx, sizeof(*data));
-	if (data != NULL) {
-		/* Get configuration parameters */
-		ospdb_init_config(&cfg, data);
-		ospdb_get_config(argc, argv, &cfg, data);
-		ospdb_check_config(&cfg, data);
-		ospdb_dump_config(&cfg, data);
-
-		/* Create OSP provider */
-		result = ospdb_create_provider(&cfg, &data->provider);
-		if (result == ISC_R_SUCCESS) {
-			*dbdata = data;
-		} else {
-			isc_mem_put(ns_g_mctx, data, sizeof(*data));
-		}
+	if ((key != NULL) &&
+		(data->cache != NULL) &&
+		(route->count != 0) &&
+		(ospdb_render_route(data, route, wire, sizeof(wire), &wirelen) == ISC_R_SUCCESS))
+	{
+		ospcache_putwire(data->cache, key, route, wire, wirelen);
+		ospdb_put_wire(wire, wirelen, ttl, lookup);
 	} else {
-		OSPDB_LOG(ISC_LOG_ERROR, "%s", "Failed to get memory");
-		result = ISC_R_NOMEMORY;
+		/* One by one, a destination that does not fit a NAPTR record is left out as the text parser did */
+		for (i = 0; i < route->count; i++) {
+			wirelen = 0;
+			if (ospdb_render_dest(data, i + 1, &route->dest[i], wire, sizeof(wire), &wirelen) == ISC_R_SUCCESS) {
+				ospdb_put_wire(wire, wirelen, ttl, lookup);
+			} else {
+				OSPDB_LOG(ISC_LOG_WARNING, "Record '%d' of '%s' too long", i + 1, route->dest[i].called);
+			}
+		}
 	}
 
 	OSPDB_LOG_END;
-
-	return result;
 }
 
 /*
- * Destroy call back function
+ * Join the in-flight AuthReq for a key, or start a new flight
+ * param data Running data structure
+ * param key Cache key
+ * param leader Leader flag buffer, ISC_TRUE if the caller must issue the AuthReq
+ * return Flight, NULL failed
  */
-static void ospdb_destroy(
-	const char *zone,
-	void *driverdata,
-	void **dbdata)
+static ospdb_flight_t *ospdb_join_flight(
+	ospdb_data_t *data,
+	const char *key,
+	isc_boolean_t *leader)
 {
-	ospdb_data_t *data = *dbdata;
+	ospdb_flight_t *flight;
+
+	LOCK(&data->flightlock);
+
+	for (flight = ISC_LIST_HEAD(data->flights); flight != NULL; flight = ISC_LIST_NEXT(flight, link)) {
+		if (strcmp(flight->key, key) == 0) {
+			break;
+		}
+	}
+
+	if (flight != NULL) {
+		flight->refs++;
+		data->coalesced++;
+		*leader = ISC_FALSE;
+	} else if ((flight = isc_mem_get(ns_g_mctx, sizeof(*flight))) != NULL) {
+		snprintf(flight->key, sizeof(flight->key), "%s", key);
+		flight->refs = 1;
+		flight->done = ISC_FALSE;
+		flight->result = ISC_R_FAILURE;
+		flight->route.count = 0;
+		ISC_LINK_INIT(flight, link);
+		ISC_LIST_APPEND(data->flights, flight, link);
+		*leader = ISC_TRUE;
+	} else {
+		*leader = ISC_TRUE;
+	}
+
+	UNLOCK(&data->flightlock);
+
+	return flight;
+}
+
+/*
+ * Detach from a flight, flight lock must be held
+ * param flight Flight
+ */
+static void ospdb_detach_flight(
+	ospdb_flight_t *flight)
+{
+	INSIST(flight->refs > 0);
+
+	flight->refs--;
+	if (flight->refs == 0) {
+		isc_mem_put(ns_g_mctx, flight, sizeof(*flight));
+	}
+}
+
+/*
+ * Publish AuthReq result to the lookups waiting on a flight and detach from it
+ * param data Running data structure
+ * param flight Flight
+ * param result AuthReq result
+ * param route Route
+ */
+static void ospdb_land_flight(
+	ospdb_data_t *data,
+	ospdb_flight_t *flight,
+	isc_result_t result,
+	ospcache_route_t *route)
+{
+	LOCK(&data->flightlock);
+
+	flight->result = result;
+	if (result == ISC_R_SUCCESS) {
+		memcpy(&flight->route, route, sizeof(flight->route));
+	}
+	flight->done = ISC_TRUE;
+
+	/* Lookups arriving from now on start their own flight or find the route in cache */
+	ISC_LIST_UNLINK(data->flights, flight, link);
+
+	BROADCAST(&data->flightcond);
+
+	ospdb_detach_flight(flight);
+
+	UNLOCK(&data->flightlock);
+}
+
+/*
+ * Wait for a flight to land, copy its result and detach from it
+ * param data Running data structure
+ * param flight Flight
+ * param deadline Deadline, NULL for no limit
+ * param route Route buffer, only written on success
+ * return AuthReq result, ISC_R_TIMEDOUT deadline passed
+ */
+static isc_result_t ospdb_wait_flight(
+	ospdb_data_t *data,
+	ospdb_flight_t *flight,
+	isc_time_t *deadline,
+	ospcache_route_t *route)
+{
+	isc_result_t result = ISC_R_TIMEDOUT;
+
+	LOCK(&data->flightlock);
+
+	while (flight->done == ISC_FALSE) {
+		if (deadline == NULL) {
+			WAIT(&data->flightcond, &data->flightlock);
+		} else if (isc_condition_waituntil(&data->flightcond, &data->flightlock, deadline) == ISC_R_TIMEDOUT) {
+			break;
+		}
+	}
+
+	if (flight->done == ISC_TRUE) {
+		result = flight->result;
+		if (result == ISC_R_SUCCESS) {
+			memcpy(route, &flight->route, sizeof(*route));
+		}
+	}
+
+	ospdb_detach_flight(flight);
+
+	UNLOCK(&data->flightlock);
+
+	return result;
+}
+
+/*
+ * Get prefix a route is scoped to by the prefix scope rules, the longest matching rule wins
+ * param data Running data structure
+ * param called Called number
+ * param prefix Prefix buffer
+ * param prefixsize Size of prefix buffer
+ * return ISC_R_SUCCESS prefix scoped, ISC_R_NOTFOUND no rule or number too short
+ */
+static isc_result_t ospdb_get_scope(
+	ospdb_data_t *data,
+	const char *called,
+	char *prefix,
+	int prefixsize)
+{
+	ospdb_prefixrule_t *rule = NULL;
+	size_t length, best = 0;
+	int i;
+
+	for (i = 0; i < data->prefixnum; i++) {
+		length = strlen(data->prefixrule[i].prefix);
+		if ((strncmp(called, data->prefixrule[i].prefix, length) == 0) && ((rule == NULL) || (length > best))) {
+			rule = &data->prefixrule[i];
+			best = length;
+		}
+	}
+
+	if ((rule == NULL) || (strlen(called) < (size_t)rule->length) || (rule->length >= prefixsize)) {
+		return ISC_R_NOTFOUND;
+	}
+
+	memcpy(prefix, called, rule->length);
+	prefix[rule->length] = '\0';
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Check if a route can be shared by a number block, i.e. it carries nothing specific to the called number
+ * param route Route
+ * param called Called number
+ * return ISC_TRUE shareable, ISC_FALSE number specific
+ */
+static isc_boolean_t ospdb_check_scope(
+	ospcache_route_t *route,
+	const char *called)
+{
+	int i;
+
+	for (i = 0; i < route->count; i++) {
+		/* Translated numbers and ported number routing info only apply to this number */
+		if ((strcmp(route->dest[i].called, called) != 0) || (route->dest[i].nprn[0] != '\0')) {
+			return ISC_FALSE;
+		}
+	}
+
+	return ISC_TRUE;
+}
+
+/*
+ * Make a route of a ported number shareable by every number with the same LRN. Destinations for the number itself are
+ * moved to the LRN and lose their number portability info, translated ones are kept as they are.
+ * param route Route
+ * param query Query info of a ported number
+ */
+static void ospdb_strip_ported(
+	ospcache_route_t *route,
+	ospdb_query_t *query)
+{
+	ospcache_dest_t *dest;
+	int i;
+
+	for (i = 0; i < route->count; i++) {
+		dest = &route->dest[i];
+		if (strcmp(dest->called, query->called) == 0) {
+			snprintf(dest->called, sizeof(dest->called), "%s", query->routing);
+			dest->nprn[0] = '\0';
+			dest->npcic[0] = '\0';
+			dest->npdi = 0;
+		}
+	}
+}
+
+/*
+ * Turn a route shared by LRN back into a route of a ported number, with the locally dipped number portability info
+ * param route Route
+ * param query Query info of a ported number
+ */
+static void ospdb_apply_ported(
+	ospcache_route_t *route,
+	ospdb_query_t *query)
+{
+	ospcache_dest_t *dest;
+	int i;
+
+	for (i = 0; i < route->count; i++) {
+		dest = &route->dest[i];
+		if (strcmp(dest->called, query->routing) == 0) {
+			snprintf(dest->called, sizeof(dest->called), "%s", query->called);
+			snprintf(dest->nprn, sizeof(dest->nprn), "%s", query->nprn);
+			snprintf(dest->npcic, sizeof(dest->npcic), "%s", query->npcic);
+			dest->npdi = 1;
+		}
+	}
+}
+
+/*
+ * Check if an AuthReq result is a definitive answer rather than a failure to get one
+ * param result AuthReq result
+ * return ISC_TRUE definitive, ISC_FALSE failure
+ */
+static isc_boolean_t ospdb_is_definitive(
+	isc_result_t result)
+{
+	return ((result == ISC_R_SUCCESS) || (result == ISC_R_NOPERM) || (result == ISC_R_NOTFOUND) || (result == ISC_R_NOMORE)) ? ISC_TRUE : ISC_FALSE;
+}
+
+/*
+ * Issue AuthReq and update caches with its result
+ * param data Running data structure
+ * param query Query info
+ * param key Cache key, NULL for not caching
+ * param now Current time
+ * param route Route buffer
+ * return ISC_R_SUCCESS successful, ISC_R_QUOTA too many in-flight AuthReqs, other failed
+ */
+static isc_result_t ospdb_run_authreq(
+	ospdb_data_t *data,
+	ospdb_query_t *query,
+	const char *key,
+	isc_stdtime_t now,
+	ospcache_route_t *route)
+{
+	char prefix[OSPCACHE_NUM_SIZE];
+	unsigned int ttl;
+	isc_result_t result;
+
+	if (isc_quota_reserve(&data->inflight) != ISC_R_SUCCESS) {
+		/* Too many worker threads already blocked on the OSP server, fail fast instead of stalling one more */
+		OSPDB_LOG(ISC_LOG_DEBUG(1), "Too many in-flight AuthReqs for '%s'", query->called);
+		result = ISC_R_QUOTA;
+	} else {
+		if ((result = ospdb_query_route(data, query, route, now, &ttl)) == ISC_R_SUCCESS) {
+			if (query->nprn[0] != '\0') {
+				ospdb_strip_ported(route, query);
+			}
+
+			if ((key != NULL) && (data->shm != NULL) && (ttl != 0)) {
+				ospshm_put(data->shm, key, now, now + ttl, route);
+			}
+
+			if ((key != NULL) && (data->cache != NULL) && (ttl != 0)) {
+				if ((data->prefixnum != 0) &&
+					(ospdb_get_scope(data, query->routing, prefix, sizeof(prefix)) == ISC_R_SUCCESS) &&
+					(ospdb_check_scope(route, query->routing) == ISC_TRUE))
+				{
+					OSPDB_LOG(ISC_LOG_DEBUG(1), "Cache route of '%s' for prefix '%s'", query->routing, prefix);
+					ospcache_putprefix(data->cache, prefix, now, now + ttl, route);
+					if (data->peer != NULL) {
+						osppeer_publish(data->peer, ISC_TRUE, prefix, now, now + ttl, route);
+					}
+				} else {
+					ospcache_put(data->cache, key, now + ttl, route);
+					if (data->peer != NULL) {
+						osppeer_publish(data->peer, ISC_FALSE, key, now, now + ttl, route);
+					}
+				}
+			}
+		} else if ((key != NULL) && (data->negcache != NULL) && (ospdb_is_definitive(result) == ISC_TRUE)) {
+			/* Only definitive answers are remembered, transport failures must be retried */
+			ospcache_putnegative(data->negcache, key, now + data->negcachettl, result);
+		}
+
+		isc_quota_release(&data->inflight);
+	}
+
+	return result;
+}
+
+/*
+ * Queue AuthReq to a background thread
+ * param data Running data structure
+ * param query Query info
+ * param key Cache key
+ * param flight Flight, attached by the task, NULL for none
+ * return ISC_R_SUCCESS successful, ISC_R_NOMEMORY failed
+ */
+static isc_result_t ospdb_queue_task(
+	ospdb_data_t *data,
+	ospdb_query_t *query,
+	const char *key,
+	ospdb_flight_t *flight)
+{
+	ospdb_task_t *task;
+
+	if ((task = isc_mem_get(ns_g_mctx, sizeof(*task))) == NULL) {
+		return ISC_R_NOMEMORY;
+	}
+	snprintf(task->called, sizeof(task->called), "%s", query->called);
+	snprintf(task->srcdev, sizeof(task->srcdev), "%s", query->srcdev);
+	snprintf(task->srcuriuser, sizeof(task->srcuriuser), "%s", query->srcuriuser);
+	snprintf(task->nprn, sizeof(task->nprn), "%s", query->nprn);
+	snprintf(task->npcic, sizeof(task->npcic), "%s", query->npcic);
+	snprintf(task->key, sizeof(task->key), "%s", key);
+	ISC_LINK_INIT(task, link);
+
+	task->flight = flight;
+	if (flight != NULL) {
+		LOCK(&data->flightlock);
+		flight->refs++;
+		UNLOCK(&data->flightlock);
+	}
+
+	LOCK(&data->tasklock);
+	ISC_LIST_APPEND(data->tasks, task, link);
+	SIGNAL(&data->taskcond);
+	UNLOCK(&data->tasklock);
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Background thread, runs queued AuthReqs until shutdown
+ * param arg Running data structure
+ */
+static isc_threadresult_t ospdb_run_tasks(
+	isc_threadarg_t arg)
+{
+	ospdb_data_t *data = (ospdb_data_t *)arg;
+	ospdb_task_t *task;
+	ospdb_query_t query;
+	ospcache_route_t route;
+	isc_stdtime_t now;
+	isc_result_t result;
+
+	LOCK(&data->tasklock);
+
+	while (data->shutdown == ISC_FALSE) {
+		if ((task = ISC_LIST_HEAD(data->tasks)) == NULL) {
+			WAIT(&data->taskcond, &data->tasklock);
+			continue;
+		}
+		ISC_LIST_UNLINK(data->tasks, task, link);
+
+		UNLOCK(&data->tasklock);
+
+		query.called = task->called;
+		query.serverip = data->deviceip;
+		query.srcdev = task->srcdev;
+		query.srcuriuser = task->srcuriuser;
+		query.nprn = task->nprn;
+		query.npcic = task->npcic;
+		query.routing = (task->nprn[0] != '\0') ? task->nprn : task->called;
+
+		isc_stdtime_get(&now);
+		result = ospdb_run_authreq(data, &query, task->key, now, &route);
+		if (task->flight != NULL) {
+			ospdb_land_flight(data, task->flight, result, &route);
+		}
+
+		isc_mem_put(ns_g_mctx, task, sizeof(*task));
+
+		LOCK(&data->tasklock);
+	}
+
+	UNLOCK(&data->tasklock);
+
+	return ((isc_threadresult_t)0);
+}
+
+/*
+ * Free the lookup answer kept on a DNS client, called by client.c
+ * param client DNS client
+ */
+static void ospdb_free_memo(
+	ns_client_t *client)
+{
+	isc_mem_put(client->mctx, client->sdbmemo, sizeof(ospdb_memo_t));
+	client->sdbmemo = NULL;
+	client->sdbmemofree = NULL;
+	client->sdbmemovalid = ISC_FALSE;
+}
+
+/*
+ * Answer a lookup with the answer kept for the current request of a DNS client
+ * param data Running data structure
+ * param client DNS client, may be NULL
+ * param called Called number
+ * param lookup SDB lookup handle
+ * param stale Stale route flag buffer
+ * param result Lookup result buffer
+ * return ISC_TRUE answered, ISC_FALSE not found
+ */
+static isc_boolean_t ospdb_answer_memo(
+	ospdb_data_t *data,
+	ns_client_t *client,
+	const char *called,
+	dns_sdblookup_t *lookup,
+	isc_boolean_t *stale,
+	isc_result_t *result)
+{
+	ospdb_memo_t *memo;
+	isc_boolean_t found = ISC_FALSE;
+
+	if ((client != NULL) && (client->sdbmemovalid == ISC_TRUE) && (client->sdbmemofree == ospdb_free_memo)) {
+		memo = client->sdbmemo;
+		if ((memo->data == data) && (strcmp(memo->called, called) == 0)) {
+			*stale = memo->stale;
+			*result = memo->result;
+			if (memo->result != ISC_R_SUCCESS) {
+				/* Failed lookups have no records */
+			} else if (memo->wirelen != 0) {
+				ospdb_put_wire(memo->answer.wire, memo->wirelen, 0, lookup);
+			} else {
+				ospdb_put_route(data, &memo->answer.route, (memo->stale == ISC_TRUE) ? data->stalettl : 0, NULL, lookup);
+			}
+			found = ISC_TRUE;
+		}
+	}
+
+	return found;
+}
+
+/*
+ * Keep a lookup answer for the current request of a DNS client, the memo is allocated at the first use and kept with the client
+ * param data Running data structure
+ * param client DNS client, may be NULL
+ * param called Called number
+ * param route Route, used when no rendered records
+ * param wire Rendered records
+ * param wirelen Rendered records length, 0 for none
+ * param stale Stale route flag
+ * param result Lookup result
+ */
+static void ospdb_put_memo(
+	ospdb_data_t *data,
+	ns_client_t *client,
+	const char *called,
+	const ospcache_route_t *route,
+	const unsigned char *wire,
+	size_t wirelen,
+	isc_boolean_t stale,
+	isc_result_t result)
+{
+	ospdb_memo_t *memo;
+
+	if ((client != NULL) && (client->sdbmemo == NULL)) {
+		if ((client->sdbmemo = isc_mem_get(client->mctx, sizeof(ospdb_memo_t))) != NULL) {
+			client->sdbmemofree = ospdb_free_memo;
+		}
+	}
+
+	if ((client != NULL) && (client->sdbmemo != NULL) && (client->sdbmemofree == ospdb_free_memo)) {
+		memo = client->sdbmemo;
+		memo->data = data;
+		snprintf(memo->called, sizeof(memo->called), "%s", called);
+		memo->result = result;
+		memo->stale = stale;
+		memo->wirelen = 0;
+		if (result != ISC_R_SUCCESS) {
+			/* Nothing to keep */
+		} else if (wirelen != 0) {
+			/* Only the used parts are copied */
+			memcpy(memo->answer.wire, wire, wirelen);
+			memo->wirelen = wirelen;
+		} else {
+			memo->answer.route.count = route->count;
+			memcpy(memo->answer.route.dest, route->dest, (size_t)route->count * sizeof(ospcache_dest_t));
+		}
+		client->sdbmemovalid = ISC_TRUE;
+	}
+}
+
+/*
+ * Refresh a hot route in the background before it expires, subject to the refresh ahead rate
+ * param data Running data structure
+ * param query Query info
+ * param key Cache key
+ * param now Current time
+ */
+static void ospdb_prefetch_route(
+	ospdb_data_t *data,
+	ospdb_query_t *query,
+	const char *key,
+	isc_stdtime_t now)
+{
+	isc_boolean_t allowed;
+
+	LOCK(&data->tasklock);
+	if (data->prefetchsecond != now) {
+		data->prefetchsecond = now;
+		data->prefetchcount = 0;
+	}
+	allowed = (data->prefetchcount < data->prefetchrate) ? ISC_TRUE : ISC_FALSE;
+	if (allowed == ISC_TRUE) {
+		data->prefetchcount++;
+	} else {
+		data->prefetchdrops++;
+	}
+	UNLOCK(&data->tasklock);
+
+	if (allowed == ISC_FALSE) {
+		/* The route simply expires and is fetched by the next lookup */
+		OSPDB_LOG(ISC_LOG_DEBUG(1), "Refresh ahead rate exceeded for '%s'", key);
+	} else if (ospdb_queue_task(data, query, key, NULL) == ISC_R_SUCCESS) {
+		OSPDB_LOG(ISC_LOG_DEBUG(1), "Refresh ahead for '%s'", key);
+	}
+}
+
+/*
+ * Get route from OSP server, concurrent lookups for the same key share one AuthReq
+ * param data Running data structure
+ * param query Query info
+ * param key Cache key, NULL for neither coalescing nor caching
+ * param now Current time
+ * param route Route buffer
+ * param stale Stale flag buffer, ISC_TRUE if an expired route is returned
+ * return ISC_R_SUCCESS successful, ISC_R_QUOTA too many in-flight AuthReqs, other failed
+ */
+static isc_result_t ospdb_fetch_route(
+	ospdb_data_t *data,
+	ospdb_query_t *query,
+	const char *key,
+	isc_stdtime_t now,
+	ospcache_route_t *route,
+	isc_boolean_t *stale)
+{
+	ospdb_flight_t *flight = NULL;
+	isc_boolean_t leader = ISC_TRUE;
+	isc_boolean_t havestale = ISC_FALSE;
+	isc_interval_t interval;
+	isc_time_t deadline, *deadlinep = NULL;
+	isc_result_t result;
+
+	OSPDB_LOG_START;
+
+	*stale = ISC_FALSE;
+
+	if (key != NULL) {
+		flight = ospdb_join_flight(data, key, &leader);
+	}
+
+	/*
+	 * With a route still in the stale window, the AuthReq runs in the background so that the lookup can give up on it at
+	 * the deadline. The AuthReq keeps going and refreshes the cache for later lookups.
+	 */
+	if ((flight != NULL) && (data->nthreads != 0) && (ospcache_getstale(data->cache, key, now, route) == ISC_R_SUCCESS)) {
+		havestale = ISC_TRUE;
+		if (data->staledeadline != 0) {
+			isc_interval_set(&interval, data->staledeadline / 1000, (data->staledeadline % 1000) * 1000000);
+			if (isc_time_nowplusinterval(&deadline, &interval) == ISC_R_SUCCESS) {
+				deadlinep = &deadline;
+			}
+		}
+	}
+
+	if (leader == ISC_FALSE) {
+		OSPDB_LOG(ISC_LOG_DEBUG(1), "Wait for in-flight AuthReq for '%s'", key);
+		result = ospdb_wait_flight(data, flight, deadlinep, route);
+	} else if (havestale == ISC_TRUE) {
+		if ((result = ospdb_queue_task(data, query, key, flight)) == ISC_R_SUCCESS) {
+			result = ospdb_wait_flight(data, flight, deadlinep, route);
+		} else {
+			ospdb_land_flight(data, flight, result, route);
+		}
+	} else {
+		result = ospdb_run_authreq(data, query, key, now, route);
+
+		if (flight != NULL) {
+			ospdb_land_flight(data, flight, result, route);
+		}
+	}
+
+	if ((havestale == ISC_TRUE) && (ospdb_is_definitive(result) == ISC_FALSE)) {
+		/* The route buffer still holds the stale route, wait_flight only overwrites it on success */
+		OSPDB_LOG(ISC_LOG_DEBUG(1), "Serve stale route for '%s', AuthReq result '%s'", key, isc_result_totext(result));
+		*stale = ISC_TRUE;
+		result = ISC_R_SUCCESS;
+	}
+
+	OSPDB_LOG_END;
+
+	return result;
+}
+
+/*
+ * Answer a query from the local rules, without AuthReq, cache or dataset work
+ * param data Running data structure
+ * param called Called number
+ * param lookup SDB lookup handle
+ * param result Lookup result buffer
+ * return ISC_TRUE answered, ISC_FALSE left to OSP
+ */
+static isc_boolean_t ospdb_apply_rules(
+	ospdb_data_t *data,
+	const char *called,
+	dns_sdblookup_t *lookup,
+	isc_result_t *result)
+{
+	ospcache_route_t route;
+	int action;
+	isc_boolean_t answered = ISC_TRUE;
+
+	action = osprules_lookup(data->rules, called, &route);
+	if (action == OSPRULES_ROUTE) {
+		OSPDB_LOG(ISC_LOG_DEBUG(1), "Local route for '%s'", called);
+		ospdb_put_route(data, &route, 0, NULL, lookup);
+		*result = ISC_R_SUCCESS;
+	} else if (action == OSPRULES_NXDOMAIN) {
+		OSPDB_LOG(ISC_LOG_DEBUG(1), "Local nxdomain for '%s'", called);
+		*result = ISC_R_NOTFOUND;
+	} else if (action == OSPRULES_REFUSE) {
+		/* query_find() turns it into SERVFAIL, lookup2 flags the client so client.c answers REFUSED */
+		OSPDB_LOG(ISC_LOG_DEBUG(1), "Local refusal for '%s'", called);
+		*result = DNS_R_REFUSED;
+	} else {
+		answered = ISC_FALSE;
+	}
+
+	return answered;
+}
+
+/*
+ * Lookup call back function, works on the wire labels of the name relative to the zone
+ */
+static isc_result_t ospdb_lookup2(
+	const dns_name_t *zone,
+	const dns_name_t *name,
+	void *dbdata,
+	dns_sdblookup_t *lookup,
+	dns_clientinfomethods_t *methods,
+	dns_clientinfo_t *clientinfo)
+{
+	ns_client_t *client = NULL;
+#ifdef DNS_CLIENTINFO_VERSION
+	isc_sockaddr_t *address;
+	int length;
+	char srcuribuf[OSPDB_STR_SIZE];
+#endif /* DNS_CLIENTINFO_VERSION */
+	ospdb_data_t *data = dbdata;
+	ospdb_query_t query;
+	char called[OSPDB_STR_SIZE];
+	char namebuf[DNS_NAME_FORMATSIZE];
+	char clientip[OSPDB_STR_SIZE];
+	char srcuriuser[OSPDB_STR_SIZE];
+	char srcurihost[OSPDB_STR_SIZE];
+	char srcdev[OSPDB_STR_SIZE];
+	char nprn[OSPLNP_NUM_SIZE];
+	char npcic[OSPLNP_CIC_SIZE];
+	char key[OSPCACHE_KEY_SIZE];
+	const char *wirekey;
+	isc_boolean_t havekey;
+	isc_boolean_t ported;
+	isc_boolean_t stale;
+	isc_boolean_t prefetch;
+	isc_boolean_t memoed;
+	isc_boolean_t hold = ISC_FALSE;
+	isc_stdtime_t now;
+	isc_stdtime_t expire;
+	int i;
+	ospcache_route_t route;
+	unsigned char wire[OSPCACHE_WIRE_SIZE];
+	size_t wirelen;
+	dns_rdatatype_t type = dns_sdb_gettype(lookup);
+	isc_result_t result = ISC_R_SUCCESS;
+
+	UNUSED(zone);
+
+	OSPDB_LOG_START;
+
+	if (dns_name_countlabels(name) == 0) {
+		/* SOA and NS come from authority(), sdb builds the apex node once per zone instance, see DNS_SDBFLAG_STATICAPEX */
+		OSPDB_LOG(ISC_LOG_DEBUG(3), "%s", "lookup for '@'");
+	} else if (ospdb_is_nsname(name) == ISC_TRUE) {
+		/* For ns record */
+		OSPDB_LOG(ISC_LOG_DEBUG(3), "%s", "lookup for 'ns'");
+		result = dns_sdb_putrr(lookup, "A", 0, data->deviceip);
+	} else if (ospdb_convert_name(name, called, sizeof(called)) != ISC_R_SUCCESS) {
+		dns_name_format(name, namebuf, sizeof(namebuf));
+		OSPDB_LOG(ISC_LOG_DEBUG(1), "Unsupported domain name '%s'", namebuf);
+		result = ISC_R_NOTFOUND;
+	} else if ((data->rules != NULL) && (ospdb_apply_rules(data, called, lookup, &result) == ISC_TRUE)) {
+		/* Answered by the local rules */
+		hold = (result == ISC_R_SUCCESS) ? ISC_TRUE : ISC_FALSE;
+	} else if ((type != dns_rdatatype_naptr) && (type != dns_rdatatype_any)) {
+		/* Only NAPTR records are answered, the name exists without records of other types */
+		OSPDB_LOG(ISC_LOG_DEBUG(2), "No type '%u' records for '%s'", type, called);
+	} else {
+		/* Get called number */
+		query.called = called;
+
+		/* Get DNS server address */
+		query.serverip = data->deviceip;
+
+		/* Get DNS client address and source URI info */
+		clientip[0] = '\0';
+		srcuriuser[0] = '\0';
+		srcurihost[0] = '\0';
+#ifdef DNS_CLIENTINFO_VERSION
+		if ((methods != NULL) && ((methods->version - methods->age) >= DNS_CLIENTINFOMETHODS_VERSION)) {
+			methods->sourceip(clientinfo, &address);
+			if (getnameinfo(&address->type.sa, address->length, clientip, sizeof(clientip), NULL, 0, NI_NUMERICHOST) != 0) {
+				clientip[0] = '\0';
+			}
+		}
+
+		if (clientinfo != NULL) {
+			client = (ns_client_t *)clientinfo->data;
+		}
+
+		if (data->usesrcuri == ISC_TRUE) {
+			if ((client != NULL) && (client->urilen != 0)) {
+				length = client->urilen < sizeof(srcuribuf) ? client->urilen : sizeof(srcuribuf) - 1;
+				memmove(srcuribuf, client->uribuf, length);
+				srcuribuf[length] = '\0';
+				ospdb_parse_uri(srcuribuf, srcuriuser, sizeof(srcuriuser), srcurihost, sizeof(srcurihost));
+			}
+		}
+#endif /* DNS_CLIENTINFO_VERSION */
+		if (srcurihost[0] != '\0') {
+			ospdb_convert_toout(srcurihost, srcdev, sizeof(srcdev));
+		} else {
+			ospdb_convert_toout(clientip, srcdev, sizeof(srcdev));
+		}
+		query.srcdev = srcdev;
+		query.srcuriuser = srcuriuser;
+
+		/* Ported numbers are routed by their LRN */
+		nprn[0] = '\0';
+		npcic[0] = '\0';
+		query.routing = called;
+		if ((data->lnp != NULL) && (osplnp_lookup(data->lnp, called, nprn, sizeof(nprn), npcic, sizeof(npcic)) == ISC_R_SUCCESS)) {
+			OSPDB_LOG(ISC_LOG_DEBUG(1), "Ported number '%s' LRN '%s'", called, nprn);
+			query.routing = nprn;
+		}
+		query.nprn = nprn;
+		query.npcic = npcic;
+		ported = (nprn[0] != '\0') ? ISC_TRUE : ISC_FALSE;
+
+		isc_stdtime_get(&now);
+
+		havekey = ISC_FALSE;
+		if (ospdb_build_key(data, &query, key, sizeof(key)) == ISC_R_SUCCESS) {
+			havekey = ISC_TRUE;
+		} else {
+			OSPDB_LOG(ISC_LOG_DEBUG(1), "Cache key too long for '%s'", called);
+		}
+
+		/* Rendered records carry the called number, routes shared by LRN are rendered per lookup */
+		wirekey = ((havekey == ISC_TRUE) && (ported == ISC_FALSE)) ? key : NULL;
+
+		stale = ISC_FALSE;
+		wirelen = 0;
+		memoed = ISC_FALSE;
+
+		/* A repeat lookup of the same request, for additional data or ANY, gets the answer of the first */
+		if (ospdb_answer_memo(data, client, called, lookup, &stale, &result) == ISC_TRUE) {
+			OSPDB_LOG(ISC_LOG_DEBUG(1), "Repeat lookup for '%s', result '%s'", called, isc_result_totext(result));
+			memoed = ISC_TRUE;
+		} else if ((data->replica != NULL) && (ospreplica_lookup(data->replica, query.routing, &route) == ISC_R_SUCCESS)) {
+			/* The replica holds routes by called number prefix, they do not depend on caller or source */
+			OSPDB_LOG(ISC_LOG_DEBUG(1), "Replica hit for '%s'", query.routing);
+			if (ported == ISC_TRUE) {
+				ospdb_apply_ported(&route, &query);
+			}
+			ospdb_put_route(data, &route, 0, NULL, lookup);
+		} else if ((havekey == ISC_TRUE) && (data->cache != NULL) && (ospcache_getwire(data->cache, key, now, &route, wire, sizeof(wire), &wirelen, &prefetch) == ISC_R_SUCCESS)) {
+			OSPDB_LOG(ISC_LOG_DEBUG(1), "Cache hit for '%s'", key);
+			if (prefetch == ISC_TRUE) {
+				ospdb_prefetch_route(data, &query, key, now);
+			}
+			if (wirelen != 0) {
+				ospdb_put_wire(wire, wirelen, 0, lookup);
+			} else {
+				if (ported == ISC_TRUE) {
+					ospdb_apply_ported(&route, &query);
+				}
+				ospdb_put_route(data, &route, 0, wirekey, lookup);
+			}
+		} else if ((havekey == ISC_TRUE) && (data->shm != NULL) && (ospshm_get(data->shm, key, now, &route, &expire) == ISC_R_SUCCESS)) {
+			OSPDB_LOG(ISC_LOG_DEBUG(1), "Shared table hit for '%s'", key);
+			/* Keep a private copy so later lookups do not touch the shared segment */
+			if (data->cache != NULL) {
+				ospcache_put(data->cache, key, expire, &route);
+			}
+			if (ported == ISC_TRUE) {
+				ospdb_apply_ported(&route, &query);
+			}
+			ospdb_put_route(data, &route, 0, wirekey, lookup);
+		} else if ((data->prefixnum != 0) && (ospcache_getprefix(data->cache, query.routing, now, &route) == ISC_R_SUCCESS)) {
+			OSPDB_LOG(ISC_LOG_DEBUG(1), "Prefix cache hit for '%s'", query.routing);
+			/* Prefix routes only carry the called number they were fetched for */
+			for (i = 0; i < route.count; i++) {
+				snprintf(route.dest[i].called, sizeof(route.dest[i].called), "%s", query.routing);
+			}
+			if (ported == ISC_TRUE) {
+				ospdb_apply_ported(&route, &query);
+			}
+			ospdb_put_route(data, &route, 0, NULL, lookup);
+		} else if ((havekey == ISC_TRUE) && (data->negcache != NULL) && (ospcache_getnegative(data->negcache, key, now, &result) == ISC_R_SUCCESS)) {
+			OSPDB_LOG(ISC_LOG_DEBUG(1), "Negative cache hit for '%s', result '%s'", key, isc_result_totext(result));
+		} else if ((result = ospdb_fetch_route(data, &query, (havekey == ISC_TRUE) ? key : NULL, now, &route, &stale)) == ISC_R_SUCCESS) {
+			if (ported == ISC_TRUE) {
+				ospdb_apply_ported(&route, &query);
+			}
+			ospdb_put_route(data, &route, (stale == ISC_TRUE) ? data->stalettl : 0, wirekey, lookup);
+		}
+
+		/* Keep the answer for repeat lookups of the request, rendered records only come from the route cache */
+		if (memoed == ISC_FALSE) {
+			ospdb_put_memo(data, client, called, &route, wire, wirelen, stale, result);
+		}
+
+		/* Stale routes are not reused, a fresh one may be there for the next query */
+		hold = ((result == ISC_R_SUCCESS) && (stale == ISC_FALSE)) ? ISC_TRUE : ISC_FALSE;
+	}
+
+#ifdef DNS_CLIENTINFO_VERSION
+	/* Let client.c keep the rendered response for a while and answer REFUSED for refused numbers. The last lookup of a request decides */
+	if (clientinfo != NULL) {
+		client = (ns_client_t *)clientinfo->data;
+		if (client != NULL) {
+			client->resphold = ((hold == ISC_TRUE) && (data->respcache == ISC_TRUE)) ? data->respcachettl : 0;
+			client->sdbrefused = (result == DNS_R_REFUSED) ? ISC_TRUE : ISC_FALSE;
+		}
+	}
+#else
+	UNUSED(hold);
+#endif /* DNS_CLIENTINFO_VERSION */
+
+	OSPDB_LOG_END;
+
+	return result;
+}
+
+/*
+ * Authority call back function
+ */
+static isc_result_t ospdb_authority(
+	const char *zone,
+	void *dbdata,
+	dns_sdblookup_t *lookup)
+{
+	isc_result_t result;
+
+	UNUSED(zone);
+	UNUSED(dbdata);
+
+	OSPDB_LOG_START;
+
+	/* SOA record */
+	result = dns_sdb_putsoa(lookup, "ns", "ospadmin", 0);
+	INSIST(result == ISC_R_SUCCESS);
+
+	/* NS record */
+	result = dns_sdb_putrr(lookup, "NS", 86400, "ns");
+	INSIST(result == ISC_R_SUCCESS);
+
+	OSPDB_LOG_END;
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Init in-flight AuthReq list and background task queue
+ * param data Running data structure
+ * return ISC_R_SUCCESS successful, other failed
+ */
+static isc_result_t ospdb_init_flights(
+	ospdb_data_t *data)
+{
+	isc_result_t result;
+
+	ISC_LIST_INIT(data->flights);
+	data->coalesced = 0;
+	ISC_LIST_INIT(data->tasks);
+	data->shutdown = ISC_FALSE;
+
+	if ((result = isc_mutex_init(&data->flightlock)) != ISC_R_SUCCESS) {
+		OSPDB_LOG(ISC_LOG_ERROR, "%s", "Failed to init flight lock");
+	} else if ((result = isc_condition_init(&data->flightcond)) != ISC_R_SUCCESS) {
+		OSPDB_LOG(ISC_LOG_ERROR, "%s", "Failed to init flight condition");
+		DESTROYLOCK(&data->flightlock);
+	} else if ((result = isc_mutex_init(&data->tasklock)) != ISC_R_SUCCESS) {
+		OSPDB_LOG(ISC_LOG_ERROR, "%s", "Failed to init task lock");
+		isc_condition_destroy(&data->flightcond);
+		DESTROYLOCK(&data->flightlock);
+	} else if ((result = isc_condition_init(&data->taskcond)) != ISC_R_SUCCESS) {
+		OSPDB_LOG(ISC_LOG_ERROR, "%s", "Failed to init task condition");
+		DESTROYLOCK(&data->tasklock);
+		isc_condition_destroy(&data->flightcond);
+		DESTROYLOCK(&data->flightlock);
+	} else if ((result = isc_condition_init(&data->housecond)) != ISC_R_SUCCESS) {
+		OSPDB_LOG(ISC_LOG_ERROR, "%s", "Failed to init housekeeping condition");
+		isc_condition_destroy(&data->taskcond);
+		DESTROYLOCK(&data->tasklock);
+		isc_condition_destroy(&data->flightcond);
+		DESTROYLOCK(&data->flightlock);
+	}
+
+	return result;
+}
+
+/*
+ * Stop background threads and drop queued tasks
+ * param data Running data structure
+ */
+static void ospdb_stop_threads(
+	ospdb_data_t *data)
+{
+	ospdb_task_t *task;
+	ospcache_route_t route;
+
+	OSPDB_LOG_START;
+
+	LOCK(&data->tasklock);
+	data->shutdown = ISC_TRUE;
+	BROADCAST(&data->taskcond);
+	BROADCAST(&data->housecond);
+	UNLOCK(&data->tasklock);
+
+	if (data->househeld == ISC_TRUE) {
+		isc_thread_join(data->housekeeper, NULL);
+		data->househeld = ISC_FALSE;
+	}
+
+	while (data->nthreads > 0) {
+		data->nthreads--;
+		isc_thread_join(data->threads[data->nthreads], NULL);
+	}
+
+	while ((task = ISC_LIST_HEAD(data->tasks)) != NULL) {
+		ISC_LIST_UNLINK(data->tasks, task, link);
+		if (task->flight != NULL) {
+			route.count = 0;
+			ospdb_land_flight(data, task->flight, ISC_R_SHUTTINGDOWN, &route);
+		}
+		isc_mem_put(ns_g_mctx, task, sizeof(*task));
+	}
+
+	OSPDB_LOG_END;
+}
+
+/*
+ * Write route cache snapshot
+ * param data Running data structure
+ * param now Current time
+ */
+static void ospdb_save_snapshot(
+	ospdb_data_t *data,
+	isc_stdtime_t now)
+{
+	unsigned int count;
+	isc_result_t result;
+
+	/* Instances sharing the cache during a reload leave the snapshot to the one that stays */
+	if ((data->snapshotfile[0] != '\0') && (data->cache != NULL) && (ospdb_own_cache(data) == ISC_TRUE)) {
+		if ((result = ospcache_save(data->cache, data->snapshotfile, now, &count)) == ISC_R_SUCCESS) {
+			OSPDB_LOG(ISC_LOG_DEBUG(1), "Saved '%u' routes to snapshot '%s'", count, data->snapshotfile);
+		} else {
+			OSPDB_LOG(ISC_LOG_WARNING, "Failed to save snapshot '%s', error '%s'", data->snapshotfile, isc_result_totext(result));
+		}
+	}
+}
+
+/*
+ * Map route cache snapshot, a missing or unusable snapshot only means a cold cache
+ * param data Running data structure
+ */
+static void ospdb_load_snapshot(
+	ospdb_data_t *data)
+{
+	unsigned int count;
+	isc_result_t result;
+
+	if ((data->snapshotfile[0] != '\0') && (data->cache != NULL)) {
+		if ((result = ospcache_load(data->cache, data->snapshotfile, &count)) == ISC_R_SUCCESS) {
+			OSPDB_LOG(ISC_LOG_INFO, "Mapped '%u' routes from snapshot '%s'", count, data->snapshotfile);
+		} else if (result == ISC_R_FILENOTFOUND) {
+			OSPDB_LOG(ISC_LOG_DEBUG(1), "Without snapshot '%s'", data->snapshotfile);
+		} else {
+			OSPDB_LOG(ISC_LOG_WARNING, "Ignore snapshot '%s', error '%s'", data->snapshotfile, isc_result_totext(result));
+		}
+	}
+}
+
+/*
+ * Apply the route replica delta file if it changed since it was last applied
+ * param data Running data structure
+ */
+static void ospdb_apply_delta(
+	ospdb_data_t *data)
+{
+	struct stat st;
+	unsigned int count;
+	isc_result_t result;
+
+	if ((data->replica == NULL) || (stat(data->replicadelta, &st) != 0) || (st.st_mtime == data->replicamtime)) {
+		return;
+	}
+
+	/* A bad delta is not retried until it is rewritten */
+	data->replicamtime = st.st_mtime;
+
+	if ((result = ospreplica_apply(data->replica, data->replicadelta, &count)) == ISC_R_SUCCESS) {
+		OSPDB_LOG(ISC_LOG_INFO, "Applied '%u' lines from replica delta '%s'", count, data->replicadelta);
+	} else if (result == ISC_R_UNEXPECTEDTOKEN) {
+		OSPDB_LOG(ISC_LOG_WARNING, "Ignore replica delta '%s', bad line '%u'", data->replicadelta, count);
+	} else {
+		OSPDB_LOG(ISC_LOG_WARNING, "Failed to apply replica delta '%s', error '%s'", data->replicadelta, isc_result_totext(result));
+	}
+
+	/* Lines before a bad one may have been applied */
+	if (data->respcache == ISC_TRUE) {
+		ospresp_flush();
+	}
+}
+
+/*
+ * Reload the number portability dataset if its source changed, the old dataset stays in use if the new one is bad
+ * param data Running data structure
+ */
+static void ospdb_reload_lnp(
+	ospdb_data_t *data)
+{
+	osplnp_stats_t stats;
+	isc_boolean_t reloaded;
+	unsigned int line;
+	isc_result_t result;
+
+	if ((result = osplnp_reload(data->lnp, &reloaded, &line)) != ISC_R_SUCCESS) {
+		if (result == ISC_R_UNEXPECTEDTOKEN) {
+			OSPDB_LOG(ISC_LOG_WARNING, "Keep number portability dataset, '%s' bad line '%u'", data->lnpfile, line);
+		} else {
+			OSPDB_LOG(ISC_LOG_WARNING, "Keep number portability dataset, failed to reload '%s', error '%s'", data->lnpfile, isc_result_totext(result));
+		}
+	} else if (reloaded == ISC_TRUE) {
+		osplnp_getstats(data->lnp, &stats);
+		OSPDB_LOG(ISC_LOG_INFO, "Reloaded '%u' ported numbers from '%s'", stats.records, data->lnpfile);
+		if (data->respcache == ISC_TRUE) {
+			ospresp_flush();
+		}
+	}
+}
+
+/*
+ * Reload the local rules if the file changed, the old rules stay in use if the new ones are bad
+ * param data Running data structure
+ */
+static void ospdb_reload_rules(
+	ospdb_data_t *data)
+{
+	osprules_stats_t stats;
+	isc_boolean_t reloaded;
+	unsigned int line;
+	isc_result_t result;
+
+	if ((result = osprules_reload(data->rules, &reloaded, &line)) != ISC_R_SUCCESS) {
+		if (result == ISC_R_UNEXPECTEDTOKEN) {
+			OSPDB_LOG(ISC_LOG_WARNING, "Keep local rules, '%s' bad line '%u'", data->rulesfile, line);
+		} else {
+			OSPDB_LOG(ISC_LOG_WARNING, "Keep local rules, failed to reload '%s', error '%s'", data->rulesfile, isc_result_totext(result));
+		}
+	} else if (reloaded == ISC_TRUE) {
+		osprules_getstats(data->rules, &stats);
+		OSPDB_LOG(ISC_LOG_INFO, "Reloaded '%u' local rules from '%s'", stats.rules, data->rulesfile);
+		if (data->respcache == ISC_TRUE) {
+			ospresp_flush();
+		}
+	}
+}
+
+/*
+ * Run periodic jobs
+ * param data Running data structure
+ * param now Current time
+ */
+static void ospdb_do_housekeeping(
+	ospdb_data_t *data,
+	isc_stdtime_t now)
+{
+	if ((data->snapshotfile[0] != '\0') && (now >= data->snapshotnext)) {
+		ospdb_save_snapshot(data, now);
+		data->snapshotnext = now + data->snapshotinterval;
+	}
+
+	if ((data->replicadelta[0] != '\0') && (now >= data->replicanext)) {
+		ospdb_apply_delta(data);
+		data->replicanext = now + data->replicainterval;
+	}
+
+	if ((data->lnp != NULL) && (now >= data->lnpnext)) {
+		ospdb_reload_lnp(data);
+		data->lnpnext = now + data->lnpinterval;
+	}
+
+	if ((data->rules != NULL) && (now >= data->rulesnext)) {
+		ospdb_reload_rules(data);
+		data->rulesnext = now + data->rulesinterval;
+	}
+}
+
+/*
+ * Housekeeping thread, runs periodic jobs once a second until shutdown
+ * param arg Running data structure
+ */
+static isc_threadresult_t ospdb_run_housekeeping(
+	isc_threadarg_t arg)
+{
+	ospdb_data_t *data = (ospdb_data_t *)arg;
+	isc_interval_t interval;
+	isc_time_t deadline;
+	isc_stdtime_t now;
+
+	isc_interval_set(&interval, 1, 0);
+
+	LOCK(&data->tasklock);
+
+	while (data->shutdown == ISC_FALSE) {
+		if (isc_time_nowplusinterval(&deadline, &interval) == ISC_R_SUCCESS) {
+			isc_condition_waituntil(&data->housecond, &data->tasklock, &deadline);
+		}
+		if (data->shutdown == ISC_TRUE) {
+			break;
+		}
+
+		UNLOCK(&data->tasklock);
+
+		isc_stdtime_get(&now);
+		ospdb_do_housekeeping(data, now);
+
+		LOCK(&data->tasklock);
+	}
+
+	UNLOCK(&data->tasklock);
+
+	return ((isc_threadresult_t)0);
+}
+
+/*
+ * Start background threads, refresh threads are only used by serve stale and refresh ahead, the housekeeping thread
+ * only by periodic jobs
+ * param data Running data structure
+ * return ISC_R_SUCCESS successful, other failed
+ */
+static isc_result_t ospdb_start_threads(
+	ospdb_data_t *data)
+{
+	isc_stdtime_t now;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	OSPDB_LOG_START;
+
+	if ((data->servestale != 0) || (data->prefetch != 0)) {
+		while (data->nthreads < data->refreshthreads) {
+			if ((result = isc_thread_create(ospdb_run_tasks, data, &data->threads[data->nthreads])) != ISC_R_SUCCESS) {
+				OSPDB_LOG(ISC_LOG_ERROR, "Failed to create background thread, error '%s'", isc_result_totext(result));
+				ospdb_stop_threads(data);
+				break;
+			}
+			data->nthreads++;
+		}
+	}
+
+	if ((result == ISC_R_SUCCESS) && ((data->snapshotfile[0] != '\0') || (data->replicadelta[0] != '\0') || (data->lnp != NULL) || (data->rules != NULL))) {
+		isc_stdtime_get(&now);
+		data->snapshotnext = now + data->snapshotinterval;
+		data->replicanext = now;
+		data->lnpnext = now + data->lnpinterval;
+		data->rulesnext = now + data->rulesinterval;
+		if ((result = isc_thread_create(ospdb_run_housekeeping, data, &data->housekeeper)) == ISC_R_SUCCESS) {
+			data->househeld = ISC_TRUE;
+		} else {
+			OSPDB_LOG(ISC_LOG_ERROR, "Failed to create housekeeping thread, error '%s'", isc_result_totext(result));
+			ospdb_stop_threads(data);
+		}
+	}
+
+	OSPDB_LOG_END;
+
+	return result;
+}
+
+/*
+ * Check if a destination address matches a purge value, with or without brackets and port
+ * param dest Destination address, "[host]:port", "[host]" or "host"
+ * param value Purge value
+ * return ISC_TRUE match, ISC_FALSE no match
+ */
+static isc_boolean_t ospdb_match_destination(
+	const char *dest,
+	const char *value)
+{
+	const char *host = dest;
+	const char *end;
+	size_t length;
+
+	if (strcmp(dest, value) == 0) {
+		return ISC_TRUE;
+	}
+
+	if (*host == '[') {
+		host++;
+		end = strchr(host, ']');
+	} else {
+		end = strchr(host, ':');
+	}
+	length = (end != NULL) ? (size_t)(end - host) : strlen(host);
+
+	return ((strlen(value) == length) && (strncmp(host, value, length) == 0)) ? ISC_TRUE : ISC_FALSE;
+}
+
+/*
+ * Check if a cached route or negative result is covered by a purge, ospcache_purge and ospshm_purge function
+ * param arg Purge match info
+ * param prefix Key is a number prefix flag
+ * param key Cache key, "called|calling|source", or number prefix
+ * param count Number of destinations
+ * param dest Destinations
+ * return ISC_TRUE purge, ISC_FALSE keep
+ */
+static isc_boolean_t ospdb_match_route(
+	void *arg,
+	isc_boolean_t prefix,
+	const char *key,
+	int count,
+	const ospcache_dest_t *dest)
+{
+	ospdb_purgematch_t *match = (ospdb_purgematch_t *)arg;
+	size_t length = strlen(match->value);
+	size_t keylength = strlen(key);
+	int i;
+
+	switch (match->type) {
+	case OSPPURGE_NUMBER:
+		if (prefix == ISC_TRUE) {
+			/* The prefix route answers this number */
+			return (strncmp(match->value, key, keylength) == 0) ? ISC_TRUE : ISC_FALSE;
+		}
+		return ((strncmp(key, match->value, length) == 0) && (key[length] == '|')) ? ISC_TRUE : ISC_FALSE;
+	case OSPPURGE_PREFIX:
+		if ((prefix == ISC_TRUE) && (keylength < length)) {
+			/* The prefix route answers numbers under the purged prefix */
+			return (strncmp(match->value, key, keylength) == 0) ? ISC_TRUE : ISC_FALSE;
+		}
+		return (strncmp(key, match->value, length) == 0) ? ISC_TRUE : ISC_FALSE;
+	case OSPPURGE_DESTINATION:
+		for (i = 0; i < count; i++) {
+			if (ospdb_match_destination(dest[i].dest, match->value) == ISC_TRUE) {
+				return ISC_TRUE;
+			}
+		}
+		return ISC_FALSE;
+	default:
+		return ISC_FALSE;
+	}
+}
+
+/*
+ * Drop cached routes covered by a purge, osppurge function
+ * param arg Running data structure
+ * param type Purge type
+ * param value Called number, number prefix or destination
+ */
+static void ospdb_purge_routes(
+	void *arg,
+	int type,
+	const char *value)
+{
+	ospdb_data_t *data = (ospdb_data_t *)arg;
+	ospdb_purgematch_t match;
+	unsigned int count = 0;
+
+	match.type = type;
+	match.value = value;
+
+	if (data->cache != NULL) {
+		count += ospcache_purge(data->cache, ospdb_match_route, &match);
+	}
+	if (data->negcache != NULL) {
+		count += ospcache_purge(data->negcache, ospdb_match_route, &match);
+	}
+	if (data->shm != NULL) {
+		count += ospshm_purge(data->shm, ospdb_match_route, &match);
+	}
+
+	/* Rendered responses are not matched, they all go */
+	if (data->respcache == ISC_TRUE) {
+		ospresp_flush();
+	}
+
+	OSPDB_LOG(ISC_LOG_INFO, "Purged '%u' routes for %s '%s'",
+		count,
+		(type == OSPPURGE_NUMBER) ? "number" : ((type == OSPPURGE_PREFIX) ? "prefix" : "destination"),
+		value);
+}
+
+/*
+ * Map a route replica or local rules protocol name to an OSP protocol
+ * param name Protocol name
+ * return OSP protocol, -1 for unknown
+ */
+static int ospdb_get_protocol(
+	const char *name)
+{
+	if (strcmp(name, OSPDB_PROTOCOL_SIP) == 0) {
+		return OSPC_PROTNAME_SIP;
+	} else if (strcmp(name, OSPDB_PROTOCOL_H323) == 0) {
+		return OSPC_PROTNAME_Q931;
+	}
+
+	return -1;
+}
+
+/*
+ * Create route and negative caches, the route cache starts from the snapshot if there is one
+ * param data Running data structure
+ * return ISC_R_SUCCESS successful, other failed
+ */
+static isc_result_t ospdb_new_cache(
+	ospdb_data_t *data)
+{
+	isc_result_t result = ISC_R_SUCCESS;
+
+	if (data->cachesize != 0) {
+		result = ospcache_create(ns_g_mctx, (size_t)data->cachesize * 1024, data->servestale, &data->cache);
+		if (result == ISC_R_SUCCESS) {
+			ospcache_setprefetch(data->cache, data->prefetch, data->prefetchhits);
+			if ((data->prefixnum != 0) && ((result = ospcache_setprefix(data->cache, data->prefixentries)) != ISC_R_SUCCESS)) {
+				OSPDB_LOG(ISC_LOG_ERROR, "Failed to create prefix table, error '%s'", isc_result_totext(result));
+			} else {
+				ospdb_load_snapshot(data);
+			}
+		} else {
+			OSPDB_LOG(ISC_LOG_ERROR, "Failed to create route cache, error '%s'", isc_result_totext(result));
+		}
+	}
+
+	if ((result == ISC_R_SUCCESS) && (data->negcachesize != 0)) {
+		result = ospcache_create(ns_g_mctx, (size_t)data->negcachesize * 1024, 0, &data->negcache);
+		if (result != ISC_R_SUCCESS) {
+			OSPDB_LOG(ISC_LOG_ERROR, "Failed to create negative cache, error '%s'", isc_result_totext(result));
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Create or adopt route and negative caches, attach the shared table, map the route replica and the number portability dataset,
+ * compile the local rules and start cache replication and the invalidation listener
+ * param zone Zone name
+ * param data Running data structure
+ * return ISC_R_SUCCESS successful, other failed
+ */
+static isc_result_t ospdb_create_cache(
+	const char *zone,
+	ospdb_data_t *data)
+{
+	ospreplica_stats_t replicastats;
+	osplnp_stats_t lnpstats;
+	osprules_stats_t rulesstats;
+	unsigned int line;
+	isc_result_t optresult;	/* Result of optional parts, which do not fail the zone */
+	isc_result_t result = ISC_R_SUCCESS;
+
+	OSPDB_LOG_START;
+
+	/* A reloaded zone keeps its caches if their configuration did not change */
+	if ((data->cachesize == 0) && (data->negcachesize == 0)) {
+		/* Without caches */
+	} else if (ospdb_adopt_cache(zone, data) == ISC_TRUE) {
+		OSPDB_LOG(ISC_LOG_INFO, "Adopted caches of zone '%s'", zone);
+	} else if ((result = ospdb_new_cache(data)) == ISC_R_SUCCESS) {
+		ospdb_share_cache(zone, data);
+	}
+
+	/* The shared table only saves AuthReqs, run without it rather than fail the zone */
+	if ((result == ISC_R_SUCCESS) && (data->shmname[0] != '\0')) {
+		if (ospshm_attach(ns_g_mctx, data->shmname, (size_t)data->shmsize * 1024, &data->shm) != ISC_R_SUCCESS) {
+			OSPDB_LOG(ISC_LOG_ERROR, "Failed to attach shared table '%s'", data->shmname);
+		}
+	}
+
+	/* Replication fills the route cache, it is pointless without one, and like the shared table it is optional. Unsigned fills are never accepted */
+	if ((result == ISC_R_SUCCESS) && (data->cache != NULL) && (data->peeron == ISC_TRUE)) {
+		if (data->peersecret[0] == '\0') {
+			OSPDB_LOG(ISC_LOG_ERROR, "Cache replication requires %s", OSPDB_NAME_PEERSECRET);
+		} else {
+			optresult = osppeer_create(ns_g_mctx, data->cache, &data->peerlisten, data->peersecret, (isc_uint32_t)data->cachemaxttl, data->peernum, data->peeraddr, &data->peer);
+			if (optresult != ISC_R_SUCCESS) {
+				OSPDB_LOG(ISC_LOG_ERROR, "Failed to start cache replication, error '%s'", isc_result_totext(optresult));
+			}
+		}
+	}
+
+	/* Without the replica lookups fall back to the caches and the OSP server */
+	if ((result == ISC_R_SUCCESS) && (data->replicafile[0] != '\0')) {
+		optresult = ospreplica_create(ns_g_mctx, data->replicafile, ospdb_get_protocol, &data->replica);
+		if (optresult == ISC_R_SUCCESS) {
+			ospreplica_getstats(data->replica, &replicastats);
+			OSPDB_LOG(ISC_LOG_INFO, "Mapped '%u' prefixes from replica '%s'", replicastats.prefixes, data->replicafile);
+		} else {
+			OSPDB_LOG(ISC_LOG_ERROR, "Failed to load replica '%s', error '%s'", data->replicafile, isc_result_totext(optresult));
+		}
+	}
+
+	/* Without the dataset ported numbers are left to the OSP server */
+	if ((result == ISC_R_SUCCESS) && (data->lnpfile[0] != '\0')) {
+		optresult = osplnp_create(ns_g_mctx, data->lnpfile, &line, &data->lnp);
+		if (optresult == ISC_R_SUCCESS) {
+			osplnp_getstats(data->lnp, &lnpstats);
+			OSPDB_LOG(ISC_LOG_INFO, "Mapped '%u' ported numbers from '%s'", lnpstats.records, data->lnpfile);
+		} else if (optresult == ISC_R_UNEXPECTEDTOKEN) {
+			OSPDB_LOG(ISC_LOG_ERROR, "Failed to load number portability dataset '%s', bad line '%u'", data->lnpfile, line);
+		} else {
+			OSPDB_LOG(ISC_LOG_ERROR, "Failed to load number portability dataset '%s', error '%s'", data->lnpfile, isc_result_totext(optresult));
+		}
+	}
+
+	/* Without the rules every number goes the OSP way */
+	if ((result == ISC_R_SUCCESS) && (data->rulesfile[0] != '\0')) {
+		optresult = osprules_create(ns_g_mctx, data->rulesfile, ospdb_get_protocol, &line, &data->rules);
+		if (optresult == ISC_R_SUCCESS) {
+			osprules_getstats(data->rules, &rulesstats);
+			OSPDB_LOG(ISC_LOG_INFO, "Compiled '%u' local rules from '%s'", rulesstats.rules, data->rulesfile);
+		} else if (optresult == ISC_R_UNEXPECTEDTOKEN) {
+			OSPDB_LOG(ISC_LOG_ERROR, "Failed to load local rules '%s', bad line '%u'", data->rulesfile, line);
+		} else {
+			OSPDB_LOG(ISC_LOG_ERROR, "Failed to load local rules '%s', error '%s'", data->rulesfile, isc_result_totext(optresult));
+		}
+	}
+
+	/* Responses of all zones are kept in one cache, see ospresp.c */
+	if ((result == ISC_R_SUCCESS) && (data->respcachesize != 0)) {
+		ospresp_attach((size_t)data->respcachesize * 1024, ((data->cachekey & OSPDB_CACHEKEY_SOURCE) != 0) ? ISC_TRUE : ISC_FALSE);
+		data->respcache = ISC_TRUE;
+	}
+
+	/* Unsigned purges are never accepted */
+	if ((result == ISC_R_SUCCESS) && (data->purgeon == ISC_TRUE)) {
+		if (data->purgesecret[0] == '\0') {
+			OSPDB_LOG(ISC_LOG_ERROR, "Invalidation listener requires %s", OSPDB_NAME_PURGESECRET);
+		} else {
+			optresult = osppurge_create(ns_g_mctx, &data->purgelisten, data->purgesecret, ospdb_purge_routes, data, &data->purge);
+			if (optresult != ISC_R_SUCCESS) {
+				OSPDB_LOG(ISC_LOG_ERROR, "Failed to start invalidation listener, error '%s'", isc_result_totext(optresult));
+			}
+		}
+	}
+
+	OSPDB_LOG_END;
+
+	return result;
+}
+
+/*
+ * Log cache statistics
+ * param cache Cache handle
+ * param label Cache name
+ */
+static void ospdb_log_cache(
+	ospcache_t *cache,
+	const char *label)
+{
+	ospcache_stats_t stats;
+
+	if (cache != NULL) {
+		ospcache_getstats(cache, &stats);
+		OSPDB_LOG(ISC_LOG_INFO,
+			"%s "
+			"entries '%u' "
+			"memory '%lu' "
+			"hits '%llu' "
+			"misses '%llu' "
+			"stalehits '%llu' "
+			"prefetches '%llu' "
+			"prefixes '%u' "
+			"prefixhits '%llu' "
+			"prefixevictions '%llu' "
+			"snaphits '%llu' "
+			"purges '%llu' "
+			"wirehits '%llu' "
+			"inserts '%llu' "
+			"evictions '%llu' "
+			"expirations '%llu'",
+			label,
+			stats.entries,
+			(unsigned long)stats.memory,
+			(unsigned long long)stats.hits,
+			(unsigned long long)stats.misses,
+			(unsigned long long)stats.stalehits,
+			(unsigned long long)stats.prefetches,
+			stats.prefixes,
+			(unsigned long long)stats.prefixhits,
+			(unsigned long long)stats.prefixevictions,
+			(unsigned long long)stats.snaphits,
+			(unsigned long long)stats.purges,
+			(unsigned long long)stats.wirehits,
+			(unsigned long long)stats.inserts,
+			(unsigned long long)stats.evictions,
+			(unsigned long long)stats.expirations);
+	}
+}
+
+/*
+ * Free running data structure, OSP provider must have been detached
+ * param data Running data structure
+ */
+static void ospdb_free_data(
+	ospdb_data_t *data)
+{
+	ospshm_stats_t shmstats;
+	osppeer_stats_t peerstats;
+	osppurge_stats_t purgestats;
+	ospreplica_stats_t replicastats;
+	osplnp_stats_t lnpstats;
+	osprules_stats_t rulesstats;
+	ospresp_stats_t respstats;
+
+	OSPDB_LOG_START;
+
+	/* The invalidation listener purges all caches, stop it first */
+	if (data->purge != NULL) {
+		osppurge_getstats(data->purge, &purgestats);
+		OSPDB_LOG(ISC_LOG_INFO,
+			"Invalidation listener "
+			"accepted '%llu' "
+			"rejected '%llu'",
+			(unsigned long long)purgestats.accepted,
+			(unsigned long long)purgestats.rejected);
+		osppurge_destroy(&data->purge);
+	}
+
+	/* Replication writes into the route cache, stop it first */
+	if (data->peer != NULL) {
+		osppeer_getstats(data->peer, &peerstats);
+		OSPDB_LOG(ISC_LOG_INFO,
+			"Cache replication "
+			"sent '%llu' "
+			"received '%llu' "
+			"rejected '%llu' "
+			"syncs '%llu' "
+			"synced '%u'",
+			(unsigned long long)peerstats.sent,
+			(unsigned long long)peerstats.received,
+			(unsigned long long)peerstats.rejected,
+			(unsigned long long)peerstats.syncs,
+			peerstats.synced);
+		osppeer_destroy(&data->peer);
+	}
+
+	if (data->replica != NULL) {
+		ospreplica_getstats(data->replica, &replicastats);
+		OSPDB_LOG(ISC_LOG_INFO,
+			"Route replica '%s' "
+			"prefixes '%u' "
+			"destinations '%u' "
+			"strings '%lu' "
+			"hits '%llu' "
+			"misses '%llu' "
+			"deltas '%llu'",
+			data->replicafile,
+			replicastats.prefixes,
+			replicastats.dests,
+			(unsigned long)replicastats.strings,
+			(unsigned long long)replicastats.hits,
+			(unsigned long long)replicastats.misses,
+			(unsigned long long)replicastats.deltas);
+		ospreplica_destroy(&data->replica);
+	}
+
+	if (data->lnp != NULL) {
+		osplnp_getstats(data->lnp, &lnpstats);
+		OSPDB_LOG(ISC_LOG_INFO,
+			"Number portability dataset '%s' "
+			"records '%u' "
+			"hits '%llu' "
+			"misses '%llu' "
+			"reloads '%llu'",
+			data->lnpfile,
+			lnpstats.records,
+			(unsigned long long)lnpstats.hits,
+			(unsigned long long)lnpstats.misses,
+			(unsigned long long)lnpstats.reloads);
+		osplnp_destroy(&data->lnp);
+	}
+
+	if (data->rules != NULL) {
+		osprules_getstats(data->rules, &rulesstats);
+		OSPDB_LOG(ISC_LOG_INFO,
+			"Local rules '%s' "
+			"rules '%u' "
+			"nodes '%u' "
+			"hits '%llu' "
+			"misses '%llu' "
+			"reloads '%llu'",
+			data->rulesfile,
+			rulesstats.rules,
+			rulesstats.nodes,
+			(unsigned long long)rulesstats.hits,
+			(unsigned long long)rulesstats.misses,
+			(unsigned long long)rulesstats.reloads);
+		osprules_destroy(&data->rules);
+	}
+
+	if (data->respcache == ISC_TRUE) {
+		ospresp_getstats(&respstats);
+		OSPDB_LOG(ISC_LOG_INFO,
+			"Response cache "
+			"entries '%u' "
+			"memory '%lu' "
+			"hits '%llu' "
+			"misses '%llu' "
+			"inserts '%llu' "
+			"evictions '%llu' "
+			"flushes '%llu'",
+			respstats.entries,
+			(unsigned long)respstats.memory,
+			(unsigned long long)respstats.hits,
+			(unsigned long long)respstats.misses,
+			(unsigned long long)respstats.inserts,
+			(unsigned long long)respstats.evictions,
+			(unsigned long long)respstats.flushes);
+		ospresp_detach(((data->cachekey & OSPDB_CACHEKEY_SOURCE) != 0) ? ISC_TRUE : ISC_FALSE);
+		data->respcache = ISC_FALSE;
+	}
+
+	if (data->sharedcache != NULL) {
+		ospdb_detach_cache(data);
+	}
+
+	if (data->cache != NULL) {
+		ospdb_log_cache(data->cache, "Route cache");
+		ospcache_destroy(&data->cache);
+	}
+
+	if (data->negcache != NULL) {
+		ospdb_log_cache(data->negcache, "Negative cache");
+		ospcache_destroy(&data->negcache);
+	}
+
+	if (data->shm != NULL) {
+		ospshm_getstats(data->shm, &shmstats);
+		OSPDB_LOG(ISC_LOG_INFO,
+			"Shared table '%s' "
+			"slots '%u' "
+			"hits '%u' "
+			"misses '%u' "
+			"inserts '%u' "
+			"busy '%u'",
+			data->shmname,
+			shmstats.slots,
+			shmstats.hits,
+			shmstats.misses,
+			shmstats.inserts,
+			shmstats.busy);
+		ospshm_detach(&data->shm);
+	}
+
+	OSPDB_LOG(ISC_LOG_INFO, "Coalesced lookups '%llu'", (unsigned long long)data->coalesced);
+	OSPDB_LOG(ISC_LOG_INFO, "Refresh ahead drops '%llu'", (unsigned long long)data->prefetchdrops);
+
+	INSIST(data->nthreads == 0);
+	INSIST(data->househeld == ISC_FALSE);
+	INSIST(ISC_LIST_EMPTY(data->tasks));
+	isc_condition_destroy(&data->housecond);
+	isc_condition_destroy(&data->taskcond);
+	DESTROYLOCK(&data->tasklock);
+
+	INSIST(ISC_LIST_EMPTY(data->flights));
+	isc_condition_destroy(&data->flightcond);
+	DESTROYLOCK(&data->flightlock);
+
+	isc_quota_destroy(&data->inflight);
+
+	isc_mem_put(ns_g_mctx, data, sizeof(*data));
+
+	OSPDB_LOG_END;
+}
+
+/*
+ * Create call back function
+ */
+static isc_result_t ospdb_create(
+	const char *zone,
+	int argc,
+	char **argv,
+	void *driverdata,
+	void **dbdata)
+{
+	ospdb_config_t cfg;
+	ospdb_data_t *data;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	UNUSED(driverdata);
+
+	OSPDB_LOG_START;
+
+	/* Get running data structure */
+	data = isc_mem_get(ns_g_mctx, sizeof(*data));
+	if (data != NULL) {
+		/* Get configuration parameters, zeroed so that provider configurations compare as bytes */
+		memset(&cfg, 0, sizeof(cfg));
+		ospdb_init_config(&cfg, data);
+		ospdb_get_config(argc, argv, &cfg, data);
+		ospdb_check_config(&cfg, data);
+		ospdb_dump_config(&cfg, data);
+
+		/* Init in-flight AuthReq quota, 0 for unlimited */
+		if ((result = isc_quota_init(&data->inflight, data->maxinflight)) != ISC_R_SUCCESS) {
+			OSPDB_LOG(ISC_LOG_ERROR, "%s", "Failed to init in-flight quota");
+			isc_mem_put(ns_g_mctx, data, sizeof(*data));
+		} else if ((result = ospdb_init_flights(data)) != ISC_R_SUCCESS) {
+			isc_quota_destroy(&data->inflight);
+			isc_mem_put(ns_g_mctx, data, sizeof(*data));
+		} else if ((result = ospdb_create_cache(zone, data)) != ISC_R_SUCCESS) {
+			ospdb_free_data(data);
+		} else if ((result = ospdb_attach_provider(zone, &cfg, data)) != ISC_R_SUCCESS) {
+			ospdb_free_data(data);
+		} else if ((result = ospdb_start_threads(data)) != ISC_R_SUCCESS) {
+			ospdb_detach_provider(data);
+			ospdb_free_data(data);
+		} else {
+			*dbdata = data;
+		}
+	} else {
+		OSPDB_LOG(ISC_LOG_ERROR, "%s", "Failed to get memory");
+		result = ISC_R_NOMEMORY;
+	}
+
+	OSPDB_LOG_END;
+
+	return result;
+}
+
+/*
+ * Destroy call back function
+ */
+static void ospdb_destroy(
+	const char *zone,
+	void *driverdata,
+	void **dbdata)
+{
+	ospdb_data_t *data = *dbdata;
+	isc_stdtime_t now;
 
 	UNUSED(zone);
 	UNUSED(driverdata);
 
 	OSPDB_LOG_START;
 
-	/* Delete OSP provider */
-	ospdb_delete_provider(data->provider);
+	/* Stop background AuthReqs before the provider goes away */
+	ospdb_stop_threads(data);
+
+	/* Keep the working set for the next instance */
+	isc_stdtime_get(&now);
+	ospdb_save_snapshot(data, now);
+
+	/* Delete OSP provider unless a new instance of the zone adopted it */
+	ospdb_detach_provider(data);
 
 	/* Free running data structure */
-	isc_mem_put(ns_g_mctx, data, sizeof(*data));
+	ospdb_free_data(data);
 
 	OSPDB_LOG_END;
 }
@@ -1525,12 +4492,12 @@ static void ospdb_destroy(
  * Call back function list structure
  */
 static dns_sdbmethods_t ospdb_methods = {
-	ospdb_lookup,
+	NULL,				/* lookup, lookup2 is used instead */
 	ospdb_authority,
 	NULL,				/* allnodes */
 	ospdb_create,
 	ospdb_destroy,
-	NULL				/* lookup2 */
+	ospdb_lookup2
 };
 
 /*
@@ -1539,7 +4506,7 @@ static dns_sdbmethods_t ospdb_methods = {
 isc_result_t ospdb_init(void)
 {
 	int error = OSPC_ERR_NO_ERROR;
-	unsigned int flags = DNS_SDBFLAG_RELATIVEOWNER | DNS_SDBFLAG_RELATIVERDATA | DNS_SDBFLAG_THREADSAFE;
+	unsigned int flags = DNS_SDBFLAG_RELATIVEOWNER | DNS_SDBFLAG_RELATIVERDATA | DNS_SDBFLAG_THREADSAFE | DNS_SDBFLAG_STATICAPEX;
 	isc_result_t result = ISC_R_FAILURE;
 
 	OSPDB_LOG_START;
@@ -1548,8 +4515,21 @@ isc_result_t ospdb_init(void)
 	if ((error = OSPPInit(OSPC_FALSE)) == OSPC_ERR_NO_ERROR) {
 		ospdb_init_flag = ISC_TRUE;
 
-		/* Register OSP SDB driver */
-		result = dns_sdb_register("osp", &ospdb_methods, NULL, flags, ns_g_mctx, &ospdb);
+		/* Objects kept across zone reloads */
+		ISC_LIST_INIT(ospdb_sharedlist);
+		if ((result = isc_mutex_init(&ospdb_sharedlock)) != ISC_R_SUCCESS) {
+			OSPDB_LOG(ISC_LOG_ERROR, "%s", "Failed to init shared object lock");
+		} else {
+			ospdb_shared_flag = ISC_TRUE;
+
+			/* Response cache stays disabled until a zone attaches */
+			if ((result = ospresp_init(ns_g_mctx)) != ISC_R_SUCCESS) {
+				OSPDB_LOG(ISC_LOG_ERROR, "Failed to initialize response cache, error '%s'", isc_result_totext(result));
+			} else {
+				/* Register OSP SDB driver */
+				result = dns_sdb_register("osp", &ospdb_methods, NULL, flags, ns_g_mctx, &ospdb);
+			}
+		}
 	} else {
 		OSPDB_LOG(ISC_LOG_ERROR, "Failed to initialize OSP client, error '%d'", error);
 	}
@@ -1572,6 +4552,14 @@ void ospdb_clear(void)
 			dns_sdb_unregister(&ospdb);
 		}
 
+		/* All zones are gone */
+		ospresp_clear();
+		if (ospdb_shared_flag == ISC_TRUE) {
+			INSIST(ISC_LIST_EMPTY(ospdb_sharedlist));
+			DESTROYLOCK(&ospdb_sharedlock);
+			ospdb_shared_flag = ISC_FALSE;
+		}
+
 		/* Cleanup OSP client */
 		OSPPCleanup();
 	}
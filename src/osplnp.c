@@ -0,0 +1,682 @@
+/*
+ * osplnp.c
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <isc/crc64.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/rwlock.h>
+#include <isc/stdtime.h>
+#include <isc/util.h>
+
+#include "osplnp.h"
+
+/*
+ * The source is a text file, one ported number per line, "number lrn [cic]", lines starting with '#' are comments. It
+ * is compiled into an index file next to it, records sorted by number, which is memory mapped read only and reused as
+ * long as the source is unchanged. A source that already is an index file is mapped as is.
+ *
+ * Numbers are packed into 64 bits, the digit count above the value, so a lookup is a binary search over integers.
+ */
+
+/* Constant */
+#define OSPLNP_MAGIC		"OSPLNP"	/* Index file magic */
+#define OSPLNP_VERSION		1			/* Index file format version */
+#define OSPLNP_SUFFIX		".idx"		/* Index file name suffix */
+#define OSPLNP_PATH_SIZE	1024		/* File path length */
+#define OSPLNP_LINE_SIZE	256			/* Max source line length */
+#define OSPLNP_MIN_RECORDS	65536		/* Min number of builder records */
+#define OSPLNP_NUM_SHIFT	56			/* Number digit count position */
+#define OSPLNP_CIC_SHIFT	28			/* CIC digit count position */
+
+/* Index file header. The file is the header then the records. The checksum covers the records. */
+typedef struct osplnp_header {
+	char magic[8];				/* OSPLNP_MAGIC */
+	isc_uint32_t version;		/* OSPLNP_VERSION */
+	isc_uint32_t count;			/* Number of records */
+	isc_uint64_t srcmtime;		/* Source modification time, 0 for an index built elsewhere */
+	isc_uint64_t srcsize;		/* Source size */
+	isc_uint64_t checksum;		/* CRC-64 of the records */
+	isc_uint64_t created;		/* Creation time */
+} osplnp_header_t;
+
+/* Record */
+typedef struct osplnp_record {
+	isc_uint64_t number;		/* Packed ported number */
+	isc_uint64_t lrn;			/* Packed Location Routing Number */
+	isc_uint32_t cic;			/* Packed Carrier Identification Code, 0 for none */
+	isc_uint32_t reserved;		/* Reserved, 0 */
+} osplnp_record_t;
+
+/* Mapped index */
+typedef struct osplnp_index {
+	void *base;							/* Mapping */
+	size_t size;						/* Mapping size */
+	const osplnp_header_t *header;		/* Header */
+	const osplnp_record_t *records;		/* Records */
+	time_t srcmtime;					/* Source modification time when mapped */
+	off_t srcsize;						/* Source size when mapped */
+} osplnp_index_t;
+
+/* Number portability dataset */
+struct osplnp {
+	isc_mem_t *mctx;					/* Memory context */
+	char path[OSPLNP_PATH_SIZE];		/* Source file */
+	isc_rwlock_t lock;					/* Held for read by lookups, for write only to swap the index */
+	osplnp_index_t *index;				/* Current index */
+	isc_mutex_t statslock;				/* Statistics lock */
+	isc_uint64_t hits;					/* Number of ported numbers found */
+	isc_uint64_t misses;				/* Number of numbers not found */
+	isc_uint64_t reloads;				/* Number of reloads */
+};
+
+/*
+ * Pack a digit string
+ * param str Digit string
+ * param maxdigits Max number of digits
+ * param shift Digit count position
+ * param value Packed value buffer
+ * return ISC_R_SUCCESS successful, ISC_R_RANGE empty, too long or not digits
+ */
+static isc_result_t osplnp_pack(
+	const char *str,
+	size_t maxdigits,
+	unsigned int shift,
+	isc_uint64_t *value)
+{
+	size_t length = strlen(str);
+	const char *p;
+
+	if ((length == 0) || (length > maxdigits)) {
+		return ISC_R_RANGE;
+	}
+
+	*value = 0;
+	for (p = str; *p != '\0'; p++) {
+		if ((*p < '0') || (*p > '9')) {
+			return ISC_R_RANGE;
+		}
+		*value = *value * 10 + (*p - '0');
+	}
+	*value |= (isc_uint64_t)length << shift;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Unpack a digit string
+ * param value Packed value
+ * param shift Digit count position
+ * param str String buffer
+ * param size String buffer size
+ */
+static void osplnp_unpack(
+	isc_uint64_t value,
+	unsigned int shift,
+	char *str,
+	size_t size)
+{
+	size_t length = (size_t)(value >> shift);
+
+	if (length >= size) {
+		str[0] = '\0';
+		return;
+	}
+
+	value &= ((isc_uint64_t)1 << shift) - 1;
+	str[length] = '\0';
+	while (length > 0) {
+		str[--length] = '0' + (char)(value % 10);
+		value /= 10;
+	}
+}
+
+/*
+ * Order records by number
+ * param a Record
+ * param b Record
+ * return <0, 0, >0
+ */
+static int osplnp_compare_records(
+	const void *a,
+	const void *b)
+{
+	const osplnp_record_t *reca = a;
+	const osplnp_record_t *recb = b;
+
+	return (reca->number < recb->number) ? -1 : ((reca->number > recb->number) ? 1 : 0);
+}
+
+/*
+ * Compile source into an index file, replaced atomically. Of duplicate numbers the last line wins.
+ * param mctx Memory context
+ * param path Source file path
+ * param st Source file status
+ * param idxpath Index file path
+ * param line Number of lines read buffer, the offending line on format errors
+ * return ISC_R_SUCCESS successful, ISC_R_FILENOTFOUND no source, ISC_R_UNEXPECTEDTOKEN bad line, other failed
+ */
+static isc_result_t osplnp_compile(
+	isc_mem_t *mctx,
+	const char *path,
+	const struct stat *st,
+	const char *idxpath,
+	unsigned int *line)
+{
+	char buffer[OSPLNP_LINE_SIZE];
+	char tmppath[OSPLNP_PATH_SIZE];
+	char *number, *lrn, *cic, *saveptr = NULL;
+	osplnp_record_t *records = NULL, *tmp, *record;
+	size_t count = 0, maxcount = 0, i, j;
+	osplnp_header_t header;
+	isc_uint64_t cicvalue, crc;
+	isc_stdtime_t now;
+	FILE *fp;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	*line = 0;
+
+	if (snprintf(tmppath, sizeof(tmppath), "%s.tmp", idxpath) >= (int)sizeof(tmppath)) {
+		return ISC_R_NOSPACE;
+	}
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		return ISC_R_FILENOTFOUND;
+	}
+
+	while ((result == ISC_R_SUCCESS) && (fgets(buffer, sizeof(buffer), fp) != NULL)) {
+		(*line)++;
+
+		if (((number = strtok_r(buffer, " \t\r\n", &saveptr)) == NULL) || (number[0] == '#')) {
+			continue;
+		}
+
+		if (count == maxcount) {
+			maxcount = (maxcount == 0) ? OSPLNP_MIN_RECORDS : maxcount * 2;
+			if ((tmp = isc_mem_get(mctx, maxcount * sizeof(osplnp_record_t))) == NULL) {
+				result = ISC_R_NOMEMORY;
+				break;
+			}
+			if (records != NULL) {
+				memcpy(tmp, records, count * sizeof(osplnp_record_t));
+				isc_mem_put(mctx, records, (maxcount / 2) * sizeof(osplnp_record_t));
+			}
+			records = tmp;
+		}
+
+		record = &records[count];
+		lrn = strtok_r(NULL, " \t\r\n", &saveptr);
+		cic = strtok_r(NULL, " \t\r\n", &saveptr);
+		cicvalue = 0;
+		if ((lrn == NULL) ||
+			(osplnp_pack(number, OSPLNP_NUM_SIZE - 1, OSPLNP_NUM_SHIFT, &record->number) != ISC_R_SUCCESS) ||
+			(osplnp_pack(lrn, OSPLNP_NUM_SIZE - 1, OSPLNP_NUM_SHIFT, &record->lrn) != ISC_R_SUCCESS) ||
+			((cic != NULL) && (osplnp_pack(cic, OSPLNP_CIC_SIZE - 1, OSPLNP_CIC_SHIFT, &cicvalue) != ISC_R_SUCCESS)))
+		{
+			result = ISC_R_UNEXPECTEDTOKEN;
+			break;
+		}
+		record->cic = (isc_uint32_t)cicvalue;
+		record->reserved = 0;
+		count++;
+	}
+
+	fclose(fp);
+
+	if ((result == ISC_R_SUCCESS) && (count != 0)) {
+		/* qsort is not stable, reserved carries the line order so that the last line of a duplicate number wins */
+		for (i = 0; i < count; i++) {
+			records[i].reserved = (isc_uint32_t)i;
+		}
+		qsort(records, count, sizeof(osplnp_record_t), osplnp_compare_records);
+		for (i = 0, j = 0; i < count; i++) {
+			if ((j != 0) && (records[j - 1].number == records[i].number)) {
+				if (records[i].reserved > records[j - 1].reserved) {
+					records[j - 1] = records[i];
+				}
+			} else {
+				records[j++] = records[i];
+			}
+		}
+		for (i = 0; i < j; i++) {
+			records[i].reserved = 0;
+		}
+		count = j;
+	}
+
+	if ((result == ISC_R_SUCCESS) && ((fp = fopen(tmppath, "wb")) == NULL)) {
+		result = ISC_R_FAILURE;
+	}
+
+	if (result == ISC_R_SUCCESS) {
+		isc_stdtime_get(&now);
+
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, OSPLNP_MAGIC, sizeof(OSPLNP_MAGIC));
+		header.version = OSPLNP_VERSION;
+		header.count = (isc_uint32_t)count;
+		header.srcmtime = (isc_uint64_t)st->st_mtime;
+		header.srcsize = (isc_uint64_t)st->st_size;
+		header.created = now;
+
+		isc_crc64_init(&crc);
+		isc_crc64_update(&crc, records, count * sizeof(osplnp_record_t));
+		isc_crc64_final(&crc);
+		header.checksum = crc;
+
+		if ((fwrite(&header, sizeof(header), 1, fp) != 1) ||
+			((count != 0) && (fwrite(records, sizeof(osplnp_record_t), count, fp) != count)) ||
+			(fflush(fp) != 0) ||
+			(fsync(fileno(fp)) != 0))
+		{
+			result = ISC_R_FAILURE;
+		}
+
+		if ((fclose(fp) != 0) && (result == ISC_R_SUCCESS)) {
+			result = ISC_R_FAILURE;
+		}
+
+		if ((result == ISC_R_SUCCESS) && (rename(tmppath, idxpath) != 0)) {
+			result = ISC_R_FAILURE;
+		}
+
+		if (result != ISC_R_SUCCESS) {
+			unlink(tmppath);
+		}
+	}
+
+	if (records != NULL) {
+		isc_mem_put(mctx, records, maxcount * sizeof(osplnp_record_t));
+	}
+
+	return result;
+}
+
+/*
+ * Unmap index
+ * param mctx Memory context
+ * param indexp Mapped index
+ */
+static void osplnp_unmap_index(
+	isc_mem_t *mctx,
+	osplnp_index_t **indexp)
+{
+	munmap((*indexp)->base, (*indexp)->size);
+	isc_mem_put(mctx, *indexp, sizeof(osplnp_index_t));
+	*indexp = NULL;
+}
+
+/*
+ * Map and check index file
+ * param mctx Memory context
+ * param path Index file path
+ * param indexp Mapped index buffer
+ * return ISC_R_SUCCESS successful, ISC_R_FILENOTFOUND no index, ISC_R_INVALIDFILE wrong version, size or content, other failed
+ */
+static isc_result_t osplnp_map_index(
+	isc_mem_t *mctx,
+	const char *path,
+	osplnp_index_t **indexp)
+{
+	osplnp_index_t *index;
+	const osplnp_header_t *header;
+	const osplnp_record_t *records;
+	struct stat st;
+	isc_uint64_t crc;
+	isc_uint32_t i;
+	void *base;
+	int fd;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return ISC_R_FILENOTFOUND;
+	}
+	if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(osplnp_header_t))) {
+		close(fd);
+		return ISC_R_INVALIDFILE;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return ISC_R_FAILURE;
+	}
+	header = base;
+	records = (const osplnp_record_t *)(header + 1);
+
+	if ((memcmp(header->magic, OSPLNP_MAGIC, sizeof(OSPLNP_MAGIC)) != 0) ||
+		(header->version != OSPLNP_VERSION) ||
+		(sizeof(osplnp_header_t) + (isc_uint64_t)header->count * sizeof(osplnp_record_t) != (isc_uint64_t)st.st_size))
+	{
+		result = ISC_R_INVALIDFILE;
+	}
+
+	if (result == ISC_R_SUCCESS) {
+		isc_crc64_init(&crc);
+		isc_crc64_update(&crc, records, header->count * sizeof(osplnp_record_t));
+		isc_crc64_final(&crc);
+		if (crc != header->checksum) {
+			result = ISC_R_INVALIDFILE;
+		}
+	}
+
+	/* Lookups rely on the order */
+	for (i = 1; (i < header->count) && (result == ISC_R_SUCCESS); i++) {
+		if (records[i - 1].number >= records[i].number) {
+			result = ISC_R_INVALIDFILE;
+		}
+	}
+
+	if ((result == ISC_R_SUCCESS) && ((index = isc_mem_get(mctx, sizeof(*index))) == NULL)) {
+		result = ISC_R_NOMEMORY;
+	}
+
+	if (result != ISC_R_SUCCESS) {
+		munmap(base, st.st_size);
+		return result;
+	}
+
+	index->base = base;
+	index->size = st.st_size;
+	index->header = header;
+	index->records = records;
+	index->srcmtime = 0;
+	index->srcsize = 0;
+
+	*indexp = index;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Load the index for a source, compiling it if the source changed
+ * param mctx Memory context
+ * param path Source file path
+ * param line Number of lines read buffer, the offending line on format errors
+ * param indexp Mapped index buffer
+ * return ISC_R_SUCCESS successful, ISC_R_FILENOTFOUND no source, ISC_R_UNEXPECTEDTOKEN bad line, other failed
+ */
+static isc_result_t osplnp_load_index(
+	isc_mem_t *mctx,
+	const char *path,
+	unsigned int *line,
+	osplnp_index_t **indexp)
+{
+	char idxpath[OSPLNP_PATH_SIZE];
+	char magic[sizeof(OSPLNP_MAGIC)];
+	osplnp_index_t *index = NULL;
+	struct stat st;
+	FILE *fp;
+	isc_result_t result;
+
+	*line = 0;
+
+	if (snprintf(idxpath, sizeof(idxpath), "%s%s", path, OSPLNP_SUFFIX) >= (int)sizeof(idxpath)) {
+		return ISC_R_NOSPACE;
+	}
+
+	if ((stat(path, &st) != 0) || ((fp = fopen(path, "rb")) == NULL)) {
+		return ISC_R_FILENOTFOUND;
+	}
+	if (fread(magic, sizeof(magic), 1, fp) != 1) {
+		memset(magic, 0, sizeof(magic));
+	}
+	fclose(fp);
+
+	if (memcmp(magic, OSPLNP_MAGIC, sizeof(magic)) == 0) {
+		/* Built elsewhere */
+		result = osplnp_map_index(mctx, path, &index);
+	} else {
+		result = osplnp_map_index(mctx, idxpath, &index);
+		if ((result == ISC_R_SUCCESS) &&
+			((index->header->srcmtime != (isc_uint64_t)st.st_mtime) || (index->header->srcsize != (isc_uint64_t)st.st_size)))
+		{
+			osplnp_unmap_index(mctx, &index);
+			result = ISC_R_INVALIDFILE;
+		}
+		if ((result != ISC_R_SUCCESS) && ((result = osplnp_compile(mctx, path, &st, idxpath, line)) == ISC_R_SUCCESS)) {
+			result = osplnp_map_index(mctx, idxpath, &index);
+		}
+	}
+
+	if (result == ISC_R_SUCCESS) {
+		index->srcmtime = st.st_mtime;
+		index->srcsize = st.st_size;
+		*indexp = index;
+	}
+
+	return result;
+}
+
+/*
+ * Create number portability dataset
+ * param mctx Memory context
+ * param path Source file, text or index
+ * param line Number of lines read buffer, the offending line on format errors
+ * param lnpp Number portability dataset handle buffer
+ * return ISC_R_SUCCESS successful, ISC_R_FILENOTFOUND no source, ISC_R_UNEXPECTEDTOKEN bad line, other failed
+ */
+isc_result_t osplnp_create(
+	isc_mem_t *mctx,
+	const char *path,
+	unsigned int *line,
+	osplnp_t **lnpp)
+{
+	osplnp_t *lnp;
+	osplnp_index_t *index = NULL;
+	isc_result_t result;
+
+	REQUIRE(lnpp != NULL && *lnpp == NULL);
+
+	*line = 0;
+
+	if (strlen(path) >= sizeof(lnp->path)) {
+		return ISC_R_NOSPACE;
+	}
+
+	if ((result = osplnp_load_index(mctx, path, line, &index)) != ISC_R_SUCCESS) {
+		return result;
+	}
+
+	if ((lnp = isc_mem_get(mctx, sizeof(*lnp))) == NULL) {
+		osplnp_unmap_index(mctx, &index);
+		return ISC_R_NOMEMORY;
+	}
+	lnp->mctx = NULL;
+	isc_mem_attach(mctx, &lnp->mctx);
+	snprintf(lnp->path, sizeof(lnp->path), "%s", path);
+	lnp->index = index;
+	lnp->hits = 0;
+	lnp->misses = 0;
+	lnp->reloads = 0;
+
+	if ((result = isc_rwlock_init(&lnp->lock, 0, 0)) != ISC_R_SUCCESS) {
+		osplnp_unmap_index(mctx, &lnp->index);
+		isc_mem_putanddetach(&lnp->mctx, lnp, sizeof(*lnp));
+		return result;
+	}
+	if ((result = isc_mutex_init(&lnp->statslock)) != ISC_R_SUCCESS) {
+		isc_rwlock_destroy(&lnp->lock);
+		osplnp_unmap_index(mctx, &lnp->index);
+		isc_mem_putanddetach(&lnp->mctx, lnp, sizeof(*lnp));
+		return result;
+	}
+
+	*lnpp = lnp;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Destroy number portability dataset, the index file stays for the next start
+ * param lnpp Number portability dataset handle
+ */
+void osplnp_destroy(
+	osplnp_t **lnpp)
+{
+	osplnp_t *lnp;
+
+	REQUIRE(lnpp != NULL && *lnpp != NULL);
+
+	lnp = *lnpp;
+
+	osplnp_unmap_index(lnp->mctx, &lnp->index);
+	DESTROYLOCK(&lnp->statslock);
+	isc_rwlock_destroy(&lnp->lock);
+	isc_mem_putanddetach(&lnp->mctx, lnp, sizeof(*lnp));
+
+	*lnpp = NULL;
+}
+
+/*
+ * Get LRN and CIC of a ported number
+ * param lnp Number portability dataset handle
+ * param number Called number
+ * param lrn LRN buffer
+ * param lrnsize LRN buffer size
+ * param cic CIC buffer, empty for none
+ * param cicsize CIC buffer size
+ * return ISC_R_SUCCESS ported, ISC_R_NOTFOUND not ported or not a number
+ */
+isc_result_t osplnp_lookup(
+	osplnp_t *lnp,
+	const char *number,
+	char *lrn,
+	size_t lrnsize,
+	char *cic,
+	size_t cicsize)
+{
+	const osplnp_index_t *index;
+	const osplnp_record_t *record = NULL;
+	isc_uint64_t value;
+	isc_uint32_t low, high, middle;
+	isc_result_t result = ISC_R_NOTFOUND;
+
+	if (osplnp_pack(number, OSPLNP_NUM_SIZE - 1, OSPLNP_NUM_SHIFT, &value) == ISC_R_SUCCESS) {
+		RWLOCK(&lnp->lock, isc_rwlocktype_read);
+
+		index = lnp->index;
+		low = 0;
+		high = index->header->count;
+		while (low < high) {
+			middle = low + (high - low) / 2;
+			if (index->records[middle].number == value) {
+				record = &index->records[middle];
+				break;
+			} else if (index->records[middle].number < value) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+
+		if (record != NULL) {
+			osplnp_unpack(record->lrn, OSPLNP_NUM_SHIFT, lrn, lrnsize);
+			osplnp_unpack(record->cic, OSPLNP_CIC_SHIFT, cic, cicsize);
+			result = ISC_R_SUCCESS;
+		}
+
+		RWUNLOCK(&lnp->lock, isc_rwlocktype_read);
+	}
+
+	LOCK(&lnp->statslock);
+	if (result == ISC_R_SUCCESS) {
+		lnp->hits++;
+	} else {
+		lnp->misses++;
+	}
+	UNLOCK(&lnp->statslock);
+
+	return result;
+}
+
+/*
+ * Reload the dataset if its source changed, the new index is swapped in and lookups are only held up by the swap
+ * itself. Must not be called from two threads at once.
+ * param lnp Number portability dataset handle
+ * param reloaded Reloaded flag buffer
+ * param line Number of lines read buffer, the offending line on format errors
+ * return ISC_R_SUCCESS successful or unchanged, ISC_R_FILENOTFOUND no source, ISC_R_UNEXPECTEDTOKEN bad line, other failed
+ */
+isc_result_t osplnp_reload(
+	osplnp_t *lnp,
+	isc_boolean_t *reloaded,
+	unsigned int *line)
+{
+	osplnp_index_t *index = NULL, *old;
+	struct stat st;
+	isc_result_t result;
+
+	*reloaded = ISC_FALSE;
+	*line = 0;
+
+	/* Only this thread swaps the index, so it can be read without the lock */
+	if (stat(lnp->path, &st) != 0) {
+		return ISC_R_FILENOTFOUND;
+	}
+	if ((st.st_mtime == lnp->index->srcmtime) && (st.st_size == lnp->index->srcsize)) {
+		return ISC_R_SUCCESS;
+	}
+
+	if ((result = osplnp_load_index(lnp->mctx, lnp->path, line, &index)) != ISC_R_SUCCESS) {
+		return result;
+	}
+
+	RWLOCK(&lnp->lock, isc_rwlocktype_write);
+	old = lnp->index;
+	lnp->index = index;
+	RWUNLOCK(&lnp->lock, isc_rwlocktype_write);
+
+	osplnp_unmap_index(lnp->mctx, &old);
+
+	LOCK(&lnp->statslock);
+	lnp->reloads++;
+	UNLOCK(&lnp->statslock);
+
+	*reloaded = ISC_TRUE;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Get statistics
+ * param lnp Number portability dataset handle
+ * param stats Statistics buffer
+ */
+void osplnp_getstats(
+	osplnp_t *lnp,
+	osplnp_stats_t *stats)
+{
+	LOCK(&lnp->statslock);
+	stats->hits = lnp->hits;
+	stats->misses = lnp->misses;
+	stats->reloads = lnp->reloads;
+	UNLOCK(&lnp->statslock);
+
+	RWLOCK(&lnp->lock, isc_rwlocktype_read);
+	stats->records = lnp->index->header->count;
+	RWUNLOCK(&lnp->lock, isc_rwlocktype_read);
+}
+
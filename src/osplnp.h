@@ -0,0 +1,47 @@
+/*
+ * osplnp.h
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OSPLNP_H
+#define OSPLNP_H	1
+
+#include <isc/types.h>
+
+/* Buffer size */
+#define OSPLNP_NUM_SIZE		16		/* Number and LRN length, 15 digits */
+#define OSPLNP_CIC_SIZE		8		/* Carrier Identification Code length, 7 digits */
+
+/* Number portability statistics */
+typedef struct osplnp_stats {
+	isc_uint64_t hits;			/* Number of ported numbers found */
+	isc_uint64_t misses;		/* Number of numbers not found */
+	isc_uint64_t reloads;		/* Number of reloads */
+	unsigned int records;		/* Current number of records */
+} osplnp_stats_t;
+
+/* Number portability dataset handle */
+typedef struct osplnp osplnp_t;
+
+isc_result_t osplnp_create(isc_mem_t *mctx, const char *path, unsigned int *line, osplnp_t **lnpp);
+void osplnp_destroy(osplnp_t **lnpp);
+isc_result_t osplnp_lookup(osplnp_t *lnp, const char *number, char *lrn, size_t lrnsize, char *cic, size_t cicsize);
+isc_result_t osplnp_reload(osplnp_t *lnp, isc_boolean_t *reloaded, unsigned int *line);
+void osplnp_getstats(osplnp_t *lnp, osplnp_stats_t *stats);
+
+#endif /* OSPLNP_H */
+
@@ -0,0 +1,904 @@
+/*
+ * osppeer.c
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <isc/hmacsha.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/thread.h>
+#include <isc/util.h>
+
+#include "osppeer.h"
+
+/*
+ * A peer message is one UDP datagram:
+ *
+ *   <magic> <version> <type> <flags> <reserved> <time> <body> <signature>
+ *
+ * time is the sender's UNIX time in 4 bytes and signature is the HMAC-SHA256, keyed by the shared secret, of
+ * everything before it. Messages with a bad signature or more than OSPPEER_WINDOW seconds away from local time are
+ * dropped before the body is looked at. A replayed fill inside the window only repeats a route the peer did send.
+ */
+
+/* Constant */
+#define OSPPEER_MAGIC			"OSPP"			/* Message magic */
+#define OSPPEER_VERSION			2				/* Message format version */
+#define OSPPEER_HDR_SIZE		12				/* Message header size, magic, version, type, flags, reserved, time */
+#define OSPPEER_MSG_SIZE		8192			/* Max message size, a full route fits */
+#define OSPPEER_TIMEOUT			1				/* Receive timeout in seconds, bounds shutdown delay */
+#define OSPPEER_SYNC_INTERVAL	5				/* Seconds between bulk sync requests to a peer that has not answered */
+#define OSPPEER_SYNC_ATTEMPTS	3				/* Max number of bulk sync requests per peer */
+#define OSPPEER_SYNC_BATCH		64				/* Number of bulk sync messages sent between pauses */
+#define OSPPEER_SYNC_PAUSE		1000			/* Pause between bulk sync batches in microseconds */
+#define OSPPEER_SYNC_BUFFER		(64 * 1024)		/* Initial bulk sync buffer size, doubled as needed */
+#define OSPPEER_RCVBUF			(4 * 1024 * 1024)	/* Receive buffer size, absorbs a bulk sync burst */
+#define OSPPEER_WINDOW			30				/* Max clock difference in seconds */
+#define OSPPEER_SECRET_SIZE		256				/* Max secret length */
+
+/* Message type */
+#define OSPPEER_MSG_FILL		1				/* Route, flags, TTL, key and destinations follow the header */
+#define OSPPEER_MSG_SYNC		2				/* Request for all fresh routes of the receiver */
+#define OSPPEER_MSG_SYNCEND		3				/* End of a bulk sync */
+
+/* Message flag */
+#define OSPPEER_FLAG_PREFIX		0x01			/* Key is a number prefix */
+
+/* Peer */
+typedef struct osppeer_node {
+	isc_sockaddr_t address;		/* Peer address */
+	isc_boolean_t synced;		/* Bulk sync from this peer completed flag */
+	int attempts;				/* Number of bulk sync requests sent */
+	isc_stdtime_t lastsync;		/* Last time a bulk sync was served to this peer */
+} osppeer_node_t;
+
+/* Replication */
+struct osppeer {
+	isc_mem_t *mctx;							/* Memory context */
+	ospcache_t *cache;							/* Route cache */
+	int fd;										/* UDP socket */
+	char secret[OSPPEER_SECRET_SIZE];			/* HMAC key */
+	isc_uint32_t maxttl;						/* Max TTL of routes received */
+	int npeers;									/* Number of peers */
+	osppeer_node_t nodes[OSPPEER_MAX_PEERS];	/* Peers */
+	isc_thread_t thread;						/* Receive thread */
+	isc_mutex_t lock;							/* Lock for shutdown flag and statistics */
+	isc_boolean_t shutdown;						/* Shutdown flag */
+	osppeer_stats_t stats;						/* Statistics */
+};
+
+/* Bulk sync walk argument, routes are encoded under the cache lock and sent after it is released */
+typedef struct osppeer_walk {
+	osppeer_t *peer;				/* Replication handle */
+	isc_stdtime_t now;				/* Current time */
+	unsigned char *buffer;			/* Unsigned messages, each after its 2 byte length */
+	size_t size;					/* Buffer size */
+	size_t used;					/* Buffer length */
+} osppeer_walk_t;
+
+/*
+ * Parse address
+ * param str Address string, "ip:port" or "[ip]:port"
+ * param address Address buffer
+ * return ISC_R_SUCCESS successful, ISC_R_BADADDRESSFORM wrong format
+ */
+isc_result_t osppeer_parseaddr(
+	const char *str,
+	isc_sockaddr_t *address)
+{
+	char host[INET6_ADDRSTRLEN];
+	const char *end, *port;
+	size_t length;
+	int portnum;
+	struct in_addr in4;
+	struct in6_addr in6;
+
+	if (str[0] == '[') {
+		if (((end = strchr(str, ']')) == NULL) || (end[1] != ':')) {
+			return ISC_R_BADADDRESSFORM;
+		}
+		str++;
+		length = end - str;
+		port = end + 2;
+	} else {
+		if ((end = strrchr(str, ':')) == NULL) {
+			return ISC_R_BADADDRESSFORM;
+		}
+		length = end - str;
+		port = end + 1;
+	}
+
+	if (length >= sizeof(host)) {
+		return ISC_R_BADADDRESSFORM;
+	}
+	memcpy(host, str, length);
+	host[length] = '\0';
+
+	portnum = atoi(port);
+	if ((portnum <= 0) || (portnum > 65535)) {
+		return ISC_R_BADADDRESSFORM;
+	}
+
+	if (inet_pton(AF_INET, host, &in4) == 1) {
+		isc_sockaddr_fromin(address, &in4, (in_port_t)portnum);
+	} else if (inet_pton(AF_INET6, host, &in6) == 1) {
+		isc_sockaddr_fromin6(address, &in6, (in_port_t)portnum);
+	} else {
+		return ISC_R_BADADDRESSFORM;
+	}
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Append length prefixed string to message
+ * param buffer Message buffer
+ * param size Message buffer size
+ * param offset Message length, updated
+ * param str String, shorter than 256
+ * return ISC_R_SUCCESS successful, ISC_R_NOSPACE buffer too small
+ */
+static isc_result_t osppeer_put_string(
+	unsigned char *buffer,
+	size_t size,
+	size_t *offset,
+	const char *str)
+{
+	size_t length = strlen(str);
+
+	if ((length > 255) || (*offset + 1 + length > size)) {
+		return ISC_R_NOSPACE;
+	}
+
+	buffer[(*offset)++] = (unsigned char)length;
+	memcpy(buffer + *offset, str, length);
+	*offset += length;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Read length prefixed string from message
+ * param buffer Message
+ * param length Message length
+ * param offset Read position, updated
+ * param str String buffer
+ * param strsize String buffer size
+ * return ISC_R_SUCCESS successful, ISC_R_UNEXPECTEDEND message too short, ISC_R_NOSPACE string too long
+ */
+static isc_result_t osppeer_get_string(
+	const unsigned char *buffer,
+	size_t length,
+	size_t *offset,
+	char *str,
+	size_t strsize)
+{
+	size_t strlength;
+
+	if (*offset >= length) {
+		return ISC_R_UNEXPECTEDEND;
+	}
+	strlength = buffer[(*offset)++];
+	if (*offset + strlength > length) {
+		return ISC_R_UNEXPECTEDEND;
+	}
+	if (strlength >= strsize) {
+		return ISC_R_NOSPACE;
+	}
+
+	memcpy(str, buffer + *offset, strlength);
+	str[strlength] = '\0';
+	*offset += strlength;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Build message header
+ * param buffer Message buffer, at least OSPPEER_HDR_SIZE
+ * param type Message type
+ * param flags Message flags
+ * param now Current time
+ */
+static void osppeer_put_header(
+	unsigned char *buffer,
+	int type,
+	int flags,
+	isc_stdtime_t now)
+{
+	memcpy(buffer, OSPPEER_MAGIC, 4);
+	buffer[4] = OSPPEER_VERSION;
+	buffer[5] = (unsigned char)type;
+	buffer[6] = (unsigned char)flags;
+	buffer[7] = 0;
+	buffer[8] = (unsigned char)(now >> 24);
+	buffer[9] = (unsigned char)(now >> 16);
+	buffer[10] = (unsigned char)(now >> 8);
+	buffer[11] = (unsigned char)now;
+}
+
+/*
+ * Append signature to message
+ * param peer Replication handle
+ * param buffer Message buffer, ISC_SHA256_DIGESTLENGTH bytes free after the message
+ * param length Message length
+ * return Signed message length
+ */
+static size_t osppeer_sign(
+	osppeer_t *peer,
+	unsigned char *buffer,
+	size_t length)
+{
+	isc_hmacsha256_t hmac;
+
+	isc_hmacsha256_init(&hmac, (const unsigned char *)peer->secret, strlen(peer->secret));
+	isc_hmacsha256_update(&hmac, buffer, length);
+	isc_hmacsha256_sign(&hmac, buffer + length, ISC_SHA256_DIGESTLENGTH);
+	isc_hmacsha256_invalidate(&hmac);
+
+	return length + ISC_SHA256_DIGESTLENGTH;
+}
+
+/*
+ * Verify message signature, format version and time
+ * param peer Replication handle
+ * param buffer Signed message
+ * param length Signed message length
+ * param now Current time
+ * return ISC_R_SUCCESS successful, ISC_R_UNEXPECTEDEND too short, ISC_R_NOPERM bad signature, ISC_R_UNEXPECTED bad format, ISC_R_RANGE out of time window
+ */
+static isc_result_t osppeer_verify(
+	osppeer_t *peer,
+	const unsigned char *buffer,
+	size_t length,
+	isc_stdtime_t now)
+{
+	unsigned char digest[ISC_SHA256_DIGESTLENGTH];
+	isc_hmacsha256_t hmac;
+	isc_boolean_t verified;
+	long sent;
+
+	if (length < OSPPEER_HDR_SIZE + ISC_SHA256_DIGESTLENGTH) {
+		return ISC_R_UNEXPECTEDEND;
+	}
+	length -= ISC_SHA256_DIGESTLENGTH;
+
+	memcpy(digest, buffer + length, sizeof(digest));
+	isc_hmacsha256_init(&hmac, (const unsigned char *)peer->secret, strlen(peer->secret));
+	isc_hmacsha256_update(&hmac, buffer, length);
+	verified = isc_hmacsha256_verify(&hmac, digest, sizeof(digest));
+	isc_hmacsha256_invalidate(&hmac);
+	if (verified == ISC_FALSE) {
+		return ISC_R_NOPERM;
+	}
+
+	if ((memcmp(buffer, OSPPEER_MAGIC, 4) != 0) || (buffer[4] != OSPPEER_VERSION)) {
+		return ISC_R_UNEXPECTED;
+	}
+
+	sent = (long)(((isc_uint32_t)buffer[8] << 24) |
+		((isc_uint32_t)buffer[9] << 16) |
+		((isc_uint32_t)buffer[10] << 8) |
+		(isc_uint32_t)buffer[11]);
+	if ((sent < (long)now - OSPPEER_WINDOW) || (sent > (long)now + OSPPEER_WINDOW)) {
+		return ISC_R_RANGE;
+	}
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Build unsigned route fill message
+ * param buffer Message buffer
+ * param size Message buffer size, without room for the signature
+ * param prefix Key is a number prefix flag
+ * param key Cache key or number prefix
+ * param ttl Seconds the route stays fresh
+ * param route Route
+ * param now Current time
+ * return Message length, 0 for route too large
+ */
+static size_t osppeer_encode_fill(
+	unsigned char *buffer,
+	size_t size,
+	isc_boolean_t prefix,
+	const char *key,
+	isc_uint32_t ttl,
+	const ospcache_route_t *route,
+	isc_stdtime_t now)
+{
+	const ospcache_dest_t *dest;
+	size_t offset = OSPPEER_HDR_SIZE;
+	int i;
+	isc_result_t result;
+
+	osppeer_put_header(buffer, OSPPEER_MSG_FILL, (prefix == ISC_TRUE) ? OSPPEER_FLAG_PREFIX : 0, now);
+
+	buffer[offset++] = (unsigned char)(ttl >> 24);
+	buffer[offset++] = (unsigned char)(ttl >> 16);
+	buffer[offset++] = (unsigned char)(ttl >> 8);
+	buffer[offset++] = (unsigned char)ttl;
+
+	if ((result = osppeer_put_string(buffer, size, &offset, key)) == ISC_R_SUCCESS) {
+		buffer[offset++] = (unsigned char)route->count;
+		for (i = 0; (i < route->count) && (result == ISC_R_SUCCESS); i++) {
+			dest = &route->dest[i];
+			if (offset + 2 > size) {
+				result = ISC_R_NOSPACE;
+				break;
+			}
+			buffer[offset++] = (unsigned char)dest->protocol;
+			buffer[offset++] = (unsigned char)dest->npdi;
+			if (((result = osppeer_put_string(buffer, size, &offset, dest->called)) != ISC_R_SUCCESS) ||
+				((result = osppeer_put_string(buffer, size, &offset, dest->dest)) != ISC_R_SUCCESS) ||
+				((result = osppeer_put_string(buffer, size, &offset, dest->dnid)) != ISC_R_SUCCESS) ||
+				((result = osppeer_put_string(buffer, size, &offset, dest->nprn)) != ISC_R_SUCCESS))
+			{
+				break;
+			}
+			result = osppeer_put_string(buffer, size, &offset, dest->npcic);
+		}
+	}
+
+	return (result == ISC_R_SUCCESS) ? offset : 0;
+}
+
+/*
+ * Parse route fill message
+ * param buffer Message
+ * param length Message length, without the signature
+ * param key Key buffer, OSPCACHE_KEY_SIZE
+ * param ttl TTL buffer
+ * param route Route buffer
+ * return ISC_R_SUCCESS successful, other bad format
+ */
+static isc_result_t osppeer_decode_fill(
+	const unsigned char *buffer,
+	size_t length,
+	char *key,
+	isc_uint32_t *ttl,
+	ospcache_route_t *route)
+{
+	ospcache_dest_t *dest;
+	size_t offset = OSPPEER_HDR_SIZE;
+	int i;
+	isc_result_t result;
+
+	if (length < offset + 4) {
+		return ISC_R_UNEXPECTEDEND;
+	}
+	*ttl = ((isc_uint32_t)buffer[offset] << 24) |
+		((isc_uint32_t)buffer[offset + 1] << 16) |
+		((isc_uint32_t)buffer[offset + 2] << 8) |
+		(isc_uint32_t)buffer[offset + 3];
+	offset += 4;
+
+	if ((result = osppeer_get_string(buffer, length, &offset, key, OSPCACHE_KEY_SIZE)) != ISC_R_SUCCESS) {
+		return result;
+	}
+
+	if (offset >= length) {
+		return ISC_R_UNEXPECTEDEND;
+	}
+	route->count = buffer[offset++];
+	if (route->count > OSPCACHE_MAX_DEST) {
+		return ISC_R_RANGE;
+	}
+
+	for (i = 0; (i < route->count) && (result == ISC_R_SUCCESS); i++) {
+		dest = &route->dest[i];
+		if (offset + 2 > length) {
+			return ISC_R_UNEXPECTEDEND;
+		}
+		dest->protocol = buffer[offset++];
+		dest->npdi = buffer[offset++];
+		if (((result = osppeer_get_string(buffer, length, &offset, dest->called, sizeof(dest->called))) != ISC_R_SUCCESS) ||
+			((result = osppeer_get_string(buffer, length, &offset, dest->dest, sizeof(dest->dest))) != ISC_R_SUCCESS) ||
+			((result = osppeer_get_string(buffer, length, &offset, dest->dnid, sizeof(dest->dnid))) != ISC_R_SUCCESS) ||
+			((result = osppeer_get_string(buffer, length, &offset, dest->nprn, sizeof(dest->nprn))) != ISC_R_SUCCESS))
+		{
+			break;
+		}
+		result = osppeer_get_string(buffer, length, &offset, dest->npcic, sizeof(dest->npcic));
+	}
+
+	if ((result == ISC_R_SUCCESS) && (offset != length)) {
+		result = ISC_R_RANGE;
+	}
+
+	return result;
+}
+
+/*
+ * Send message to one peer
+ * param peer Replication handle
+ * param address Peer address
+ * param buffer Message
+ * param length Message length
+ * param flags sendto flags
+ * return ISC_R_SUCCESS successful, ISC_R_FAILURE failed
+ */
+static isc_result_t osppeer_send(
+	osppeer_t *peer,
+	const isc_sockaddr_t *address,
+	const unsigned char *buffer,
+	size_t length,
+	int flags)
+{
+	if (sendto(peer->fd, buffer, length, flags, &address->type.sa, address->length) != (ssize_t)length) {
+		return ISC_R_FAILURE;
+	}
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Encode one route of a bulk sync, ospcache_walk function, runs with a cache lock held so it never sends
+ * param arg Bulk sync walk argument
+ * param prefix Key is a number prefix flag
+ * param key Cache key or number prefix
+ * param expire Expire time
+ * param route Route
+ */
+static void osppeer_sync_route(
+	void *arg,
+	isc_boolean_t prefix,
+	const char *key,
+	isc_stdtime_t expire,
+	const ospcache_route_t *route)
+{
+	osppeer_walk_t *walk = (osppeer_walk_t *)arg;
+	unsigned char message[OSPPEER_MSG_SIZE];
+	unsigned char *buffer;
+	size_t length, size;
+
+	length = osppeer_encode_fill(message, sizeof(message) - ISC_SHA256_DIGESTLENGTH, prefix, key, expire - walk->now, route, walk->now);
+	if (length == 0) {
+		return;
+	}
+
+	if (walk->used + 2 + length > walk->size) {
+		size = (walk->size == 0) ? OSPPEER_SYNC_BUFFER : walk->size * 2;
+		/* Out of memory only cuts the bulk sync short, fills keep it up to date */
+		if ((buffer = isc_mem_get(walk->peer->mctx, size)) == NULL) {
+			return;
+		}
+		if (walk->buffer != NULL) {
+			memcpy(buffer, walk->buffer, walk->used);
+			isc_mem_put(walk->peer->mctx, walk->buffer, walk->size);
+		}
+		walk->buffer = buffer;
+		walk->size = size;
+	}
+
+	walk->buffer[walk->used++] = (unsigned char)(length >> 8);
+	walk->buffer[walk->used++] = (unsigned char)length;
+	memcpy(walk->buffer + walk->used, message, length);
+	walk->used += length;
+}
+
+/*
+ * Serve a bulk sync, encodes all fresh routes and sends them paced, so neither cache lookups nor the receiver stall
+ * param peer Replication handle
+ * param node Requesting peer
+ * param now Current time
+ * return Number of routes sent
+ */
+static isc_uint64_t osppeer_sync(
+	osppeer_t *peer,
+	osppeer_node_t *node,
+	isc_stdtime_t now)
+{
+	unsigned char message[OSPPEER_MSG_SIZE];
+	osppeer_walk_t walk;
+	size_t offset, length;
+	isc_stdtime_t sendtime;
+	isc_boolean_t shutdown = ISC_FALSE;
+	isc_uint64_t sent = 0;
+	unsigned int count = 0;
+
+	walk.peer = peer;
+	walk.now = now;
+	walk.buffer = NULL;
+	walk.size = 0;
+	walk.used = 0;
+	ospcache_walk(peer->cache, now, osppeer_sync_route, &walk);
+
+	for (offset = 0; (offset < walk.used) && (shutdown == ISC_FALSE); offset += length) {
+		length = ((size_t)walk.buffer[offset] << 8) | (size_t)walk.buffer[offset + 1];
+		offset += 2;
+		memcpy(message, walk.buffer + offset, length);
+
+		/* Signed at send time, a large sync outlasts the time window */
+		isc_stdtime_get(&sendtime);
+		message[8] = (unsigned char)(sendtime >> 24);
+		message[9] = (unsigned char)(sendtime >> 16);
+		message[10] = (unsigned char)(sendtime >> 8);
+		message[11] = (unsigned char)sendtime;
+		if (osppeer_send(peer, &node->address, message, osppeer_sign(peer, message, length), 0) == ISC_R_SUCCESS) {
+			sent++;
+		}
+
+		if (++count % OSPPEER_SYNC_BATCH == 0) {
+			usleep(OSPPEER_SYNC_PAUSE);
+			LOCK(&peer->lock);
+			shutdown = peer->shutdown;
+			UNLOCK(&peer->lock);
+		}
+	}
+
+	if (walk.buffer != NULL) {
+		isc_mem_put(peer->mctx, walk.buffer, walk.size);
+	}
+
+	isc_stdtime_get(&sendtime);
+	osppeer_put_header(message, OSPPEER_MSG_SYNCEND, 0, sendtime);
+	osppeer_send(peer, &node->address, message, osppeer_sign(peer, message, OSPPEER_HDR_SIZE), 0);
+
+	return sent;
+}
+
+/*
+ * Find peer by address
+ * param peer Replication handle
+ * param address Source address
+ * return Peer, NULL for unknown source
+ */
+static osppeer_node_t *osppeer_find_node(
+	osppeer_t *peer,
+	const isc_sockaddr_t *address)
+{
+	int i;
+
+	for (i = 0; i < peer->npeers; i++) {
+		if (isc_sockaddr_equal(&peer->nodes[i].address, address)) {
+			return &peer->nodes[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Request bulk sync from peers that have not completed one
+ * param peer Replication handle
+ * param now Current time
+ */
+static void osppeer_request_sync(
+	osppeer_t *peer,
+	isc_stdtime_t now)
+{
+	unsigned char buffer[OSPPEER_HDR_SIZE + ISC_SHA256_DIGESTLENGTH];
+	osppeer_node_t *node;
+	int i;
+
+	osppeer_put_header(buffer, OSPPEER_MSG_SYNC, 0, now);
+	osppeer_sign(peer, buffer, OSPPEER_HDR_SIZE);
+
+	for (i = 0; i < peer->npeers; i++) {
+		node = &peer->nodes[i];
+		if ((node->synced == ISC_FALSE) && (node->attempts < OSPPEER_SYNC_ATTEMPTS)) {
+			node->attempts++;
+			osppeer_send(peer, &node->address, buffer, sizeof(buffer), 0);
+		}
+	}
+}
+
+/*
+ * Handle one message from a peer, verifies it before looking at the body
+ * param peer Replication handle
+ * param node Peer
+ * param buffer Signed message
+ * param length Signed message length
+ * param now Current time
+ * return ISC_R_SUCCESS successful, other bad signature, time or format
+ */
+static isc_result_t osppeer_handle(
+	osppeer_t *peer,
+	osppeer_node_t *node,
+	const unsigned char *buffer,
+	size_t length,
+	isc_stdtime_t now)
+{
+	char key[OSPCACHE_KEY_SIZE];
+	isc_uint32_t ttl;
+	ospcache_route_t route;
+	isc_uint64_t sent;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	if ((result = osppeer_verify(peer, buffer, length, now)) != ISC_R_SUCCESS) {
+		return result;
+	}
+	length -= ISC_SHA256_DIGESTLENGTH;
+
+	switch (buffer[5]) {
+	case OSPPEER_MSG_FILL:
+		if (((result = osppeer_decode_fill(buffer, length, key, &ttl, &route)) == ISC_R_SUCCESS) && (ttl != 0)) {
+			/* Fills from peers are never published again, so replication cannot loop. A TTL beyond the local limit would wrap the expire time */
+			if (ttl > peer->maxttl) {
+				ttl = peer->maxttl;
+			}
+			if ((buffer[6] & OSPPEER_FLAG_PREFIX) != 0) {
+				result = ospcache_putprefix(peer->cache, key, now, now + ttl, &route);
+			} else {
+				result = ospcache_put(peer->cache, key, now + ttl, &route);
+			}
+			if (result == ISC_R_SUCCESS) {
+				LOCK(&peer->lock);
+				peer->stats.received++;
+				UNLOCK(&peer->lock);
+			}
+		}
+		break;
+	case OSPPEER_MSG_SYNC:
+		/* A peer asks again while its first sync is in flight, one per interval is served */
+		if ((node->lastsync == 0) || (now >= node->lastsync + OSPPEER_SYNC_INTERVAL)) {
+			node->lastsync = now;
+			sent = osppeer_sync(peer, node, now);
+			LOCK(&peer->lock);
+			peer->stats.syncs++;
+			peer->stats.sent += sent;
+			UNLOCK(&peer->lock);
+		}
+		break;
+	case OSPPEER_MSG_SYNCEND:
+		if (node->synced == ISC_FALSE) {
+			node->synced = ISC_TRUE;
+			LOCK(&peer->lock);
+			peer->stats.synced++;
+			UNLOCK(&peer->lock);
+		}
+		break;
+	default:
+		result = ISC_R_UNEXPECTED;
+		break;
+	}
+
+	return result;
+}
+
+/*
+ * Receive thread, requests bulk sync on start and applies messages from peers until shutdown
+ * param arg Replication handle
+ */
+static isc_threadresult_t osppeer_run(
+	isc_threadarg_t arg)
+{
+	osppeer_t *peer = (osppeer_t *)arg;
+	unsigned char buffer[OSPPEER_MSG_SIZE];
+	isc_sockaddr_t from;
+	socklen_t fromlen;
+	ssize_t length;
+	osppeer_node_t *node;
+	isc_stdtime_t now, nextsync = 0;
+	isc_boolean_t shutdown;
+
+	for (;;) {
+		LOCK(&peer->lock);
+		shutdown = peer->shutdown;
+		UNLOCK(&peer->lock);
+		if (shutdown == ISC_TRUE) {
+			break;
+		}
+
+		isc_stdtime_get(&now);
+		if (now >= nextsync) {
+			osppeer_request_sync(peer, now);
+			nextsync = now + OSPPEER_SYNC_INTERVAL;
+		}
+
+		memset(&from, 0, sizeof(from));
+		fromlen = sizeof(from.type);
+		if ((length = recvfrom(peer->fd, buffer, sizeof(buffer), 0, &from.type.sa, &fromlen)) < 0) {
+			/* Timeout or interrupted */
+			continue;
+		}
+		from.length = fromlen;
+
+		isc_stdtime_get(&now);
+		if (((node = osppeer_find_node(peer, &from)) == NULL) ||
+			(osppeer_handle(peer, node, buffer, (size_t)length, now) != ISC_R_SUCCESS))
+		{
+			LOCK(&peer->lock);
+			peer->stats.rejected++;
+			UNLOCK(&peer->lock);
+		}
+	}
+
+	return ((isc_threadresult_t)0);
+}
+
+/*
+ * Create replication, binds the listen address and starts the receive thread, which requests bulk sync from peers
+ * param mctx Memory context
+ * param cache Route cache routes are replicated from and into
+ * param listen Listen address, also the source address of messages to peers
+ * param secret Shared secret messages are signed with
+ * param maxttl Max TTL of routes received, longer ones are cut to it
+ * param npeers Number of peers
+ * param peers Peer addresses
+ * param peerp Replication handle buffer
+ * return ISC_R_SUCCESS successful, ISC_R_NOMEMORY out of memory, ISC_R_NOSPACE secret too long, other failed
+ */
+isc_result_t osppeer_create(
+	isc_mem_t *mctx,
+	ospcache_t *cache,
+	const isc_sockaddr_t *listen,
+	const char *secret,
+	isc_uint32_t maxttl,
+	int npeers,
+	const isc_sockaddr_t *peers,
+	osppeer_t **peerp)
+{
+	osppeer_t *peer;
+	struct timeval timeout;
+	int size = OSPPEER_RCVBUF;
+	int on = 1;
+	int i;
+	isc_result_t result;
+
+	REQUIRE(peerp != NULL && *peerp == NULL);
+	REQUIRE(npeers >= 0 && npeers <= OSPPEER_MAX_PEERS);
+
+	if (strlen(secret) >= OSPPEER_SECRET_SIZE) {
+		return ISC_R_NOSPACE;
+	}
+
+	if ((peer = isc_mem_get(mctx, sizeof(*peer))) == NULL) {
+		return ISC_R_NOMEMORY;
+	}
+	memset(peer, 0, sizeof(*peer));
+	peer->mctx = NULL;
+	isc_mem_attach(mctx, &peer->mctx);
+	peer->cache = cache;
+	snprintf(peer->secret, sizeof(peer->secret), "%s", secret);
+	peer->maxttl = maxttl;
+	peer->shutdown = ISC_FALSE;
+	peer->npeers = npeers;
+	for (i = 0; i < npeers; i++) {
+		peer->nodes[i].address = peers[i];
+		peer->nodes[i].synced = ISC_FALSE;
+		peer->nodes[i].attempts = 0;
+		peer->nodes[i].lastsync = 0;
+	}
+
+	if ((peer->fd = socket(listen->type.sa.sa_family, SOCK_DGRAM, 0)) < 0) {
+		result = ISC_R_FAILURE;
+	} else {
+		/* Failure to grow the buffer only makes a bulk sync lossier */
+		setsockopt(peer->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+		/* On reload the new zone instance binds before the old one is gone */
+		setsockopt(peer->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		timeout.tv_sec = OSPPEER_TIMEOUT;
+		timeout.tv_usec = 0;
+		if ((setsockopt(peer->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) ||
+			(bind(peer->fd, &listen->type.sa, listen->length) != 0))
+		{
+			result = (errno == EADDRINUSE) ? ISC_R_ADDRINUSE : ISC_R_FAILURE;
+		} else if ((result = isc_mutex_init(&peer->lock)) == ISC_R_SUCCESS) {
+			if ((result = isc_thread_create(osppeer_run, peer, &peer->thread)) != ISC_R_SUCCESS) {
+				DESTROYLOCK(&peer->lock);
+			}
+		}
+		if (result != ISC_R_SUCCESS) {
+			close(peer->fd);
+		}
+	}
+
+	if (result != ISC_R_SUCCESS) {
+		memset(peer->secret, 0, sizeof(peer->secret));
+		isc_mem_putanddetach(&peer->mctx, peer, sizeof(*peer));
+		return result;
+	}
+
+	*peerp = peer;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Destroy replication, waits for the receive thread
+ * param peerp Replication handle
+ */
+void osppeer_destroy(
+	osppeer_t **peerp)
+{
+	osppeer_t *peer;
+
+	REQUIRE(peerp != NULL && *peerp != NULL);
+
+	peer = *peerp;
+	*peerp = NULL;
+
+	LOCK(&peer->lock);
+	peer->shutdown = ISC_TRUE;
+	UNLOCK(&peer->lock);
+
+	isc_thread_join(peer->thread, NULL);
+
+	close(peer->fd);
+	DESTROYLOCK(&peer->lock);
+
+	memset(peer->secret, 0, sizeof(peer->secret));
+	isc_mem_putanddetach(&peer->mctx, peer, sizeof(*peer));
+}
+
+/*
+ * Send a route just fetched from the OSP server to all peers, never blocks
+ * param peer Replication handle
+ * param prefix Key is a number prefix flag
+ * param key Cache key or number prefix
+ * param now Current time
+ * param expire Expire time
+ * param route Route
+ */
+void osppeer_publish(
+	osppeer_t *peer,
+	isc_boolean_t prefix,
+	const char *key,
+	isc_stdtime_t now,
+	isc_stdtime_t expire,
+	const ospcache_route_t *route)
+{
+	unsigned char buffer[OSPPEER_MSG_SIZE];
+	size_t length;
+	isc_uint64_t sent = 0;
+	int i;
+
+	if ((expire <= now) || (peer->npeers == 0)) {
+		return;
+	}
+
+	if ((length = osppeer_encode_fill(buffer, sizeof(buffer) - ISC_SHA256_DIGESTLENGTH, prefix, key, expire - now, route, now)) == 0) {
+		return;
+	}
+	length = osppeer_sign(peer, buffer, length);
+
+	for (i = 0; i < peer->npeers; i++) {
+		if (osppeer_send(peer, &peer->nodes[i].address, buffer, length, MSG_DONTWAIT) == ISC_R_SUCCESS) {
+			sent++;
+		}
+	}
+
+	LOCK(&peer->lock);
+	peer->stats.sent += sent;
+	UNLOCK(&peer->lock);
+}
+
+/*
+ * Get replication statistics
+ * param peer Replication handle
+ * param stats Statistics buffer
+ */
+void osppeer_getstats(
+	osppeer_t *peer,
+	osppeer_stats_t *stats)
+{
+	LOCK(&peer->lock);
+	*stats = peer->stats;
+	UNLOCK(&peer->lock);
+}
+
@@ -0,0 +1,51 @@
+/*
+ * osppeer.h
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OSPPEER_H
+#define OSPPEER_H	1
+
+#include <isc/types.h>
+#include <isc/sockaddr.h>
+#include <isc/stdtime.h>
+
+#include "ospcache.h"
+
+/* Constant */
+#define OSPPEER_MAX_PEERS	16		/* Max number of peers */
+
+/* Replication statistics */
+typedef struct osppeer_stats {
+	isc_uint64_t sent;			/* Number of routes sent to peers */
+	isc_uint64_t received;		/* Number of routes received from peers and cached */
+	isc_uint64_t rejected;		/* Number of messages dropped for unknown source, bad signature, time or format */
+	isc_uint64_t syncs;			/* Number of bulk syncs served */
+	unsigned int synced;		/* Number of peers that completed the bulk sync of this node */
+} osppeer_stats_t;
+
+/* Replication handle */
+typedef struct osppeer osppeer_t;
+
+isc_result_t osppeer_parseaddr(const char *str, isc_sockaddr_t *address);
+isc_result_t osppeer_create(isc_mem_t *mctx, ospcache_t *cache, const isc_sockaddr_t *listen, const char *secret, isc_uint32_t maxttl, int npeers, const isc_sockaddr_t *peers, osppeer_t **peerp);
+void osppeer_destroy(osppeer_t **peerp);
+void osppeer_publish(osppeer_t *peer, isc_boolean_t prefix, const char *key, isc_stdtime_t now, isc_stdtime_t expire, const ospcache_route_t *route);
+void osppeer_getstats(osppeer_t *peer, osppeer_stats_t *stats);
+
+#endif /* OSPPEER_H */
+
@@ -0,0 +1,337 @@
+/*
+ * osppurge.c
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <isc/hmacsha.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/stdtime.h>
+#include <isc/thread.h>
+#include <isc/util.h>
+
+#include "osppurge.h"
+
+/*
+ * A purge message is one UDP datagram of text:
+ *
+ *   OSPPURGE <time> <type> <value> <signature>
+ *
+ * time is the sender's UNIX time, type is number, prefix or destination, and signature is the lowercase hex
+ * HMAC-SHA256, keyed by the shared secret, of everything before the last space. Messages more than OSPPURGE_WINDOW
+ * seconds away from local time are dropped. A replayed message inside the window only repeats an idempotent purge.
+ */
+
+/* Constant */
+#define OSPPURGE_MAGIC		"OSPPURGE"		/* Message tag */
+#define OSPPURGE_MSG_SIZE	512				/* Max message size */
+#define OSPPURGE_TIMEOUT	1				/* Receive timeout in seconds, bounds shutdown delay */
+#define OSPPURGE_WINDOW		30				/* Max clock difference in seconds */
+#define OSPPURGE_SECRET_SIZE	256			/* Max secret length */
+
+/* Invalidation listener */
+struct osppurge {
+	isc_mem_t *mctx;						/* Memory context */
+	int fd;									/* UDP socket */
+	char secret[OSPPURGE_SECRET_SIZE];		/* HMAC key */
+	osppurge_func_t func;					/* Purge function */
+	void *arg;								/* Purge function argument */
+	isc_thread_t thread;					/* Receive thread */
+	isc_mutex_t lock;						/* Lock for shutdown flag and statistics */
+	isc_boolean_t shutdown;					/* Shutdown flag */
+	osppurge_stats_t stats;					/* Statistics */
+};
+
+/*
+ * Convert hex string to bytes
+ * param hex Hex string
+ * param buffer Byte buffer
+ * param size Number of bytes expected
+ * return ISC_R_SUCCESS successful, ISC_R_BADHEX wrong length or character
+ */
+static isc_result_t osppurge_decode_hex(
+	const char *hex,
+	unsigned char *buffer,
+	size_t size)
+{
+	static const char digits[] = "0123456789abcdef";
+	const char *high, *low;
+	size_t i;
+
+	if (strlen(hex) != size * 2) {
+		return ISC_R_BADHEX;
+	}
+
+	for (i = 0; i < size; i++) {
+		if (((high = strchr(digits, hex[i * 2])) == NULL) || ((low = strchr(digits, hex[i * 2 + 1])) == NULL)) {
+			return ISC_R_BADHEX;
+		}
+		buffer[i] = (unsigned char)(((high - digits) << 4) | (low - digits));
+	}
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Check and parse purge message
+ * param purge Invalidation listener handle
+ * param message Message, NUL terminated, modified
+ * param now Current time
+ * param type Purge type buffer
+ * param value Purge value buffer, OSPPURGE_VALUE_SIZE
+ * return ISC_R_SUCCESS successful, other bad format, signature or time
+ */
+static isc_result_t osppurge_parse(
+	osppurge_t *purge,
+	char *message,
+	isc_stdtime_t now,
+	int *type,
+	char *value)
+{
+	unsigned char digest[ISC_SHA256_DIGESTLENGTH];
+	isc_hmacsha256_t hmac;
+	char *signature, *item, *saveptr = NULL;
+	long sent;
+	isc_boolean_t verified;
+
+	if ((signature = strrchr(message, ' ')) == NULL) {
+		return ISC_R_UNEXPECTEDEND;
+	}
+	*signature++ = '\0';
+	if (osppurge_decode_hex(signature, digest, sizeof(digest)) != ISC_R_SUCCESS) {
+		return ISC_R_BADHEX;
+	}
+
+	/* Nothing in the message is looked at before the signature is checked */
+	isc_hmacsha256_init(&hmac, (const unsigned char *)purge->secret, strlen(purge->secret));
+	isc_hmacsha256_update(&hmac, (const unsigned char *)message, strlen(message));
+	verified = isc_hmacsha256_verify(&hmac, digest, sizeof(digest));
+	isc_hmacsha256_invalidate(&hmac);
+	if (verified == ISC_FALSE) {
+		return ISC_R_NOPERM;
+	}
+
+	if (((item = strtok_r(message, " ", &saveptr)) == NULL) || (strcmp(item, OSPPURGE_MAGIC) != 0)) {
+		return ISC_R_UNEXPECTEDTOKEN;
+	}
+
+	if ((item = strtok_r(NULL, " ", &saveptr)) == NULL) {
+		return ISC_R_UNEXPECTEDEND;
+	}
+	sent = strtol(item, NULL, 10);
+	if ((sent < (long)now - OSPPURGE_WINDOW) || (sent > (long)now + OSPPURGE_WINDOW)) {
+		return ISC_R_RANGE;
+	}
+
+	if ((item = strtok_r(NULL, " ", &saveptr)) == NULL) {
+		return ISC_R_UNEXPECTEDEND;
+	} else if (strcmp(item, "number") == 0) {
+		*type = OSPPURGE_NUMBER;
+	} else if (strcmp(item, "prefix") == 0) {
+		*type = OSPPURGE_PREFIX;
+	} else if (strcmp(item, "destination") == 0) {
+		*type = OSPPURGE_DESTINATION;
+	} else {
+		return ISC_R_UNEXPECTEDTOKEN;
+	}
+
+	if (((item = strtok_r(NULL, " ", &saveptr)) == NULL) || (strlen(item) >= OSPPURGE_VALUE_SIZE)) {
+		return ISC_R_UNEXPECTEDEND;
+	}
+	if ((*type != OSPPURGE_DESTINATION) && (strspn(item, "0123456789") != strlen(item))) {
+		return ISC_R_UNEXPECTEDTOKEN;
+	}
+	snprintf(value, OSPPURGE_VALUE_SIZE, "%s", item);
+
+	if (strtok_r(NULL, " ", &saveptr) != NULL) {
+		return ISC_R_UNEXPECTEDTOKEN;
+	}
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Receive thread, applies purge messages until shutdown
+ * param arg Invalidation listener handle
+ */
+static isc_threadresult_t osppurge_run(
+	isc_threadarg_t arg)
+{
+	osppurge_t *purge = (osppurge_t *)arg;
+	char message[OSPPURGE_MSG_SIZE];
+	char value[OSPPURGE_VALUE_SIZE];
+	ssize_t length;
+	int type;
+	isc_stdtime_t now;
+	isc_boolean_t shutdown;
+	isc_result_t result;
+
+	for (;;) {
+		LOCK(&purge->lock);
+		shutdown = purge->shutdown;
+		UNLOCK(&purge->lock);
+		if (shutdown == ISC_TRUE) {
+			break;
+		}
+
+		if ((length = recv(purge->fd, message, sizeof(message) - 1, 0)) < 0) {
+			/* Timeout or interrupted */
+			continue;
+		}
+		message[length] = '\0';
+		while ((length > 0) && ((message[length - 1] == '\n') || (message[length - 1] == '\r'))) {
+			message[--length] = '\0';
+		}
+
+		isc_stdtime_get(&now);
+		if ((strlen(message) == (size_t)length) &&
+			((result = osppurge_parse(purge, message, now, &type, value)) == ISC_R_SUCCESS))
+		{
+			purge->func(purge->arg, type, value);
+			LOCK(&purge->lock);
+			purge->stats.accepted++;
+			UNLOCK(&purge->lock);
+		} else {
+			LOCK(&purge->lock);
+			purge->stats.rejected++;
+			UNLOCK(&purge->lock);
+		}
+	}
+
+	return ((isc_threadresult_t)0);
+}
+
+/*
+ * Create invalidation listener, binds the listen address and starts the receive thread
+ * param mctx Memory context
+ * param listen Listen address
+ * param secret Shared secret messages are signed with
+ * param func Purge function
+ * param arg Purge function argument
+ * param purgep Invalidation listener handle buffer
+ * return ISC_R_SUCCESS successful, ISC_R_NOMEMORY out of memory, ISC_R_NOSPACE secret too long, other failed
+ */
+isc_result_t osppurge_create(
+	isc_mem_t *mctx,
+	const isc_sockaddr_t *listen,
+	const char *secret,
+	osppurge_func_t func,
+	void *arg,
+	osppurge_t **purgep)
+{
+	osppurge_t *purge;
+	struct timeval timeout;
+	int on = 1;
+	isc_result_t result;
+
+	REQUIRE(purgep != NULL && *purgep == NULL);
+
+	if (strlen(secret) >= OSPPURGE_SECRET_SIZE) {
+		return ISC_R_NOSPACE;
+	}
+
+	if ((purge = isc_mem_get(mctx, sizeof(*purge))) == NULL) {
+		return ISC_R_NOMEMORY;
+	}
+	memset(purge, 0, sizeof(*purge));
+	purge->mctx = NULL;
+	isc_mem_attach(mctx, &purge->mctx);
+	snprintf(purge->secret, sizeof(purge->secret), "%s", secret);
+	purge->func = func;
+	purge->arg = arg;
+	purge->shutdown = ISC_FALSE;
+
+	if ((purge->fd = socket(listen->type.sa.sa_family, SOCK_DGRAM, 0)) < 0) {
+		result = ISC_R_FAILURE;
+	} else {
+		/* On reload the new zone instance binds before the old one is gone */
+		setsockopt(purge->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		timeout.tv_sec = OSPPURGE_TIMEOUT;
+		timeout.tv_usec = 0;
+		if ((setsockopt(purge->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) ||
+			(bind(purge->fd, &listen->type.sa, listen->length) != 0))
+		{
+			result = (errno == EADDRINUSE) ? ISC_R_ADDRINUSE : ISC_R_FAILURE;
+		} else if ((result = isc_mutex_init(&purge->lock)) == ISC_R_SUCCESS) {
+			if ((result = isc_thread_create(osppurge_run, purge, &purge->thread)) != ISC_R_SUCCESS) {
+				DESTROYLOCK(&purge->lock);
+			}
+		}
+		if (result != ISC_R_SUCCESS) {
+			close(purge->fd);
+		}
+	}
+
+	if (result != ISC_R_SUCCESS) {
+		memset(purge->secret, 0, sizeof(purge->secret));
+		isc_mem_putanddetach(&purge->mctx, purge, sizeof(*purge));
+		return result;
+	}
+
+	*purgep = purge;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Destroy invalidation listener, waits for the receive thread
+ * param purgep Invalidation listener handle
+ */
+void osppurge_destroy(
+	osppurge_t **purgep)
+{
+	osppurge_t *purge;
+
+	REQUIRE(purgep != NULL && *purgep != NULL);
+
+	purge = *purgep;
+	*purgep = NULL;
+
+	LOCK(&purge->lock);
+	purge->shutdown = ISC_TRUE;
+	UNLOCK(&purge->lock);
+
+	isc_thread_join(purge->thread, NULL);
+
+	close(purge->fd);
+	DESTROYLOCK(&purge->lock);
+
+	memset(purge->secret, 0, sizeof(purge->secret));
+	isc_mem_putanddetach(&purge->mctx, purge, sizeof(*purge));
+}
+
+/*
+ * Get invalidation listener statistics
+ * param purge Invalidation listener handle
+ * param stats Statistics buffer
+ */
+void osppurge_getstats(
+	osppurge_t *purge,
+	osppurge_stats_t *stats)
+{
+	LOCK(&purge->lock);
+	*stats = purge->stats;
+	UNLOCK(&purge->lock);
+}
+
@@ -0,0 +1,51 @@
+/*
+ * osppurge.h
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OSPPURGE_H
+#define OSPPURGE_H	1
+
+#include <isc/types.h>
+#include <isc/sockaddr.h>
+
+/* Purge type */
+#define OSPPURGE_NUMBER			1	/* Routes of one called number */
+#define OSPPURGE_PREFIX			2	/* Routes of called numbers starting with a prefix */
+#define OSPPURGE_DESTINATION	3	/* Routes through one destination */
+
+/* Buffer size */
+#define OSPPURGE_VALUE_SIZE		264	/* Purge value length, a destination address fits */
+
+/* Invalidation listener statistics */
+typedef struct osppurge_stats {
+	isc_uint64_t accepted;	/* Number of purge messages applied */
+	isc_uint64_t rejected;	/* Number of messages dropped for bad format, signature or time */
+} osppurge_stats_t;
+
+/* Purge function, called from the listener thread with purge type and value */
+typedef void (*osppurge_func_t)(void *arg, int type, const char *value);
+
+/* Invalidation listener handle */
+typedef struct osppurge osppurge_t;
+
+isc_result_t osppurge_create(isc_mem_t *mctx, const isc_sockaddr_t *listen, const char *secret, osppurge_func_t func, void *arg, osppurge_t **purgep);
+void osppurge_destroy(osppurge_t **purgep);
+void osppurge_getstats(osppurge_t *purge, osppurge_stats_t *stats);
+
+#endif /* OSPPURGE_H */
+
@@ -0,0 +1,997 @@
+/*
+ * ospreplica.c
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <isc/crc64.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/rwlock.h>
+#include <isc/stdtime.h>
+#include <isc/util.h>
+
+#include "ospreplica.h"
+
+/*
+ * The route export is a text file, one destination per line, destinations of a prefix in preference order:
+ *
+ *   prefix protocol dest [dnid [nprn [npcic [npdi]]]]
+ *
+ * Empty fields are written as "-", lines starting with '#' are comments. A delta file has the same lines preceded by
+ * "+", which together replace all destinations of their prefix, or "- prefix", which removes the prefix.
+ *
+ * The export is compiled into an index file next to it, which is memory mapped read only and reused as long as it is
+ * newer than the export. Deltas compile a new index from the current one and swap it in.
+ */
+
+/* Constant */
+#define OSPREPLICA_MAGIC		"OSPRIDX"	/* Index file magic */
+#define OSPREPLICA_VERSION		1			/* Index file format version */
+#define OSPREPLICA_SUFFIX		".idx"		/* Index file name suffix */
+#define OSPREPLICA_PATH_SIZE	1024		/* File path length */
+#define OSPREPLICA_LINE_SIZE	1024		/* Max export line length */
+#define OSPREPLICA_MIN_SLOTS	1024		/* Min number of string intern slots, power of 2 */
+#define OSPREPLICA_MIN_LINES	1024		/* Min number of builder lines */
+
+/* Builder line kind */
+#define OSPREPLICA_LINE_BASE	0			/* Export or current index */
+#define OSPREPLICA_LINE_ADD		1			/* Delta destination */
+#define OSPREPLICA_LINE_REMOVE	2			/* Delta prefix removal */
+
+/*
+ * Index file header. The file is the header, prefix records sorted by prefix, destination records, then the string
+ * table. The checksum covers everything after the header.
+ */
+typedef struct ospreplica_header {
+	char magic[8];				/* OSPREPLICA_MAGIC */
+	isc_uint32_t version;		/* OSPREPLICA_VERSION */
+	isc_uint32_t nprefixes;		/* Number of prefix records */
+	isc_uint32_t ndests;		/* Number of destination records */
+	isc_uint32_t reserved;		/* Reserved, 0 */
+	isc_uint64_t strsize;		/* String table size */
+	isc_uint64_t prefixoffset;	/* Offset of prefix records */
+	isc_uint64_t destoffset;	/* Offset of destination records */
+	isc_uint64_t stroffset;		/* Offset of string table */
+	isc_uint64_t checksum;		/* CRC-64 of everything after the header */
+	isc_uint64_t created;		/* Creation time */
+} ospreplica_header_t;
+
+/* Prefix record */
+typedef struct ospreplica_prefix {
+	isc_uint32_t prefix;		/* Number prefix, string offset */
+	isc_uint32_t first;			/* First destination record */
+	isc_uint32_t count;			/* Number of destination records */
+} ospreplica_prefix_t;
+
+/* Destination record, strings are offsets into the string table */
+typedef struct ospreplica_dest {
+	isc_int32_t protocol;		/* Destination signaling protocol */
+	isc_int32_t npdi;			/* Number Portability Dip */
+	isc_uint32_t dest;			/* Destination address */
+	isc_uint32_t dnid;			/* Destination network ID */
+	isc_uint32_t nprn;			/* Routing number */
+	isc_uint32_t npcic;			/* Carrier Identification Code */
+} ospreplica_dest_t;
+
+/* Mapped index */
+typedef struct ospreplica_index {
+	void *base;								/* Mapping */
+	size_t size;							/* Mapping size */
+	const ospreplica_header_t *header;		/* Header */
+	const ospreplica_prefix_t *prefixes;	/* Prefix records */
+	const ospreplica_dest_t *dests;			/* Destination records */
+	const char *strings;					/* String table */
+} ospreplica_index_t;
+
+/* Builder line, one destination of one prefix */
+typedef struct ospreplica_line {
+	char prefix[OSPCACHE_NUM_SIZE];	/* Number prefix */
+	isc_uint32_t seq;				/* Input order, destinations keep it */
+	int kind;						/* OSPREPLICA_LINE_BASE, ADD or REMOVE */
+	ospreplica_dest_t dest;			/* Destination, strings are builder string offsets */
+} ospreplica_line_t;
+
+/* Index builder */
+typedef struct ospreplica_builder {
+	isc_mem_t *mctx;				/* Memory context */
+	char *strings;					/* String table */
+	size_t strsize;					/* String table used size */
+	size_t strmax;					/* String table allocated size */
+	isc_uint32_t *slots;			/* Intern slots, string offset + 1, 0 for empty */
+	isc_uint32_t nslots;			/* Number of intern slots, power of 2 */
+	isc_uint32_t nstrings;			/* Number of interned strings */
+	ospreplica_line_t *lines;		/* Lines */
+	size_t nlines;					/* Number of lines */
+	size_t maxlines;				/* Number of allocated lines */
+} ospreplica_builder_t;
+
+/* Route replica */
+struct ospreplica {
+	isc_mem_t *mctx;						/* Memory context */
+	char path[OSPREPLICA_PATH_SIZE];		/* Export file */
+	ospreplica_protofunc_t protofunc;		/* Protocol name function */
+	isc_rwlock_t lock;						/* Held for read by lookups, for write only to swap the index */
+	ospreplica_index_t *index;				/* Current index */
+	isc_mutex_t statslock;					/* Statistics lock */
+	isc_uint64_t hits;						/* Number of lookups answered */
+	isc_uint64_t misses;					/* Number of lookups not answered */
+	isc_uint64_t deltas;					/* Number of deltas applied */
+};
+
+/*
+ * Grow an array allocated from a memory context
+ * param mctx Memory context
+ * param array Array, replaced
+ * param max Number of allocated elements, updated
+ * param used Number of used elements
+ * param size Element size
+ * param min Min number of elements
+ * return ISC_R_SUCCESS successful, ISC_R_NOMEMORY failed
+ */
+static isc_result_t ospreplica_grow(
+	isc_mem_t *mctx,
+	void **array,
+	size_t *max,
+	size_t used,
+	size_t size,
+	size_t min)
+{
+	size_t newmax = (*max == 0) ? min : *max * 2;
+	void *tmp;
+
+	if ((tmp = isc_mem_get(mctx, newmax * size)) == NULL) {
+		return ISC_R_NOMEMORY;
+	}
+	if (*array != NULL) {
+		memcpy(tmp, *array, used * size);
+		isc_mem_put(mctx, *array, *max * size);
+	}
+	*array = tmp;
+	*max = newmax;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Free builder buffers
+ * param builder Index builder
+ */
+static void ospreplica_free_builder(
+	ospreplica_builder_t *builder)
+{
+	if (builder->strings != NULL) {
+		isc_mem_put(builder->mctx, builder->strings, builder->strmax);
+	}
+	if (builder->slots != NULL) {
+		isc_mem_put(builder->mctx, builder->slots, builder->nslots * sizeof(isc_uint32_t));
+	}
+	if (builder->lines != NULL) {
+		isc_mem_put(builder->mctx, builder->lines, builder->maxlines * sizeof(ospreplica_line_t));
+	}
+}
+
+/*
+ * Intern string
+ * param builder Index builder
+ * param str String
+ * param offset String offset buffer
+ * return ISC_R_SUCCESS successful, ISC_R_NOMEMORY failed
+ */
+static isc_result_t ospreplica_intern(
+	ospreplica_builder_t *builder,
+	const char *str,
+	isc_uint32_t *offset)
+{
+	isc_uint32_t *slots, nslots, slot, i;
+	size_t length = strlen(str) + 1;
+	void *tmp;
+	isc_result_t result;
+
+	/* Keep the slots at most half full */
+	if ((builder->nstrings + 1) * 2 > builder->nslots) {
+		nslots = (builder->nslots == 0) ? OSPREPLICA_MIN_SLOTS : builder->nslots * 2;
+		if ((slots = isc_mem_get(builder->mctx, nslots * sizeof(isc_uint32_t))) == NULL) {
+			return ISC_R_NOMEMORY;
+		}
+		memset(slots, 0, nslots * sizeof(isc_uint32_t));
+		for (i = 0; i < builder->nslots; i++) {
+			if (builder->slots[i] != 0) {
+				for (slot = ospcache_hash(builder->strings + builder->slots[i] - 1) & (nslots - 1); slots[slot] != 0; slot = (slot + 1) & (nslots - 1))
+					;
+				slots[slot] = builder->slots[i];
+			}
+		}
+		if (builder->slots != NULL) {
+			isc_mem_put(builder->mctx, builder->slots, builder->nslots * sizeof(isc_uint32_t));
+		}
+		builder->slots = slots;
+		builder->nslots = nslots;
+	}
+
+	for (slot = ospcache_hash(str) & (builder->nslots - 1); builder->slots[slot] != 0; slot = (slot + 1) & (builder->nslots - 1)) {
+		if (strcmp(builder->strings + builder->slots[slot] - 1, str) == 0) {
+			*offset = builder->slots[slot] - 1;
+			return ISC_R_SUCCESS;
+		}
+	}
+
+	while (builder->strsize + length > builder->strmax) {
+		tmp = builder->strings;
+		if ((result = ospreplica_grow(builder->mctx, &tmp, &builder->strmax, builder->strsize, 1, 65536)) != ISC_R_SUCCESS) {
+			return result;
+		}
+		builder->strings = tmp;
+	}
+
+	*offset = (isc_uint32_t)builder->strsize;
+	memcpy(builder->strings + builder->strsize, str, length);
+	builder->strsize += length;
+	builder->slots[slot] = *offset + 1;
+	builder->nstrings++;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Add line
+ * param builder Index builder
+ * param prefix Number prefix
+ * param kind Line kind
+ * param dest Destination, NULL for removal
+ * return ISC_R_SUCCESS successful, ISC_R_NOMEMORY failed
+ */
+static isc_result_t ospreplica_add_line(
+	ospreplica_builder_t *builder,
+	const char *prefix,
+	int kind,
+	const ospreplica_dest_t *dest)
+{
+	ospreplica_line_t *line;
+	void *tmp;
+	isc_result_t result;
+
+	if (builder->nlines == builder->maxlines) {
+		tmp = builder->lines;
+		if ((result = ospreplica_grow(builder->mctx, &tmp, &builder->maxlines, builder->nlines, sizeof(ospreplica_line_t), OSPREPLICA_MIN_LINES)) != ISC_R_SUCCESS) {
+			return result;
+		}
+		builder->lines = tmp;
+	}
+
+	line = &builder->lines[builder->nlines];
+	snprintf(line->prefix, sizeof(line->prefix), "%s", prefix);
+	line->seq = (isc_uint32_t)builder->nlines;
+	line->kind = kind;
+	if (dest != NULL) {
+		line->dest = *dest;
+	} else {
+		memset(&line->dest, 0, sizeof(line->dest));
+	}
+	builder->nlines++;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Parse one field, "-" for empty
+ * param builder Index builder
+ * param str Field, may be NULL
+ * param maxlen Max field length
+ * param offset String offset buffer
+ * return ISC_R_SUCCESS successful, ISC_R_NOSPACE too long, ISC_R_NOMEMORY failed
+ */
+static isc_result_t ospreplica_parse_field(
+	ospreplica_builder_t *builder,
+	const char *str,
+	size_t maxlen,
+	isc_uint32_t *offset)
+{
+	if ((str == NULL) || (strcmp(str, "-") == 0)) {
+		str = "";
+	}
+	if (strlen(str) >= maxlen) {
+		return ISC_R_NOSPACE;
+	}
+
+	return ospreplica_intern(builder, str, offset);
+}
+
+/*
+ * Parse export or delta file into builder lines
+ * param builder Index builder
+ * param path File path
+ * param delta Delta file flag
+ * param protofunc Protocol name function
+ * param line Number of lines read buffer, the offending line on format errors
+ * return ISC_R_SUCCESS successful, ISC_R_FILENOTFOUND no file, ISC_R_UNEXPECTEDTOKEN bad line, other failed
+ */
+static isc_result_t ospreplica_parse_file(
+	ospreplica_builder_t *builder,
+	const char *path,
+	isc_boolean_t delta,
+	ospreplica_protofunc_t protofunc,
+	unsigned int *line)
+{
+	char buffer[OSPREPLICA_LINE_SIZE];
+	char *item, *prefix, *saveptr = NULL;
+	ospreplica_dest_t dest;
+	ospcache_dest_t *sizes = NULL;
+	FILE *fp;
+	int kind;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	*line = 0;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		return ISC_R_FILENOTFOUND;
+	}
+
+	while ((result == ISC_R_SUCCESS) && (fgets(buffer, sizeof(buffer), fp) != NULL)) {
+		(*line)++;
+
+		if ((item = strtok_r(buffer, " \t\r\n", &saveptr)) == NULL) {
+			continue;
+		}
+		if (item[0] == '#') {
+			continue;
+		}
+
+		kind = OSPREPLICA_LINE_BASE;
+		if (delta == ISC_TRUE) {
+			if (strcmp(item, "+") == 0) {
+				kind = OSPREPLICA_LINE_ADD;
+			} else if (strcmp(item, "-") == 0) {
+				kind = OSPREPLICA_LINE_REMOVE;
+			} else {
+				result = ISC_R_UNEXPECTEDTOKEN;
+				break;
+			}
+			item = strtok_r(NULL, " \t\r\n", &saveptr);
+		}
+
+		prefix = item;
+		if ((prefix == NULL) ||
+			(prefix[0] == '\0') ||
+			(strlen(prefix) >= OSPCACHE_NUM_SIZE) ||
+			(strspn(prefix, "0123456789") != strlen(prefix)))
+		{
+			result = ISC_R_UNEXPECTEDTOKEN;
+			break;
+		}
+
+		if (kind == OSPREPLICA_LINE_REMOVE) {
+			result = ospreplica_add_line(builder, prefix, kind, NULL);
+			continue;
+		}
+
+		if (((item = strtok_r(NULL, " \t\r\n", &saveptr)) == NULL) || ((dest.protocol = protofunc(item)) < 0)) {
+			result = ISC_R_UNEXPECTEDTOKEN;
+			break;
+		}
+		if (((item = strtok_r(NULL, " \t\r\n", &saveptr)) == NULL) || (strcmp(item, "-") == 0)) {
+			result = ISC_R_UNEXPECTEDTOKEN;
+			break;
+		}
+		if (((result = ospreplica_parse_field(builder, item, sizeof(sizes->dest), &dest.dest)) != ISC_R_SUCCESS) ||
+			((result = ospreplica_parse_field(builder, strtok_r(NULL, " \t\r\n", &saveptr), sizeof(sizes->dnid), &dest.dnid)) != ISC_R_SUCCESS) ||
+			((result = ospreplica_parse_field(builder, strtok_r(NULL, " \t\r\n", &saveptr), sizeof(sizes->nprn), &dest.nprn)) != ISC_R_SUCCESS) ||
+			((result = ospreplica_parse_field(builder, strtok_r(NULL, " \t\r\n", &saveptr), sizeof(sizes->npcic), &dest.npcic)) != ISC_R_SUCCESS))
+		{
+			if (result == ISC_R_NOSPACE) {
+				result = ISC_R_UNEXPECTEDTOKEN;
+			}
+			break;
+		}
+		item = strtok_r(NULL, " \t\r\n", &saveptr);
+		dest.npdi = ((item != NULL) && (strcmp(item, "1") == 0)) ? 1 : 0;
+
+		result = ospreplica_add_line(builder, prefix, kind, &dest);
+	}
+
+	fclose(fp);
+
+	return result;
+}
+
+/*
+ * Add all destinations of a mapped index as base lines
+ * param builder Index builder
+ * param index Mapped index
+ * return ISC_R_SUCCESS successful, ISC_R_NOMEMORY failed
+ */
+static isc_result_t ospreplica_expand_index(
+	ospreplica_builder_t *builder,
+	const ospreplica_index_t *index)
+{
+	const ospreplica_prefix_t *prefix;
+	const ospreplica_dest_t *src;
+	ospreplica_dest_t dest;
+	isc_uint32_t i, j;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	for (i = 0; (i < index->header->nprefixes) && (result == ISC_R_SUCCESS); i++) {
+		prefix = &index->prefixes[i];
+		for (j = 0; (j < prefix->count) && (result == ISC_R_SUCCESS); j++) {
+			src = &index->dests[prefix->first + j];
+			dest.protocol = src->protocol;
+			dest.npdi = src->npdi;
+			if (((result = ospreplica_intern(builder, index->strings + src->dest, &dest.dest)) == ISC_R_SUCCESS) &&
+				((result = ospreplica_intern(builder, index->strings + src->dnid, &dest.dnid)) == ISC_R_SUCCESS) &&
+				((result = ospreplica_intern(builder, index->strings + src->nprn, &dest.nprn)) == ISC_R_SUCCESS) &&
+				((result = ospreplica_intern(builder, index->strings + src->npcic, &dest.npcic)) == ISC_R_SUCCESS))
+			{
+				result = ospreplica_add_line(builder, index->strings + prefix->prefix, OSPREPLICA_LINE_BASE, &dest);
+			}
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Order lines by prefix, then input order
+ * param a Line
+ * param b Line
+ * return <0, 0, >0
+ */
+static int ospreplica_compare_lines(
+	const void *a,
+	const void *b)
+{
+	const ospreplica_line_t *linea = a;
+	const ospreplica_line_t *lineb = b;
+	int cmp;
+
+	if ((cmp = strcmp(linea->prefix, lineb->prefix)) != 0) {
+		return cmp;
+	}
+
+	return (linea->seq < lineb->seq) ? -1 : ((linea->seq > lineb->seq) ? 1 : 0);
+}
+
+/*
+ * Write builder lines to an index file, replaced atomically. Delta lines of a prefix replace its base lines, at most
+ * OSPCACHE_MAX_DEST destinations are kept per prefix.
+ * param builder Index builder
+ * param path Index file path
+ * return ISC_R_SUCCESS successful, other failed
+ */
+static isc_result_t ospreplica_write_index(
+	ospreplica_builder_t *builder,
+	const char *path)
+{
+	char tmppath[OSPREPLICA_PATH_SIZE];
+	ospreplica_header_t header;
+	ospreplica_prefix_t *prefixes = NULL;
+	ospreplica_dest_t *dests = NULL;
+	ospreplica_line_t *line;
+	isc_uint32_t nprefixes = 0, ndests = 0, offset;
+	isc_uint64_t crc;
+	isc_stdtime_t now;
+	isc_boolean_t changed;
+	size_t i, start, end;
+	FILE *fp;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	if (snprintf(tmppath, sizeof(tmppath), "%s.tmp", path) >= (int)sizeof(tmppath)) {
+		return ISC_R_NOSPACE;
+	}
+
+	/* Intern the empty string first so that no table is empty */
+	if ((result = ospreplica_intern(builder, "", &offset)) != ISC_R_SUCCESS) {
+		return result;
+	}
+
+	if (builder->nlines != 0) {
+		qsort(builder->lines, builder->nlines, sizeof(ospreplica_line_t), ospreplica_compare_lines);
+
+		/* Line counts bound both record counts */
+		if (((prefixes = isc_mem_get(builder->mctx, builder->nlines * sizeof(ospreplica_prefix_t))) == NULL) ||
+			((dests = isc_mem_get(builder->mctx, builder->nlines * sizeof(ospreplica_dest_t))) == NULL))
+		{
+			result = ISC_R_NOMEMORY;
+		}
+	}
+
+	for (start = 0; (start < builder->nlines) && (result == ISC_R_SUCCESS); start = end) {
+		changed = ISC_FALSE;
+		for (end = start; (end < builder->nlines) && (strcmp(builder->lines[end].prefix, builder->lines[start].prefix) == 0); end++) {
+			if (builder->lines[end].kind != OSPREPLICA_LINE_BASE) {
+				changed = ISC_TRUE;
+			}
+		}
+
+		if ((result = ospreplica_intern(builder, builder->lines[start].prefix, &offset)) != ISC_R_SUCCESS) {
+			break;
+		}
+		prefixes[nprefixes].prefix = offset;
+		prefixes[nprefixes].first = ndests;
+		prefixes[nprefixes].count = 0;
+		for (i = start; i < end; i++) {
+			line = &builder->lines[i];
+			if (((changed == ISC_TRUE) && (line->kind != OSPREPLICA_LINE_ADD)) || (prefixes[nprefixes].count == OSPCACHE_MAX_DEST)) {
+				continue;
+			}
+			dests[ndests++] = line->dest;
+			prefixes[nprefixes].count++;
+		}
+		if (prefixes[nprefixes].count != 0) {
+			nprefixes++;
+		}
+	}
+
+	if ((result == ISC_R_SUCCESS) && ((fp = fopen(tmppath, "wb")) == NULL)) {
+		result = ISC_R_FAILURE;
+	}
+
+	if (result == ISC_R_SUCCESS) {
+		isc_stdtime_get(&now);
+
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, OSPREPLICA_MAGIC, sizeof(OSPREPLICA_MAGIC));
+		header.version = OSPREPLICA_VERSION;
+		header.nprefixes = nprefixes;
+		header.ndests = ndests;
+		header.strsize = builder->strsize;
+		header.prefixoffset = sizeof(header);
+		header.destoffset = header.prefixoffset + (isc_uint64_t)nprefixes * sizeof(ospreplica_prefix_t);
+		header.stroffset = header.destoffset + (isc_uint64_t)ndests * sizeof(ospreplica_dest_t);
+		header.created = now;
+
+		isc_crc64_init(&crc);
+		isc_crc64_update(&crc, prefixes, nprefixes * sizeof(ospreplica_prefix_t));
+		isc_crc64_update(&crc, dests, ndests * sizeof(ospreplica_dest_t));
+		isc_crc64_update(&crc, builder->strings, builder->strsize);
+		isc_crc64_final(&crc);
+		header.checksum = crc;
+
+		if ((fwrite(&header, sizeof(header), 1, fp) != 1) ||
+			((nprefixes != 0) && (fwrite(prefixes, sizeof(ospreplica_prefix_t), nprefixes, fp) != nprefixes)) ||
+			((ndests != 0) && (fwrite(dests, sizeof(ospreplica_dest_t), ndests, fp) != ndests)) ||
+			(fwrite(builder->strings, 1, builder->strsize, fp) != builder->strsize) ||
+			(fflush(fp) != 0) ||
+			(fsync(fileno(fp)) != 0))
+		{
+			result = ISC_R_FAILURE;
+		}
+
+		if ((fclose(fp) != 0) && (result == ISC_R_SUCCESS)) {
+			result = ISC_R_FAILURE;
+		}
+
+		if ((result == ISC_R_SUCCESS) && (rename(tmppath, path) != 0)) {
+			result = ISC_R_FAILURE;
+		}
+
+		if (result != ISC_R_SUCCESS) {
+			unlink(tmppath);
+		}
+	}
+
+	if (prefixes != NULL) {
+		isc_mem_put(builder->mctx, prefixes, builder->nlines * sizeof(ospreplica_prefix_t));
+	}
+	if (dests != NULL) {
+		isc_mem_put(builder->mctx, dests, builder->nlines * sizeof(ospreplica_dest_t));
+	}
+
+	return result;
+}
+
+/*
+ * Unmap index
+ * param mctx Memory context
+ * param indexp Mapped index
+ */
+static void ospreplica_unmap_index(
+	isc_mem_t *mctx,
+	ospreplica_index_t **indexp)
+{
+	munmap((*indexp)->base, (*indexp)->size);
+	isc_mem_put(mctx, *indexp, sizeof(ospreplica_index_t));
+	*indexp = NULL;
+}
+
+/*
+ * Map and check index file
+ * param mctx Memory context
+ * param path Index file path
+ * param indexp Mapped index buffer
+ * return ISC_R_SUCCESS successful, ISC_R_FILENOTFOUND no index, ISC_R_INVALIDFILE wrong version, size or content, other failed
+ */
+static isc_result_t ospreplica_map_index(
+	isc_mem_t *mctx,
+	const char *path,
+	ospreplica_index_t **indexp)
+{
+	ospreplica_index_t *index;
+	const ospreplica_header_t *header;
+	const ospreplica_dest_t *dest;
+	struct stat st;
+	isc_uint64_t crc;
+	isc_uint32_t i;
+	void *base;
+	int fd;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return ISC_R_FILENOTFOUND;
+	}
+	if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(ospreplica_header_t))) {
+		close(fd);
+		return ISC_R_INVALIDFILE;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return ISC_R_FAILURE;
+	}
+	header = base;
+
+	if ((memcmp(header->magic, OSPREPLICA_MAGIC, sizeof(OSPREPLICA_MAGIC)) != 0) ||
+		(header->version != OSPREPLICA_VERSION) ||
+		(header->strsize == 0) ||
+		(header->prefixoffset != sizeof(ospreplica_header_t)) ||
+		(header->destoffset != header->prefixoffset + (isc_uint64_t)header->nprefixes * sizeof(ospreplica_prefix_t)) ||
+		(header->stroffset != header->destoffset + (isc_uint64_t)header->ndests * sizeof(ospreplica_dest_t)) ||
+		(header->stroffset + header->strsize != (isc_uint64_t)st.st_size))
+	{
+		result = ISC_R_INVALIDFILE;
+	}
+
+	if (result == ISC_R_SUCCESS) {
+		isc_crc64_init(&crc);
+		isc_crc64_update(&crc, (const char *)base + sizeof(ospreplica_header_t), st.st_size - sizeof(ospreplica_header_t));
+		isc_crc64_final(&crc);
+		if (crc != header->checksum) {
+			result = ISC_R_INVALIDFILE;
+		}
+	}
+
+	if ((result == ISC_R_SUCCESS) && (((index = isc_mem_get(mctx, sizeof(*index))) == NULL))) {
+		result = ISC_R_NOMEMORY;
+	}
+
+	if (result == ISC_R_SUCCESS) {
+		index->base = base;
+		index->size = st.st_size;
+		index->header = header;
+		index->prefixes = (const ospreplica_prefix_t *)((const char *)base + header->prefixoffset);
+		index->dests = (const ospreplica_dest_t *)((const char *)base + header->destoffset);
+		index->strings = (const char *)base + header->stroffset;
+
+		/* Offsets are trusted by lookups, check them once here */
+		if (index->strings[header->strsize - 1] != '\0') {
+			result = ISC_R_INVALIDFILE;
+		}
+		for (i = 0; (i < header->nprefixes) && (result == ISC_R_SUCCESS); i++) {
+			if ((index->prefixes[i].prefix >= header->strsize) ||
+				(index->prefixes[i].count > OSPCACHE_MAX_DEST) ||
+				((isc_uint64_t)index->prefixes[i].first + index->prefixes[i].count > header->ndests) ||
+				((i != 0) && (strcmp(index->strings + index->prefixes[i - 1].prefix, index->strings + index->prefixes[i].prefix) >= 0)))
+			{
+				result = ISC_R_INVALIDFILE;
+			}
+		}
+		for (i = 0; (i < header->ndests) && (result == ISC_R_SUCCESS); i++) {
+			dest = &index->dests[i];
+			if ((dest->dest >= header->strsize) ||
+				(dest->dnid >= header->strsize) ||
+				(dest->nprn >= header->strsize) ||
+				(dest->npcic >= header->strsize))
+			{
+				result = ISC_R_INVALIDFILE;
+			}
+		}
+
+		if (result != ISC_R_SUCCESS) {
+			isc_mem_put(mctx, index, sizeof(*index));
+		}
+	}
+
+	if (result != ISC_R_SUCCESS) {
+		munmap(base, st.st_size);
+		return result;
+	}
+
+	*indexp = index;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Create route replica, the index is reused if it is newer than the export, else compiled from the export
+ * param mctx Memory context
+ * param path Route export file
+ * param protofunc Protocol name function
+ * param replicap Route replica handle buffer
+ * return ISC_R_SUCCESS successful, ISC_R_FILENOTFOUND neither export nor index, ISC_R_UNEXPECTEDTOKEN bad export line, other failed
+ */
+isc_result_t ospreplica_create(
+	isc_mem_t *mctx,
+	const char *path,
+	ospreplica_protofunc_t protofunc,
+	ospreplica_t **replicap)
+{
+	char idxpath[OSPREPLICA_PATH_SIZE];
+	ospreplica_t *replica;
+	ospreplica_builder_t builder;
+	ospreplica_index_t *index = NULL;
+	struct stat exportst, indexst;
+	isc_boolean_t haveexport, haveindex;
+	unsigned int line;
+	isc_result_t result;
+
+	REQUIRE(replicap != NULL && *replicap == NULL);
+
+	if ((strlen(path) >= sizeof(replica->path)) ||
+		(snprintf(idxpath, sizeof(idxpath), "%s%s", path, OSPREPLICA_SUFFIX) >= (int)sizeof(idxpath)))
+	{
+		return ISC_R_NOSPACE;
+	}
+
+	haveexport = (stat(path, &exportst) == 0) ? ISC_TRUE : ISC_FALSE;
+	haveindex = (stat(idxpath, &indexst) == 0) ? ISC_TRUE : ISC_FALSE;
+
+	result = ISC_R_FILENOTFOUND;
+	if ((haveindex == ISC_TRUE) && ((haveexport == ISC_FALSE) || (indexst.st_mtime >= exportst.st_mtime))) {
+		result = ospreplica_map_index(mctx, idxpath, &index);
+	}
+
+	if ((result != ISC_R_SUCCESS) && (haveexport == ISC_TRUE)) {
+		memset(&builder, 0, sizeof(builder));
+		builder.mctx = mctx;
+		if (((result = ospreplica_parse_file(&builder, path, ISC_FALSE, protofunc, &line)) == ISC_R_SUCCESS) &&
+			((result = ospreplica_write_index(&builder, idxpath)) == ISC_R_SUCCESS))
+		{
+			result = ospreplica_map_index(mctx, idxpath, &index);
+		}
+		ospreplica_free_builder(&builder);
+	}
+
+	if (result != ISC_R_SUCCESS) {
+		return result;
+	}
+
+	if ((replica = isc_mem_get(mctx, sizeof(*replica))) == NULL) {
+		ospreplica_unmap_index(mctx, &index);
+		return ISC_R_NOMEMORY;
+	}
+	replica->mctx = NULL;
+	isc_mem_attach(mctx, &replica->mctx);
+	snprintf(replica->path, sizeof(replica->path), "%s", path);
+	replica->protofunc = protofunc;
+	replica->index = index;
+	replica->hits = 0;
+	replica->misses = 0;
+	replica->deltas = 0;
+
+	if ((result = isc_rwlock_init(&replica->lock, 0, 0)) != ISC_R_SUCCESS) {
+		ospreplica_unmap_index(mctx, &replica->index);
+		isc_mem_putanddetach(&replica->mctx, replica, sizeof(*replica));
+		return result;
+	}
+	if ((result = isc_mutex_init(&replica->statslock)) != ISC_R_SUCCESS) {
+		isc_rwlock_destroy(&replica->lock);
+		ospreplica_unmap_index(mctx, &replica->index);
+		isc_mem_putanddetach(&replica->mctx, replica, sizeof(*replica));
+		return result;
+	}
+
+	*replicap = replica;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Destroy route replica, the index file stays for the next start
+ * param replicap Route replica handle
+ */
+void ospreplica_destroy(
+	ospreplica_t **replicap)
+{
+	ospreplica_t *replica;
+
+	REQUIRE(replicap != NULL && *replicap != NULL);
+
+	replica = *replicap;
+
+	ospreplica_unmap_index(replica->mctx, &replica->index);
+	DESTROYLOCK(&replica->statslock);
+	isc_rwlock_destroy(&replica->lock);
+	isc_mem_putanddetach(&replica->mctx, replica, sizeof(*replica));
+
+	*replicap = NULL;
+}
+
+/*
+ * Find prefix record
+ * param index Mapped index
+ * param number Number
+ * param length Prefix length
+ * return Prefix record, NULL for not found
+ */
+static const ospreplica_prefix_t *ospreplica_find(
+	const ospreplica_index_t *index,
+	const char *number,
+	size_t length)
+{
+	const ospreplica_prefix_t *prefix;
+	const char *str;
+	isc_uint32_t low = 0, high = index->header->nprefixes, middle;
+	int cmp;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		prefix = &index->prefixes[middle];
+		str = index->strings + prefix->prefix;
+		if ((cmp = strncmp(str, number, length)) == 0) {
+			cmp = (str[length] != '\0') ? 1 : 0;
+		}
+		if (cmp == 0) {
+			return prefix;
+		} else if (cmp < 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Get route by longest prefix match
+ * param replica Route replica handle
+ * param number Called number
+ * param route Route buffer, called numbers are set to number
+ * return ISC_R_SUCCESS found, ISC_R_NOTFOUND not found
+ */
+isc_result_t ospreplica_lookup(
+	ospreplica_t *replica,
+	const char *number,
+	ospcache_route_t *route)
+{
+	const ospreplica_index_t *index;
+	const ospreplica_prefix_t *prefix = NULL;
+	const ospreplica_dest_t *src;
+	ospcache_dest_t *dest;
+	size_t length = strlen(number);
+	isc_uint32_t i;
+	isc_result_t result = ISC_R_NOTFOUND;
+
+	if (length >= OSPCACHE_NUM_SIZE) {
+		length = OSPCACHE_NUM_SIZE - 1;
+	}
+
+	RWLOCK(&replica->lock, isc_rwlocktype_read);
+
+	index = replica->index;
+	for (; (length > 0) && (prefix == NULL); length--) {
+		prefix = ospreplica_find(index, number, length);
+	}
+
+	if (prefix != NULL) {
+		route->count = prefix->count;
+		for (i = 0; i < prefix->count; i++) {
+			src = &index->dests[prefix->first + i];
+			dest = &route->dest[i];
+			dest->protocol = src->protocol;
+			dest->npdi = src->npdi;
+			snprintf(dest->called, sizeof(dest->called), "%s", number);
+			snprintf(dest->dest, sizeof(dest->dest), "%s", index->strings + src->dest);
+			snprintf(dest->dnid, sizeof(dest->dnid), "%s", index->strings + src->dnid);
+			snprintf(dest->nprn, sizeof(dest->nprn), "%s", index->strings + src->nprn);
+			snprintf(dest->npcic, sizeof(dest->npcic), "%s", index->strings + src->npcic);
+		}
+		result = ISC_R_SUCCESS;
+	}
+
+	RWUNLOCK(&replica->lock, isc_rwlocktype_read);
+
+	LOCK(&replica->statslock);
+	if (result == ISC_R_SUCCESS) {
+		replica->hits++;
+	} else {
+		replica->misses++;
+	}
+	UNLOCK(&replica->statslock);
+
+	return result;
+}
+
+/*
+ * Apply a delta file, a new index is compiled from the current one and swapped in, lookups are only held up by the
+ * swap itself. Must not be called from two threads at once.
+ * param replica Route replica handle
+ * param path Delta file
+ * param count Number of delta lines read buffer, the offending line on format errors
+ * return ISC_R_SUCCESS successful, ISC_R_FILENOTFOUND no delta, ISC_R_UNEXPECTEDTOKEN bad delta line, other failed
+ */
+isc_result_t ospreplica_apply(
+	ospreplica_t *replica,
+	const char *path,
+	unsigned int *count)
+{
+	char idxpath[OSPREPLICA_PATH_SIZE];
+	ospreplica_builder_t builder;
+	ospreplica_index_t *index = NULL, *old;
+	isc_result_t result;
+
+	snprintf(idxpath, sizeof(idxpath), "%s%s", replica->path, OSPREPLICA_SUFFIX);
+
+	memset(&builder, 0, sizeof(builder));
+	builder.mctx = replica->mctx;
+
+	/* Only this thread swaps the index, so it can be read without the lock */
+	if (((result = ospreplica_expand_index(&builder, replica->index)) == ISC_R_SUCCESS) &&
+		((result = ospreplica_parse_file(&builder, path, ISC_TRUE, replica->protofunc, count)) == ISC_R_SUCCESS) &&
+		((result = ospreplica_write_index(&builder, idxpath)) == ISC_R_SUCCESS))
+	{
+		result = ospreplica_map_index(replica->mctx, idxpath, &index);
+	}
+
+	ospreplica_free_builder(&builder);
+
+	if (result != ISC_R_SUCCESS) {
+		return result;
+	}
+
+	RWLOCK(&replica->lock, isc_rwlocktype_write);
+	old = replica->index;
+	replica->index = index;
+	RWUNLOCK(&replica->lock, isc_rwlocktype_write);
+
+	ospreplica_unmap_index(replica->mctx, &old);
+
+	LOCK(&replica->statslock);
+	replica->deltas++;
+	UNLOCK(&replica->statslock);
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Get statistics
+ * param replica Route replica handle
+ * param stats Statistics buffer
+ */
+void ospreplica_getstats(
+	ospreplica_t *replica,
+	ospreplica_stats_t *stats)
+{
+	LOCK(&replica->statslock);
+	stats->hits = replica->hits;
+	stats->misses = replica->misses;
+	stats->deltas = replica->deltas;
+	UNLOCK(&replica->statslock);
+
+	RWLOCK(&replica->lock, isc_rwlocktype_read);
+	stats->prefixes = replica->index->header->nprefixes;
+	stats->dests = replica->index->header->ndests;
+	stats->strings = (size_t)replica->index->header->strsize;
+	RWUNLOCK(&replica->lock, isc_rwlocktype_read);
+}
+
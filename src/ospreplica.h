@@ -0,0 +1,50 @@
+/*
+ * ospreplica.h
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OSPREPLICA_H
+#define OSPREPLICA_H	1
+
+#include <isc/types.h>
+
+#include "ospcache.h"
+
+/* Route replica statistics */
+typedef struct ospreplica_stats {
+	isc_uint64_t hits;			/* Number of lookups answered */
+	isc_uint64_t misses;		/* Number of lookups not answered */
+	isc_uint64_t deltas;		/* Number of deltas applied */
+	unsigned int prefixes;		/* Current number of prefixes */
+	unsigned int dests;			/* Current number of destinations */
+	size_t strings;				/* Current size of string table */
+} ospreplica_stats_t;
+
+/* Protocol name to signaling protocol function, returns -1 for unknown names */
+typedef int (*ospreplica_protofunc_t)(const char *name);
+
+/* Route replica handle */
+typedef struct ospreplica ospreplica_t;
+
+isc_result_t ospreplica_create(isc_mem_t *mctx, const char *path, ospreplica_protofunc_t protofunc, ospreplica_t **replicap);
+void ospreplica_destroy(ospreplica_t **replicap);
+isc_result_t ospreplica_lookup(ospreplica_t *replica, const char *number, ospcache_route_t *route);
+isc_result_t ospreplica_apply(ospreplica_t *replica, const char *path, unsigned int *count);
+void ospreplica_getstats(ospreplica_t *replica, ospreplica_stats_t *stats);
+
+#endif /* OSPREPLICA_H */
+
@@ -0,0 +1,766 @@
+/*
+ * ospresp.c
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <isc/list.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/netaddr.h>
+#include <isc/rwlock.h>
+#include <isc/util.h>
+
+#include <dns/message.h>
+#include <dns/name.h>
+#include <dns/rdataset.h>
+#include <dns/result.h>
+#include <dns/view.h>
+#include <dns/zone.h>
+#include <dns/zt.h>
+
+#include <named/client.h>
+#include <named/server.h>
+#include <named/globals.h>
+
+#include "ospresp.h"
+
+/*
+ * Rendered responses are kept by everything that shapes them: view, header flags, EDNS and DO, question name, type
+ * and class, source URI and, when a zone keys routes by source, the client address. A hit is sent from
+ * client_request with the message ID and question name case of the query, query.c and the database are not involved.
+ *
+ * One cache serves all zones. It is enabled while any zone has it configured. Flushes only move the generation on,
+ * flushed responses are dropped when met or evicted for memory.
+ */
+
+/* Constant */
+#define OSPRESP_SHARDS			16		/* Number of shards, power of 2 */
+#define OSPRESP_ENTRY_GUESS		512		/* Expected average entry size used to size hash tables */
+#define OSPRESP_MIN_BUCKETS		64		/* Min number of hash buckets per shard, power of 2 */
+#define OSPRESP_HEADER_SIZE		12		/* DNS header length */
+#define OSPRESP_NAME_SIZE		255		/* Max wire name length */
+#define OSPRESP_MAX_LABEL		63		/* Max label length */
+
+/* Key flags */
+#define OSPRESP_FLAG_EDNS		0x01	/* Query has OPT */
+#define OSPRESP_FLAG_DO			0x02	/* Query has DO */
+#define OSPRESP_FLAG_RA			0x04	/* Recursion available */
+
+typedef struct ospresp_entry ospresp_entry_t;
+
+/* Cache entry, key and response follow in the same allocation */
+struct ospresp_entry {
+	ospresp_entry_t *next;				/* Hash chain */
+	ISC_LINK(ospresp_entry_t) link;		/* LRU list, most recently used at head */
+	unsigned int hash;					/* Key hash */
+	size_t size;						/* Allocated size */
+	isc_stdtime_t expire;				/* Expire time */
+	isc_uint32_t generation;			/* Cache generation when added */
+	unsigned int keylen;				/* Key length */
+	unsigned char *key;					/* Key */
+	size_t msglen;						/* Response length */
+	unsigned char *msg;					/* Rendered response */
+};
+
+/* Cache shard */
+typedef struct ospresp_shard {
+	isc_mutex_t lock;					/* Shard lock */
+	unsigned int nbuckets;				/* Number of hash buckets, power of 2, 0 while disabled */
+	ospresp_entry_t **buckets;			/* Hash buckets */
+	ISC_LIST(ospresp_entry_t) lru;		/* LRU list */
+	size_t memory;						/* Memory used by entries */
+	unsigned int entries;				/* Number of entries */
+	isc_uint64_t hits;					/* Number of queries answered */
+	isc_uint64_t misses;				/* Number of cacheable queries not answered */
+	isc_uint64_t inserts;				/* Number of responses added or replaced */
+	isc_uint64_t evictions;				/* Number of responses dropped for memory */
+} ospresp_shard_t;
+
+/* Response cache */
+typedef struct ospresp {
+	isc_mem_t *mctx;							/* Memory context */
+	isc_rwlock_t lock;							/* Held for read by queries, for write by configuration changes */
+	unsigned int refs;							/* Number of zones using the cache, 0 for disabled */
+	size_t maxmemory;							/* Max memory per shard */
+	unsigned int bysource;						/* Number of zones keying by client address, any puts it in the key */
+	isc_uint32_t generation;					/* Current generation */
+	isc_uint64_t flushes;						/* Number of flushes */
+	ospresp_shard_t shards[OSPRESP_SHARDS];		/* Shards */
+} ospresp_t;
+
+/* Response cache, NULL before ospresp_init */
+static ospresp_t *ospresp = NULL;
+
+/*
+ * Hash key, FNV-1a
+ * param key Key
+ * param keylen Key length
+ * return Hash value
+ */
+static unsigned int ospresp_hash(
+	const unsigned char *key,
+	unsigned int keylen)
+{
+	unsigned int hash = 2166136261U;
+	unsigned int i;
+
+	for (i = 0; i < keylen; i++) {
+		hash ^= key[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/*
+ * Get bucket of a hash value
+ * param shard Shard
+ * param hash Hash value
+ * return Bucket
+ */
+static ospresp_entry_t **ospresp_get_bucket(
+	ospresp_shard_t *shard,
+	unsigned int hash)
+{
+	return &shard->buckets[(hash / OSPRESP_SHARDS) & (shard->nbuckets - 1)];
+}
+
+/*
+ * Unlink and free entry, shard must be locked
+ * param shard Shard
+ * param entry Entry
+ */
+static void ospresp_free_entry(
+	ospresp_shard_t *shard,
+	ospresp_entry_t *entry)
+{
+	ospresp_entry_t **prev;
+
+	for (prev = ospresp_get_bucket(shard, entry->hash); *prev != entry; prev = &(*prev)->next)
+		;
+	*prev = entry->next;
+
+	ISC_LIST_UNLINK(shard->lru, entry, link);
+	shard->memory -= entry->size;
+	shard->entries--;
+
+	isc_mem_put(ospresp->mctx, entry, entry->size);
+}
+
+/*
+ * Find entry, shard must be locked
+ * param shard Shard
+ * param hash Key hash
+ * param key Key
+ * param keylen Key length
+ * return Entry or NULL
+ */
+static ospresp_entry_t *ospresp_find_entry(
+	ospresp_shard_t *shard,
+	unsigned int hash,
+	const unsigned char *key,
+	unsigned int keylen)
+{
+	ospresp_entry_t *entry;
+
+	for (entry = *ospresp_get_bucket(shard, hash); entry != NULL; entry = entry->next) {
+		if ((entry->hash == hash) && (entry->keylen == keylen) && (memcmp(entry->key, key, keylen) == 0)) {
+			break;
+		}
+	}
+
+	return entry;
+}
+
+/*
+ * Check the allow-query and allow-query-on of the zone answering a query, as query.c does. Zones without their own use
+ * the view ones, checked by the caller.
+ * param client Client
+ * return ISC_TRUE allowed, ISC_FALSE refused or no question
+ */
+static isc_boolean_t ospresp_check_zone(
+	ns_client_t *client)
+{
+	dns_name_t *qname = NULL;
+	dns_rdataset_t *qrdataset;
+	dns_zone_t *zone = NULL;
+	dns_acl_t *acl;
+	unsigned int options = 0;
+	isc_result_t result;
+	isc_boolean_t allowed = ISC_TRUE;
+
+	if (dns_message_firstname(client->message, DNS_SECTION_QUESTION) != ISC_R_SUCCESS) {
+		return ISC_FALSE;
+	}
+	dns_message_currentname(client->message, DNS_SECTION_QUESTION, &qname);
+	if ((qrdataset = ISC_LIST_HEAD(qname->list)) == NULL) {
+		return ISC_FALSE;
+	}
+
+	/* DS is answered by the parent zone */
+	if (qrdataset->type == dns_rdatatype_ds) {
+		options |= DNS_ZTFIND_NOEXACT;
+	}
+
+	result = dns_zt_find(client->view->zonetable, qname, options, NULL, &zone);
+	if ((result == ISC_R_SUCCESS) || (result == DNS_R_PARTIALMATCH)) {
+		if (((acl = dns_zone_getqueryacl(zone)) != NULL) &&
+			(ns_client_checkaclsilent(client, NULL, acl, ISC_TRUE) != ISC_R_SUCCESS))
+		{
+			allowed = ISC_FALSE;
+		} else if (((acl = dns_zone_getqueryonacl(zone)) != NULL) &&
+			(ns_client_checkaclsilent(client, &client->destaddr, acl, ISC_TRUE) != ISC_R_SUCCESS))
+		{
+			allowed = ISC_FALSE;
+		}
+		dns_zone_detach(&zone);
+	}
+
+	return allowed;
+}
+
+/*
+ * Build the key of a query into the client, lock must be held
+ * param client Client
+ * param namelen Question name length buffer
+ * return ISC_TRUE built, ISC_FALSE query not cacheable
+ */
+static isc_boolean_t ospresp_build_key(
+	ns_client_t *client,
+	unsigned int *namelen)
+{
+	unsigned char *key = client->respkeybuf;
+	const unsigned char *query;
+	isc_region_t *raw;
+	isc_netaddr_t netaddr;
+	unsigned int keylen = 0, offset, label, flags = 0;
+	unsigned char c;
+
+	client->respkeylen = 0;
+
+	/*
+	 * Only plain UDP queries the view and the zone let in, anything signed, rate limited, logged or asking for server
+	 * specific options goes the full way.
+	 */
+	if (((client->attributes & NS_CLIENTATTR_TCP) != 0) ||
+		((client->attributes & (NS_CLIENTATTR_WANTNSID | NS_CLIENTATTR_WANTSIT | NS_CLIENTATTR_HAVESIT | NS_CLIENTATTR_WANTEXPIRE)) != 0) ||
+		(client->view == NULL) ||
+		(client->view->rrl != NULL) ||
+		(ns_client_checkaclsilent(client, NULL, client->view->queryacl, ISC_TRUE) != ISC_R_SUCCESS) ||
+		(ns_client_checkaclsilent(client, &client->destaddr, client->view->queryonacl, ISC_TRUE) != ISC_R_SUCCESS) ||
+		(ospresp_check_zone(client) == ISC_FALSE) ||
+		(ns_g_server->log_queries == ISC_TRUE) ||
+		(client->signer != NULL) ||
+		(dns_message_gettsig(client->message, NULL) != NULL) ||
+		(dns_message_getsig0(client->message, NULL) != NULL))
+	{
+		return ISC_FALSE;
+	}
+
+	/* Exactly one question and no records but OPT */
+	if (((raw = dns_message_getrawmessage(client->message)) == NULL) || (raw->length < OSPRESP_HEADER_SIZE + 5)) {
+		return ISC_FALSE;
+	}
+	query = raw->base;
+	if ((query[4] != 0) || (query[5] != 1) || (query[6] != 0) || (query[7] != 0) || (query[8] != 0) || (query[9] != 0)) {
+		return ISC_FALSE;
+	}
+
+	memcpy(key, &client->view, sizeof(client->view));
+	keylen += sizeof(client->view);
+
+	/* RD, AD and CD are copied or honoured in responses */
+	key[keylen++] = query[2] & (DNS_MESSAGEFLAG_RD >> 8);
+	key[keylen++] = query[3] & ((DNS_MESSAGEFLAG_AD | DNS_MESSAGEFLAG_CD) & 0xff);
+	if ((client->attributes & NS_CLIENTATTR_WANTOPT) != 0) {
+		flags |= OSPRESP_FLAG_EDNS;
+	}
+	if ((client->extflags & DNS_MESSAGEEXTFLAG_DO) != 0) {
+		flags |= OSPRESP_FLAG_DO;
+	}
+	if ((client->attributes & NS_CLIENTATTR_RA) != 0) {
+		flags |= OSPRESP_FLAG_RA;
+	}
+	key[keylen++] = (unsigned char)flags;
+
+	/* Question name in lower case, a question has no compression pointers */
+	for (offset = OSPRESP_HEADER_SIZE; (label = query[offset]) != 0; offset += label + 1) {
+		if ((label > OSPRESP_MAX_LABEL) ||
+			(offset + label + 1 - OSPRESP_HEADER_SIZE >= OSPRESP_NAME_SIZE) ||
+			(offset + label + 1 + 5 > raw->length))
+		{
+			return ISC_FALSE;
+		}
+		key[keylen++] = (unsigned char)label;
+		for (c = 1; c <= label; c++) {
+			key[keylen++] = ((query[offset + c] >= 'A') && (query[offset + c] <= 'Z')) ? query[offset + c] + ('a' - 'A') : query[offset + c];
+		}
+	}
+	*namelen = offset + 1 - OSPRESP_HEADER_SIZE;
+
+	/* Root label, type and class */
+	memcpy(key + keylen, query + offset, 5);
+	keylen += 5;
+
+	key[keylen++] = (unsigned char)(client->urilen >> 8);
+	key[keylen++] = (unsigned char)(client->urilen & 0xff);
+	memcpy(key + keylen, client->uribuf, client->urilen);
+	keylen += client->urilen;
+
+	if (ospresp->bysource != 0) {
+		isc_netaddr_fromsockaddr(&netaddr, &client->peeraddr);
+		key[keylen++] = (unsigned char)netaddr.family;
+		if (netaddr.family == AF_INET) {
+			memcpy(key + keylen, &netaddr.type.in, sizeof(netaddr.type.in));
+			keylen += sizeof(netaddr.type.in);
+		} else {
+			memcpy(key + keylen, &netaddr.type.in6, sizeof(netaddr.type.in6));
+			keylen += sizeof(netaddr.type.in6);
+		}
+	}
+
+	client->respkeylen = keylen;
+
+	return ISC_TRUE;
+}
+
+/*
+ * Get the lowest answer TTL of a response
+ * param msg Response
+ * param len Response length
+ * param ttl Lowest TTL buffer
+ * return ISC_R_SUCCESS successful, ISC_R_FORMERR malformed
+ */
+static isc_result_t ospresp_get_ttl(
+	const unsigned char *msg,
+	size_t len,
+	isc_uint32_t *ttl)
+{
+	size_t offset = OSPRESP_HEADER_SIZE;
+	unsigned int count, rdlen, section;
+	isc_uint32_t value;
+
+	*ttl = 0xffffffff;
+
+	for (section = 0; section < 2; section++) {
+		count = (section == 0) ? ((msg[4] << 8) | msg[5]) : ((msg[6] << 8) | msg[7]);
+		while (count-- > 0) {
+			/* Owner name, up to a root label or a compression pointer */
+			while ((offset < len) && (msg[offset] != 0) && ((msg[offset] & 0xc0) != 0xc0)) {
+				offset += msg[offset] + 1;
+			}
+			if (offset >= len) {
+				return ISC_R_FORMERR;
+			}
+			offset += (msg[offset] == 0) ? 1 : 2;
+
+			if (section == 0) {
+				/* Question type and class */
+				offset += 4;
+				continue;
+			}
+			if (offset + 10 > len) {
+				return ISC_R_FORMERR;
+			}
+			value = ((isc_uint32_t)msg[offset + 4] << 24) | (msg[offset + 5] << 16) | (msg[offset + 6] << 8) | msg[offset + 7];
+			rdlen = (msg[offset + 8] << 8) | msg[offset + 9];
+			offset += 10 + rdlen;
+			if (offset > len) {
+				return ISC_R_FORMERR;
+			}
+			if (value < *ttl) {
+				*ttl = value;
+			}
+		}
+	}
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Free all entries and hash tables, lock must be held for write
+ */
+static void ospresp_free_entries(void)
+{
+	ospresp_shard_t *shard;
+	unsigned int i;
+
+	for (i = 0; i < OSPRESP_SHARDS; i++) {
+		shard = &ospresp->shards[i];
+		LOCK(&shard->lock);
+		while (!ISC_LIST_EMPTY(shard->lru)) {
+			ospresp_free_entry(shard, ISC_LIST_HEAD(shard->lru));
+		}
+		if (shard->buckets != NULL) {
+			isc_mem_put(ospresp->mctx, shard->buckets, shard->nbuckets * sizeof(ospresp_entry_t *));
+			shard->buckets = NULL;
+			shard->nbuckets = 0;
+		}
+		UNLOCK(&shard->lock);
+	}
+}
+
+/*
+ * Init response cache, disabled until a zone attaches
+ * param mctx Memory context
+ * return ISC_R_SUCCESS successful, other failed
+ */
+isc_result_t ospresp_init(
+	isc_mem_t *mctx)
+{
+	ospresp_shard_t *shard;
+	unsigned int i;
+	isc_result_t result;
+
+	REQUIRE(ospresp == NULL);
+
+	if ((ospresp = isc_mem_get(mctx, sizeof(*ospresp))) == NULL) {
+		return ISC_R_NOMEMORY;
+	}
+	memset(ospresp, 0, sizeof(*ospresp));
+	ospresp->mctx = NULL;
+	isc_mem_attach(mctx, &ospresp->mctx);
+
+	if ((result = isc_rwlock_init(&ospresp->lock, 0, 0)) != ISC_R_SUCCESS) {
+		isc_mem_putanddetach(&ospresp->mctx, ospresp, sizeof(*ospresp));
+		ospresp = NULL;
+		return result;
+	}
+
+	for (i = 0; i < OSPRESP_SHARDS; i++) {
+		shard = &ospresp->shards[i];
+		ISC_LIST_INIT(shard->lru);
+		if ((result = isc_mutex_init(&shard->lock)) != ISC_R_SUCCESS) {
+			break;
+		}
+	}
+
+	if (result != ISC_R_SUCCESS) {
+		while (i-- > 0) {
+			DESTROYLOCK(&ospresp->shards[i].lock);
+		}
+		isc_rwlock_destroy(&ospresp->lock);
+		isc_mem_putanddetach(&ospresp->mctx, ospresp, sizeof(*ospresp));
+		ospresp = NULL;
+		return result;
+	}
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Destroy response cache, no query may be running
+ */
+void ospresp_clear(void)
+{
+	unsigned int i;
+
+	if (ospresp == NULL) {
+		return;
+	}
+
+	ospresp_free_entries();
+	for (i = 0; i < OSPRESP_SHARDS; i++) {
+		DESTROYLOCK(&ospresp->shards[i].lock);
+	}
+	isc_rwlock_destroy(&ospresp->lock);
+	isc_mem_putanddetach(&ospresp->mctx, ospresp, sizeof(*ospresp));
+	ospresp = NULL;
+}
+
+/*
+ * Attach a zone, enabling the cache. The size is the largest of the attached zones and the client address is in the
+ * key while any attached zone keys by it, a later zone never loosens either. Hash tables are sized by the first.
+ * Cached responses are flushed.
+ * param maxmemory Max memory used by responses in bytes
+ * param bysource Client address in key flag
+ */
+void ospresp_attach(
+	size_t maxmemory,
+	isc_boolean_t bysource)
+{
+	ospresp_shard_t *shard;
+	unsigned int i, nbuckets;
+
+	if (ospresp == NULL) {
+		return;
+	}
+
+	RWLOCK(&ospresp->lock, isc_rwlocktype_write);
+
+	if (maxmemory / OSPRESP_SHARDS > ospresp->maxmemory) {
+		ospresp->maxmemory = maxmemory / OSPRESP_SHARDS;
+	}
+	if (bysource == ISC_TRUE) {
+		ospresp->bysource++;
+	}
+	ospresp->generation++;
+
+	if (ospresp->refs == 0) {
+		/* Size hash tables for the expected number of entries */
+		for (nbuckets = OSPRESP_MIN_BUCKETS; nbuckets * OSPRESP_ENTRY_GUESS < ospresp->maxmemory; nbuckets *= 2)
+			;
+		for (i = 0; i < OSPRESP_SHARDS; i++) {
+			shard = &ospresp->shards[i];
+			LOCK(&shard->lock);
+			if ((shard->buckets = isc_mem_get(ospresp->mctx, nbuckets * sizeof(ospresp_entry_t *))) != NULL) {
+				memset(shard->buckets, 0, nbuckets * sizeof(ospresp_entry_t *));
+				shard->nbuckets = nbuckets;
+			}
+			UNLOCK(&shard->lock);
+		}
+	}
+	ospresp->refs++;
+
+	RWUNLOCK(&ospresp->lock, isc_rwlocktype_write);
+}
+
+/*
+ * Detach a zone, the last one disables the cache and frees all responses
+ * param bysource Client address in key flag the zone was attached with
+ */
+void ospresp_detach(
+	isc_boolean_t bysource)
+{
+	if (ospresp == NULL) {
+		return;
+	}
+
+	RWLOCK(&ospresp->lock, isc_rwlocktype_write);
+
+	INSIST(ospresp->refs > 0);
+	ospresp->generation++;
+	if (bysource == ISC_TRUE) {
+		INSIST(ospresp->bysource > 0);
+		ospresp->bysource--;
+	}
+	if (--ospresp->refs == 0) {
+		ospresp_free_entries();
+		ospresp->maxmemory = 0;
+	}
+
+	RWUNLOCK(&ospresp->lock, isc_rwlocktype_write);
+}
+
+/*
+ * Drop all cached responses, for route changes the cache key does not show
+ */
+void ospresp_flush(void)
+{
+	if (ospresp == NULL) {
+		return;
+	}
+
+	RWLOCK(&ospresp->lock, isc_rwlocktype_write);
+	ospresp->generation++;
+	ospresp->flushes++;
+	RWUNLOCK(&ospresp->lock, isc_rwlocktype_write);
+}
+
+/*
+ * Get the cached response of a query, ready to send. The key is kept in the client for ospresp_put.
+ * param client Client
+ * param buf Response buffer
+ * param size Response buffer size
+ * param len Response length buffer
+ * return ISC_R_SUCCESS found, ISC_R_NOTFOUND not found, ISC_R_NOSPACE buffer too small, ISC_R_IGNORE not cacheable
+ */
+isc_result_t ospresp_get(
+	ns_client_t *client,
+	unsigned char *buf,
+	size_t size,
+	size_t *len)
+{
+	ospresp_shard_t *shard;
+	ospresp_entry_t *entry;
+	isc_region_t *raw;
+	unsigned int hash, namelen;
+	isc_result_t result = ISC_R_NOTFOUND;
+
+	client->respkeylen = 0;
+	client->resphold = 0;
+
+	if (ospresp == NULL) {
+		return ISC_R_IGNORE;
+	}
+
+	RWLOCK(&ospresp->lock, isc_rwlocktype_read);
+
+	if ((ospresp->refs == 0) || (ospresp_build_key(client, &namelen) == ISC_FALSE)) {
+		RWUNLOCK(&ospresp->lock, isc_rwlocktype_read);
+		return ISC_R_IGNORE;
+	}
+	client->respgen = ospresp->generation;
+
+	hash = ospresp_hash(client->respkeybuf, client->respkeylen);
+	shard = &ospresp->shards[hash & (OSPRESP_SHARDS - 1)];
+
+	LOCK(&shard->lock);
+
+	if (shard->buckets != NULL) {
+		entry = ospresp_find_entry(shard, hash, client->respkeybuf, client->respkeylen);
+		if ((entry != NULL) && ((entry->generation != ospresp->generation) || (entry->expire <= client->now))) {
+			ospresp_free_entry(shard, entry);
+			entry = NULL;
+		}
+		if (entry == NULL) {
+			shard->misses++;
+		} else if (entry->msglen > size) {
+			result = ISC_R_NOSPACE;
+		} else {
+			memcpy(buf, entry->msg, entry->msglen);
+			*len = entry->msglen;
+			ISC_LIST_UNLINK(shard->lru, entry, link);
+			ISC_LIST_PREPEND(shard->lru, entry, link);
+			shard->hits++;
+			result = ISC_R_SUCCESS;
+		}
+	}
+
+	UNLOCK(&shard->lock);
+
+	RWUNLOCK(&ospresp->lock, isc_rwlocktype_read);
+
+	if (result == ISC_R_SUCCESS) {
+		/* Message ID and question name as the client sent them, answers point to the question name */
+		raw = dns_message_getrawmessage(client->message);
+		memcpy(buf, raw->base, 2);
+		memcpy(buf + OSPRESP_HEADER_SIZE, raw->base + OSPRESP_HEADER_SIZE, namelen);
+	}
+
+	return result;
+}
+
+/*
+ * Cache the response of a query if the database allowed it, with the key and generation ospresp_get left in the
+ * client. Only successful untruncated responses with answers are kept, for the lowest answer TTL or the database hold
+ * time, whichever is shorter. Answers with TTL 0 are kept for the hold time.
+ * param client Client
+ * param msg Rendered response
+ * param len Response length
+ */
+void ospresp_put(
+	ns_client_t *client,
+	const unsigned char *msg,
+	size_t len)
+{
+	ospresp_shard_t *shard;
+	ospresp_entry_t *entry;
+	isc_uint32_t ttl, hold = client->resphold;
+	unsigned int hash;
+	size_t size;
+
+	if ((ospresp == NULL) ||
+		(client->respkeylen == 0) ||
+		(hold == 0) ||
+		(len < OSPRESP_HEADER_SIZE) ||
+		((msg[3] & 0x0f) != dns_rcode_noerror) ||
+		((msg[2] & (DNS_MESSAGEFLAG_TC >> 8)) != 0) ||
+		((msg[6] == 0) && (msg[7] == 0)) ||
+		(ospresp_get_ttl(msg, len, &ttl) != ISC_R_SUCCESS))
+	{
+		return;
+	}
+	if ((ttl != 0) && (ttl < hold)) {
+		hold = ttl;
+	}
+
+	size = sizeof(*entry) + client->respkeylen + len;
+	hash = ospresp_hash(client->respkeybuf, client->respkeylen);
+
+	RWLOCK(&ospresp->lock, isc_rwlocktype_read);
+
+	/* A flush since the lookup may have dropped the routes this response was built from */
+	if ((ospresp->refs != 0) && (client->respgen == ospresp->generation) && (size <= ospresp->maxmemory)) {
+		shard = &ospresp->shards[hash & (OSPRESP_SHARDS - 1)];
+
+		LOCK(&shard->lock);
+
+		if ((shard->buckets != NULL) && ((entry = isc_mem_get(ospresp->mctx, size)) != NULL)) {
+			entry->hash = hash;
+			entry->size = size;
+			entry->expire = client->now + hold;
+			entry->generation = ospresp->generation;
+			entry->keylen = client->respkeylen;
+			entry->key = (unsigned char *)(entry + 1);
+			memcpy(entry->key, client->respkeybuf, client->respkeylen);
+			entry->msglen = len;
+			entry->msg = entry->key + entry->keylen;
+			memcpy(entry->msg, msg, len);
+
+			while (!ISC_LIST_EMPTY(shard->lru) && (shard->memory + size > ospresp->maxmemory)) {
+				ospresp_free_entry(shard, ISC_LIST_TAIL(shard->lru));
+				shard->evictions++;
+			}
+
+			entry->next = *ospresp_get_bucket(shard, hash);
+			*ospresp_get_bucket(shard, hash) = entry;
+			ISC_LINK_INIT(entry, link);
+			ISC_LIST_PREPEND(shard->lru, entry, link);
+			shard->memory += size;
+			shard->entries++;
+			shard->inserts++;
+
+			/* The old response of the key, if any, is behind the new one in the chain */
+			for (entry = entry->next; entry != NULL; entry = entry->next) {
+				if ((entry->hash == hash) && (entry->keylen == client->respkeylen) && (memcmp(entry->key, client->respkeybuf, entry->keylen) == 0)) {
+					ospresp_free_entry(shard, entry);
+					break;
+				}
+			}
+		}
+
+		UNLOCK(&shard->lock);
+	}
+
+	RWUNLOCK(&ospresp->lock, isc_rwlocktype_read);
+}
+
+/*
+ * Get statistics
+ * param stats Statistics buffer
+ */
+void ospresp_getstats(
+	ospresp_stats_t *stats)
+{
+	ospresp_shard_t *shard;
+	unsigned int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (ospresp == NULL) {
+		return;
+	}
+
+	RWLOCK(&ospresp->lock, isc_rwlocktype_read);
+	stats->flushes = ospresp->flushes;
+	for (i = 0; i < OSPRESP_SHARDS; i++) {
+		shard = &ospresp->shards[i];
+		LOCK(&shard->lock);
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->inserts += shard->inserts;
+		stats->evictions += shard->evictions;
+		stats->entries += shard->entries;
+		stats->memory += shard->memory;
+		UNLOCK(&shard->lock);
+	}
+	RWUNLOCK(&ospresp->lock, isc_rwlocktype_read);
+}
+
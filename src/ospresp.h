@@ -0,0 +1,51 @@
+/*
+ * ospresp.h
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OSPRESP_H
+#define OSPRESP_H	1
+
+#include <isc/types.h>
+
+#include <named/client.h>
+
+/* Buffer size */
+#define OSPRESP_KEY_SIZE	576		/* Key length, view, flags, question, source URI and address */
+
+/* Response cache statistics */
+typedef struct ospresp_stats {
+	isc_uint64_t hits;			/* Number of queries answered from cache */
+	isc_uint64_t misses;		/* Number of cacheable queries not answered from cache */
+	isc_uint64_t inserts;		/* Number of responses added or replaced */
+	isc_uint64_t evictions;		/* Number of responses dropped for memory */
+	isc_uint64_t flushes;		/* Number of flushes */
+	unsigned int entries;		/* Current number of responses, flushed ones not yet reused included */
+	size_t memory;				/* Current memory used by responses */
+} ospresp_stats_t;
+
+isc_result_t ospresp_init(isc_mem_t *mctx);
+void ospresp_clear(void);
+void ospresp_attach(size_t maxmemory, isc_boolean_t bysource);
+void ospresp_detach(isc_boolean_t bysource);
+void ospresp_flush(void);
+isc_result_t ospresp_get(ns_client_t *client, unsigned char *buf, size_t size, size_t *len);
+void ospresp_put(ns_client_t *client, const unsigned char *msg, size_t len);
+void ospresp_getstats(ospresp_stats_t *stats);
+
+#endif /* OSPRESP_H */
+
@@ -0,0 +1,501 @@
+/*
+ * osprules.c
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/rwlock.h>
+#include <isc/util.h>
+
+#include "osprules.h"
+#include "osptrie.h"
+
+/*
+ * The rules file is a text file, one rule per line, lines starting with '#' are comments:
+ *	prefix route sip|h323 dest [dnid]	answer with dest, route lines of the same prefix add destinations in order
+ *	prefix nxdomain						answer nonexistent domain
+ *	prefix refuse						refuse the query
+ *	prefix pass							route through OSP, to carve a range out of a shorter prefix
+ * The prefix "*" matches all numbers. The longest matching prefix wins.
+ *
+ * A rule set is compiled into a digit trie whose values are rule indexes and is never changed after that. A reload
+ * compiles a new set aside and swaps the pointer, so lookups only wait for the swap itself.
+ */
+
+/* Constant */
+#define OSPRULES_PATH_SIZE	1024		/* File path length */
+#define OSPRULES_LINE_SIZE	1024		/* Max rules line length */
+#define OSPRULES_MIN_RULES	64			/* Min number of rules allocated */
+#define OSPRULES_ALL		"*"			/* Prefix matching all numbers */
+
+/* Rule */
+typedef struct osprules_rule {
+	int action;									/* Rule action */
+	int count;									/* Number of destinations */
+	unsigned int dest[OSPCACHE_MAX_DEST];		/* Destination indexes */
+} osprules_rule_t;
+
+/* Compiled rule set */
+typedef struct osprules_set {
+	osptrie_t *trie;				/* Prefix to rule index */
+	osprules_rule_t *rules;			/* Rules */
+	unsigned int nrules;			/* Number of rules */
+	unsigned int maxrules;			/* Number of allocated rules */
+	ospcache_dest_t *dests;			/* Destinations */
+	unsigned int ndests;			/* Number of destinations */
+	unsigned int maxdests;			/* Number of allocated destinations */
+	time_t srcmtime;				/* Rules file modification time when compiled */
+	off_t srcsize;					/* Rules file size when compiled */
+} osprules_set_t;
+
+/* Rule table */
+struct osprules {
+	isc_mem_t *mctx;						/* Memory context */
+	char path[OSPRULES_PATH_SIZE];			/* Rules file */
+	osprules_protofunc_t protofunc;			/* Protocol name function */
+	isc_rwlock_t lock;						/* Held for read by lookups, for write only to swap the set */
+	osprules_set_t *set;					/* Current rule set */
+	isc_mutex_t statslock;					/* Statistics lock */
+	isc_uint64_t hits;						/* Number of lookups matching a rule other than pass */
+	isc_uint64_t misses;					/* Number of lookups left to OSP */
+	isc_uint64_t reloads;					/* Number of reloads */
+};
+
+/*
+ * Free rule set
+ * param mctx Memory context
+ * param setp Rule set
+ */
+static void osprules_free_set(
+	isc_mem_t *mctx,
+	osprules_set_t **setp)
+{
+	osprules_set_t *set = *setp;
+
+	if (set->trie != NULL) {
+		osptrie_destroy(&set->trie);
+	}
+	if (set->rules != NULL) {
+		isc_mem_put(mctx, set->rules, set->maxrules * sizeof(osprules_rule_t));
+	}
+	if (set->dests != NULL) {
+		isc_mem_put(mctx, set->dests, set->maxdests * sizeof(ospcache_dest_t));
+	}
+	isc_mem_put(mctx, set, sizeof(*set));
+
+	*setp = NULL;
+}
+
+/*
+ * Grow an array to hold one more item
+ * param mctx Memory context
+ * param array Array
+ * param count Number of used items
+ * param max Number of allocated items
+ * param size Item size
+ * return ISC_R_SUCCESS successful, ISC_R_NOMEMORY failed
+ */
+static isc_result_t osprules_grow(
+	isc_mem_t *mctx,
+	void **array,
+	unsigned int count,
+	unsigned int *max,
+	size_t size)
+{
+	unsigned int newmax;
+	void *tmp;
+
+	if (count < *max) {
+		return ISC_R_SUCCESS;
+	}
+
+	newmax = (*max == 0) ? OSPRULES_MIN_RULES : *max * 2;
+	if ((tmp = isc_mem_get(mctx, newmax * size)) == NULL) {
+		return ISC_R_NOMEMORY;
+	}
+	if (*array != NULL) {
+		memcpy(tmp, *array, count * size);
+		isc_mem_put(mctx, *array, *max * size);
+	}
+	*array = tmp;
+	*max = newmax;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Parse the destination of a route line
+ * param mctx Memory context
+ * param set Rule set
+ * param rule Rule
+ * param protofunc Protocol name function
+ * param saveptr strtok_r context of the line
+ * return ISC_R_SUCCESS successful, ISC_R_UNEXPECTEDTOKEN bad line, ISC_R_NOMEMORY failed
+ */
+static isc_result_t osprules_parse_dest(
+	isc_mem_t *mctx,
+	osprules_set_t *set,
+	osprules_rule_t *rule,
+	osprules_protofunc_t protofunc,
+	char **saveptr)
+{
+	ospcache_dest_t *dest;
+	char *protocol, *host, *dnid;
+	isc_result_t result;
+
+	protocol = strtok_r(NULL, " \t\r\n", saveptr);
+	host = strtok_r(NULL, " \t\r\n", saveptr);
+	dnid = strtok_r(NULL, " \t\r\n", saveptr);
+	if ((rule->count == OSPCACHE_MAX_DEST) ||
+		(protocol == NULL) ||
+		(host == NULL) ||
+		(strlen(host) >= sizeof(dest->dest)) ||
+		((dnid != NULL) && (strlen(dnid) >= sizeof(dest->dnid))) ||
+		(strtok_r(NULL, " \t\r\n", saveptr) != NULL))
+	{
+		return ISC_R_UNEXPECTEDTOKEN;
+	}
+
+	if ((result = osprules_grow(mctx, (void **)&set->dests, set->ndests, &set->maxdests, sizeof(ospcache_dest_t))) != ISC_R_SUCCESS) {
+		return result;
+	}
+
+	dest = &set->dests[set->ndests];
+	memset(dest, 0, sizeof(*dest));
+	if ((dest->protocol = protofunc(protocol)) < 0) {
+		return ISC_R_UNEXPECTEDTOKEN;
+	}
+	snprintf(dest->dest, sizeof(dest->dest), "%s", host);
+	if (dnid != NULL) {
+		snprintf(dest->dnid, sizeof(dest->dnid), "%s", dnid);
+	}
+	rule->dest[rule->count++] = set->ndests++;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Compile rules file
+ * param mctx Memory context
+ * param path Rules file path
+ * param protofunc Protocol name function
+ * param line Number of lines read buffer, the offending line on format errors
+ * param setp Rule set buffer
+ * return ISC_R_SUCCESS successful, ISC_R_FILENOTFOUND no file, ISC_R_UNEXPECTEDTOKEN bad line, other failed
+ */
+static isc_result_t osprules_compile(
+	isc_mem_t *mctx,
+	const char *path,
+	osprules_protofunc_t protofunc,
+	unsigned int *line,
+	osprules_set_t **setp)
+{
+	char buffer[OSPRULES_LINE_SIZE];
+	char *prefix, *item, *saveptr = NULL;
+	osprules_set_t *set;
+	osprules_rule_t *rule;
+	struct stat st;
+	FILE *fp;
+	int action, index, length;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	*line = 0;
+
+	if ((stat(path, &st) != 0) || ((fp = fopen(path, "r")) == NULL)) {
+		return ISC_R_FILENOTFOUND;
+	}
+
+	if ((set = isc_mem_get(mctx, sizeof(*set))) == NULL) {
+		fclose(fp);
+		return ISC_R_NOMEMORY;
+	}
+	memset(set, 0, sizeof(*set));
+	set->srcmtime = st.st_mtime;
+	set->srcsize = st.st_size;
+
+	result = osptrie_create(mctx, &set->trie);
+
+	while ((result == ISC_R_SUCCESS) && (fgets(buffer, sizeof(buffer), fp) != NULL)) {
+		(*line)++;
+
+		if (((prefix = strtok_r(buffer, " \t\r\n", &saveptr)) == NULL) || (prefix[0] == '#')) {
+			continue;
+		}
+		if (strcmp(prefix, OSPRULES_ALL) == 0) {
+			prefix = "";
+		} else if ((strlen(prefix) >= OSPCACHE_NUM_SIZE) || (strspn(prefix, "0123456789") != strlen(prefix))) {
+			result = ISC_R_UNEXPECTEDTOKEN;
+			break;
+		}
+
+		if ((item = strtok_r(NULL, " \t\r\n", &saveptr)) == NULL) {
+			result = ISC_R_UNEXPECTEDTOKEN;
+			break;
+		} else if (strcmp(item, "route") == 0) {
+			action = OSPRULES_ROUTE;
+		} else if (strcmp(item, "nxdomain") == 0) {
+			action = OSPRULES_NXDOMAIN;
+		} else if (strcmp(item, "refuse") == 0) {
+			action = OSPRULES_REFUSE;
+		} else if (strcmp(item, "pass") == 0) {
+			action = OSPRULES_PASS;
+		} else {
+			result = ISC_R_UNEXPECTEDTOKEN;
+			break;
+		}
+
+		/* Only route lines may repeat a prefix, each adds a destination */
+		index = osptrie_match(set->trie, prefix, &length);
+		if ((index != OSPTRIE_NONE) && (length == (int)strlen(prefix))) {
+			rule = &set->rules[index];
+			if ((action != OSPRULES_ROUTE) || (rule->action != OSPRULES_ROUTE)) {
+				result = ISC_R_UNEXPECTEDTOKEN;
+				break;
+			}
+		} else {
+			if ((result = osprules_grow(mctx, (void **)&set->rules, set->nrules, &set->maxrules, sizeof(osprules_rule_t))) != ISC_R_SUCCESS) {
+				break;
+			}
+			rule = &set->rules[set->nrules];
+			rule->action = action;
+			rule->count = 0;
+			if ((result = osptrie_add(set->trie, prefix, (int)set->nrules)) != ISC_R_SUCCESS) {
+				break;
+			}
+			set->nrules++;
+		}
+
+		if (action == OSPRULES_ROUTE) {
+			result = osprules_parse_dest(mctx, set, rule, protofunc, &saveptr);
+		} else if (strtok_r(NULL, " \t\r\n", &saveptr) != NULL) {
+			result = ISC_R_UNEXPECTEDTOKEN;
+		}
+	}
+
+	fclose(fp);
+
+	if (result == ISC_R_SUCCESS) {
+		*setp = set;
+	} else {
+		osprules_free_set(mctx, &set);
+	}
+
+	return result;
+}
+
+/*
+ * Create rule table
+ * param mctx Memory context
+ * param path Rules file
+ * param protofunc Protocol name function
+ * param line Number of lines read buffer, the offending line on format errors
+ * param rulesp Rule table handle buffer
+ * return ISC_R_SUCCESS successful, ISC_R_FILENOTFOUND no file, ISC_R_UNEXPECTEDTOKEN bad line, other failed
+ */
+isc_result_t osprules_create(
+	isc_mem_t *mctx,
+	const char *path,
+	osprules_protofunc_t protofunc,
+	unsigned int *line,
+	osprules_t **rulesp)
+{
+	osprules_t *rules;
+	osprules_set_t *set = NULL;
+	isc_result_t result;
+
+	REQUIRE(rulesp != NULL && *rulesp == NULL);
+
+	*line = 0;
+
+	if (strlen(path) >= sizeof(rules->path)) {
+		return ISC_R_NOSPACE;
+	}
+
+	if ((result = osprules_compile(mctx, path, protofunc, line, &set)) != ISC_R_SUCCESS) {
+		return result;
+	}
+
+	if ((rules = isc_mem_get(mctx, sizeof(*rules))) == NULL) {
+		osprules_free_set(mctx, &set);
+		return ISC_R_NOMEMORY;
+	}
+	rules->mctx = NULL;
+	isc_mem_attach(mctx, &rules->mctx);
+	snprintf(rules->path, sizeof(rules->path), "%s", path);
+	rules->protofunc = protofunc;
+	rules->set = set;
+	rules->hits = 0;
+	rules->misses = 0;
+	rules->reloads = 0;
+
+	if ((result = isc_rwlock_init(&rules->lock, 0, 0)) != ISC_R_SUCCESS) {
+		osprules_free_set(mctx, &rules->set);
+		isc_mem_putanddetach(&rules->mctx, rules, sizeof(*rules));
+		return result;
+	}
+	if ((result = isc_mutex_init(&rules->statslock)) != ISC_R_SUCCESS) {
+		isc_rwlock_destroy(&rules->lock);
+		osprules_free_set(mctx, &rules->set);
+		isc_mem_putanddetach(&rules->mctx, rules, sizeof(*rules));
+		return result;
+	}
+
+	*rulesp = rules;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Destroy rule table
+ * param rulesp Rule table handle
+ */
+void osprules_destroy(
+	osprules_t **rulesp)
+{
+	osprules_t *rules;
+
+	REQUIRE(rulesp != NULL && *rulesp != NULL);
+
+	rules = *rulesp;
+
+	osprules_free_set(rules->mctx, &rules->set);
+	DESTROYLOCK(&rules->statslock);
+	isc_rwlock_destroy(&rules->lock);
+	isc_mem_putanddetach(&rules->mctx, rules, sizeof(*rules));
+
+	*rulesp = NULL;
+}
+
+/*
+ * Find the rule of a number
+ * param rules Rule table handle
+ * param number Called number
+ * param route Route buffer, filled for OSPRULES_ROUTE with the called number set to number
+ * return Action of the longest matching prefix, OSPRULES_PASS for none
+ */
+int osprules_lookup(
+	osprules_t *rules,
+	const char *number,
+	ospcache_route_t *route)
+{
+	const osprules_set_t *set;
+	const osprules_rule_t *rule;
+	int index, i;
+	int action = OSPRULES_PASS;
+
+	RWLOCK(&rules->lock, isc_rwlocktype_read);
+
+	set = rules->set;
+	if ((index = osptrie_match(set->trie, number, NULL)) != OSPTRIE_NONE) {
+		rule = &set->rules[index];
+		action = rule->action;
+		if (action == OSPRULES_ROUTE) {
+			route->count = rule->count;
+			for (i = 0; i < rule->count; i++) {
+				route->dest[i] = set->dests[rule->dest[i]];
+				snprintf(route->dest[i].called, sizeof(route->dest[i].called), "%s", number);
+			}
+		}
+	}
+
+	RWUNLOCK(&rules->lock, isc_rwlocktype_read);
+
+	LOCK(&rules->statslock);
+	if (action == OSPRULES_PASS) {
+		rules->misses++;
+	} else {
+		rules->hits++;
+	}
+	UNLOCK(&rules->statslock);
+
+	return action;
+}
+
+/*
+ * Reload the rules if the file changed, the new set is swapped in and lookups are only held up by the swap itself.
+ * Must not be called from two threads at once.
+ * param rules Rule table handle
+ * param reloaded Reloaded flag buffer
+ * param line Number of lines read buffer, the offending line on format errors
+ * return ISC_R_SUCCESS successful or unchanged, ISC_R_FILENOTFOUND no file, ISC_R_UNEXPECTEDTOKEN bad line, other failed
+ */
+isc_result_t osprules_reload(
+	osprules_t *rules,
+	isc_boolean_t *reloaded,
+	unsigned int *line)
+{
+	osprules_set_t *set = NULL, *old;
+	struct stat st;
+	isc_result_t result;
+
+	*reloaded = ISC_FALSE;
+	*line = 0;
+
+	/* Only this thread swaps the set, so it can be read without the lock */
+	if (stat(rules->path, &st) != 0) {
+		return ISC_R_FILENOTFOUND;
+	}
+	if ((st.st_mtime == rules->set->srcmtime) && (st.st_size == rules->set->srcsize)) {
+		return ISC_R_SUCCESS;
+	}
+
+	if ((result = osprules_compile(rules->mctx, rules->path, rules->protofunc, line, &set)) != ISC_R_SUCCESS) {
+		return result;
+	}
+
+	RWLOCK(&rules->lock, isc_rwlocktype_write);
+	old = rules->set;
+	rules->set = set;
+	RWUNLOCK(&rules->lock, isc_rwlocktype_write);
+
+	osprules_free_set(rules->mctx, &old);
+
+	LOCK(&rules->statslock);
+	rules->reloads++;
+	UNLOCK(&rules->statslock);
+
+	*reloaded = ISC_TRUE;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Get statistics
+ * param rules Rule table handle
+ * param stats Statistics buffer
+ */
+void osprules_getstats(
+	osprules_t *rules,
+	osprules_stats_t *stats)
+{
+	LOCK(&rules->statslock);
+	stats->hits = rules->hits;
+	stats->misses = rules->misses;
+	stats->reloads = rules->reloads;
+	UNLOCK(&rules->statslock);
+
+	RWLOCK(&rules->lock, isc_rwlocktype_read);
+	stats->rules = rules->set->nrules;
+	stats->nodes = osptrie_nodes(rules->set->trie);
+	RWUNLOCK(&rules->lock, isc_rwlocktype_read);
+}
+
@@ -0,0 +1,55 @@
+/*
+ * osprules.h
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OSPRULES_H
+#define OSPRULES_H	1
+
+#include <isc/types.h>
+
+#include "ospcache.h"
+
+/* Rule action */
+#define OSPRULES_PASS		0		/* Route through OSP */
+#define OSPRULES_ROUTE		1		/* Answer with the rule destinations */
+#define OSPRULES_NXDOMAIN	2		/* Answer nonexistent domain */
+#define OSPRULES_REFUSE		3		/* Refuse */
+
+/* Rule table statistics */
+typedef struct osprules_stats {
+	isc_uint64_t hits;			/* Number of lookups matching a rule other than pass */
+	isc_uint64_t misses;		/* Number of lookups left to OSP */
+	isc_uint64_t reloads;		/* Number of reloads */
+	unsigned int rules;			/* Current number of rules */
+	unsigned int nodes;			/* Current number of trie nodes */
+} osprules_stats_t;
+
+/* Protocol name to signaling protocol function, returns -1 for unknown names */
+typedef int (*osprules_protofunc_t)(const char *name);
+
+/* Rule table handle */
+typedef struct osprules osprules_t;
+
+isc_result_t osprules_create(isc_mem_t *mctx, const char *path, osprules_protofunc_t protofunc, unsigned int *line, osprules_t **rulesp);
+void osprules_destroy(osprules_t **rulesp);
+int osprules_lookup(osprules_t *rules, const char *number, ospcache_route_t *route);
+isc_result_t osprules_reload(osprules_t *rules, isc_boolean_t *reloaded, unsigned int *line);
+void osprules_getstats(osprules_t *rules, osprules_stats_t *stats);
+
+#endif /* OSPRULES_H */
+
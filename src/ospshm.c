@@ -0,0 +1,485 @@
+/*
+ * ospshm.c
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <isc/atomic.h>
+#include <isc/mem.h>
+#include <isc/platform.h>
+#include <isc/util.h>
+
+#include "ospshm.h"
+
+/* Constant */
+#define OSPSHM_MAGIC		"OSPSHM"	/* Segment magic */
+#define OSPSHM_VERSION		1			/* Segment layout version */
+#define OSPSHM_WAYS			4			/* Number of slots per bucket */
+#define OSPSHM_WAIT			1000		/* Number of 1 ms waits for the creator to publish the segment */
+
+/* Segment header, padded so that slots start on a cache line */
+typedef struct ospshm_header {
+	char magic[8];				/* OSPSHM_MAGIC */
+	isc_uint32_t version;		/* OSPSHM_VERSION */
+	isc_uint32_t slotsize;		/* Size of ospshm_slot_t */
+	isc_uint32_t ways;			/* OSPSHM_WAYS */
+	isc_uint32_t nbuckets;		/* Number of buckets, power of 2 */
+	isc_int32_t ready;			/* Set by the creator once the header is valid */
+	char pad[36];				/* Padding to 64 bytes */
+} ospshm_header_t;
+
+/*
+ * Slot, protected by a sequence lock. A writer makes seq odd with compare and swap, writes, then makes it even again.
+ * A reader copies the slot and only trusts the copy if seq was even and unchanged around it.
+ */
+typedef struct ospshm_slot {
+	isc_int32_t seq;				/* Sequence, odd while being written */
+	isc_uint32_t hash;				/* Key hash */
+	isc_uint32_t expire;			/* Expire time, 0 for empty */
+	isc_uint32_t reserved;			/* Reserved, 0 */
+	char key[OSPCACHE_KEY_SIZE];	/* Key */
+	ospcache_route_t route;			/* Route */
+} ospshm_slot_t;
+
+/* Attachment */
+struct ospshm {
+	isc_mem_t *mctx;			/* Memory context */
+	void *base;					/* Mapped segment */
+	size_t size;				/* Mapped segment size */
+	ospshm_header_t *header;	/* Segment header */
+	ospshm_slot_t *slots;		/* Slot array */
+	isc_int32_t hits;			/* Number of lookups answered */
+	isc_int32_t misses;			/* Number of lookups not answered */
+	isc_int32_t inserts;		/* Number of routes written */
+	isc_int32_t busy;			/* Number of reads or writes skipped for a concurrent writer */
+};
+
+#if defined(ISC_PLATFORM_HAVEXADD) && defined(ISC_PLATFORM_HAVECMPXCHG)
+
+/*
+ * Read sequence with a full memory barrier
+ * param seq Sequence
+ * return Sequence value
+ */
+static isc_int32_t ospshm_read_seq(
+	isc_int32_t *seq)
+{
+	return isc_atomic_xadd(seq, 0);
+}
+
+/*
+ * Attach shared route table, the segment is created and laid out by the first instance
+ * param mctx Memory context
+ * param name POSIX shared memory object name, "/name"
+ * param size Segment size in bytes used when the segment is created
+ * param shmp Shared route table handle
+ * return ISC_R_SUCCESS successful, ISC_R_INVALIDFILE incompatible segment, ISC_R_NOSPACE size too small, other failed
+ */
+isc_result_t ospshm_attach(
+	isc_mem_t *mctx,
+	const char *name,
+	size_t size,
+	ospshm_t **shmp)
+{
+	ospshm_t *shm;
+	ospshm_header_t *header;
+	struct stat st;
+	isc_boolean_t creator = ISC_FALSE;
+	isc_uint32_t nbuckets;
+	void *base;
+	int fd, wait;
+
+	REQUIRE(shmp != NULL && *shmp == NULL);
+
+	if (size < sizeof(ospshm_header_t) + OSPSHM_WAYS * sizeof(ospshm_slot_t)) {
+		return ISC_R_NOSPACE;
+	}
+
+	if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0) {
+		creator = ISC_TRUE;
+		if (ftruncate(fd, size) != 0) {
+			close(fd);
+			shm_unlink(name);
+			return ISC_R_FAILURE;
+		}
+	} else if ((errno != EEXIST) || ((fd = shm_open(name, O_RDWR, 0)) < 0)) {
+		return ISC_R_FAILURE;
+	}
+
+	/* Another instance may still be sizing the segment */
+	for (wait = 0; ; wait++) {
+		if (fstat(fd, &st) != 0) {
+			close(fd);
+			return ISC_R_FAILURE;
+		}
+		if (st.st_size >= (off_t)sizeof(ospshm_header_t)) {
+			break;
+		}
+		if (wait == OSPSHM_WAIT) {
+			close(fd);
+			return ISC_R_INVALIDFILE;
+		}
+		usleep(1000);
+	}
+
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return ISC_R_FAILURE;
+	}
+	header = base;
+
+	if (creator == ISC_TRUE) {
+		for (nbuckets = 1; (nbuckets * 2) * OSPSHM_WAYS * sizeof(ospshm_slot_t) <= st.st_size - sizeof(ospshm_header_t); nbuckets *= 2)
+			;
+		memcpy(header->magic, OSPSHM_MAGIC, sizeof(OSPSHM_MAGIC));
+		header->version = OSPSHM_VERSION;
+		header->slotsize = sizeof(ospshm_slot_t);
+		header->ways = OSPSHM_WAYS;
+		header->nbuckets = nbuckets;
+
+		/* Slots are zero filled by ftruncate, i.e. empty with even sequences */
+		isc_atomic_xadd(&header->ready, 1);
+	} else {
+		for (wait = 0; (ospshm_read_seq(&header->ready) == 0) && (wait < OSPSHM_WAIT); wait++) {
+			usleep(1000);
+		}
+	}
+
+	if ((ospshm_read_seq(&header->ready) == 0) ||
+		(memcmp(header->magic, OSPSHM_MAGIC, sizeof(OSPSHM_MAGIC)) != 0) ||
+		(header->version != OSPSHM_VERSION) ||
+		(header->slotsize != sizeof(ospshm_slot_t)) ||
+		(header->ways != OSPSHM_WAYS) ||
+		(header->nbuckets == 0) ||
+		((header->nbuckets & (header->nbuckets - 1)) != 0) ||
+		(sizeof(ospshm_header_t) + (isc_uint64_t)header->nbuckets * OSPSHM_WAYS * sizeof(ospshm_slot_t) > (isc_uint64_t)st.st_size))
+	{
+		munmap(base, st.st_size);
+		return ISC_R_INVALIDFILE;
+	}
+
+	shm = isc_mem_get(mctx, sizeof(*shm));
+	if (shm == NULL) {
+		munmap(base, st.st_size);
+		return ISC_R_NOMEMORY;
+	}
+	shm->mctx = NULL;
+	isc_mem_attach(mctx, &shm->mctx);
+	shm->base = base;
+	shm->size = st.st_size;
+	shm->header = header;
+	shm->slots = (ospshm_slot_t *)(header + 1);
+	shm->hits = 0;
+	shm->misses = 0;
+	shm->inserts = 0;
+	shm->busy = 0;
+
+	*shmp = shm;
+
+	return ISC_R_SUCCESS;
+}
+
+#else /* ISC_PLATFORM_HAVEXADD && ISC_PLATFORM_HAVECMPXCHG */
+
+/*
+ * Attach shared route table, not supported without atomic operations
+ */
+isc_result_t ospshm_attach(
+	isc_mem_t *mctx,
+	const char *name,
+	size_t size,
+	ospshm_t **shmp)
+{
+	UNUSED(mctx);
+	UNUSED(name);
+	UNUSED(size);
+	UNUSED(shmp);
+
+	return ISC_R_NOTIMPLEMENTED;
+}
+
+#endif /* ISC_PLATFORM_HAVEXADD && ISC_PLATFORM_HAVECMPXCHG */
+
+/*
+ * Detach shared route table, the segment stays for other and later instances
+ * param shmp Shared route table handle
+ */
+void ospshm_detach(
+	ospshm_t **shmp)
+{
+	ospshm_t *shm;
+
+	REQUIRE(shmp != NULL && *shmp != NULL);
+
+	shm = *shmp;
+
+	munmap(shm->base, shm->size);
+	isc_mem_putanddetach(&shm->mctx, shm, sizeof(*shm));
+
+	*shmp = NULL;
+}
+
+#if defined(ISC_PLATFORM_HAVEXADD) && defined(ISC_PLATFORM_HAVECMPXCHG)
+
+/*
+ * Get bucket of a hash
+ * param shm Shared route table handle
+ * param hash Key hash
+ * return First slot of bucket
+ */
+static ospshm_slot_t *ospshm_get_bucket(
+	ospshm_t *shm,
+	unsigned int hash)
+{
+	return &shm->slots[(hash & (shm->header->nbuckets - 1)) * OSPSHM_WAYS];
+}
+
+/*
+ * Get route, without locking
+ * param shm Shared route table handle
+ * param key Key
+ * param now Current time
+ * param route Route buffer, content undefined if not found
+ * param expire Expire time buffer
+ * return ISC_R_SUCCESS found, ISC_R_NOTFOUND not found, expired or being written
+ */
+isc_result_t ospshm_get(
+	ospshm_t *shm,
+	const char *key,
+	isc_stdtime_t now,
+	ospcache_route_t *route,
+	isc_stdtime_t *expire)
+{
+	unsigned int hash = ospcache_hash(key);
+	ospshm_slot_t *slot = ospshm_get_bucket(shm, hash);
+	isc_stdtime_t slotexpire;
+	isc_int32_t seq;
+	int way, count;
+
+	for (way = 0; way < OSPSHM_WAYS; way++, slot++) {
+		seq = ospshm_read_seq(&slot->seq);
+		if ((seq & 1) != 0) {
+			isc_atomic_xadd(&shm->busy, 1);
+			continue;
+		}
+
+		/* Everything read here may be torn, it is only trusted once the sequence is checked again */
+		slotexpire = slot->expire;
+		if ((slot->hash != hash) || (slotexpire <= now) || (strncmp(slot->key, key, OSPCACHE_KEY_SIZE) != 0)) {
+			continue;
+		}
+		count = slot->route.count;
+		if ((count < 0) || (count > OSPCACHE_MAX_DEST)) {
+			continue;
+		}
+		route->count = count;
+		memcpy(route->dest, slot->route.dest, count * sizeof(ospcache_dest_t));
+
+		if (ospshm_read_seq(&slot->seq) != seq) {
+			isc_atomic_xadd(&shm->busy, 1);
+			continue;
+		}
+
+		*expire = slotexpire;
+		isc_atomic_xadd(&shm->hits, 1);
+
+		return ISC_R_SUCCESS;
+	}
+
+	isc_atomic_xadd(&shm->misses, 1);
+
+	return ISC_R_NOTFOUND;
+}
+
+/*
+ * Add or replace route, the slot of the same key or else the one expiring soonest in the bucket is used. The write is
+ * skipped if another writer holds that slot.
+ * param shm Shared route table handle
+ * param key Key
+ * param now Current time
+ * param expire Expire time
+ * param route Route
+ */
+void ospshm_put(
+	ospshm_t *shm,
+	const char *key,
+	isc_stdtime_t now,
+	isc_stdtime_t expire,
+	const ospcache_route_t *route)
+{
+	unsigned int hash = ospcache_hash(key);
+	ospshm_slot_t *bucket = ospshm_get_bucket(shm, hash);
+	ospshm_slot_t *slot, *victim = NULL;
+	isc_int32_t seq;
+	int way;
+
+	REQUIRE(route->count >= 0 && route->count <= OSPCACHE_MAX_DEST);
+
+	/* Unlocked reads only pick the slot, a wrong pick costs a cache entry, not consistency */
+	for (way = 0, slot = bucket; way < OSPSHM_WAYS; way++, slot++) {
+		if ((slot->hash == hash) && (strncmp(slot->key, key, OSPCACHE_KEY_SIZE) == 0)) {
+			victim = slot;
+			break;
+		}
+		if ((victim == NULL) || ((victim->expire > now) && (slot->expire < victim->expire))) {
+			victim = slot;
+		}
+	}
+
+	seq = ospshm_read_seq(&victim->seq);
+	if (((seq & 1) != 0) || (isc_atomic_cmpxchg(&victim->seq, seq, seq + 1) != seq)) {
+		isc_atomic_xadd(&shm->busy, 1);
+		return;
+	}
+
+	victim->hash = hash;
+	victim->expire = expire;
+	snprintf(victim->key, sizeof(victim->key), "%s", key);
+	victim->route.count = route->count;
+	memcpy(victim->route.dest, route->dest, route->count * sizeof(ospcache_dest_t));
+
+	isc_atomic_xadd(&victim->seq, 1);
+	isc_atomic_xadd(&shm->inserts, 1);
+}
+
+/*
+ * Empty all slots for which a function returns ISC_TRUE, a slot held by another writer is waited for
+ * param shm Shared route table handle
+ * param func Match function
+ * param arg Match function argument
+ * return Number of slots emptied
+ */
+unsigned int ospshm_purge(
+	ospshm_t *shm,
+	ospcache_matchfunc_t func,
+	void *arg)
+{
+	ospshm_slot_t *slot;
+	isc_uint32_t i, nslots = shm->header->nbuckets * OSPSHM_WAYS;
+	isc_int32_t seq;
+	unsigned int count = 0;
+	int wait;
+
+	for (i = 0, slot = shm->slots; i < nslots; i++, slot++) {
+		if (slot->expire == 0) {
+			continue;
+		}
+
+		for (wait = 0; wait < OSPSHM_WAIT; wait++) {
+			seq = ospshm_read_seq(&slot->seq);
+			if (((seq & 1) == 0) && (isc_atomic_cmpxchg(&slot->seq, seq, seq + 1) == seq)) {
+				break;
+			}
+			usleep(1000);
+		}
+		if (wait == OSPSHM_WAIT) {
+			/* A writer died holding the slot, nobody can read it anyway */
+			continue;
+		}
+
+		if ((slot->expire != 0) &&
+			(slot->route.count >= 0) && (slot->route.count <= OSPCACHE_MAX_DEST) &&
+			(func(arg, ISC_FALSE, slot->key, slot->route.count, slot->route.dest) == ISC_TRUE))
+		{
+			slot->expire = 0;
+			count++;
+		}
+
+		isc_atomic_xadd(&slot->seq, 1);
+	}
+
+	return count;
+}
+
+#else /* ISC_PLATFORM_HAVEXADD && ISC_PLATFORM_HAVECMPXCHG */
+
+/*
+ * Get route, never attached without atomic operations
+ */
+isc_result_t ospshm_get(
+	ospshm_t *shm,
+	const char *key,
+	isc_stdtime_t now,
+	ospcache_route_t *route,
+	isc_stdtime_t *expire)
+{
+	UNUSED(shm);
+	UNUSED(key);
+	UNUSED(now);
+	UNUSED(route);
+	UNUSED(expire);
+
+	return ISC_R_NOTFOUND;
+}
+
+/*
+ * Add or replace route, never attached without atomic operations
+ */
+void ospshm_put(
+	ospshm_t *shm,
+	const char *key,
+	isc_stdtime_t now,
+	isc_stdtime_t expire,
+	const ospcache_route_t *route)
+{
+	UNUSED(shm);
+	UNUSED(key);
+	UNUSED(now);
+	UNUSED(expire);
+	UNUSED(route);
+}
+
+/*
+ * Empty slots, never attached without atomic operations
+ */
+unsigned int ospshm_purge(
+	ospshm_t *shm,
+	ospcache_matchfunc_t func,
+	void *arg)
+{
+	UNUSED(shm);
+	UNUSED(func);
+	UNUSED(arg);
+
+	return 0;
+}
+
+#endif /* ISC_PLATFORM_HAVEXADD && ISC_PLATFORM_HAVECMPXCHG */
+
+/*
+ * Get statistics of this attachment
+ * param shm Shared route table handle
+ * param stats Statistics buffer
+ */
+void ospshm_getstats(
+	ospshm_t *shm,
+	ospshm_stats_t *stats)
+{
+	stats->hits = (isc_uint32_t)shm->hits;
+	stats->misses = (isc_uint32_t)shm->misses;
+	stats->inserts = (isc_uint32_t)shm->inserts;
+	stats->busy = (isc_uint32_t)shm->busy;
+	stats->slots = shm->header->nbuckets * OSPSHM_WAYS;
+}
@@ -0,0 +1,48 @@
+/*
+ * ospshm.h
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OSPSHM_H
+#define OSPSHM_H	1
+
+#include <isc/types.h>
+#include <isc/stdtime.h>
+
+#include "ospcache.h"
+
+/* Shared route table statistics of one attachment */
+typedef struct ospshm_stats {
+	isc_uint32_t hits;		/* Number of lookups answered from shared table */
+	isc_uint32_t misses;	/* Number of lookups not answered from shared table */
+	isc_uint32_t inserts;	/* Number of routes written */
+	isc_uint32_t busy;		/* Number of reads or writes skipped for a concurrent writer */
+	isc_uint32_t slots;		/* Number of slots */
+} ospshm_stats_t;
+
+/* Shared route table handle */
+typedef struct ospshm ospshm_t;
+
+isc_result_t ospshm_attach(isc_mem_t *mctx, const char *name, size_t size, ospshm_t **shmp);
+void ospshm_detach(ospshm_t **shmp);
+isc_result_t ospshm_get(ospshm_t *shm, const char *key, isc_stdtime_t now, ospcache_route_t *route, isc_stdtime_t *expire);
+void ospshm_put(ospshm_t *shm, const char *key, isc_stdtime_t now, isc_stdtime_t expire, const ospcache_route_t *route);
+unsigned int ospshm_purge(ospshm_t *shm, ospcache_matchfunc_t func, void *arg);
+void ospshm_getstats(ospshm_t *shm, ospshm_stats_t *stats);
+
+#endif /* OSPSHM_H */
+
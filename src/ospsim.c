@@ -0,0 +1,718 @@
+/*
+ * ospsim.c
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Offline route cache simulator. A query trace is replayed through the route, prefix and negative caches of the OSP
+ * SDB driver, ospcache.c, with the driver's lookup order and keys, to size caches and TTLs before they are deployed.
+ *
+ * Trace lines are "timestamp called calling source [result]", "-" for an empty calling number or source, # for
+ * comments. Timestamps are in seconds and must not go back. The result is what the OSP server answered, ok (default),
+ * notfound or noperm, both remembered by the negative cache, or fail, which is not.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <isc/mem.h>
+#include <isc/result.h>
+#include <isc/util.h>
+
+#include "ospcache.h"
+
+/* Buffer size */
+#define OSPSIM_STR_SIZE		512		/* Normal string length */
+#define OSPSIM_LINE_SIZE	1024	/* Trace line length */
+
+/* Constant */
+#define OSPSIM_MAX_CAPNUM	16		/* Max number of route cache capacities */
+#define OSPSIM_MAX_PREFIXNUM	32	/* Max number of prefix scope rules, as the driver */
+#define OSPSIM_RECORD_GUESS	65536	/* Initial number of trace records */
+
+/* Cache key components, as the driver */
+#define OSPSIM_CACHEKEY_CALLED	0x01	/* Called number */
+#define OSPSIM_CACHEKEY_CALLING	0x02	/* Calling number */
+#define OSPSIM_CACHEKEY_SOURCE	0x04	/* Source */
+
+/* Prefix scope rule, routes of numbers starting with prefix are cached for their first length digits */
+typedef struct ospsim_prefixrule {
+	char prefix[OSPCACHE_NUM_SIZE];	/* Number prefix the rule applies to */
+	int length;						/* Scope length */
+} ospsim_prefixrule_t;
+
+/* Cache models */
+typedef struct ospsim_config {
+	unsigned int cachekey;							/* Route cache key components */
+	int capnum;										/* Number of route cache capacities */
+	int capacity[OSPSIM_MAX_CAPNUM];				/* Route cache capacities in KB, 0 for none */
+	int ttl;										/* Route TTL */
+	int prefixnum;									/* Number of prefix scope rules */
+	ospsim_prefixrule_t prefixrule[OSPSIM_MAX_PREFIXNUM];	/* Prefix scope rules */
+	int prefixentries;								/* Max number of cached prefixes */
+	int negcachesize;								/* Negative cache size in KB, 0 for none */
+	int negcachettl;								/* Negative cache TTL */
+	int prefetch;									/* Refresh ahead window, 0 for none */
+	int prefetchhits;								/* Refresh ahead min hits */
+	int destcount;									/* Number of destinations per route */
+} ospsim_config_t;
+
+/* Trace record */
+typedef struct ospsim_record {
+	isc_stdtime_t time;		/* Query time */
+	char *called;			/* Called number */
+	char *calling;			/* Calling number */
+	char *source;			/* Source */
+	isc_result_t result;	/* OSP server answer */
+} ospsim_record_t;
+
+/* Trace */
+typedef struct ospsim_trace {
+	unsigned int count;			/* Number of records */
+	unsigned int size;			/* Number of allocated records */
+	ospsim_record_t *records;	/* Records */
+} ospsim_trace_t;
+
+/* Replay results */
+typedef struct ospsim_stats {
+	isc_uint64_t lookups;		/* Number of lookups */
+	isc_uint64_t hits;			/* Number of lookups answered from the route cache */
+	isc_uint64_t prefixhits;	/* Number of lookups answered from the prefix table */
+	isc_uint64_t neghits;		/* Number of lookups answered from the negative cache */
+	isc_uint64_t authreqs;		/* Number of AuthReqs for lookups */
+	isc_uint64_t refreshes;		/* Number of refresh ahead AuthReqs */
+	unsigned int peakqps;		/* Max number of AuthReqs in one second */
+	size_t peakmemory;			/* Max memory used by route cache entries */
+	ospcache_stats_t cache;		/* Route cache statistics at the end */
+} ospsim_stats_t;
+
+/*
+ * Print usage
+ * param name Program name
+ */
+static void ospsim_usage(
+	const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options] tracefile|-\n"
+		"\t-k called[+calling][+source]\troute cache key, default called\n"
+		"\t-c KB[,KB...]\t\t\troute cache capacities to compare, 0 for none, up to %d, default 0,1024,16384\n"
+		"\t-t seconds\t\t\troute TTL, default 60\n"
+		"\t-p prefix:length[,...]\t\tprefix scope rules, requires key called\n"
+		"\t-e entries\t\t\tmax number of cached prefixes, default 1000\n"
+		"\t-n KB\t\t\t\tnegative cache size, default 0\n"
+		"\t-N seconds\t\t\tnegative cache TTL, default 10\n"
+		"\t-r seconds\t\t\trefresh ahead window, default 0\n"
+		"\t-R hits\t\t\t\trefresh ahead min hits, default 3\n"
+		"\t-d count\t\t\tdestinations per route, 1~%d, default 1\n"
+		"Trace lines: timestamp called calling source [ok|notfound|noperm|fail], \"-\" for empty fields\n",
+		name, OSPSIM_MAX_CAPNUM, OSPCACHE_MAX_DEST);
+}
+
+/*
+ * Parse route cache key components
+ * param value Components, called[+calling][+source]
+ * param cachekey Key components buffer
+ * return ISC_R_SUCCESS successful, ISC_R_FAILURE wrong value
+ */
+static isc_result_t ospsim_parse_key(
+	char *value,
+	unsigned int *cachekey)
+{
+	char *item, *saveptr = NULL;
+	unsigned int flags = 0;
+
+	for (item = strtok_r(value, "+", &saveptr); item != NULL; item = strtok_r(NULL, "+", &saveptr)) {
+		if (strcmp(item, "called") == 0) {
+			flags |= OSPSIM_CACHEKEY_CALLED;
+		} else if (strcmp(item, "calling") == 0) {
+			flags |= OSPSIM_CACHEKEY_CALLING;
+		} else if (strcmp(item, "source") == 0) {
+			flags |= OSPSIM_CACHEKEY_SOURCE;
+		} else {
+			return ISC_R_FAILURE;
+		}
+	}
+	if ((flags & OSPSIM_CACHEKEY_CALLED) == 0) {
+		return ISC_R_FAILURE;
+	}
+	*cachekey = flags;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Parse a number within range
+ * param value Number
+ * param min Min value
+ * param max Max value
+ * param number Number buffer
+ * return ISC_R_SUCCESS successful, ISC_R_RANGE wrong value
+ */
+static isc_result_t ospsim_parse_int(
+	const char *value,
+	int min,
+	int max,
+	int *number)
+{
+	char *end;
+	long tmp;
+
+	errno = 0;
+	tmp = strtol(value, &end, 10);
+	if ((errno != 0) || (end == value) || (*end != '\0') || (tmp < min) || (tmp > max)) {
+		return ISC_R_RANGE;
+	}
+	*number = (int)tmp;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Parse configuration
+ * param argc Number of arguments
+ * param argv Arguments
+ * param cfg Configuration buffer
+ * param path Trace file path buffer
+ * return ISC_R_SUCCESS successful, ISC_R_FAILURE wrong arguments
+ */
+static isc_result_t ospsim_get_config(
+	int argc,
+	char **argv,
+	ospsim_config_t *cfg,
+	const char **path)
+{
+	char *item, *colon, *saveptr = NULL;
+	int opt, tmp;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->cachekey = OSPSIM_CACHEKEY_CALLED;
+	cfg->capnum = 3;
+	cfg->capacity[0] = 0;
+	cfg->capacity[1] = 1024;
+	cfg->capacity[2] = 16384;
+	cfg->ttl = 60;
+	cfg->prefixentries = 1000;
+	cfg->negcachettl = 10;
+	cfg->prefetchhits = 3;
+	cfg->destcount = 1;
+
+	while ((result == ISC_R_SUCCESS) && ((opt = getopt(argc, argv, "k:c:t:p:e:n:N:r:R:d:")) != -1)) {
+		switch (opt) {
+		case 'k':
+			result = ospsim_parse_key(optarg, &cfg->cachekey);
+			break;
+		case 'c':
+			cfg->capnum = 0;
+			for (item = strtok_r(optarg, ",", &saveptr); (result == ISC_R_SUCCESS) && (item != NULL); item = strtok_r(NULL, ",", &saveptr)) {
+				if (cfg->capnum == OSPSIM_MAX_CAPNUM) {
+					result = ISC_R_RANGE;
+				} else if ((result = ospsim_parse_int(item, 0, 1048576, &tmp)) == ISC_R_SUCCESS) {
+					cfg->capacity[cfg->capnum++] = tmp;
+				}
+			}
+			if (cfg->capnum == 0) {
+				result = ISC_R_RANGE;
+			}
+			break;
+		case 't':
+			result = ospsim_parse_int(optarg, 1, 86400, &cfg->ttl);
+			break;
+		case 'p':
+			cfg->prefixnum = 0;
+			for (item = strtok_r(optarg, ",", &saveptr); (result == ISC_R_SUCCESS) && (item != NULL); item = strtok_r(NULL, ",", &saveptr)) {
+				if ((cfg->prefixnum == OSPSIM_MAX_PREFIXNUM) || ((colon = strchr(item, ':')) == NULL)) {
+					result = ISC_R_RANGE;
+				} else {
+					*colon = '\0';
+					if (((result = ospsim_parse_int(colon + 1, 1, OSPCACHE_NUM_SIZE - 1, &tmp)) == ISC_R_SUCCESS) && (tmp < (int)strlen(item))) {
+						result = ISC_R_RANGE;
+					}
+					if (result == ISC_R_SUCCESS) {
+						snprintf(cfg->prefixrule[cfg->prefixnum].prefix, sizeof(cfg->prefixrule[cfg->prefixnum].prefix), "%s", item);
+						cfg->prefixrule[cfg->prefixnum].length = tmp;
+						cfg->prefixnum++;
+					}
+				}
+			}
+			break;
+		case 'e':
+			result = ospsim_parse_int(optarg, 1, 100000, &cfg->prefixentries);
+			break;
+		case 'n':
+			result = ospsim_parse_int(optarg, 0, 1048576, &cfg->negcachesize);
+			break;
+		case 'N':
+			result = ospsim_parse_int(optarg, 1, 3600, &cfg->negcachettl);
+			break;
+		case 'r':
+			result = ospsim_parse_int(optarg, 0, 3600, &cfg->prefetch);
+			break;
+		case 'R':
+			result = ospsim_parse_int(optarg, 1, 1000000, &cfg->prefetchhits);
+			break;
+		case 'd':
+			result = ospsim_parse_int(optarg, 1, OSPCACHE_MAX_DEST, &cfg->destcount);
+			break;
+		default:
+			result = ISC_R_FAILURE;
+			break;
+		}
+	}
+
+	/* Prefix routes do not depend on caller or source */
+	if ((result == ISC_R_SUCCESS) && (cfg->prefixnum != 0) && (cfg->cachekey != OSPSIM_CACHEKEY_CALLED)) {
+		result = ISC_R_FAILURE;
+	}
+
+	if ((result == ISC_R_SUCCESS) && (optind != argc - 1)) {
+		result = ISC_R_FAILURE;
+	}
+
+	if (result == ISC_R_SUCCESS) {
+		*path = argv[optind];
+	} else {
+		result = ISC_R_FAILURE;
+	}
+
+	return result;
+}
+
+/*
+ * Copy a trace field
+ * param mctx Memory context
+ * param field Field, "-" for empty
+ * return Copy or NULL
+ */
+static char *ospsim_copy_field(
+	isc_mem_t *mctx,
+	const char *field)
+{
+	if (strcmp(field, "-") == 0) {
+		field = "";
+	}
+
+	return isc_mem_strdup(mctx, field);
+}
+
+/*
+ * Load trace
+ * param mctx Memory context
+ * param path Trace file path, "-" for standard input
+ * param trace Trace buffer
+ * param line Bad line number buffer
+ * return ISC_R_SUCCESS successful, ISC_R_UNEXPECTEDTOKEN bad line, other failed
+ */
+static isc_result_t ospsim_load_trace(
+	isc_mem_t *mctx,
+	const char *path,
+	ospsim_trace_t *trace,
+	unsigned int *line)
+{
+	FILE *fp;
+	char buffer[OSPSIM_LINE_SIZE];
+	char timestamp[OSPSIM_STR_SIZE], called[OSPSIM_STR_SIZE], calling[OSPSIM_STR_SIZE], source[OSPSIM_STR_SIZE], status[OSPSIM_STR_SIZE];
+	ospsim_record_t *record, *records;
+	char *end;
+	double time;
+	int fields;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	memset(trace, 0, sizeof(*trace));
+	*line = 0;
+
+	if (strcmp(path, "-") == 0) {
+		fp = stdin;
+	} else if ((fp = fopen(path, "r")) == NULL) {
+		return ISC_R_FILENOTFOUND;
+	}
+
+	while ((result == ISC_R_SUCCESS) && (fgets(buffer, sizeof(buffer), fp) != NULL)) {
+		(*line)++;
+		status[0] = '\0';
+		fields = sscanf(buffer, "%511s %511s %511s %511s %511s", timestamp, called, calling, source, status);
+		if ((fields <= 0) || (timestamp[0] == '#')) {
+			continue;
+		}
+		time = strtod(timestamp, &end);
+		if ((fields < 4) || (*end != '\0') || (time < 0) || (strlen(called) >= OSPCACHE_NUM_SIZE) ||
+			((trace->count != 0) && ((isc_stdtime_t)time < trace->records[trace->count - 1].time)))
+		{
+			result = ISC_R_UNEXPECTEDTOKEN;
+			break;
+		}
+
+		if (trace->count == trace->size) {
+			if ((records = isc_mem_get(mctx, (trace->size + OSPSIM_RECORD_GUESS) * sizeof(*records))) == NULL) {
+				result = ISC_R_NOMEMORY;
+				break;
+			}
+			if (trace->records != NULL) {
+				memcpy(records, trace->records, trace->count * sizeof(*records));
+				isc_mem_put(mctx, trace->records, trace->size * sizeof(*records));
+			}
+			trace->records = records;
+			trace->size += OSPSIM_RECORD_GUESS;
+		}
+
+		record = &trace->records[trace->count];
+		record->time = (isc_stdtime_t)time;
+		if ((status[0] == '\0') || (strcmp(status, "ok") == 0)) {
+			record->result = ISC_R_SUCCESS;
+		} else if (strcmp(status, "notfound") == 0) {
+			record->result = ISC_R_NOTFOUND;
+		} else if (strcmp(status, "noperm") == 0) {
+			record->result = ISC_R_NOPERM;
+		} else if (strcmp(status, "fail") == 0) {
+			record->result = ISC_R_FAILURE;
+		} else {
+			result = ISC_R_UNEXPECTEDTOKEN;
+			break;
+		}
+		record->called = ospsim_copy_field(mctx, called);
+		record->calling = ospsim_copy_field(mctx, calling);
+		record->source = ospsim_copy_field(mctx, source);
+		if ((record->called == NULL) || (record->calling == NULL) || (record->source == NULL)) {
+			if (record->called != NULL) {
+				isc_mem_free(mctx, record->called);
+			}
+			if (record->calling != NULL) {
+				isc_mem_free(mctx, record->calling);
+			}
+			if (record->source != NULL) {
+				isc_mem_free(mctx, record->source);
+			}
+			result = ISC_R_NOMEMORY;
+			break;
+		}
+		trace->count++;
+	}
+
+	if (fp != stdin) {
+		fclose(fp);
+	}
+
+	return result;
+}
+
+/*
+ * Free trace
+ * param mctx Memory context
+ * param trace Trace
+ */
+static void ospsim_free_trace(
+	isc_mem_t *mctx,
+	ospsim_trace_t *trace)
+{
+	unsigned int i;
+
+	for (i = 0; i < trace->count; i++) {
+		isc_mem_free(mctx, trace->records[i].called);
+		isc_mem_free(mctx, trace->records[i].calling);
+		isc_mem_free(mctx, trace->records[i].source);
+	}
+	if (trace->records != NULL) {
+		isc_mem_put(mctx, trace->records, trace->size * sizeof(*trace->records));
+	}
+	memset(trace, 0, sizeof(*trace));
+}
+
+/*
+ * Get the scope prefix of a number, longest rule wins, as the driver
+ * param cfg Configuration
+ * param called Called number
+ * param prefix Prefix buffer
+ * param prefixsize Prefix buffer size
+ * return ISC_R_SUCCESS successful, ISC_R_NOTFOUND not covered
+ */
+static isc_result_t ospsim_get_scope(
+	ospsim_config_t *cfg,
+	const char *called,
+	char *prefix,
+	int prefixsize)
+{
+	ospsim_prefixrule_t *rule = NULL;
+	size_t length, best = 0;
+	int i;
+
+	for (i = 0; i < cfg->prefixnum; i++) {
+		length = strlen(cfg->prefixrule[i].prefix);
+		if ((strncmp(called, cfg->prefixrule[i].prefix, length) == 0) && ((rule == NULL) || (length > best))) {
+			rule = &cfg->prefixrule[i];
+			best = length;
+		}
+	}
+
+	if ((rule == NULL) || (strlen(called) < (size_t)rule->length) || (rule->length >= prefixsize)) {
+		return ISC_R_NOTFOUND;
+	}
+
+	memcpy(prefix, called, rule->length);
+	prefix[rule->length] = '\0';
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Build a route as the OSP server would answer it
+ * param cfg Configuration
+ * param called Called number
+ * param route Route buffer
+ */
+static void ospsim_build_route(
+	ospsim_config_t *cfg,
+	const char *called,
+	ospcache_route_t *route)
+{
+	int i;
+
+	memset(route, 0, sizeof(*route));
+	route->count = cfg->destcount;
+	for (i = 0; i < route->count; i++) {
+		snprintf(route->dest[i].called, sizeof(route->dest[i].called), "%s", called);
+		snprintf(route->dest[i].dest, sizeof(route->dest[i].dest), "[192.0.2.%d]:5060", i + 1);
+	}
+}
+
+/*
+ * Run an AuthReq and update caches with its result, as the driver
+ * param cfg Configuration
+ * param cache Route cache, may be NULL
+ * param negcache Negative cache, may be NULL
+ * param record Trace record
+ * param key Cache key
+ * param now Current time
+ */
+static void ospsim_run_authreq(
+	ospsim_config_t *cfg,
+	ospcache_t *cache,
+	ospcache_t *negcache,
+	ospsim_record_t *record,
+	const char *key,
+	isc_stdtime_t now)
+{
+	char prefix[OSPCACHE_NUM_SIZE];
+	ospcache_route_t route;
+
+	if (record->result == ISC_R_SUCCESS) {
+		if (cache != NULL) {
+			ospsim_build_route(cfg, record->called, &route);
+			if ((cfg->prefixnum != 0) && (ospsim_get_scope(cfg, record->called, prefix, sizeof(prefix)) == ISC_R_SUCCESS)) {
+				ospcache_putprefix(cache, prefix, now, now + cfg->ttl, &route);
+			} else {
+				ospcache_put(cache, key, now + cfg->ttl, &route);
+			}
+		}
+	} else if ((negcache != NULL) && (record->result != ISC_R_FAILURE)) {
+		/* Only definitive answers are remembered, transport failures must be retried */
+		ospcache_putnegative(negcache, key, now + cfg->negcachettl, record->result);
+	}
+}
+
+/*
+ * Replay trace through one route cache capacity
+ * param mctx Memory context
+ * param cfg Configuration
+ * param capacity Route cache capacity in KB, 0 for none
+ * param trace Trace
+ * param stats Results buffer
+ * return ISC_R_SUCCESS successful, other failed
+ */
+static isc_result_t ospsim_replay(
+	isc_mem_t *mctx,
+	ospsim_config_t *cfg,
+	int capacity,
+	ospsim_trace_t *trace,
+	ospsim_stats_t *stats)
+{
+	ospcache_t *cache = NULL;
+	ospcache_t *negcache = NULL;
+	ospcache_stats_t cachestats;
+	ospsim_record_t *record;
+	ospcache_route_t route;
+	char key[OSPCACHE_KEY_SIZE];
+	isc_boolean_t prefetch;
+	isc_stdtime_t second = 0;
+	unsigned int i, qps = 0;
+	int length;
+	isc_result_t status;
+	isc_result_t result = ISC_R_SUCCESS;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (capacity != 0) {
+		if ((result = ospcache_create(mctx, (size_t)capacity * 1024, 0, &cache)) == ISC_R_SUCCESS) {
+			ospcache_setprefetch(cache, cfg->prefetch, cfg->prefetchhits);
+			if (cfg->prefixnum != 0) {
+				result = ospcache_setprefix(cache, cfg->prefixentries);
+			}
+		}
+	}
+	if ((result == ISC_R_SUCCESS) && (cfg->negcachesize != 0)) {
+		result = ospcache_create(mctx, (size_t)cfg->negcachesize * 1024, 0, &negcache);
+	}
+
+	for (i = 0; (result == ISC_R_SUCCESS) && (i < trace->count); i++) {
+		record = &trace->records[i];
+
+		/* A new second, close the last one */
+		if (record->time != second) {
+			if (qps > stats->peakqps) {
+				stats->peakqps = qps;
+			}
+			qps = 0;
+			second = record->time;
+			if (cache != NULL) {
+				ospcache_getstats(cache, &cachestats);
+				if (cachestats.memory > stats->peakmemory) {
+					stats->peakmemory = cachestats.memory;
+				}
+			}
+		}
+
+		stats->lookups++;
+
+		length = snprintf(key, sizeof(key), "%s|%s|%s",
+			record->called,
+			((cfg->cachekey & OSPSIM_CACHEKEY_CALLING) != 0) ? record->calling : "",
+			((cfg->cachekey & OSPSIM_CACHEKEY_SOURCE) != 0) ? record->source : "");
+		if ((length < 0) || (length >= (int)sizeof(key))) {
+			/* The driver does not cache lookups with keys too long */
+			stats->authreqs++;
+			qps++;
+		} else if ((cache != NULL) && (ospcache_get(cache, key, record->time, &route, &prefetch) == ISC_R_SUCCESS)) {
+			stats->hits++;
+			if (prefetch == ISC_TRUE) {
+				/* Refreshed in the background, assumed to land at once */
+				stats->refreshes++;
+				qps++;
+				ospsim_run_authreq(cfg, cache, negcache, record, key, record->time);
+			}
+		} else if ((cfg->prefixnum != 0) && (cache != NULL) && (ospcache_getprefix(cache, record->called, record->time, &route) == ISC_R_SUCCESS)) {
+			stats->prefixhits++;
+		} else if ((negcache != NULL) && (ospcache_getnegative(negcache, key, record->time, &status) == ISC_R_SUCCESS)) {
+			stats->neghits++;
+		} else {
+			stats->authreqs++;
+			qps++;
+			ospsim_run_authreq(cfg, cache, negcache, record, key, record->time);
+		}
+	}
+	if (qps > stats->peakqps) {
+		stats->peakqps = qps;
+	}
+
+	if (cache != NULL) {
+		ospcache_getstats(cache, &stats->cache);
+		if (stats->cache.memory > stats->peakmemory) {
+			stats->peakmemory = stats->cache.memory;
+		}
+		ospcache_destroy(&cache);
+	}
+	if (negcache != NULL) {
+		ospcache_destroy(&negcache);
+	}
+
+	return result;
+}
+
+/*
+ * Print results of one capacity
+ * param capacity Route cache capacity in KB
+ * param duration Trace duration in seconds
+ * param stats Results
+ */
+static void ospsim_report(
+	int capacity,
+	unsigned int duration,
+	ospsim_stats_t *stats)
+{
+	isc_uint64_t answered = stats->hits + stats->prefixhits + stats->neghits;
+
+	printf("%10d %12llu %8.2f%% %8.2f%% %8.2f%% %8.2f%% %10.2f %8u %10llu %10lu %8u %8u %10llu\n",
+		capacity,
+		(unsigned long long)stats->lookups,
+		(stats->lookups != 0) ? answered * 100.0 / stats->lookups : 0.0,
+		(stats->lookups != 0) ? stats->hits * 100.0 / stats->lookups : 0.0,
+		(stats->lookups != 0) ? stats->prefixhits * 100.0 / stats->lookups : 0.0,
+		(stats->lookups != 0) ? stats->neghits * 100.0 / stats->lookups : 0.0,
+		(double)(stats->authreqs + stats->refreshes) / duration,
+		stats->peakqps,
+		(unsigned long long)stats->refreshes,
+		(unsigned long)(stats->peakmemory / 1024),
+		stats->cache.entries,
+		stats->cache.prefixes,
+		(unsigned long long)(stats->cache.evictions + stats->cache.prefixevictions));
+}
+
+int main(
+	int argc,
+	char **argv)
+{
+	ospsim_config_t cfg;
+	ospsim_trace_t trace;
+	ospsim_stats_t stats;
+	isc_mem_t *mctx = NULL;
+	const char *path = NULL;
+	unsigned int line, duration;
+	int i;
+	isc_result_t result;
+
+	if (ospsim_get_config(argc, argv, &cfg, &path) != ISC_R_SUCCESS) {
+		ospsim_usage(argv[0]);
+		return 1;
+	}
+
+	if ((result = isc_mem_create(0, 0, &mctx)) != ISC_R_SUCCESS) {
+		fprintf(stderr, "Failed to create memory context, error '%s'\n", isc_result_totext(result));
+		return 1;
+	}
+
+	if ((result = ospsim_load_trace(mctx, path, &trace, &line)) != ISC_R_SUCCESS) {
+		if (result == ISC_R_UNEXPECTEDTOKEN) {
+			fprintf(stderr, "Bad trace '%s' line '%u'\n", path, line);
+		} else {
+			fprintf(stderr, "Failed to load trace '%s', error '%s'\n", path, isc_result_totext(result));
+		}
+	} else if (trace.count == 0) {
+		fprintf(stderr, "Empty trace '%s'\n", path);
+		result = ISC_R_NOMORE;
+	} else {
+		duration = trace.records[trace.count - 1].time - trace.records[0].time + 1;
+		printf("Trace '%s' lookups '%u' duration '%u' seconds, route TTL '%d', negative cache '%d' KB TTL '%d', refresh ahead '%d' hits '%d', prefix rules '%d'\n",
+			path, trace.count, duration, cfg.ttl, cfg.negcachesize, cfg.negcachettl, cfg.prefetch, cfg.prefetchhits, cfg.prefixnum);
+		printf("%10s %12s %9s %9s %9s %9s %10s %8s %10s %10s %8s %8s %10s\n",
+			"cache(KB)", "lookups", "hitratio", "exact", "prefix", "negative", "ospqps", "peakqps", "refreshes", "memory(KB)", "entries", "prefixes", "evictions");
+		for (i = 0; (result == ISC_R_SUCCESS) && (i < cfg.capnum); i++) {
+			if ((result = ospsim_replay(mctx, &cfg, cfg.capacity[i], &trace, &stats)) == ISC_R_SUCCESS) {
+				ospsim_report(cfg.capacity[i], duration, &stats);
+			} else {
+				fprintf(stderr, "Failed to replay trace with cache '%d' KB, error '%s'\n", cfg.capacity[i], isc_result_totext(result));
+			}
+		}
+	}
+
+	ospsim_free_trace(mctx, &trace);
+	isc_mem_destroy(&mctx);
+
+	return (result == ISC_R_SUCCESS) ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+/*
+ * osptrie.c
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include <isc/mem.h>
+#include <isc/util.h>
+
+#include "osptrie.h"
+
+/* Constant */
+#define OSPTRIE_RADIX		10		/* Number of children per node, one per digit */
+#define OSPTRIE_MIN_NODES	64		/* Initial number of nodes */
+#define OSPTRIE_ROOT		0		/* Root node index */
+
+/* Node, children are indexes into the node array, 0 for none since the root is nobody's child */
+typedef struct osptrie_node {
+	unsigned int child[OSPTRIE_RADIX];	/* Child per digit */
+	int value;							/* Value of the prefix ending here, OSPTRIE_NONE for none */
+} osptrie_node_t;
+
+/* Digit trie, all nodes live in one contiguous array so that a match touches one cache line per digit */
+struct osptrie {
+	isc_mem_t *mctx;			/* Memory context */
+	osptrie_node_t *nodes;		/* Node array */
+	unsigned int size;			/* Number of allocated nodes */
+	unsigned int used;			/* Number of used nodes */
+};
+
+/*
+ * Init node
+ * param node Node
+ */
+static void osptrie_init_node(
+	osptrie_node_t *node)
+{
+	memset(node->child, 0, sizeof(node->child));
+	node->value = OSPTRIE_NONE;
+}
+
+/*
+ * Create trie
+ * param mctx Memory context
+ * param triep Trie handle
+ * return ISC_R_SUCCESS successful, ISC_R_NOMEMORY failed
+ */
+isc_result_t osptrie_create(
+	isc_mem_t *mctx,
+	osptrie_t **triep)
+{
+	osptrie_t *trie;
+
+	REQUIRE(triep != NULL && *triep == NULL);
+
+	trie = isc_mem_get(mctx, sizeof(*trie));
+	if (trie == NULL) {
+		return ISC_R_NOMEMORY;
+	}
+	trie->nodes = isc_mem_get(mctx, OSPTRIE_MIN_NODES * sizeof(osptrie_node_t));
+	if (trie->nodes == NULL) {
+		isc_mem_put(mctx, trie, sizeof(*trie));
+		return ISC_R_NOMEMORY;
+	}
+	trie->mctx = NULL;
+	isc_mem_attach(mctx, &trie->mctx);
+	trie->size = OSPTRIE_MIN_NODES;
+	trie->used = 1;
+	osptrie_init_node(&trie->nodes[OSPTRIE_ROOT]);
+
+	*triep = trie;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Destroy trie
+ * param triep Trie handle
+ */
+void osptrie_destroy(
+	osptrie_t **triep)
+{
+	osptrie_t *trie;
+
+	REQUIRE(triep != NULL && *triep != NULL);
+
+	trie = *triep;
+
+	isc_mem_put(trie->mctx, trie->nodes, trie->size * sizeof(osptrie_node_t));
+	isc_mem_putanddetach(&trie->mctx, trie, sizeof(*trie));
+
+	*triep = NULL;
+}
+
+/*
+ * Remove all prefixes, the node array is kept for reuse
+ * param trie Trie handle
+ */
+void osptrie_clear(
+	osptrie_t *trie)
+{
+	trie->used = 1;
+	osptrie_init_node(&trie->nodes[OSPTRIE_ROOT]);
+}
+
+/*
+ * Add or replace prefix value
+ * param trie Trie handle
+ * param prefix Digit string
+ * param value Value, OSPTRIE_NONE to remove the prefix
+ * return ISC_R_SUCCESS successful, ISC_R_RANGE non-digit in prefix, ISC_R_NOMEMORY failed
+ */
+isc_result_t osptrie_add(
+	osptrie_t *trie,
+	const char *prefix,
+	int value)
+{
+	const char *digit;
+	osptrie_node_t *nodes;
+	unsigned int index = OSPTRIE_ROOT, next, size;
+
+	for (digit = prefix; *digit != '\0'; digit++) {
+		if ((*digit < '0') || (*digit > '9')) {
+			return ISC_R_RANGE;
+		}
+	}
+
+	for (digit = prefix; *digit != '\0'; digit++) {
+		next = trie->nodes[index].child[*digit - '0'];
+		if (next == 0) {
+			if (value == OSPTRIE_NONE) {
+				/* Nothing to remove */
+				return ISC_R_SUCCESS;
+			}
+
+			if (trie->used == trie->size) {
+				/* Grow node array, indexes stay valid */
+				size = trie->size * 2;
+				nodes = isc_mem_get(trie->mctx, size * sizeof(osptrie_node_t));
+				if (nodes == NULL) {
+					return ISC_R_NOMEMORY;
+				}
+				memcpy(nodes, trie->nodes, trie->used * sizeof(osptrie_node_t));
+				isc_mem_put(trie->mctx, trie->nodes, trie->size * sizeof(osptrie_node_t));
+				trie->nodes = nodes;
+				trie->size = size;
+			}
+
+			next = trie->used++;
+			osptrie_init_node(&trie->nodes[next]);
+			trie->nodes[index].child[*digit - '0'] = next;
+		}
+		index = next;
+	}
+
+	trie->nodes[index].value = value;
+
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Longest prefix match
+ * param trie Trie handle
+ * param number Digit string, matching stops at the first non-digit
+ * param length Matched prefix length buffer, may be NULL
+ * return Value of the longest matching prefix, OSPTRIE_NONE for no match
+ */
+int osptrie_match(
+	osptrie_t *trie,
+	const char *number,
+	int *length)
+{
+	const osptrie_node_t *node = &trie->nodes[OSPTRIE_ROOT];
+	const char *digit;
+	unsigned int next;
+	int value = node->value, matched = 0;
+
+	for (digit = number; (*digit >= '0') && (*digit <= '9'); digit++) {
+		if ((next = node->child[*digit - '0']) == 0) {
+			break;
+		}
+		node = &trie->nodes[next];
+		if (node->value != OSPTRIE_NONE) {
+			value = node->value;
+			matched = digit - number + 1;
+		}
+	}
+
+	if (length != NULL) {
+		*length = matched;
+	}
+
+	return value;
+}
+
+/*
+ * Get number of used nodes
+ * param trie Trie handle
+ * return Number of used nodes
+ */
+unsigned int osptrie_nodes(
+	osptrie_t *trie)
+{
+	return trie->used;
+}
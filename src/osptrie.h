@@ -0,0 +1,39 @@
+/*
+ * osptrie.h
+ *
+ * Copyright (c) 2013, TransNexus, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ *   Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *   Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or
+ *   other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OSPTRIE_H
+#define OSPTRIE_H	1
+
+#include <isc/types.h>
+
+/* Constant */
+#define OSPTRIE_NONE	(-1)	/* No value */
+
+/* Digit trie handle */
+typedef struct osptrie osptrie_t;
+
+isc_result_t osptrie_create(isc_mem_t *mctx, osptrie_t **triep);
+void osptrie_destroy(osptrie_t **triep);
+void osptrie_clear(osptrie_t *trie);
+isc_result_t osptrie_add(osptrie_t *trie, const char *prefix, int value);
+int osptrie_match(osptrie_t *trie, const char *number, int *length);
+unsigned int osptrie_nodes(osptrie_t *trie);
+
+#endif /* OSPTRIE_H */
+
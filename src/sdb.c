@@ -30,7 +30,11 @@
 #include <isc/mem.h>
 #include <isc/once.h>
 #include <isc/print.h>
+#include <isc/refcount.h>
 #include <isc/region.h>
+/* For ENUM2OSP start */
+#include <isc/thread.h>
+/* For ENUM2OSP end */
 #include <isc/util.h>
 
 #include <dns/callbacks.h>
@@ -58,15 +62,34 @@ struct dns_sdbimplementation {
 	dns_dbimplementation_t		*dbimp;
 };
 
+/* For ENUM2OSP start */
+/*
+ * Rdatalists, rdata and rdata bytes of a node are carved from an arena
+ * inside the node, sized for a rdatalist and two NAPTRs, the default
+ * number of destinations.  Larger answers spill to the memory context.
+ * Nodes are recycled through per zone pools, one for each worker
+ * thread.
+ */
+#define SDB_ARENA_SIZE		512
+#define SDB_ARENA_ALIGN		(sizeof(void *))
+#define SDB_NODEPOOLS		16
+#define SDB_FREE_NODES		16
+#define SDB_FILL_NODES		4
+/* For ENUM2OSP end */
+
 struct dns_sdb {
 	/* Unlocked */
 	dns_db_t			common;
 	char				*zone;
 	dns_sdbimplementation_t		*implementation;
 	void				*dbdata;
-	isc_mutex_t			lock;
-	/* Locked */
-	unsigned int			references;
+	/* For ENUM2OSP start */
+	struct dns_sdblookup		*apex;
+	isc_mempool_t			*nodepools[SDB_NODEPOOLS];
+	isc_mutex_t			poollocks[SDB_NODEPOOLS];
+	/* Atomic */
+	isc_refcount_t			references;
+	/* For ENUM2OSP end */
 };
 
 struct dns_sdblookup {
@@ -77,10 +100,18 @@ struct dns_sdblookup {
 	ISC_LIST(isc_buffer_t)		buffers;
 	dns_name_t			*name;
 	ISC_LINK(dns_sdblookup_t)	link;
-	isc_mutex_t			lock;
 	dns_rdatacallbacks_t		callbacks;
-	/* Locked */
-	unsigned int			references;
+	/* For ENUM2OSP start */
+	dns_rdatatype_t			type;
+	unsigned int			pool;
+	unsigned int			arenaused;
+	union {
+		void			*align;
+		unsigned char		bytes[SDB_ARENA_SIZE];
+	}				arena;
+	/* Atomic */
+	isc_refcount_t			references;
+	/* For ENUM2OSP end */
 };
 
 typedef struct dns_sdblookup dns_sdbnode_t;
@@ -157,6 +188,11 @@ static isc_result_t createnode(dns_sdb_t *sdb, dns_sdbnode_t **nodep);
 
 static void destroynode(dns_sdbnode_t *node);
 
+static void freenode(dns_sdbnode_t *node);
+
+static void attachnode(dns_db_t *db, dns_dbnode_t *source,
+		       dns_dbnode_t **targetp);
+
 static void detachnode(dns_db_t *db, dns_dbnode_t **targetp);
 
 
@@ -222,6 +258,9 @@ dns_sdb_register(const char *drivername, const dns_sdbmethods_t *methods,
 	REQUIRE((flags & ~(DNS_SDBFLAG_RELATIVEOWNER |
 			   DNS_SDBFLAG_RELATIVERDATA |
 			   DNS_SDBFLAG_THREADSAFE|
+			   /* For ENUM2OSP start */
+			   DNS_SDBFLAG_STATICAPEX |
+			   /* For ENUM2OSP end */
 			   DNS_SDBFLAG_DNS64)) == 0);
 
 	imp = isc_mem_get(mctx, sizeof(dns_sdbimplementation_t));
@@ -270,6 +309,123 @@ dns_sdb_unregister(dns_sdbimplementation_t **sdbimp) {
 	*sdbimp = NULL;
 }
 
+/* For ENUM2OSP start */
+/*
+ * Type the lookup is made for, dns_rdatatype_any when the node may be
+ * asked for any type.
+ */
+dns_rdatatype_t
+dns_sdb_gettype(dns_sdblookup_t *lookup) {
+	REQUIRE(VALID_SDBLOOKUP(lookup));
+
+	return (lookup->type);
+}
+/* For ENUM2OSP end */
+
+/* For ENUM2OSP start */
+/*
+ * Carve 'size' bytes out of the node arena, NULL when it is used up.
+ */
+static inline void *
+arenaget(dns_sdbnode_t *node, unsigned int size) {
+	unsigned int used;
+
+	used = (node->arenaused + SDB_ARENA_ALIGN - 1) &
+	       ~(SDB_ARENA_ALIGN - 1);
+	if (used > SDB_ARENA_SIZE || size > SDB_ARENA_SIZE - used)
+		return (NULL);
+	node->arenaused = used + size;
+	return (node->arena.bytes + used);
+}
+
+static inline isc_boolean_t
+inarena(dns_sdbnode_t *node, void *p) {
+	unsigned char *b = p;
+
+	return (ISC_TF(b >= node->arena.bytes &&
+		       b < node->arena.bytes + SDB_ARENA_SIZE));
+}
+
+#ifdef ISC_PLATFORM_USETHREADS
+static isc_once_t		pool_once = ISC_ONCE_INIT;
+static isc_thread_key_t		pool_key;
+static isc_mutex_t		pool_lock;
+static unsigned int		pool_next = 0;
+static unsigned int		pool_ids[SDB_NODEPOOLS];
+
+static void
+initpoolkey(void) {
+	unsigned int i;
+
+	RUNTIME_CHECK(isc_mutex_init(&pool_lock) == ISC_R_SUCCESS);
+	RUNTIME_CHECK(isc_thread_key_create(&pool_key, NULL) == 0);
+	for (i = 0; i < SDB_NODEPOOLS; i++)
+		pool_ids[i] = i;
+}
+#endif
+
+/*
+ * Node pool of the calling thread.  Threads are given pools in turn
+ * the first time they ask, so up to SDB_NODEPOOLS worker threads each
+ * have a pool of their own.  A node goes back to the pool it came from.
+ */
+static unsigned int
+threadpool(void) {
+#ifdef ISC_PLATFORM_USETHREADS
+	unsigned int *id;
+
+	RUNTIME_CHECK(isc_once_do(&pool_once, initpoolkey) == ISC_R_SUCCESS);
+
+	id = isc_thread_key_getspecific(pool_key);
+	if (id == NULL) {
+		LOCK(&pool_lock);
+		id = &pool_ids[pool_next++ % SDB_NODEPOOLS];
+		UNLOCK(&pool_lock);
+		(void)isc_thread_key_setspecific(pool_key, id);
+	}
+	return (*id);
+#else
+	return (0);
+#endif
+}
+
+static void
+destroypools(dns_sdb_t *sdb, unsigned int count) {
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		isc_mempool_destroy(&sdb->nodepools[i]);
+		DESTROYLOCK(&sdb->poollocks[i]);
+	}
+}
+
+static isc_result_t
+createpools(dns_sdb_t *sdb, isc_mem_t *mctx) {
+	isc_result_t result = ISC_R_SUCCESS;
+	unsigned int i;
+
+	for (i = 0; i < SDB_NODEPOOLS; i++) {
+		result = isc_mutex_init(&sdb->poollocks[i]);
+		if (result != ISC_R_SUCCESS)
+			break;
+		result = isc_mempool_create(mctx, sizeof(dns_sdbnode_t),
+					    &sdb->nodepools[i]);
+		if (result != ISC_R_SUCCESS) {
+			DESTROYLOCK(&sdb->poollocks[i]);
+			break;
+		}
+		isc_mempool_setname(sdb->nodepools[i], "sdb nodes");
+		isc_mempool_associatelock(sdb->nodepools[i],
+					  &sdb->poollocks[i]);
+		isc_mempool_setfreemax(sdb->nodepools[i], SDB_FREE_NODES);
+		isc_mempool_setfillcount(sdb->nodepools[i], SDB_FILL_NODES);
+	}
+	if (result != ISC_R_SUCCESS)
+		destroypools(sdb, i);
+	return (result);
+}
+/* For ENUM2OSP end */
+
 static inline unsigned int
 initial_size(unsigned int len) {
 	unsigned int size;
@@ -288,9 +444,10 @@ dns_sdb_putrdata(dns_sdblookup_t *lookup, dns_rdatatype_t typeval,
 	dns_rdatalist_t *rdatalist;
 	dns_rdata_t *rdata;
 	isc_buffer_t *rdatabuf = NULL;
-	isc_result_t result;
+	isc_result_t result = ISC_R_SUCCESS;
 	isc_mem_t *mctx;
 	isc_region_t region;
+	unsigned char *p;
 
 	mctx = lookup->sdb->common.mctx;
 
@@ -302,7 +459,11 @@ dns_sdb_putrdata(dns_sdblookup_t *lookup, dns_rdatatype_t typeval,
 	}
 
 	if (rdatalist == NULL) {
-		rdatalist = isc_mem_get(mctx, sizeof(dns_rdatalist_t));
+		/* For ENUM2OSP start */
+		rdatalist = arenaget(lookup, sizeof(dns_rdatalist_t));
+		if (rdatalist == NULL)
+			rdatalist = isc_mem_get(mctx, sizeof(dns_rdatalist_t));
+		/* For ENUM2OSP end */
 		if (rdatalist == NULL)
 			return (ISC_R_NOMEMORY);
 		rdatalist->rdclass = lookup->sdb->common.rdclass;
@@ -316,26 +477,39 @@ dns_sdb_putrdata(dns_sdblookup_t *lookup, dns_rdatatype_t typeval,
 		if (rdatalist->ttl != ttl)
 			return (DNS_R_BADTTL);
 
-	rdata = isc_mem_get(mctx, sizeof(dns_rdata_t));
+	/* For ENUM2OSP start */
+	rdata = arenaget(lookup, sizeof(dns_rdata_t));
+	if (rdata == NULL)
+		rdata = isc_mem_get(mctx, sizeof(dns_rdata_t));
+	/* For ENUM2OSP end */
 	if (rdata == NULL)
 		return (ISC_R_NOMEMORY);
 
-	result = isc_buffer_allocate(mctx, &rdatabuf, rdlen);
-	if (result != ISC_R_SUCCESS)
-		goto failure;
-	DE_CONST(rdatap, region.base);
-	region.length = rdlen;
-	isc_buffer_copyregion(rdatabuf, &region);
-	isc_buffer_usedregion(rdatabuf, &region);
+	/* For ENUM2OSP start */
+	p = arenaget(lookup, rdlen);
+	if (p != NULL) {
+		memmove(p, rdatap, rdlen);
+		region.base = p;
+		region.length = rdlen;
+	} else {
+		result = isc_buffer_allocate(mctx, &rdatabuf, rdlen);
+		if (result != ISC_R_SUCCESS)
+			goto failure;
+		DE_CONST(rdatap, region.base);
+		region.length = rdlen;
+		isc_buffer_copyregion(rdatabuf, &region);
+		isc_buffer_usedregion(rdatabuf, &region);
+		ISC_LIST_APPEND(lookup->buffers, rdatabuf, link);
+	}
+	/* For ENUM2OSP end */
 	dns_rdata_init(rdata);
 	dns_rdata_fromregion(rdata, rdatalist->rdclass, rdatalist->type,
 			     &region);
 	ISC_LIST_APPEND(rdatalist->rdata, rdata, link);
-	ISC_LIST_APPEND(lookup->buffers, rdatabuf, link);
 	rdata = NULL;
 
  failure:
-	if (rdata != NULL)
+	if (rdata != NULL && !inarena(lookup, rdata))
 		isc_mem_put(mctx, rdata, sizeof(dns_rdata_t));
 	return (result);
 }
@@ -356,6 +530,9 @@ dns_sdb_putrr(dns_sdblookup_t *lookup, const char *type, dns_ttl_t ttl,
 	dns_name_t *origin;
 	isc_buffer_t b;
 	isc_buffer_t rb;
+	/* For ENUM2OSP start */
+	unsigned char buf[1024];
+	/* For ENUM2OSP end */
 
 	REQUIRE(VALID_SDBLOOKUP(lookup));
 	REQUIRE(type != NULL);
@@ -390,7 +567,12 @@ dns_sdb_putrr(dns_sdblookup_t *lookup, const char *type, dns_ttl_t ttl,
 
 		if (size >= 65535)
 			size = 65535;
-		p = isc_mem_get(mctx, size);
+		/* For ENUM2OSP start */
+		if (size <= sizeof(buf))
+			p = buf;
+		else
+			p = isc_mem_get(mctx, size);
+		/* For ENUM2OSP end */
 		if (p == NULL) {
 			result = ISC_R_NOMEMORY;
 			goto failure;
@@ -410,7 +592,10 @@ dns_sdb_putrr(dns_sdblookup_t *lookup, const char *type, dns_ttl_t ttl,
 		 */
 		if (size >= 65535)
 			break;
-		isc_mem_put(mctx, p, size);
+		/* For ENUM2OSP start */
+		if (p != buf)
+			isc_mem_put(mctx, p, size);
+		/* For ENUM2OSP end */
 		p = NULL;
 		size *= 2;
 	} while (result == ISC_R_NOSPACE);
@@ -422,8 +607,10 @@ dns_sdb_putrr(dns_sdblookup_t *lookup, const char *type, dns_ttl_t ttl,
 				  isc_buffer_base(&rb),
 				  isc_buffer_usedlength(&rb));
  failure:
-	if (p != NULL)
+	/* For ENUM2OSP start */
+	if (p != NULL && p != buf)
 		isc_mem_put(mctx, p, size);
+	/* For ENUM2OSP end */
 	if (lex != NULL)
 		isc_lex_destroy(&lex);
 
@@ -542,10 +729,9 @@ attach(dns_db_t *source, dns_db_t **targetp) {
 
 	REQUIRE(VALID_SDB(sdb));
 
-	LOCK(&sdb->lock);
-	REQUIRE(sdb->references > 0);
-	sdb->references++;
-	UNLOCK(&sdb->lock);
+	/* For ENUM2OSP start */
+	isc_refcount_increment(&sdb->references, NULL);
+	/* For ENUM2OSP end */
 
 	*targetp = source;
 }
@@ -554,9 +740,21 @@ static void
 destroy(dns_sdb_t *sdb) {
 	isc_mem_t *mctx;
 	dns_sdbimplementation_t *imp = sdb->implementation;
+	/* For ENUM2OSP start */
+	unsigned int refs;
+	/* For ENUM2OSP end */
 
 	mctx = sdb->common.mctx;
 
+	/* For ENUM2OSP start */
+	if (sdb->apex != NULL) {
+		isc_refcount_decrement(&sdb->apex->references, &refs);
+		INSIST(refs == 0);
+		freenode(sdb->apex);
+		sdb->apex = NULL;
+	}
+	/* For ENUM2OSP end */
+
 	if (imp->methods->destroy != NULL) {
 		MAYBE_LOCK(sdb);
 		imp->methods->destroy(sdb->zone, imp->driverdata,
@@ -565,7 +763,10 @@ destroy(dns_sdb_t *sdb) {
 	}
 
 	isc_mem_free(mctx, sdb->zone);
-	DESTROYLOCK(&sdb->lock);
+	/* For ENUM2OSP start */
+	isc_refcount_destroy(&sdb->references);
+	destroypools(sdb, SDB_NODEPOOLS);
+	/* For ENUM2OSP end */
 
 	sdb->common.magic = 0;
 	sdb->common.impmagic = 0;
@@ -579,17 +780,16 @@ destroy(dns_sdb_t *sdb) {
 static void
 detach(dns_db_t **dbp) {
 	dns_sdb_t *sdb = (dns_sdb_t *)(*dbp);
-	isc_boolean_t need_destroy = ISC_FALSE;
+	/* For ENUM2OSP start */
+	unsigned int refs;
+	/* For ENUM2OSP end */
 
 	REQUIRE(VALID_SDB(sdb));
-	LOCK(&sdb->lock);
-	REQUIRE(sdb->references > 0);
-	sdb->references--;
-	if (sdb->references == 0)
-		need_destroy = ISC_TRUE;
-	UNLOCK(&sdb->lock);
-
-	if (need_destroy)
+	/* For ENUM2OSP start */
+	isc_refcount_decrement(&sdb->references, &refs);
+	/* For ENUM2OSP end */
+
+	if (refs == 0)
 		destroy(sdb);
 
 	*dbp = NULL;
@@ -664,50 +864,89 @@ static isc_result_t
 createnode(dns_sdb_t *sdb, dns_sdbnode_t **nodep) {
 	dns_sdbnode_t *node;
 	isc_result_t result;
-
-	node = isc_mem_get(sdb->common.mctx, sizeof(dns_sdbnode_t));
+	/* For ENUM2OSP start */
+	unsigned int pool;
+	/* For ENUM2OSP end */
+
+	/* For ENUM2OSP start */
+	pool = threadpool();
+	node = isc_mempool_get(sdb->nodepools[pool]);
+	/* For ENUM2OSP end */
 	if (node == NULL)
 		return (ISC_R_NOMEMORY);
 
+	/* For ENUM2OSP start */
+	result = isc_refcount_init(&node->references, 1);
+	if (result != ISC_R_SUCCESS) {
+		isc_mempool_put(sdb->nodepools[pool], node);
+		return (result);
+	}
+	node->pool = pool;
+	/* For ENUM2OSP end */
 	node->sdb = NULL;
 	attach((dns_db_t *)sdb, (dns_db_t **)&node->sdb);
 	ISC_LIST_INIT(node->lists);
 	ISC_LIST_INIT(node->buffers);
 	ISC_LINK_INIT(node, link);
 	node->name = NULL;
-	result = isc_mutex_init(&node->lock);
-	if (result != ISC_R_SUCCESS) {
-		isc_mem_put(sdb->common.mctx, node, sizeof(dns_sdbnode_t));
-		return (result);
-	}
 	dns_rdatacallbacks_init(&node->callbacks);
-	node->references = 1;
+	node->type = dns_rdatatype_any;
+	node->arenaused = 0;
 	node->magic = SDBLOOKUP_MAGIC;
 
 	*nodep = node;
 	return (ISC_R_SUCCESS);
 }
 
+/* For ENUM2OSP start */
+/*
+ * Drop the reference of the node's creator, which must be the last one,
+ * and free the node.  Nodes handed out to callers are freed by
+ * detachnode() instead.
+ */
+/* For ENUM2OSP end */
 static void
 destroynode(dns_sdbnode_t *node) {
+	dns_sdb_t *sdb;
+	/* For ENUM2OSP start */
+	unsigned int refs;
+
+	isc_refcount_decrement(&node->references, &refs);
+	INSIST(refs == 0);
+	/* For ENUM2OSP end */
+
+	sdb = node->sdb;
+	freenode(node);
+	detach((dns_db_t **) (void *)&sdb);
+}
+
+/*
+ * Free a node without releasing its reference to the database.
+ */
+static void
+freenode(dns_sdbnode_t *node) {
 	dns_rdatalist_t *list;
 	dns_rdata_t *rdata;
 	isc_buffer_t *b;
-	dns_sdb_t *sdb;
 	isc_mem_t *mctx;
 
-	sdb = node->sdb;
-	mctx = sdb->common.mctx;
+	mctx = node->sdb->common.mctx;
 
 	while (!ISC_LIST_EMPTY(node->lists)) {
 		list = ISC_LIST_HEAD(node->lists);
 		while (!ISC_LIST_EMPTY(list->rdata)) {
 			rdata = ISC_LIST_HEAD(list->rdata);
 			ISC_LIST_UNLINK(list->rdata, rdata, link);
-			isc_mem_put(mctx, rdata, sizeof(dns_rdata_t));
+			/* For ENUM2OSP start */
+			if (!inarena(node, rdata))
+				isc_mem_put(mctx, rdata, sizeof(dns_rdata_t));
+			/* For ENUM2OSP end */
 		}
 		ISC_LIST_UNLINK(node->lists, list, link);
-		isc_mem_put(mctx, list, sizeof(dns_rdatalist_t));
+		/* For ENUM2OSP start */
+		if (!inarena(node, list))
+			isc_mem_put(mctx, list, sizeof(dns_rdatalist_t));
+		/* For ENUM2OSP end */
 	}
 
 	while (!ISC_LIST_EMPTY(node->buffers)) {
@@ -720,16 +959,21 @@ destroynode(dns_sdbnode_t *node) {
 		dns_name_free(node->name, mctx);
 		isc_mem_put(mctx, node->name, sizeof(dns_name_t));
 	}
-	DESTROYLOCK(&node->lock);
+	/* For ENUM2OSP start */
+	isc_refcount_destroy(&node->references);
+	/* For ENUM2OSP end */
 	node->magic = 0;
-	isc_mem_put(mctx, node, sizeof(dns_sdbnode_t));
-	detach((dns_db_t **) (void *)&sdb);
+	/* For ENUM2OSP start */
+	isc_mempool_put(node->sdb->nodepools[node->pool], node);
+	/* For ENUM2OSP end */
 }
 
+/* For ENUM2OSP start */
 static isc_result_t
-findnodeext(dns_db_t *db, dns_name_t *name, isc_boolean_t create,
-	    dns_clientinfomethods_t *methods, dns_clientinfo_t *clientinfo,
-	    dns_dbnode_t **nodep)
+findnodetype(dns_db_t *db, dns_name_t *name, isc_boolean_t create,
+	     dns_rdatatype_t type, dns_clientinfomethods_t *methods,
+	     dns_clientinfo_t *clientinfo, dns_dbnode_t **nodep)
+/* For ENUM2OSP end */
 {
 	dns_sdb_t *sdb = (dns_sdb_t *)db;
 	dns_sdbnode_t *node = NULL;
@@ -752,6 +996,13 @@ findnodeext(dns_db_t *db, dns_name_t *name, isc_boolean_t create,
 
 	isorigin = dns_name_equal(name, &sdb->common.origin);
 
+	/* For ENUM2OSP start */
+	if (isorigin && sdb->apex != NULL) {
+		attachnode(db, (dns_dbnode_t *)sdb->apex, nodep);
+		return (ISC_R_SUCCESS);
+	}
+	/* For ENUM2OSP end */
+
 	if (imp->methods->lookup2 != NULL) {
 		if ((imp->flags & DNS_SDBFLAG_RELATIVEOWNER) != 0) {
 			labels = dns_name_countlabels(name) -
@@ -783,6 +1034,10 @@ findnodeext(dns_db_t *db, dns_name_t *name, isc_boolean_t create,
 	if (result != ISC_R_SUCCESS)
 		return (result);
 
+	/* For ENUM2OSP start */
+	node->type = type;
+	/* For ENUM2OSP end */
+
 	MAYBE_LOCK(sdb);
 	if (imp->methods->lookup2 != NULL)
 		result = imp->methods->lookup2(&sdb->common.origin, name,
@@ -814,6 +1069,17 @@ findnodeext(dns_db_t *db, dns_name_t *name, isc_boolean_t create,
 	return (ISC_R_SUCCESS);
 }
 
+/* For ENUM2OSP start */
+static isc_result_t
+findnodeext(dns_db_t *db, dns_name_t *name, isc_boolean_t create,
+	    dns_clientinfomethods_t *methods, dns_clientinfo_t *clientinfo,
+	    dns_dbnode_t **nodep)
+{
+	return (findnodetype(db, name, create, dns_rdatatype_any,
+			     methods, clientinfo, nodep));
+}
+/* For ENUM2OSP end */
+
 static isc_result_t
 findext(dns_db_t *db, dns_name_t *name, dns_dbversion_t *version,
 	dns_rdatatype_t type, unsigned int options, isc_stdtime_t now,
@@ -866,8 +1132,11 @@ findext(dns_db_t *db, dns_name_t *name, dns_dbversion_t *version,
 		 * Look up the next label.
 		 */
 		dns_name_getlabelsequence(name, nlabels - i, i, xname);
-		result = findnodeext(db, xname, ISC_FALSE, methods,
-				     clientinfo, &node);
+		/* For ENUM2OSP start */
+		result = findnodetype(db, xname, ISC_FALSE,
+				      i == nlabels ? type : dns_rdatatype_any,
+				      methods, clientinfo, &node);
+		/* For ENUM2OSP end */
 		if (result == ISC_R_NOTFOUND) {
 			/*
 			 * No data at zone apex?
@@ -936,8 +1205,9 @@ findext(dns_db_t *db, dns_name_t *name, dns_dbversion_t *version,
 		 * and try again.
 		 */
 		if (i < nlabels) {
-			destroynode(node);
-			node = NULL;
+			/* For ENUM2OSP start */
+			detachnode(db, &node);
+			/* For ENUM2OSP end */
 			continue;
 		}
 
@@ -983,8 +1253,10 @@ findext(dns_db_t *db, dns_name_t *name, dns_dbversion_t *version,
 
 		xresult = dns_name_copy(xname, foundname, NULL);
 		if (xresult != ISC_R_SUCCESS) {
+			/* For ENUM2OSP start */
 			if (node != NULL)
-				destroynode(node);
+				detachnode(db, &node);
+			/* For ENUM2OSP end */
 			if (dns_rdataset_isassociated(rdataset))
 				dns_rdataset_disassociate(rdataset);
 			return (DNS_R_BADDB);
@@ -1023,13 +1295,16 @@ attachnode(dns_db_t *db, dns_dbnode_t *source, dns_dbnode_t **targetp) {
 
 	REQUIRE(VALID_SDB(sdb));
 
-	UNUSED(sdb);
+	/* For ENUM2OSP start */
+	isc_refcount_increment(&node->references, NULL);
 
-	LOCK(&node->lock);
-	INSIST(node->references > 0);
-	node->references++;
-	INSIST(node->references != 0);		/* Catch overflow. */
-	UNLOCK(&node->lock);
+	/*
+	 * The zone owns its apex node, so every user of the apex node
+	 * holds a reference to the zone instead.
+	 */
+	if (node == sdb->apex)
+		attach(db, &db);
+	/* For ENUM2OSP end */
 
 	*targetp = source;
 }
@@ -1038,24 +1313,24 @@ static void
 detachnode(dns_db_t *db, dns_dbnode_t **targetp) {
 	dns_sdb_t *sdb = (dns_sdb_t *)db;
 	dns_sdbnode_t *node;
-	isc_boolean_t need_destroy = ISC_FALSE;
+	/* For ENUM2OSP start */
+	unsigned int refs;
+	/* For ENUM2OSP end */
 
 	REQUIRE(VALID_SDB(sdb));
 	REQUIRE(targetp != NULL && *targetp != NULL);
 
-	UNUSED(sdb);
-
 	node = (dns_sdbnode_t *)(*targetp);
 
-	LOCK(&node->lock);
-	INSIST(node->references > 0);
-	node->references--;
-	if (node->references == 0)
-		need_destroy = ISC_TRUE;
-	UNLOCK(&node->lock);
-
-	if (need_destroy)
-		destroynode(node);
+	/* For ENUM2OSP start */
+	isc_refcount_decrement(&node->references, &refs);
+	if (refs == 0) {
+		/* The count is already 0, only free */
+		freenode(node);
+		detach(&db);
+	} else if (node == sdb->apex)
+		detach(&db);
+	/* For ENUM2OSP end */
 
 	*targetp = NULL;
 }
@@ -1320,6 +1595,9 @@ dns_sdb_create(isc_mem_t *mctx, dns_name_t *origin, dns_dbtype_t type,
 	char zonestr[DNS_NAME_MAXTEXT + 1];
 	isc_buffer_t b;
 	dns_sdbimplementation_t *imp;
+	/* For ENUM2OSP start */
+	dns_dbnode_t *node = NULL;
+	/* For ENUM2OSP end */
 
 	REQUIRE(driverarg != NULL);
 
@@ -1342,13 +1620,19 @@ dns_sdb_create(isc_mem_t *mctx, dns_name_t *origin, dns_dbtype_t type,
 
 	isc_mem_attach(mctx, &sdb->common.mctx);
 
-	result = isc_mutex_init(&sdb->lock);
+	/* For ENUM2OSP start */
+	result = isc_refcount_init(&sdb->references, 0);
 	if (result != ISC_R_SUCCESS)
 		goto cleanup_mctx;
 
+	result = createpools(sdb, mctx);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_references;
+	/* For ENUM2OSP end */
+
 	result = dns_name_dupwithoffsets(origin, mctx, &sdb->common.origin);
 	if (result != ISC_R_SUCCESS)
-		goto cleanup_lock;
+		goto cleanup_nodepools;
 
 	isc_buffer_init(&b, zonestr, sizeof(zonestr));
 	result = dns_name_totext(origin, ISC_TRUE, &b);
@@ -1372,11 +1656,29 @@ dns_sdb_create(isc_mem_t *mctx, dns_name_t *origin, dns_dbtype_t type,
 			goto cleanup_zonestr;
 	}
 
-	sdb->references = 1;
+	/* For ENUM2OSP start */
+	isc_refcount_increment0(&sdb->references, NULL);
+	/* For ENUM2OSP end */
 
 	sdb->common.magic = DNS_DB_MAGIC;
 	sdb->common.impmagic = SDB_MAGIC;
 
+	/* For ENUM2OSP start */
+	/*
+	 * For drivers with a static apex, look the apex up once and keep
+	 * the node for every query.  The zone owns it, so the reference
+	 * the node took on the zone is dropped.  If the driver has no apex
+	 * data yet the apex is looked up per query as before.
+	 */
+	if ((imp->flags & DNS_SDBFLAG_STATICAPEX) != 0 &&
+	    findnodetype((dns_db_t *)sdb, &sdb->common.origin, ISC_FALSE,
+			 dns_rdatatype_any, NULL, NULL, &node) == ISC_R_SUCCESS)
+	{
+		sdb->apex = (dns_sdbnode_t *)node;
+		isc_refcount_decrement(&sdb->references, NULL);
+	}
+	/* For ENUM2OSP end */
+
 	*dbp = (dns_db_t *)sdb;
 
 	return (ISC_R_SUCCESS);
@@ -1385,8 +1687,12 @@ dns_sdb_create(isc_mem_t *mctx, dns_name_t *origin, dns_dbtype_t type,
 	isc_mem_free(mctx, sdb->zone);
  cleanup_origin:
 	dns_name_free(&sdb->common.origin, mctx);
- cleanup_lock:
-	(void)isc_mutex_destroy(&sdb->lock);
+	/* For ENUM2OSP start */
+ cleanup_nodepools:
+	destroypools(sdb, SDB_NODEPOOLS);
+ cleanup_references:
+	isc_refcount_destroy(&sdb->references);
+	/* For ENUM2OSP end */
  cleanup_mctx:
 	isc_mem_put(mctx, sdb, sizeof(dns_sdb_t));
 	isc_mem_detach(&mctx);